@@ -0,0 +1,528 @@
+/*
+ *    This file is part of libutf.
+ *
+ *    libutf is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    libutf is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with libutf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measures the throughput of the library's kernels.
+ * Implementations are measured up to the one that was selected for
+ * the CPU, which may be capped with the LIBUTF_KERNEL environment variable.
+ * Build with optimizations enabled, for example:
+ *   cmake -DCMAKE_BUILD_TYPE=Release ..
+ */
+
+#include "kernel.h"
+
+#include <libutf/converter.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if (defined __unix__) || (defined __APPLE__)
+#include <unistd.h>
+#endif
+
+#if (defined _POSIX_TIMERS) && (_POSIX_TIMERS > 0)
+#define BENCHMARK_MONOTONIC
+#endif
+
+#define CORPUS_SIZE (16UL * 1024UL * 1024UL)
+
+#define REPEAT_COUNT 8
+
+/** The most threads that the parallel converter is measured with. */
+
+#define THREAD_COUNT_MAX 64
+
+struct corpus {
+	const char * name;
+	unsigned char * data;
+	size_t size;
+};
+
+static const struct {
+	const char * name;
+	size_t (*kernel)(const unsigned char * src, size_t src_size);
+} utf8_validate_kernels[] = {
+	{ "scalar", utf_kernel_utf8_validate_scalar },
+#ifdef LIBUTF_KERNEL_X86
+	{ "sse4.2", utf_kernel_utf8_validate_sse42 },
+	{ "avx2", utf_kernel_utf8_validate_avx2 },
+#endif /* LIBUTF_KERNEL_X86 */
+};
+
+static const struct {
+	const char * name;
+	size_t (*kernel)(const unsigned char * src, size_t src_size, size_t * count);
+} utf8_length_kernels[] = {
+	{ "scalar", utf_kernel_utf8_length_scalar },
+#ifdef LIBUTF_KERNEL_X86
+	{ "sse4.2", utf_kernel_utf8_length_sse42 },
+	{ "avx2", utf_kernel_utf8_length_avx2 },
+#endif /* LIBUTF_KERNEL_X86 */
+};
+
+static const struct {
+	const char * name;
+	size_t (*kernel)(const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count);
+} utf8_to_utf32_kernels[] = {
+	{ "scalar", utf_kernel_utf8_to_utf32_scalar },
+#ifdef LIBUTF_KERNEL_X86
+	{ "sse4.2", utf_kernel_utf8_to_utf32_sse42 },
+	{ "avx2", utf_kernel_utf8_to_utf32_avx2 },
+#endif /* LIBUTF_KERNEL_X86 */
+};
+
+static const struct {
+	const char * name;
+	size_t (*kernel)(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+} utf8_to_utf16le_kernels[] = {
+	{ "scalar", utf_kernel_utf8_to_utf16le_scalar },
+#ifdef LIBUTF_KERNEL_X86
+	{ "sse4.2", utf_kernel_utf8_to_utf16le_sse42 },
+	{ "avx2", utf_kernel_utf8_to_utf16le_avx2 },
+#endif /* LIBUTF_KERNEL_X86 */
+};
+
+static const struct {
+	const char * name;
+	size_t (*kernel)(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size);
+} utf32_to_utf8_kernels[] = {
+	{ "scalar", utf_kernel_utf32_to_utf8_scalar },
+#ifdef LIBUTF_KERNEL_X86
+	{ "sse4.2", utf_kernel_utf32_to_utf8_sse42 },
+	{ "avx2", utf_kernel_utf32_to_utf8_avx2 },
+#endif /* LIBUTF_KERNEL_X86 */
+};
+
+static const struct {
+	const char * name;
+	size_t (*kernel)(const unsigned char * src, size_t src_size, unsigned char * dst, int big_endian);
+} utf16_swap_kernels[] = {
+	{ "scalar", utf_kernel_utf16_swap_scalar },
+#ifdef LIBUTF_KERNEL_X86
+	{ "sse4.2", utf_kernel_utf16_swap_sse42 },
+	{ "avx2", utf_kernel_utf16_swap_avx2 },
+#endif /* LIBUTF_KERNEL_X86 */
+};
+
+static void corpus_init(struct corpus * corpus, const char * name, unsigned int non_ascii_percent, unsigned int max_length);
+
+static void corpus_free(struct corpus * corpus);
+
+static double elapsed(clock_t start);
+
+static double wall_time(void);
+
+static void report(const char * kernel, const char * variant, const struct corpus * corpus, double seconds);
+
+static void bench_utf8_to_utf32(const struct corpus * corpus);
+
+static void bench_utf8_validate(const struct corpus * corpus);
+
+static void bench_utf8_length(const struct corpus * corpus);
+
+static void bench_utf8_to_utf16le(const struct corpus * corpus);
+
+static void bench_utf32_to_utf8(const struct corpus * corpus);
+
+static void bench_utf16_swap(const struct corpus * corpus);
+
+static void bench_convert_parallel(const struct corpus * corpus);
+
+int main(void){
+
+	size_t i;
+	struct corpus corpora[4];
+
+	corpus_init(&corpora[0], "ascii", 0, 1);
+	corpus_init(&corpora[1], "latin", 5, 2);
+	corpus_init(&corpora[2], "cyrillic", 80, 2);
+	corpus_init(&corpora[3], "cjk-mixed", 50, 4);
+
+	for (i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++){
+		if (corpora[i].data == NULL){
+			fprintf(stderr, "benchmark: failed to allocate corpus\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("selected kernels: %s\n", utf_kernel_name());
+
+	for (i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++){
+		bench_utf8_validate(&corpora[i]);
+		bench_utf8_length(&corpora[i]);
+		bench_utf8_to_utf32(&corpora[i]);
+		bench_utf8_to_utf16le(&corpora[i]);
+		bench_utf32_to_utf8(&corpora[i]);
+		bench_utf16_swap(&corpora[i]);
+	}
+
+	for (i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++){
+		bench_convert_parallel(&corpora[i]);
+	}
+
+	for (i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++){
+		corpus_free(&corpora[i]);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/** Generates well-formed UTF-8 text.
+ * @param non_ascii_percent The percentage of characters that aren't ASCII.
+ * @param max_length The longest sequence to generate for non-ASCII characters.
+ */
+
+static void corpus_init(struct corpus * corpus, const char * name, unsigned int non_ascii_percent, unsigned int max_length){
+
+	size_t i = 0;
+	unsigned long int state = 1;
+	unsigned long int c;
+	unsigned int length;
+
+	corpus->name = name;
+	corpus->size = 0;
+	corpus->data = malloc(CORPUS_SIZE);
+	if (corpus->data == NULL){
+		return;
+	}
+
+	while ((i + 4) <= CORPUS_SIZE){
+		state = (state * 1103515245UL + 12345UL) & 0x7fffffffUL;
+		length = 1;
+		if (((state >> 8) % 100) < non_ascii_percent){
+			length = 2 + (unsigned int)((state >> 4) % (max_length - 1));
+		}
+		switch (length){
+			case 2:
+				c = 0x400 + ((state >> 12) % 0x100);
+				corpus->data[i++] = (unsigned char)(0xc0 | (c >> 6));
+				corpus->data[i++] = (unsigned char)(0x80 | (c & 0x3f));
+				break;
+			case 3:
+				c = 0x4e00 + ((state >> 12) % 0x5000);
+				corpus->data[i++] = (unsigned char)(0xe0 | (c >> 12));
+				corpus->data[i++] = (unsigned char)(0x80 | ((c >> 6) & 0x3f));
+				corpus->data[i++] = (unsigned char)(0x80 | (c & 0x3f));
+				break;
+			case 4:
+				c = 0x1f600 + ((state >> 12) % 0x50);
+				corpus->data[i++] = (unsigned char)(0xf0 | (c >> 18));
+				corpus->data[i++] = (unsigned char)(0x80 | ((c >> 12) & 0x3f));
+				corpus->data[i++] = (unsigned char)(0x80 | ((c >> 6) & 0x3f));
+				corpus->data[i++] = (unsigned char)(0x80 | (c & 0x3f));
+				break;
+			default:
+				corpus->data[i++] = (unsigned char)(0x20 + ((state >> 12) % 0x5f));
+				break;
+		}
+	}
+
+	corpus->size = i;
+}
+
+static void corpus_free(struct corpus * corpus){
+	free(corpus->data);
+	corpus->data = NULL;
+}
+
+static double elapsed(clock_t start){
+	return ((double)(clock() - start)) / CLOCKS_PER_SEC;
+}
+
+/** Returns the time in seconds since some point,
+ * which keeps counting while other threads do the work.
+ * Without a monotonic clock, the processor time is used. */
+
+static double wall_time(void){
+#ifdef BENCHMARK_MONOTONIC
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((double)(now.tv_sec)) + (((double)(now.tv_nsec)) / 1e9);
+#else /* BENCHMARK_MONOTONIC */
+	return ((double)(clock())) / CLOCKS_PER_SEC;
+#endif /* BENCHMARK_MONOTONIC */
+}
+
+static void report(const char * kernel, const char * variant, const struct corpus * corpus, double seconds){
+
+	double megabytes;
+
+	megabytes = ((double)(corpus->size) * REPEAT_COUNT) / (1024.0 * 1024.0);
+
+	if (seconds <= 0.0){
+		seconds = 1.0 / CLOCKS_PER_SEC;
+	}
+
+	printf("%-16s %-10s %-10s %10.1f MB/s\n", kernel, variant, corpus->name, megabytes / seconds);
+}
+
+static void bench_utf8_to_utf32(const struct corpus * corpus){
+
+	size_t i;
+	size_t j;
+	size_t count;
+	clock_t start;
+	char32_t * out;
+
+	out = malloc(corpus->size * sizeof(char32_t));
+	if (out == NULL){
+		return;
+	}
+
+	for (i = 0; i < sizeof(utf8_to_utf32_kernels) / sizeof(utf8_to_utf32_kernels[0]); i++){
+		start = clock();
+		for (j = 0; j < REPEAT_COUNT; j++){
+			utf8_to_utf32_kernels[i].kernel(corpus->data, corpus->size, out, &count);
+		}
+		report("utf8-to-utf32", utf8_to_utf32_kernels[i].name, corpus, elapsed(start));
+		if (strcmp(utf8_to_utf32_kernels[i].name, utf_kernel_name()) == 0){
+			break;
+		}
+	}
+
+	free(out);
+}
+
+static void bench_utf8_validate(const struct corpus * corpus){
+
+	size_t i;
+	size_t j;
+	clock_t start;
+
+	for (i = 0; i < sizeof(utf8_validate_kernels) / sizeof(utf8_validate_kernels[0]); i++){
+		start = clock();
+		for (j = 0; j < REPEAT_COUNT; j++){
+			utf8_validate_kernels[i].kernel(corpus->data, corpus->size);
+		}
+		report("utf8-validate", utf8_validate_kernels[i].name, corpus, elapsed(start));
+		if (strcmp(utf8_validate_kernels[i].name, utf_kernel_name()) == 0){
+			break;
+		}
+	}
+}
+
+static void bench_utf8_length(const struct corpus * corpus){
+
+	size_t i;
+	size_t j;
+	size_t count;
+	clock_t start;
+
+	for (i = 0; i < sizeof(utf8_length_kernels) / sizeof(utf8_length_kernels[0]); i++){
+		start = clock();
+		for (j = 0; j < REPEAT_COUNT; j++){
+			utf8_length_kernels[i].kernel(corpus->data, corpus->size, &count);
+		}
+		report("utf8-length", utf8_length_kernels[i].name, corpus, elapsed(start));
+		if (strcmp(utf8_length_kernels[i].name, utf_kernel_name()) == 0){
+			break;
+		}
+	}
+}
+
+/** Encodes the corpus back to UTF-8 from UTF-32.
+ * The rate is given in bytes of UTF-8. */
+
+static void bench_utf32_to_utf8(const struct corpus * corpus){
+
+	size_t i;
+	size_t j;
+	size_t count;
+	size_t size;
+	clock_t start;
+	char32_t * src;
+	unsigned char * out;
+
+	src = malloc(corpus->size * sizeof(char32_t));
+	out = malloc(corpus->size);
+	if ((src == NULL) || (out == NULL)){
+		free(src);
+		free(out);
+		return;
+	}
+
+	utf_kernel_utf8_to_utf32(corpus->data, corpus->size, src, &count);
+
+	for (i = 0; i < sizeof(utf32_to_utf8_kernels) / sizeof(utf32_to_utf8_kernels[0]); i++){
+		start = clock();
+		for (j = 0; j < REPEAT_COUNT; j++){
+			utf32_to_utf8_kernels[i].kernel(src, count, out, &size);
+		}
+		report("utf32-to-utf8", utf32_to_utf8_kernels[i].name, corpus, elapsed(start));
+		if (strcmp(utf32_to_utf8_kernels[i].name, utf_kernel_name()) == 0){
+			break;
+		}
+	}
+
+	free(src);
+	free(out);
+}
+
+/** Swaps the corpus from UTF-16BE to UTF-16LE.
+ * The rate is given in bytes of UTF-8. */
+
+static void bench_utf16_swap(const struct corpus * corpus){
+
+	size_t i;
+	size_t j;
+	size_t size;
+	clock_t start;
+	unsigned char * src;
+	unsigned char * out;
+
+	src = malloc(corpus->size * 2);
+	out = malloc(corpus->size * 2);
+	if ((src == NULL) || (out == NULL)){
+		free(src);
+		free(out);
+		return;
+	}
+
+	utf_kernel_utf8_to_utf16be(corpus->data, corpus->size, src, &size);
+
+	for (i = 0; i < sizeof(utf16_swap_kernels) / sizeof(utf16_swap_kernels[0]); i++){
+		start = clock();
+		for (j = 0; j < REPEAT_COUNT; j++){
+			utf16_swap_kernels[i].kernel(src, size, out, 1);
+		}
+		report("utf16-swap", utf16_swap_kernels[i].name, corpus, elapsed(start));
+		if (strcmp(utf16_swap_kernels[i].name, utf_kernel_name()) == 0){
+			break;
+		}
+	}
+
+	free(src);
+	free(out);
+}
+
+static void bench_utf8_to_utf16le(const struct corpus * corpus){
+
+	size_t i;
+	size_t j;
+	size_t size;
+	clock_t start;
+	unsigned char * out;
+	const void * src;
+	size_t src_left;
+	void * dst;
+	size_t dst_left;
+	utf_converter_t converter;
+
+	out = malloc(corpus->size * 2);
+	if (out == NULL){
+		return;
+	}
+
+	for (i = 0; i < sizeof(utf8_to_utf16le_kernels) / sizeof(utf8_to_utf16le_kernels[0]); i++){
+		start = clock();
+		for (j = 0; j < REPEAT_COUNT; j++){
+			utf8_to_utf16le_kernels[i].kernel(corpus->data, corpus->size, out, &size);
+		}
+		report("utf8-to-utf16le", utf8_to_utf16le_kernels[i].name, corpus, elapsed(start));
+		if (strcmp(utf8_to_utf16le_kernels[i].name, utf_kernel_name()) == 0){
+			break;
+		}
+	}
+
+	/* through the converter, writing and
+	 * reading back 64 KiB at a time */
+
+	utf_converter_init(&converter);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF16_LE);
+
+	start = clock();
+	for (j = 0; j < REPEAT_COUNT; j++){
+		for (i = 0; i < corpus->size; i += size){
+			size = utf_converter_write(&converter, &corpus->data[i], 0x10000 < (corpus->size - i) ? 0x10000 : (unsigned int)(corpus->size - i));
+			if (size == 0){
+				break;
+			}
+			while (utf_converter_read(&converter, out, 0x20000) > 0){
+			}
+		}
+	}
+	report("utf8-to-utf16le", "converter", corpus, elapsed(start));
+
+	/* straight into a caller buffer */
+
+	start = clock();
+	for (j = 0; j < REPEAT_COUNT; j++){
+		src = corpus->data;
+		src_left = corpus->size;
+		dst = out;
+		dst_left = corpus->size * 2;
+		utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left);
+	}
+	report("utf8-to-utf16le", "convert", corpus, elapsed(start));
+
+	/* only the size of the output */
+
+	start = clock();
+	for (j = 0; j < REPEAT_COUNT; j++){
+		utf_converter_measure(UTF_CODEC_UTF8, corpus->data, corpus->size, UTF_CODEC_UTF16_LE, &size);
+	}
+	report("utf8-to-utf16le", "measure", corpus, elapsed(start));
+
+	utf_converter_free(&converter);
+
+	free(out);
+}
+
+/** Measures how the parallel converter scales, from one thread up to
+ * twice the processor count, converting UTF-8 to UTF-16LE. */
+
+static void bench_convert_parallel(const struct corpus * corpus){
+
+	unsigned int thread_count;
+	unsigned int thread_count_max = 2;
+	size_t j;
+	double start;
+	double seconds;
+	double base_seconds = 0.0;
+	void * dst;
+	size_t dst_size;
+	char variant[32];
+
+#if (defined _SC_NPROCESSORS_ONLN)
+	if (sysconf(_SC_NPROCESSORS_ONLN) > 1){
+		thread_count_max = (unsigned int)(sysconf(_SC_NPROCESSORS_ONLN)) * 2;
+	}
+#endif
+	if (thread_count_max > THREAD_COUNT_MAX){
+		thread_count_max = THREAD_COUNT_MAX;
+	}
+
+	for (thread_count = 1; thread_count <= thread_count_max; thread_count *= 2){
+		start = wall_time();
+		for (j = 0; j < REPEAT_COUNT; j++){
+			if (utf_converter_convert_parallel(UTF_CODEC_UTF8, corpus->data, corpus->size, UTF_CODEC_UTF16_LE, &dst, &dst_size, thread_count) != UTF_ERROR_NONE){
+				return;
+			}
+			free(dst);
+		}
+		seconds = wall_time() - start;
+		if (thread_count == 1){
+			base_seconds = seconds;
+		}
+		sprintf(variant, "%u-thread", thread_count);
+		report("utf8-to-utf16le", variant, corpus, seconds);
+		if (seconds > 0.0){
+			printf("%-16s %-10s %-10s %10.2fx\n", "", "speedup", corpus->name, base_seconds / seconds);
+		}
+	}
+}
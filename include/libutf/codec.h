@@ -14,6 +14,9 @@
 #endif /* UTF_BIG_ENDIAN */
 #endif /* UTF_CODEC_UTF16_NE */
 
+/* the most bytes that are looked at to detect a codec */
+#define LIBUTF_CODEC_DETECT_SIZE 0x1000
+
 typedef enum utf_codec {
 	/** UTF-8 codec */
 	UTF_CODEC_UTF8,
@@ -25,16 +28,99 @@ typedef enum utf_codec {
 	UTF_CODEC_UTF32_BE,
 	/** UTF-32 codec, using little endian format */
 	UTF_CODEC_UTF32_LE,
+	/** ISO-8859-1 single-byte codec (Western European) */
+	UTF_CODEC_ISO_8859_1,
+	/** ISO-8859-2 single-byte codec (Central European) */
+	UTF_CODEC_ISO_8859_2,
+	/** ISO-8859-3 single-byte codec (South European) */
+	UTF_CODEC_ISO_8859_3,
+	/** ISO-8859-4 single-byte codec (North European) */
+	UTF_CODEC_ISO_8859_4,
+	/** ISO-8859-5 single-byte codec (Cyrillic) */
+	UTF_CODEC_ISO_8859_5,
+	/** ISO-8859-6 single-byte codec (Arabic) */
+	UTF_CODEC_ISO_8859_6,
+	/** ISO-8859-7 single-byte codec (Greek) */
+	UTF_CODEC_ISO_8859_7,
+	/** ISO-8859-8 single-byte codec (Hebrew) */
+	UTF_CODEC_ISO_8859_8,
+	/** ISO-8859-9 single-byte codec (Turkish) */
+	UTF_CODEC_ISO_8859_9,
+	/** ISO-8859-10 single-byte codec (Nordic) */
+	UTF_CODEC_ISO_8859_10,
+	/** ISO-8859-11 single-byte codec (Thai) */
+	UTF_CODEC_ISO_8859_11,
+	/** ISO-8859-13 single-byte codec (Baltic) */
+	UTF_CODEC_ISO_8859_13,
+	/** ISO-8859-14 single-byte codec (Celtic) */
+	UTF_CODEC_ISO_8859_14,
+	/** ISO-8859-15 single-byte codec (Western European, with the euro sign) */
+	UTF_CODEC_ISO_8859_15,
+	/** ISO-8859-16 single-byte codec (South-Eastern European) */
+	UTF_CODEC_ISO_8859_16,
+	/** Windows-1250 single-byte codec (Central European) */
+	UTF_CODEC_WINDOWS_1250,
+	/** Windows-1251 single-byte codec (Cyrillic) */
+	UTF_CODEC_WINDOWS_1251,
+	/** Windows-1252 single-byte codec (Western European) */
+	UTF_CODEC_WINDOWS_1252,
+	/** Windows-1253 single-byte codec (Greek) */
+	UTF_CODEC_WINDOWS_1253,
+	/** Windows-1254 single-byte codec (Turkish) */
+	UTF_CODEC_WINDOWS_1254,
+	/** Windows-1255 single-byte codec (Hebrew) */
+	UTF_CODEC_WINDOWS_1255,
+	/** Windows-1256 single-byte codec (Arabic) */
+	UTF_CODEC_WINDOWS_1256,
+	/** Windows-1257 single-byte codec (Baltic) */
+	UTF_CODEC_WINDOWS_1257,
+	/** Windows-1258 single-byte codec (Vietnamese) */
+	UTF_CODEC_WINDOWS_1258,
+	/** ASCII codec, which has no characters from U+0080 on */
+	UTF_CODEC_ASCII,
+	/** WTF-8 codec, which is UTF-8 that may have unpaired surrogates,
+	 * as they come from UTF-16 that isn't well-formed */
+	UTF_CODEC_WTF8,
+	/** CESU-8 codec, which encodes each UTF-16 code unit as a UTF-8 sequence,
+	 * so characters from U+10000 on take six bytes */
+	UTF_CODEC_CESU8,
+	/** Detects the codec from the byte order mark, or from the text if there
+	 * is none (see @ref utf_codec_detect). This is only supported by decoders,
+	 * which change to the detected codec. */
+	UTF_CODEC_AUTO,
 	/** UTF-16 codec, using the native endian format */
 	UTF_CODEC_UTF16 = UTF_CODEC_UTF16_NE,
 	/** UTF-32 codec, using native endian format */
 	UTF_CODEC_UTF32 = UTF_CODEC_UTF32_NE,
+	/** Latin-1 codec, where each byte is the character of the same value.
+	 * It's the same as ISO-8859-1. */
+	UTF_CODEC_LATIN1 = UTF_CODEC_ISO_8859_1,
 	/** The first codec in the codecs enumeration (useful for iteration) */
 	UTF_CODEC_FIRST = UTF_CODEC_UTF8,
-	/** The last codec in the codecs enumeration (useful for iteration) */
-	UTF_CODEC_LAST = UTF_CODEC_UTF32_LE
+	/** The last Unicode codec in the codecs enumeration (useful for iteration) */
+	UTF_CODEC_LAST = UTF_CODEC_UTF32_LE,
+	/** The first single-byte codepage */
+	UTF_CODEC_CODEPAGE_FIRST = UTF_CODEC_ISO_8859_1,
+	/** The last single-byte codepage */
+	UTF_CODEC_CODEPAGE_LAST = UTF_CODEC_ASCII
 } utf_codec_t;
 
+/** Detect the codec of a text from its byte order mark.
+ * If there isn't one, the codec is guessed from the first
+ * @ref LIBUTF_CODEC_DETECT_SIZE bytes of the text: the positions of
+ * zero bytes pick out UTF-16 and UTF-32 and their byte order, and
+ * anything else is taken as UTF-8. UTF-16 text that has no zero bytes,
+ * like most CJK text, can't be told apart this way.
+ * @param src The start of the text.
+ * @param src_size The number of bytes in @p src.
+ * @param bom_size Set to the number of bytes in the byte order mark, or zero
+ *  if there isn't one. If @p src is too short to tell whether it starts with one,
+ *  this is set to more than @p src_size.
+ * @returns The detected codec.
+ */
+
+utf_codec_t utf_codec_detect(const void * src, size_t src_size, size_t * bom_size);
+
 /** Calculate the minimum bytes size of a code point, for a given codec.
  * @param codec The codec to calculate the minimum character size for.
  * @returns The minimum number of bytes that occupy one character in the codec.
@@ -50,6 +50,110 @@ void utf_converter_init(utf_converter_t * converter);
 
 void utf_converter_free(utf_converter_t * converter);
 
+/** Converts from a caller's input buffer straight into a caller's output buffer.
+ * Like iconv, both buffers are advanced past what was converted.
+ * A sequence that is split at the end of the input is kept by the
+ * converter and completed by the next call, so the whole input is
+ * consumed unless an error occurs. Only bytes that can still start a
+ * valid sequence are kept. Once there's no more input,
+ * @ref utf_converter_flush converts what's left of it.
+ * Output that is left over from @ref utf_converter_write is written first.
+ * @param converter An initialized converter structure.
+ * @param src The address of the input.
+ *  On return, it points to the first byte that wasn't converted.
+ * @param src_left The number of bytes at @p src.
+ *  On return, it is the number of bytes that weren't converted.
+ * @param dst The address of the output.
+ *  On return, it points to the byte after the last one written.
+ * @param dst_left The number of bytes that fit at @p dst.
+ *  On return, it is the number of bytes that are still free.
+ * @returns On success, @ref UTF_ERROR_NONE.
+ *  If the output is full, @ref UTF_ERROR_OVERFLOW.
+ *  If the input has an invalid sequence, @ref UTF_ERROR_INVALID_SEQUENCE,
+ *  with @p src pointing to it.
+ * @ingroup libutf
+ */
+
+utf_error_t utf_converter_convert(utf_converter_t * converter, const void ** src, size_t * src_left, void ** dst, size_t * dst_left);
+
+/** Ends the input of the converter, like a call to iconv without any.
+ * What the converter kept of the last input is converted as if nothing
+ * comes after it: a sequence that was cut short is invalid, unless the
+ * decoder's policy replaces or skips it, and a high surrogate that was
+ * waiting for its pair is converted on its own, where the codecs allow it.
+ * Then the output that the converter holds is written.
+ * @param converter An initialized converter structure.
+ * @param dst The address of the output. It's advanced past what was written.
+ *  If it's a null pointer, the output is left to be read with
+ *  @ref utf_converter_read.
+ * @param dst_left The number of bytes that fit at @p dst.
+ *  On return, it is the number of bytes that are still free.
+ * @returns On success, @ref UTF_ERROR_NONE.
+ *  If the output is full, @ref UTF_ERROR_OVERFLOW, and the rest
+ *  of it is written by the next call.
+ *  If the input ended with an incomplete sequence, or a character
+ *  that can't be encoded, @ref UTF_ERROR_INVALID_SEQUENCE.
+ * @ingroup libutf
+ */
+
+utf_error_t utf_converter_flush(utf_converter_t * converter, void ** dst, size_t * dst_left);
+
+/** Finds the exact size of the output of converting a whole buffer,
+ * without converting it, so that the output can be allocated at once.
+ * @param src_codec The codec of the input.
+ * @param src The input, which must end with a complete character.
+ * @param src_size The number of bytes at @p src.
+ * @param dst_codec The codec of the output.
+ * @param dst_size Set to the number of bytes that the output takes.
+ *  If the input is invalid, it's the size of the output up to the
+ *  invalid sequence. Divide by the size of a code unit of @p dst_codec
+ *  for the number of code units.
+ * @returns On success, @ref UTF_ERROR_NONE.
+ *  If the input has an invalid or incomplete sequence,
+ *  or a character that can't be encoded, @ref UTF_ERROR_INVALID_SEQUENCE.
+ * @ingroup libutf
+ */
+
+utf_error_t utf_converter_measure(utf_codec_t src_codec, const void * src, size_t src_size, utf_codec_t dst_codec, size_t * dst_size);
+
+/** Swaps the byte order of UTF-16 or UTF-32 text in place,
+ * so that UTF-16BE becomes UTF-16LE, UTF-32LE becomes UTF-32BE, and so on.
+ * UTF-16 is checked as it's swapped. UTF-32 isn't, the same as when it's decoded.
+ * @param codec The codec that the text is in before it's swapped.
+ * @param buf The text, which is overwritten.
+ * @param size The number of bytes at @p buf.
+ * @param swap_size Set to the number of bytes that were swapped.
+ *  The bytes after that are left as they are.
+ * @returns On success, @ref UTF_ERROR_NONE.
+ *  If the text has an invalid or incomplete sequence,
+ *  or @p codec isn't UTF-16 or UTF-32, @ref UTF_ERROR_INVALID_SEQUENCE.
+ * @ingroup libutf
+ */
+
+utf_error_t utf_converter_swap(utf_codec_t codec, void * buf, size_t size, size_t * swap_size);
+
+/** Converts a whole buffer at once, on several threads.
+ * The input is split into one chunk for each thread, with every split moved
+ * forward to the start of a character. The chunks are converted separately
+ * and their outputs are joined, so the output is the same as one converter's.
+ * @param src_codec The codec of the input.
+ * @param src The input, which must end with a complete character.
+ * @param src_size The number of bytes at @p src.
+ * @param dst_codec The codec of the output.
+ * @param dst On success, set to the output. It must be released with free.
+ * @param dst_size On success, set to the number of bytes at @p dst.
+ * @param thread_count The number of threads to convert with.
+ *  If it's zero, one thread is used for each processor,
+ *  unless the input is too small for that to be worthwhile.
+ * @returns On success, @ref UTF_ERROR_NONE.
+ *  If the input has an invalid or incomplete sequence,
+ *  @ref UTF_ERROR_INVALID_SEQUENCE.
+ *  If memory can't be allocated, @ref UTF_ERROR_MALLOC.
+ * @ingroup libutf
+ */
+
+utf_error_t utf_converter_convert_parallel(utf_codec_t src_codec, const void * src, size_t src_size, utf_codec_t dst_codec, void ** dst, size_t * dst_size, unsigned int thread_count);
+
 /** Returns the decoder of the converter.
  * @param converter An initialized converter.
  * @ingroup libutf
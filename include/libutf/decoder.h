@@ -25,24 +25,49 @@
 extern "C" {
 #endif /* __cplusplus */
 
+/** What a decoder does with an invalid sequence.
+ * UTF-32 isn't checked, so it never has invalid sequences.
+ * @ingroup libutf
+ */
+
+typedef enum {
+	/** Decoding stops at the invalid sequence. This is the default. */
+	UTF_DECODER_STRICT,
+	/** Each maximal subpart of the invalid sequence is decoded as U+FFFD,
+	 * the same as the WHATWG Encoding Standard does. */
+	UTF_DECODER_REPLACE,
+	/** Each maximal subpart of the invalid sequence is dropped. */
+	UTF_DECODER_SKIP
+} utf_decoder_policy_t;
+
 /** A UTF-8, UTF-16 and UTF-32 decoder.
  * It may be used so that, once the codec is set, the decoding of the input text may be abstracted.
  * @ingroup libutf
  */
 
 typedef struct {
-	/** The input byte array, containing undecoded input */
-	unsigned char input_byte_array[4];
+	/** The input byte array, containing undecoded input.
+	 * It fits a UTF-32 surrogate pair, which a converter
+	 * to WTF-8 keeps together, and a CESU-8 one. */
+	unsigned char input_byte_array[8];
 	/** The number of bytes in the input byte array */
 	unsigned long int input_byte_count;
 	/** The codec of the decoder */
 	utf_codec_t codec;
-	/** The decoded characters */
+	/** The decoded characters, stored as a ring */
 	char32_t * output_array;
+	/** The index of the oldest decoded character in the ring */
+	unsigned long int output_index;
 	/** The number of decoded characters */
 	unsigned long int output_count;
-	/** The number of character slots reserved */
+	/** The number of character slots reserved, which is zero or a power of two */
 	unsigned long int output_count_res;
+	/** The most decoded characters held at once, or zero for no limit */
+	unsigned long int output_count_max;
+	/** What is done with invalid sequences */
+	utf_decoder_policy_t policy;
+	/** The number of invalid sequences that were replaced or skipped */
+	unsigned long int invalid_count;
 } utf_decoder_t;
 
 /** Initializes a decoder structure.
@@ -67,8 +92,11 @@ void utf_decoder_free(utf_decoder_t * decoder);
 
 unsigned int utf_decoder_avail(const utf_decoder_t * decoder);
 
-/** Decodes left over input.
- * If the left over input is not a complete sequence, this function fails.
+/** Checks for left over input.
+ * Complete sequences are decoded as soon as they are written, so the
+ * only input that can be left over is an incomplete sequence.
+ * If there is one, this function fails, unless the policy set by
+ * @ref utf_decoder_set_policy replaces or skips it.
  * This function should be called when no more input will be written to the
  * decoder.
  * @param An initialized decoder structure.
@@ -86,7 +114,33 @@ utf_error_t utf_decoder_flush(utf_decoder_t * decoder);
 
 utf_codec_t utf_decoder_get_codec(const utf_decoder_t * decoder);
 
+/** Returns the most decoded characters the decoder will hold at once.
+ * @param decoder An initialized decoder structure.
+ * @returns The limit set by @ref utf_decoder_set_limit, or zero if there is none.
+ * @ingroup libutf
+ */
+
+unsigned long int utf_decoder_get_limit(const utf_decoder_t * decoder);
+
+/** Returns what the decoder does with invalid sequences.
+ * @param decoder An initialized decoder structure.
+ * @returns The policy set by @ref utf_decoder_set_policy.
+ * @ingroup libutf
+ */
+
+utf_decoder_policy_t utf_decoder_get_policy(const utf_decoder_t * decoder);
+
+/** Returns the number of invalid sequences that were replaced or skipped.
+ * Each maximal subpart of an invalid sequence counts once.
+ * @param decoder An initialized decoder structure.
+ * @ingroup libutf
+ */
+
+unsigned long int utf_decoder_get_invalid_count(const utf_decoder_t * decoder);
+
 /** Reads decoded characters from the decoder.
+ * This takes time proportional to the number of characters read,
+ * regardless of how many are left in the decoder.
  * @param decoder An initialized decoder.
  * @param dst_array An address to write the output characters to.
  * @param dst_count The number of UTF-32 characters that can fit in @p dst_array
@@ -99,6 +153,9 @@ utf_error_t utf_decoder_read(utf_decoder_t * decoder, utf32_t * dst_array, unsig
 /** Reserves memory for the decoder's internal character buffer.
  * This can be useful to reduce the number of memory allocations for
  * a series of write operations.
+ * The count is rounded up to a power of two.
+ * If it is less than the number of available characters,
+ * the newest characters are discarded.
  * @param decoder An initialized decoder structure
  * @param count The number of UTF-32 characters to reserve in memory
  * @returns On success, @ref UTF_ERROR_NONE
@@ -108,18 +165,50 @@ utf_error_t utf_decoder_read(utf_decoder_t * decoder, utf32_t * dst_array, unsig
 utf_error_t utf_decoder_reserve(utf_decoder_t * decoder, unsigned long int count);
 
 /** Sets the codec of decoder.
+ * With @ref UTF_CODEC_AUTO, the codec is detected once four bytes have
+ * been written, or on @ref utf_decoder_flush if there are fewer,
+ * and a byte order mark is dropped instead of being decoded.
+ * Until the codec is detected, @ref utf_decoder_get_codec returns
+ * @ref UTF_CODEC_AUTO.
  * @ingroup libutf
  */
 
 void utf_decoder_set_codec(utf_decoder_t * decoder, utf_codec_t codec);
 
+/** Limits the number of decoded characters the decoder holds at once.
+ * Once the limit is reached, write operations stop consuming input
+ * until characters are read, so that the memory used by the decoder
+ * stays under the next power of two of @p count characters.
+ * @param decoder An initialized decoder structure.
+ * @param count The most characters to hold, or zero for no limit.
+ * @ingroup libutf
+ */
+
+void utf_decoder_set_limit(utf_decoder_t * decoder, unsigned long int count);
+
+/** Sets what the decoder does with invalid sequences.
+ * With @ref UTF_DECODER_REPLACE or @ref UTF_DECODER_SKIP,
+ * write operations go on past invalid sequences.
+ * @param decoder An initialized decoder structure.
+ * @param policy The policy to use from the next write operation on.
+ * @ingroup libutf
+ */
+
+void utf_decoder_set_policy(utf_decoder_t * decoder, utf_decoder_policy_t policy);
+
 /** Writes a byte array to the decoder.
- * Stops the write operation when a valid sequence is decoded or when an error occurs.
+ * The array is decoded as a block, with one dispatch on the codec per call.
+ * An incomplete sequence at the end of the array is kept by the decoder
+ * and completed by the next write operation. Only bytes that can still
+ * start a valid sequence are kept, anything else is an invalid sequence.
+ * Stops the write operation when an invalid sequence is found, unless the
+ * policy set by @ref utf_decoder_set_policy replaces or skips it,
+ * when an error occurs or when the limit set by @ref utf_decoder_set_limit is reached.
  * @param decoder An initialized decoder structure.
  * @param src The source of data to write to the decoder.
  * @param src_size The number of bytes to send to the decoder.
- * @returns The number of bytes decoded.
- *  If an error occurs during the operation, zero is returned.
+ * @returns The number of bytes consumed by the decoder.
+ *  If an error occurs, this is less than @p src_size.
  * @ingroup libutf
  */
 
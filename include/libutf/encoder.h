@@ -22,6 +22,23 @@
 #include "codec.h"
 #include "error.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/** What an encoder does with a character that the codec doesn't have,
+ * like one from U+0100 on in Latin-1, or a surrogate in UTF-8.
+ * @ingroup libutf
+ */
+
+typedef enum {
+	/** Encoding stops at the character. This is the default. */
+	UTF_ENCODER_STRICT,
+	/** The character is encoded as U+FFFD, or as a question mark
+	 * if the codec is a single-byte codepage. */
+	UTF_ENCODER_REPLACE
+} utf_encoder_policy_t;
+
 /** A UTF-8, UTF-16 or UTF-32 encoder.
  * It may be used so that, once the codec is set, the encoding of the input text may be abstracted.
  * @ingroup libutf
@@ -30,18 +47,20 @@
 typedef struct {
 	/** The encoding codec of the encoder */
 	utf_codec_t codec;
-	/** An array of bytes to store encoded characters */
+	/** An array of bytes to store encoded characters, used as a ring */
 	unsigned char * byte_array;
+	/** The index of the oldest encoded byte in the ring */
+	unsigned long int byte_index;
 	/** The number of encoded bytes in the byte array */
 	unsigned long int byte_count;
-	/** The number of bytes reserved in the byte array */
+	/** The number of bytes reserved in the byte array, which is zero or a power of two */
 	unsigned long int byte_count_res;
+	/** What is done with characters that the codec doesn't have */
+	utf_encoder_policy_t policy;
+	/** The number of characters that were replaced */
+	unsigned long int invalid_count;
 } utf_encoder_t;
 
-#ifdef __cplusplus
-extern "C" {
-#endif /* __cplusplus */
-
 /** Initializes the members of an encoder structure.
  * Sets the encoding codec to UTF-8.
  * @param encoder An uninitialized encoder structure.
@@ -66,6 +85,21 @@ void utf_encoder_free(utf_encoder_t * encoder);
 
 utf_codec_t utf_encoder_get_codec(const utf_encoder_t * encoder);
 
+/** Returns what the encoder does with characters that the codec doesn't have.
+ * @param encoder An initialized encoder structure.
+ * @returns The policy set by @ref utf_encoder_set_policy.
+ * @ingroup libutf
+ */
+
+utf_encoder_policy_t utf_encoder_get_policy(const utf_encoder_t * encoder);
+
+/** Returns the number of characters that were replaced.
+ * @param encoder An initialized encoder structure.
+ * @ingroup libutf
+ */
+
+unsigned long int utf_encoder_get_invalid_count(const utf_encoder_t * encoder);
+
 /** Reads the internal output character of the last encoded input character.
  * The encoding of the output character is determined by what codec the encoder is in.
  * The codec of the encoder can be set with the function @ref utf_encoder_set_codec.
@@ -73,6 +107,8 @@ utf_codec_t utf_encoder_get_codec(const utf_encoder_t * encoder);
  * @param dst The address of where the output character will be written.
  * @param dst_size The number of bytes to read from the encoder.
  * @return The number of bytes read from the encoder.
+ *  This takes time proportional to the number of bytes read,
+ *  regardless of how many are left in the encoder.
  */
 
 unsigned long int utf_encoder_read(utf_encoder_t * encoder, void * dst, unsigned long int dst_size);
@@ -80,6 +116,8 @@ unsigned long int utf_encoder_read(utf_encoder_t * encoder, void * dst, unsigned
 /** Reserves an amount of memory for the encoder to store encoded characters.
  * This function can be used to optimize a series of write operations, that will
  * likely use a lot of memory.
+ * The size is rounded up to a power of two.
+ * If it is less than the number of encoded bytes, the newest bytes are discarded.
  * @param encoder An initialized encoder structure.
  * @param size The number of bytes to allocate for the encoder's buffer.
  * @return On success, @ref UTF_ERROR_NONE.
@@ -96,16 +134,45 @@ utf_error_t utf_encoder_reserve(utf_encoder_t * encoder, unsigned long int size)
 
 void utf_encoder_set_codec(utf_encoder_t * encoder, utf_codec_t codec);
 
+/** Sets what the encoder does with characters that the codec doesn't have.
+ * With @ref UTF_ENCODER_REPLACE, write operations go on past them.
+ * @param encoder An initialized encoder structure.
+ * @param policy The policy to use from the next write operation on.
+ * @ingroup libutf
+ */
+
+void utf_encoder_set_policy(utf_encoder_t * encoder, utf_encoder_policy_t policy);
+
 /** Encodes an input character.
  * The output of the encoding is determined by what codec the encoder is in.
+ * In WTF-8, a low surrogate that follows a high one that hasn't been read yet
+ * is joined to it, so that the pair is encoded as the character it makes.
  * @param encoder An initialized encoder structure
  * @param input_char A valid UTF-32 character.
  * @returns On success, UTF_ERROR_NONE is returned.
+ *  If the codec doesn't have the character, @ref UTF_ERROR_INVALID_SEQUENCE
+ *  is returned, unless the policy set by @ref utf_encoder_set_policy replaces it.
  * @ingroup libutf
  */
 
 utf_error_t utf_encoder_write(utf_encoder_t * encoder, utf32_t input_char);
 
+/** Encodes an array of input characters.
+ * This is the same as calling @ref utf_encoder_write for each character,
+ * but room is made for a block of characters at a time,
+ * and each block is encoded in one pass.
+ * @param encoder An initialized encoder structure.
+ * @param src An array of valid UTF-32 characters.
+ * @param src_count The number of characters in @p src.
+ * @returns On success, @ref UTF_ERROR_NONE.
+ *  If a character can't be encoded, and the policy doesn't replace it,
+ *  @ref UTF_ERROR_INVALID_SEQUENCE is returned, and none of the characters
+ *  are written to the encoder.
+ * @ingroup libutf
+ */
+
+utf_error_t utf_encoder_write_array(utf_encoder_t * encoder, const utf32_t * src, size_t src_count);
+
 #ifdef __cplusplus
 } /* extern "C" { */
 #endif /* __cplusplus */
@@ -5,6 +5,10 @@
 
 struct utf_ifstream {
 	struct utf_istream istream;
+	/* the file's contents, if it could be memory mapped */
+	void * map;
+	/* the number of bytes mapped */
+	size_t map_size;
 };
 
 void utf_ifstream_init(struct utf_ifstream * ifstream);
@@ -4,14 +4,33 @@
 /* for char16_t and char32_t */
 #include <uchar.h>
 
+#include <libutf/converter.h>
 #include <libutf/stream.h>
 #include <libutf/string.h>
 
+/* the default number of bytes read from the source at a time */
+#define LIBUTF_ISTREAM_BUFFER_SIZE 0x10000
+
 typedef size_t (*utf_read_callback_t)(void * stream_data, void * data, size_t data_max);
 
 struct utf_istream {
 	struct utf_stream stream;
 	utf_read_callback_t read_cb;
+	/* bytes read ahead from the source, allocated on the first read */
+	unsigned char * buffer;
+	/* the number of bytes that fit in the buffer */
+	size_t buffer_size;
+	/* the index of the first byte that hasn't been converted */
+	size_t buffer_index;
+	/* the number of bytes, from buffer_index, that haven't been converted */
+	size_t buffer_count;
+	/* whether the buffer belongs to the caller (see utf_istream_set_memory) */
+	utf_bool_t buffer_borrowed;
+	/* converts from the stream's codec, and keeps
+	 * sequences that are split between reads */
+	utf_converter_t converter;
+	/* what stopped the last read short, if anything did */
+	utf_error_t error;
 };
 
 void utf_istream_init(struct utf_istream * istream);
@@ -20,6 +39,8 @@ void utf_istream_free(struct utf_istream * istream);
 
 utf_codec_t utf_istream_get_codec(const struct utf_istream * istream);
 
+utf_error_t utf_istream_get_error(const struct utf_istream * istream);
+
 void utf_istream_set_codec(struct utf_istream * istream, utf_codec_t codec);
 
 void utf_istream_set_data(struct utf_istream * istream, void * data);
@@ -32,6 +53,10 @@ void utf_istream_set_tell(struct utf_istream * istream, utf_tell_callback_t tell
 
 void utf_istream_set_read(struct utf_istream * istream, utf_read_callback_t read_cb);
 
+int utf_istream_set_buffer_size(struct utf_istream * istream, size_t buffer_size);
+
+void utf_istream_set_memory(struct utf_istream * istream, const void * data, size_t data_size);
+
 size_t utf_istream_read(struct utf_istream * istream, struct utf_string * string);
 
 size_t utf_istream_read_utf8(struct utf_istream * istream, char * data, size_t data_max);
@@ -16,6 +16,7 @@
 #include "utf8.h"
 #include "utf16.h"
 #include "utf32.h"
+#include "validator.h"
 #include "version.h"
 
 #endif /* LIBUTF_H */
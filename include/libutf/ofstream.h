@@ -13,6 +13,8 @@ void utf_ofstream_init(struct utf_ofstream * ofstream);
 
 void utf_ofstream_free(struct utf_ofstream * ofstream);
 
+int utf_ofstream_flush(struct utf_ofstream * ofstream);
+
 int utf_ofstream_open(struct utf_ofstream * ofstream, const char * path);
 
 size_t utf_ofstream_printf(struct utf_ofstream * ofstream, const char32_t * fmt, ...);
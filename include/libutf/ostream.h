@@ -7,20 +7,39 @@
 /* for va_list */
 #include <stdarg.h>
 
+#include <libutf/converter.h>
 #include <libutf/stream.h>
 #include <libutf/string.h>
 
+/* the default number of bytes buffered before they're written */
+#define LIBUTF_OSTREAM_BUFFER_SIZE 0x10000
+
 typedef size_t (*utf_write_callback_t)(void * file_ptr, const void * data, size_t data_max);
 
 struct utf_ostream {
 	struct utf_stream stream;
 	utf_write_callback_t write_cb;
+	/* encoded bytes that haven't been written, allocated on the first write */
+	unsigned char * buffer;
+	/* the number of bytes that fit in the buffer */
+	size_t buffer_size;
+	/* the number of bytes in the buffer */
+	size_t buffer_count;
+	/* whether the buffer is flushed at the end of every write */
+	utf_bool_t auto_flush;
+	/* converts to the stream's codec, and keeps
+	 * sequences that are split between writes */
+	utf_converter_t converter;
 };
 
 void utf_ostream_init(struct utf_ostream * ostream);
 
 void utf_ostream_free(struct utf_ostream * ostream);
 
+int utf_ostream_flush(struct utf_ostream * ostream);
+
+utf_codec_t utf_ostream_get_codec(const struct utf_ostream * ostream);
+
 struct utf_stream * utf_ostream_get_stream(struct utf_ostream * ostream);
 
 const struct utf_stream * utf_ostream_get_stream_const(const struct utf_ostream * ostream);
@@ -29,6 +48,12 @@ size_t utf_ostream_printf(struct utf_ostream * ostream, const char32_t * fmt, ..
 
 size_t utf_ostrema_vprintf(struct utf_ostream * ostream, const char32_t * fmt, va_list args);
 
+void utf_ostream_set_auto_flush(struct utf_ostream * ostream, utf_bool_t auto_flush);
+
+void utf_ostream_set_codec(struct utf_ostream * ostream, utf_codec_t codec);
+
+int utf_ostream_set_buffer_size(struct utf_ostream * ostream, size_t buffer_size);
+
 void utf_ostream_set_data(struct utf_ostream * ostream, void * data);
 
 void utf_ostream_set_free(struct utf_ostream * ostream, utf_free_callback_t free_cb);
@@ -98,6 +98,19 @@ char16_t utf16le(const void * in);
 
 size_t utf16_strlen(const char16_t * in, size_t in_size);
 
+/** Calculate the length of a UTF-16 string, and check that it's well-formed.
+ * Both are found in the same pass over the string.
+ * @param in The UTF-16 string.
+ * @param in_size The number of code units occupied by the UTF-16 string.
+ * @param valid_size Set to the number of code units before the first
+ *  unpaired or incomplete surrogate.
+ *  The string is well-formed if it's equal to @p in_size.
+ * @returns The length of the UTF-16 string before the first error, in code points.
+ * @ingroup libutf-procedural
+ */
+
+size_t utf16_strlen_valid(const char16_t * in, size_t in_size, size_t * valid_size);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
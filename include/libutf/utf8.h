@@ -86,13 +86,26 @@ size_t utf8_encode_length(char32_t in);
 
 /** Calculate the length of a UTF-8 string.
  * The function will stop at the end of the string or at the first error.
+ * Overlong sequences, surrogates and values above U+10FFFF are errors.
  * @param in The UTF-8 string.
  * @param in_size The number of code units occupied by the UTF-8 string.
  * @returns The length of the UTF-8 string, in code points.
  * @ingroup libutf-procedural
  */
 
-size_t utf8_strlen(const char * in, unsigned int in_size);
+size_t utf8_strlen(const char * in, size_t in_size);
+
+/** Calculate the length of a UTF-8 string, and check that it's well-formed.
+ * Both are found in the same pass over the string.
+ * @param in The UTF-8 string.
+ * @param in_size The number of code units occupied by the UTF-8 string.
+ * @param valid_size Set to the number of code units before the first error.
+ *  The string is well-formed if it's equal to @p in_size.
+ * @returns The length of the UTF-8 string before the first error, in code points.
+ * @ingroup libutf-procedural
+ */
+
+size_t utf8_strlen_valid(const char * in, size_t in_size, size_t * valid_size);
 
 /** Converts a null-terminated UTF-8 string to a null-terminated UTF-32 string.
  * @param in A null-terminated UTF-8 string.
@@ -104,6 +117,9 @@ char32_t * utf8_to_utf32(const char * in);
 
 /** Converts a UTF-8 string to a UTF-32 string.
  * Stops at the end of the UTF-8 string or when an invalid sequence is found.
+ * Overlong sequences, surrogates and values above U+10FFFF are invalid.
+ * The input is validated and decoded by the fastest kernel that the CPU supports,
+ *  see the "CPU Dispatch" section of the README.
  * @param in A UTF-8 string.
  * @param in_len The number of code units in the UTF-8 string.
  * @param out_len The number of code units in the output.
@@ -114,6 +130,22 @@ char32_t * utf8_to_utf32(const char * in);
 
 char32_t * utf8_to_utf32_s(const char * in, size_t in_len, size_t * out_len);
 
+/** Converts a UTF-8 string to a UTF-32 string, in a caller's buffer.
+ * Like snprintf, as many characters as fit are written, followed
+ * by a null terminator, and the full length is returned.
+ * Stops at the end of the UTF-8 string or when an invalid sequence is found.
+ * @param in A UTF-8 string.
+ * @param in_len The number of code units in the UTF-8 string.
+ * @param out The buffer to write the null-terminated UTF-32 string to.
+ *  May be NULL if @p out_cap is zero.
+ * @param out_cap The number of code units that fit in @p out.
+ * @returns The number of code units in the whole output,
+ *  not counting the null terminator. If it isn't less than
+ *  @p out_cap, the output was cut short.
+ */
+
+size_t utf8_to_utf32_into(const char * in, size_t in_len, char32_t * out, size_t out_cap);
+
 #ifdef __cplusplus
 } /* extern "C" { */
 #endif /* __cplusplus */
@@ -0,0 +1,92 @@
+/*
+ *    This file is part of libutf.
+ *
+ *    libutf is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    libutf is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with libutf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBUTF_VALIDATOR_H
+#define LIBUTF_VALIDATOR_H
+
+#include <libutf/error.h>
+#include <libutf/types.h>
+
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/** A UTF-8 validator, for input that arrives in chunks.
+ * Input is checked against RFC 3629, so overlong forms, surrogates
+ * and values above U+10FFFF are rejected, without decoding it.
+ * A sequence that is split between chunks is kept until the next chunk.
+ * @ingroup libutf
+ */
+
+typedef struct {
+	/** The start of a sequence that was split at the end of the last chunk */
+	unsigned char sequence[4];
+	/** The number of bytes in the sequence */
+	unsigned long int sequence_size;
+	/** The number of bytes, from the start of the input, that are well-formed */
+	size_t valid_size;
+	/** Whether an invalid sequence was found */
+	utf_bool_t invalid;
+} utf_validator_t;
+
+/** Initializes a validator structure.
+ * @param validator An uninitialized validator structure.
+ * @ingroup libutf
+ */
+
+void utf_validator_init(utf_validator_t * validator);
+
+/** Validates the next chunk of the input.
+ * Once an invalid sequence is found, the rest of the input is ignored.
+ * @param validator An initialized validator structure.
+ * @param src The chunk of UTF-8 input.
+ * @param src_size The number of bytes in @p src.
+ * @returns On success, @ref UTF_ERROR_NONE.
+ *  If the input has an invalid sequence, in this chunk or
+ *  an earlier one, @ref UTF_ERROR_INVALID_SEQUENCE.
+ * @ingroup libutf
+ */
+
+utf_error_t utf_validator_write(utf_validator_t * validator, const void * src, size_t src_size);
+
+/** Checks that the input didn't end with an incomplete sequence.
+ * This should be called after the last chunk is written.
+ * @param validator An initialized validator structure.
+ * @returns On success, @ref UTF_ERROR_NONE.
+ *  If the input has an invalid or incomplete sequence,
+ *  @ref UTF_ERROR_INVALID_SEQUENCE.
+ * @ingroup libutf
+ */
+
+utf_error_t utf_validator_finish(utf_validator_t * validator);
+
+/** Returns the number of bytes, from the start of the input,
+ * that are known to be well-formed. After an error, this is the
+ * offset of the first byte of the invalid sequence.
+ * @param validator An initialized validator structure.
+ * @ingroup libutf
+ */
+
+size_t utf_validator_get_offset(const utf_validator_t * validator);
+
+#ifdef __cplusplus
+} /* extern "C" { */
+#endif /* __cplusplus */
+
+#endif /* LIBUTF_VALIDATOR_H */
@@ -1,8 +1,21 @@
 #include <libutf/codec.h>
 
+#include "kernel.h"
+
+#include <string.h>
+
+static int is_utf8(const unsigned char * src, size_t src_size);
+
+static size_t bom_length(const unsigned char * src, size_t src_size, utf_codec_t * codec);
+
 utf_byte_count_t utf_codec_min_bytes(utf_codec_t codec){
+	if ((codec >= UTF_CODEC_CODEPAGE_FIRST) && (codec <= UTF_CODEC_CODEPAGE_LAST)){
+		return 1;
+	}
 	switch (codec){
 	case UTF_CODEC_UTF8:
+	case UTF_CODEC_WTF8:
+	case UTF_CODEC_CESU8:
 		return 1;
 	case UTF_CODEC_UTF16_LE:
 	case UTF_CODEC_UTF16_BE:
@@ -10,7 +23,131 @@ utf_byte_count_t utf_codec_min_bytes(utf_codec_t codec){
 	case UTF_CODEC_UTF32_LE:
 	case UTF_CODEC_UTF32_BE:
 		return 4;
+	default:
+		break;
 	}
 	return 0;
 }
 
+utf_codec_t utf_codec_detect(const void * src, size_t src_size, size_t * bom_size){
+
+	const unsigned char * src8 = (const unsigned char *)(src);
+	utf_codec_t codec = UTF_CODEC_UTF8;
+	size_t counts[4];
+	size_t zero_count = 0;
+	size_t unit_count = 0;
+	size_t odd_count = 0;
+	size_t even_count = 0;
+
+	*bom_size = bom_length(src8, src_size, &codec);
+	if (*bom_size > 0){
+		return codec;
+	}
+
+	if (src_size > LIBUTF_CODEC_DETECT_SIZE){
+		src_size = LIBUTF_CODEC_DETECT_SIZE;
+	}
+
+	/* only whole UTF-32 characters */
+
+	if (src_size >= 4){
+		src_size -= src_size % 4;
+	}
+
+	zero_count = utf_kernel_zero_count(src8, src_size, counts);
+	if (zero_count == 0){
+		return UTF_CODEC_UTF8;
+	}
+
+	/* the top byte of a UTF-32 character is always zero,
+	 * and so is the next one for anything in the BMP */
+
+	unit_count = src_size / 4;
+
+	if ((unit_count > 0) && (counts[3] == unit_count) && ((counts[2] * 2) >= unit_count)){
+		return UTF_CODEC_UTF32_LE;
+	} else if ((unit_count > 0) && (counts[0] == unit_count) && ((counts[1] * 2) >= unit_count)){
+		return UTF_CODEC_UTF32_BE;
+	}
+
+	/* a few NULs don't make valid UTF-8 anything else */
+
+	if (((zero_count * 16) < src_size) && is_utf8(src8, src_size)){
+		return UTF_CODEC_UTF8;
+	}
+
+	/* ASCII and Latin-1 in UTF-16 have the zero in the high byte */
+
+	odd_count = counts[1] + counts[3];
+	even_count = counts[0] + counts[2];
+
+	if (odd_count > even_count){
+		return UTF_CODEC_UTF16_LE;
+	} else if (even_count > odd_count){
+		return UTF_CODEC_UTF16_BE;
+	}
+
+	return UTF_CODEC_UTF8;
+}
+
+/** Checks for valid UTF-8, which may be cut short by the end of @p src. */
+
+static int is_utf8(const unsigned char * src, size_t src_size){
+
+	size_t valid_size = 0;
+
+	valid_size = utf_kernel_utf8_validate(src, src_size);
+	if (valid_size == src_size){
+		return 1;
+	}
+
+	return utf_kernel_utf8_subpart(&src[valid_size], src_size - valid_size) > (src_size - valid_size);
+}
+
+/** Finds the byte order mark at the start of @p src.
+ * UTF-32LE is checked for before UTF-16LE, since its byte
+ * order mark starts with the one for UTF-16LE.
+ * @param codec Set to the codec of the byte order mark.
+ * @returns The length of the byte order mark, zero if there isn't one,
+ *  or more than @p src_size if @p src is too short to tell.
+ */
+
+static size_t bom_length(const unsigned char * src, size_t src_size, utf_codec_t * codec){
+
+	static const unsigned char boms[5][4] = {
+		{ 0xef, 0xbb, 0xbf, 0x00 },
+		{ 0x00, 0x00, 0xfe, 0xff },
+		{ 0xff, 0xfe, 0x00, 0x00 },
+		{ 0xfe, 0xff, 0x00, 0x00 },
+		{ 0xff, 0xfe, 0x00, 0x00 }
+	};
+
+	static const size_t bom_sizes[5] = { 3, 4, 4, 2, 2 };
+
+	static const utf_codec_t bom_codecs[5] = {
+		UTF_CODEC_UTF8,
+		UTF_CODEC_UTF32_BE,
+		UTF_CODEC_UTF32_LE,
+		UTF_CODEC_UTF16_BE,
+		UTF_CODEC_UTF16_LE
+	};
+
+	size_t i = 0;
+	size_t n = 0;
+
+	for (i = 0; i < 5; i++){
+		n = (src_size < bom_sizes[i]) ? src_size : bom_sizes[i];
+		if (memcmp(src, boms[i], n) != 0){
+			continue;
+		}
+		if (n < bom_sizes[i]){
+			/* it may still turn out to be this one */
+			return bom_sizes[i];
+		}
+		*codec = bom_codecs[i];
+		return bom_sizes[i];
+	}
+
+	return 0;
+}
+
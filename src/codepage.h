@@ -0,0 +1,89 @@
+/*
+ *    This file is part of libutf.
+ *
+ *    libutf is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    libutf is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with libutf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This header is private to the library, it is not installed. */
+
+#ifndef LIBUTF_CODEPAGE_H
+#define LIBUTF_CODEPAGE_H
+
+#include <libutf/codec.h>
+
+/* for char16_t and char32_t */
+#include <uchar.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* Characters from this one on aren't in any of the codepages. */
+#define CODEPAGE_ENCODE_LIMIT 0x2140
+
+/* The number of 64 character blocks below CODEPAGE_ENCODE_LIMIT. */
+#define CODEPAGE_INDEX_COUNT (CODEPAGE_ENCODE_LIMIT / 64)
+
+/* What characters that a codepage doesn't have are encoded as, when they're replaced. */
+#define CODEPAGE_REPLACEMENT 0x3f
+
+/** A single-byte codepage, which is ASCII below 0x80. */
+
+struct codepage {
+	/** The character of each byte from 0x80 on, or zero if the byte isn't
+	 * used by the codepage. There's one more entry, which is always zero, so
+	 * that the vector kernels can read two entries at a time. */
+	const char16_t * decode_table;
+	/** The block in @ref encode_blocks of each 64 characters,
+	 * where block zero has none of them. */
+	const unsigned char * encode_index;
+	/** The byte of each character in a block, or zero if it isn't in the codepage */
+	const unsigned char * encode_blocks;
+	/** The characters below this one are encoded as the byte of the same
+	 * value. It's 0x100 for ISO-8859-1 and 0x80 for the other codepages. */
+	char32_t direct_limit;
+};
+
+/** Returns the tables of a single-byte codepage.
+ * @returns The tables, or a null pointer if @p codec isn't a codepage.
+ */
+
+const struct codepage * utf_codepage_get(utf_codec_t codec);
+
+/** Decodes one byte.
+ * @param c Set to the character of the byte.
+ * @returns One, or zero if the byte isn't used by the codepage.
+ */
+
+size_t utf_codepage_decode(const struct codepage * codepage, unsigned char byte, char32_t * c);
+
+/** Encodes one character.
+ * @param byte Set to the byte of the character.
+ * @returns One, or zero if the character isn't in the codepage.
+ */
+
+size_t utf_codepage_encode(const struct codepage * codepage, char32_t c, unsigned char * byte);
+
+/** Encodes characters, until one that isn't in the codepage.
+ * @param dst It must fit one byte for every character.
+ * @returns The number of characters encoded, which is also the number of bytes written.
+ */
+
+size_t utf_codepage_encode_array(const struct codepage * codepage, const char32_t * src, size_t src_count, unsigned char * dst);
+
+#ifdef __cplusplus
+} /* extern "C" { */
+#endif /* __cplusplus */
+
+#endif /* LIBUTF_CODEPAGE_H */
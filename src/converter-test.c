@@ -1,11 +1,76 @@
 #include <libutf/converter.h>
+#include <libutf/utf8.h>
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
 static void test_utf8_to_utf16be(void);
 
+static void test_utf8_to_utf16le_split(void);
+
+static void test_utf16le_to_utf8(void);
+
+static void test_convert(void);
+
+static void test_convert_split(void);
+
+static void test_convert_end(void);
+
+static void test_convert_utf32(void);
+
+static void test_write_utf32(void);
+
+static void test_convert_parallel(void);
+
+static void test_convert_ascii(void);
+
+static void test_measure(void);
+
+static void test_swap(void);
+
+static void test_lossy(void);
+
+static void test_detect(void);
+
+static void test_codepage(void);
+
+static void test_latin1(void);
+
+static void test_wtf8(void);
+
+static void check_wtf8(utf_codec_t codec, const unsigned char * utf16, size_t utf16_size, const unsigned char * expected, size_t expected_size);
+
+static void check_surrogate(utf_codec_t src_codec, const char * src, utf_codec_t dst_codec, const char * expected, size_t expected_size);
+
+static void check_end_surrogate(utf_codec_t codec);
+
+static void check_utf32_pairs(void);
+
+static void check_lossy(utf_codec_t dst_codec, utf_decoder_policy_t policy, const unsigned long int * expected, size_t expected_count);
+
+static size_t make_text(unsigned char * utf8, size_t utf8_max);
+
+static size_t convert_all(utf_codec_t src_codec, const void * src, size_t src_size, utf_codec_t dst_codec, unsigned char * dst, size_t dst_max);
+
 int main(void){
 	test_utf8_to_utf16be();
+	test_utf8_to_utf16le_split();
+	test_utf16le_to_utf8();
+	test_convert();
+	test_convert_split();
+	test_convert_end();
+	test_convert_utf32();
+	test_write_utf32();
+	test_convert_parallel();
+	test_convert_ascii();
+	test_measure();
+	test_swap();
+	test_lossy();
+	test_detect();
+	test_codepage();
+	test_latin1();
+	test_wtf8();
 	return 0;
 }
 
@@ -43,3 +108,1407 @@ static void test_utf8_to_utf16be(void){
 	utf_converter_free(&converter);
 }
 
+
+static void test_utf8_to_utf16le_split(void){
+
+	/* "a€𐐷b" split in the middle of each sequence */
+
+	unsigned char output[16];
+
+	utf_converter_t converter;
+
+	utf_converter_init(&converter);
+
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF16_LE);
+
+	assert(utf_converter_write(&converter, "a\xe2", 2) == 2);
+	assert(utf_converter_write(&converter, "\x82\xac\xf0\x90", 4) == 4);
+	assert(utf_converter_write(&converter, "\x90", 1) == 1);
+	assert(utf_converter_write(&converter, "\xb7" "b", 2) == 2);
+
+	assert(utf_converter_read(&converter, output, sizeof(output)) == 10);
+	assert(memcmp(output, "a\x00\xac\x20\x01\xd8\x37\xdc" "b\x00", 10) == 0);
+
+	/* stops at an invalid sequence */
+	assert(utf_converter_write(&converter, "ab\xff" "c", 4) == 2);
+	assert(utf_converter_read(&converter, output, sizeof(output)) == 4);
+
+	utf_converter_free(&converter);
+}
+
+static void test_utf16le_to_utf8(void){
+
+	/* "a€𐐷" */
+
+	unsigned char output[16];
+
+	utf_converter_t converter;
+
+	utf_converter_init(&converter);
+
+	utf_converter_set_decoder_codec(&converter, UTF_CODEC_UTF16_LE);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF8);
+
+	assert(utf_converter_write(&converter, "a\x00\xac\x20\x01", 5) == 5);
+	assert(utf_converter_write(&converter, "\xd8\x37", 2) == 2);
+	assert(utf_converter_write(&converter, "\xdc", 1) == 1);
+
+	assert(utf_converter_read(&converter, output, sizeof(output)) == 8);
+	assert(memcmp(output, "a\xe2\x82\xac\xf0\x90\x90\xb7", 8) == 0);
+
+	utf_converter_free(&converter);
+}
+
+static void test_convert(void){
+
+	/* "a€𐐷" */
+	const char input[] = "a\xe2\x82\xac\xf0\x90\x90\xb7";
+
+	unsigned char output[16];
+
+	const void * src = input;
+	size_t src_left = sizeof(input) - 1;
+	void * dst = output;
+	size_t dst_left = 0;
+
+	utf_converter_t converter;
+
+	utf_converter_init(&converter);
+
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF16_LE);
+
+	/* nothing fits */
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_OVERFLOW);
+	assert(src == input);
+	assert(dst == output);
+
+	/* "a€" fits, but the surrogate pair doesn't */
+	dst_left = 7;
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_OVERFLOW);
+	assert(src == &input[4]);
+	assert(src_left == 4);
+	assert(dst == &output[4]);
+	assert(dst_left == 3);
+
+	dst_left = 4;
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(src_left == 0);
+	assert(dst == &output[8]);
+	assert(dst_left == 0);
+	assert(memcmp(output, "a\x00\xac\x20\x01\xd8\x37\xdc", 8) == 0);
+
+	/* stops at an invalid sequence */
+	src = "ab\xff" "c";
+	src_left = 4;
+	dst = output;
+	dst_left = sizeof(output);
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(src_left == 2);
+	assert(dst_left == (sizeof(output) - 4));
+
+	utf_converter_free(&converter);
+}
+
+static void test_convert_split(void){
+
+	/* "€𐐷" split in the middle of each sequence */
+	const char input[] = "\xe2\x82\xac\xf0\x90\x90\xb7";
+
+	unsigned char output[16];
+
+	const void * src = input;
+	size_t src_left = 2;
+	void * dst = output;
+	size_t dst_left = sizeof(output);
+
+	utf_converter_t converter;
+
+	utf_converter_init(&converter);
+
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF16_BE);
+
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(src == &input[2]);
+	assert(src_left == 0);
+	assert(dst == output);
+
+	src_left = 3;
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(src == &input[5]);
+	assert(dst == &output[2]);
+
+	/* the split sequence isn't taken until it fits */
+	src_left = 2;
+	dst_left = 3;
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_OVERFLOW);
+	assert(src == &input[5]);
+	assert(src_left == 2);
+
+	dst_left = 4;
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(src_left == 0);
+	assert(dst == &output[6]);
+	assert(memcmp(output, "\x20\xac\xd8\x01\xdc\x37", 6) == 0);
+
+	utf_converter_free(&converter);
+}
+
+static void test_convert_end(void){
+
+	unsigned char output[16];
+	size_t output_size = 0;
+
+	const void * src = NULL;
+	size_t src_left = 0;
+	void * dst = NULL;
+	size_t dst_left = 0;
+
+	utf_converter_t converter;
+
+	utf_converter_init(&converter);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF16_LE);
+
+	/* bytes that can't start a sequence aren't kept as incomplete */
+	src = "A\x80";
+	src_left = 2;
+	dst = output;
+	dst_left = sizeof(output);
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(src_left == 1);
+	assert(dst_left == (sizeof(output) - 2));
+	assert(utf_converter_measure(UTF_CODEC_UTF8, "A\x80", 2, UTF_CODEC_UTF16_LE, &output_size) == UTF_ERROR_INVALID_SEQUENCE);
+
+	src = "A\xe0" "A";
+	src_left = 3;
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(src_left == 2);
+	assert(utf_converter_measure(UTF_CODEC_UTF8, "A\xe0" "A", 3, UTF_CODEC_UTF16_LE, &output_size) == UTF_ERROR_INVALID_SEQUENCE);
+
+	/* a sequence that the input ends in the middle of waits for the rest */
+	src = "A\xe2\x82";
+	src_left = 3;
+	dst = output;
+	dst_left = sizeof(output);
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(src_left == 0);
+	assert(dst_left == (sizeof(output) - 2));
+	assert(utf_converter_flush(&converter, &dst, &dst_left) == UTF_ERROR_INVALID_SEQUENCE);
+
+	src = "\xac";
+	src_left = 1;
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(utf_converter_flush(&converter, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(dst_left == (sizeof(output) - 4));
+	assert(memcmp(output, "A\x00\xac\x20", 4) == 0);
+
+	/* unless the policy replaces it once the input ends */
+	utf_decoder_set_policy(utf_converter_get_decoder(&converter), UTF_DECODER_REPLACE);
+	src = "A\xe2\x82";
+	src_left = 3;
+	dst = output;
+	dst_left = sizeof(output);
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(dst_left == (sizeof(output) - 2));
+	assert(utf_converter_flush(&converter, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(dst_left == (sizeof(output) - 4));
+	assert(memcmp(output, "A\x00\xfd\xff", 4) == 0);
+
+	/* without an output buffer, it's read */
+	src = "\xe2\x82";
+	src_left = 2;
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(utf_converter_flush(&converter, NULL, NULL) == UTF_ERROR_NONE);
+	assert(utf_converter_read(&converter, output, sizeof(output)) == 2);
+	assert(memcmp(output, "\xfd\xff", 2) == 0);
+
+	utf_converter_free(&converter);
+
+	/* and the same for written input */
+	utf_converter_init(&converter);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF16_LE);
+	assert(utf_converter_write(&converter, "A\x80", 2) == 1);
+	assert(utf_converter_write(&converter, "A\xe2\x82", 3) == 3);
+	dst = output;
+	dst_left = 1;
+	assert(utf_converter_flush(&converter, &dst, &dst_left) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(dst_left == 0);
+	dst_left = sizeof(output) - 1;
+	assert(utf_converter_flush(&converter, &dst, &dst_left) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(dst_left == (sizeof(output) - 4));
+	assert(memcmp(output, "A\x00" "A\x00", 4) == 0);
+	utf_converter_free(&converter);
+}
+
+static void test_convert_utf32(void){
+
+	/* "a€" from UTF-8 to UTF-32BE, which has no transcoder */
+	const char input[] = "a\xe2\x82\xac";
+
+	unsigned char output[8];
+
+	const void * src = input;
+	size_t src_left = sizeof(input) - 1;
+	void * dst = output;
+	size_t dst_left = sizeof(output);
+
+	utf_converter_t converter;
+
+	utf_converter_init(&converter);
+
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF32_BE);
+
+	/* written output comes out first */
+	assert(utf_converter_write(&converter, "b", 1) == 1);
+
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_OVERFLOW);
+	assert(src_left == 3);
+	assert(dst_left == 0);
+	assert(memcmp(output, "\x00\x00\x00" "b\x00\x00\x00" "a", 8) == 0);
+
+	dst = output;
+	dst_left = sizeof(output);
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(src_left == 0);
+	assert(dst_left == 4);
+	assert(memcmp(output, "\x00\x00\x20\xac", 4) == 0);
+
+	utf_converter_free(&converter);
+}
+
+static void test_write_utf32(void){
+
+	unsigned char * input;
+	unsigned char * output;
+	unsigned long int input_size;
+	unsigned long int output_size;
+	unsigned long int i;
+	unsigned long int c;
+
+	utf_converter_t converter;
+
+	/* enough non-ASCII text to be moved in more than one block */
+	input_size = 0x30000 * 2;
+
+	input = malloc(input_size);
+	output = malloc(input_size * 2);
+	assert(input != NULL);
+	assert(output != NULL);
+
+	for (i = 0; i < (input_size / 2); i++){
+		c = ((i % 5) == 0) ? 0x41 : (0x400 + (i % 0xd000));
+		input[(i * 2) + 0] = (c >> 8) & 0xff;
+		input[(i * 2) + 1] = (c >> 0) & 0xff;
+	}
+
+	utf_converter_init(&converter);
+
+	utf_converter_set_decoder_codec(&converter, UTF_CODEC_UTF16_BE);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF32_LE);
+
+	/* the last character is split between the writes */
+	assert(utf_converter_write(&converter, input, input_size - 1) == (input_size - 1));
+	assert(utf_converter_write(&converter, &input[input_size - 1], 1) == 1);
+
+	output_size = utf_converter_read(&converter, output, input_size * 2);
+	assert(output_size == (input_size * 2));
+	assert(utf_converter_read(&converter, output, 1) == 0);
+
+	for (i = 0; i < (input_size / 2); i++){
+		c = ((i % 5) == 0) ? 0x41 : (0x400 + (i % 0xd000));
+		assert(output[(i * 4) + 0] == ((c >> 0) & 0xff));
+		assert(output[(i * 4) + 1] == ((c >> 8) & 0xff));
+		assert(output[(i * 4) + 2] == 0);
+		assert(output[(i * 4) + 3] == 0);
+	}
+
+	utf_converter_free(&converter);
+
+	free(input);
+	free(output);
+}
+
+static void test_convert_parallel(void){
+
+	static const utf_codec_t codecs[] = {
+		UTF_CODEC_UTF8,
+		UTF_CODEC_UTF16_LE,
+		UTF_CODEC_UTF16_BE,
+		UTF_CODEC_UTF32_LE
+	};
+
+	static unsigned char utf8[4096];
+	static unsigned char src[16384];
+	static unsigned char expected[16384];
+
+	size_t utf8_size = 0;
+	size_t src_size = 0;
+	size_t expected_size = 0;
+	size_t dst_size = 0;
+	void * dst = NULL;
+	size_t i = 0;
+	size_t j = 0;
+	unsigned int thread_count = 0;
+
+	utf8_size = make_text(utf8, sizeof(utf8));
+
+	for (i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++){
+
+		src_size = convert_all(UTF_CODEC_UTF8, utf8, utf8_size, codecs[i], src, sizeof(src));
+
+		for (j = 0; j < sizeof(codecs) / sizeof(codecs[0]); j++){
+
+			expected_size = convert_all(codecs[i], src, src_size, codecs[j], expected, sizeof(expected));
+
+			for (thread_count = 0; thread_count <= 9; thread_count++){
+				assert(utf_converter_convert_parallel(codecs[i], src, src_size, codecs[j], &dst, &dst_size, thread_count) == UTF_ERROR_NONE);
+				assert(dst_size == expected_size);
+				assert(memcmp(dst, expected, expected_size) == 0);
+				free(dst);
+			}
+		}
+	}
+
+	/* empty input */
+	assert(utf_converter_convert_parallel(UTF_CODEC_UTF8, utf8, 0, UTF_CODEC_UTF16_LE, &dst, &dst_size, 4) == UTF_ERROR_NONE);
+	assert(dst != NULL);
+	assert(dst_size == 0);
+	free(dst);
+
+	/* an invalid sequence in the middle of the input */
+	utf8[utf8_size / 2] = 0xff;
+	assert(utf_converter_convert_parallel(UTF_CODEC_UTF8, utf8, utf8_size, UTF_CODEC_UTF16_LE, &dst, &dst_size, 4) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(dst == NULL);
+	assert(dst_size == 0);
+
+	/* a sequence that is cut off */
+	assert(utf_converter_convert_parallel(UTF_CODEC_UTF8, "ab\xe2\x82", 4, UTF_CODEC_UTF16_LE, &dst, &dst_size, 1) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(dst == NULL);
+
+	/* two high surrogates on their own, one on each side of the split */
+	memset(src, 'A', 46);
+	memcpy(&src[17], "\xed\xa0\x80\xed\xa0\x80", 6);
+	expected_size = convert_all(UTF_CODEC_CESU8, src, 46, UTF_CODEC_UTF16_LE, expected, sizeof(expected));
+	assert(expected_size == 84);
+	assert(utf_converter_convert_parallel(UTF_CODEC_CESU8, src, 46, UTF_CODEC_UTF16_LE, &dst, &dst_size, 2) == UTF_ERROR_NONE);
+	assert(dst_size == expected_size);
+	assert(memcmp(dst, expected, expected_size) == 0);
+	free(dst);
+
+	memset(src, 0, 44);
+	for (i = 0; i < 44; i += 2){
+		src[i] = 'A';
+	}
+	memcpy(&src[18], "\x00\xd8\x00\xd8", 4);
+	expected_size = convert_all(UTF_CODEC_UTF16_LE, src, 44, UTF_CODEC_WTF8, expected, sizeof(expected));
+	assert(expected_size == 26);
+	assert(utf_converter_convert_parallel(UTF_CODEC_UTF16_LE, src, 44, UTF_CODEC_WTF8, &dst, &dst_size, 2) == UTF_ERROR_NONE);
+	assert(dst_size == expected_size);
+	assert(memcmp(dst, expected, expected_size) == 0);
+	free(dst);
+}
+
+static void test_convert_ascii(void){
+
+	/* mostly ASCII, with runs that end in every kind of sequence */
+	const char text[] = "The quick brown fox jumps over the lazy dog. "
+	                    "caf\xc3\xa9 \xe2\x82\xac" "5 \xf0\x9f\x98\x80!"
+	                    "0123456789abcdefghijklmnopqrstuvwxyz\xc3\xa9";
+
+	unsigned char src[512];
+	unsigned char shifted[516];
+	unsigned char expected[512];
+	unsigned char output[516];
+	size_t src_size;
+	size_t expected_size;
+	size_t output_size;
+	size_t chunk_size;
+	size_t write_size;
+	size_t i;
+	int src_codec;
+	int dst_codec;
+	utf_converter_t converter;
+
+	for (src_codec = UTF_CODEC_FIRST; src_codec <= UTF_CODEC_LAST; src_codec++){
+		src_size = convert_all(UTF_CODEC_UTF8, text, sizeof(text) - 1, (utf_codec_t) src_codec, src, sizeof(src));
+		for (dst_codec = UTF_CODEC_FIRST; dst_codec <= UTF_CODEC_LAST; dst_codec++){
+
+			expected_size = convert_all(UTF_CODEC_UTF8, text, sizeof(text) - 1, (utf_codec_t) dst_codec, expected, sizeof(expected));
+			assert(convert_all((utf_codec_t) src_codec, src, src_size, (utf_codec_t) dst_codec, output, sizeof(output)) == expected_size);
+			assert(memcmp(output, expected, expected_size) == 0);
+
+			/* the kernels only take UTF-32 that's aligned to its characters */
+			for (i = 1; i < 4; i++){
+				memcpy(&shifted[i], src, src_size);
+				assert(convert_all((utf_codec_t) src_codec, &shifted[i], src_size, (utf_codec_t) dst_codec, &output[i], sizeof(output) - i) == expected_size);
+				assert(memcmp(&output[i], expected, expected_size) == 0);
+			}
+
+			/* written in chunks, that split runs and sequences */
+			for (chunk_size = 1; chunk_size <= 37; chunk_size += 6){
+				utf_converter_init(&converter);
+				utf_converter_set_decoder_codec(&converter, (utf_codec_t) src_codec);
+				utf_converter_set_encoder_codec(&converter, (utf_codec_t) dst_codec);
+				for (i = 0; i < src_size; i += write_size){
+					write_size = chunk_size;
+					if (write_size > (src_size - i)){
+						write_size = src_size - i;
+					}
+					assert(utf_converter_write(&converter, &src[i], write_size) == write_size);
+				}
+				output_size = utf_converter_read(&converter, output, sizeof(output));
+				assert(output_size == expected_size);
+				assert(memcmp(output, expected, expected_size) == 0);
+				utf_converter_free(&converter);
+			}
+		}
+	}
+
+	/* a sequence that ASCII cuts short stops the write before it */
+
+	utf_converter_init(&converter);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF32_LE);
+	assert(utf_converter_write(&converter, "ab\xe2\x82" "cd", 6) == 2);
+	assert(utf_converter_read(&converter, output, sizeof(output)) == 8);
+	utf_converter_free(&converter);
+
+	utf_converter_init(&converter);
+	utf_converter_set_decoder_codec(&converter, UTF_CODEC_UTF16_LE);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF16_BE);
+	assert(utf_converter_write(&converter, "a\x00\x01\xd8" "b\x00", 6) == 2);
+	assert(utf_converter_read(&converter, output, sizeof(output)) == 2);
+	assert(memcmp(output, "\x00" "a", 2) == 0);
+	utf_converter_free(&converter);
+}
+
+static void test_measure(void){
+
+	static const utf_codec_t codecs[] = {
+		UTF_CODEC_UTF8,
+		UTF_CODEC_UTF16_LE,
+		UTF_CODEC_UTF16_BE,
+		UTF_CODEC_UTF32_LE,
+		UTF_CODEC_UTF32_BE
+	};
+
+	static unsigned char utf8[4096];
+	static unsigned char src[16384];
+	static unsigned char expected[16384];
+
+	size_t utf8_size = 0;
+	size_t src_size = 0;
+	size_t dst_size = 0;
+	size_t i = 0;
+	size_t j = 0;
+
+	utf8_size = make_text(utf8, sizeof(utf8));
+
+	for (i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++){
+		src_size = convert_all(UTF_CODEC_UTF8, utf8, utf8_size, codecs[i], src, sizeof(src));
+		for (j = 0; j < sizeof(codecs) / sizeof(codecs[0]); j++){
+			assert(utf_converter_measure(codecs[i], src, src_size, codecs[j], &dst_size) == UTF_ERROR_NONE);
+			assert(dst_size == convert_all(codecs[i], src, src_size, codecs[j], expected, sizeof(expected)));
+		}
+	}
+
+	/* invalid UTF-8 is measured up to the invalid sequence */
+	assert(utf_converter_measure(UTF_CODEC_UTF8, "a\xe2\x82\xac\xc0\x80", 6, UTF_CODEC_UTF16_LE, &dst_size) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(dst_size == 4);
+
+	/* a sequence that is cut off */
+	assert(utf_converter_measure(UTF_CODEC_UTF8, "a\xf0\x9f\x98", 4, UTF_CODEC_UTF32_LE, &dst_size) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(dst_size == 4);
+
+	/* an unpaired surrogate */
+	assert(utf_converter_measure(UTF_CODEC_UTF16_LE, "a\x00\x00\xdc", 4, UTF_CODEC_UTF8, &dst_size) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(dst_size == 1);
+
+	/* a pair in UTF-16BE */
+	assert(utf_converter_measure(UTF_CODEC_UTF16_BE, "\xd8\x3d\xde\x00", 4, UTF_CODEC_UTF8, &dst_size) == UTF_ERROR_NONE);
+	assert(dst_size == 4);
+
+	/* past the last character in UTF-32 */
+	assert(utf_converter_measure(UTF_CODEC_UTF32_BE, "\x00\x11\x00\x00", 4, UTF_CODEC_UTF16_LE, &dst_size) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(utf_converter_measure(UTF_CODEC_UTF32_BE, "\x00\x11\x00\x00", 4, UTF_CODEC_UTF32_LE, &dst_size) == UTF_ERROR_NONE);
+	assert(dst_size == 4);
+}
+
+/** Makes some UTF-8 text, with sequences of every length. */
+
+static size_t make_text(unsigned char * utf8, size_t utf8_max){
+
+	static const char * const words[] = {
+		"a", "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "xy"
+	};
+
+	size_t utf8_size = 0;
+	size_t i = 0;
+	const char * word = NULL;
+
+	while ((utf8_size + 4) < utf8_max){
+		word = words[(i * 7) % 5];
+		memcpy(&utf8[utf8_size], word, strlen(word));
+		utf8_size += strlen(word);
+		i++;
+	}
+
+	return utf8_size;
+}
+
+static size_t convert_all(utf_codec_t src_codec, const void * src, size_t src_size, utf_codec_t dst_codec, unsigned char * dst, size_t dst_max){
+
+	utf_converter_t converter;
+	void * out = dst;
+	size_t dst_left = dst_max;
+
+	utf_converter_init(&converter);
+	utf_converter_set_decoder_codec(&converter, src_codec);
+	utf_converter_set_encoder_codec(&converter, dst_codec);
+
+	assert(utf_converter_convert(&converter, &src, &src_size, &out, &dst_left) == UTF_ERROR_NONE);
+	assert(src_size == 0);
+	assert(utf_converter_flush(&converter, &out, &dst_left) == UTF_ERROR_NONE);
+
+	utf_converter_free(&converter);
+
+	return dst_max - dst_left;
+}
+
+static void test_swap(void){
+
+	/* "a€𐐷" */
+	const unsigned char utf16be[] = { 0x00, 0x61, 0x20, 0xac, 0xd8, 0x01, 0xdc, 0x37 };
+	const unsigned char utf16le[] = { 0x61, 0x00, 0xac, 0x20, 0x01, 0xd8, 0x37, 0xdc };
+
+	unsigned char buf[16];
+	unsigned char output[16];
+	size_t swap_size = 0;
+
+	const void * src = NULL;
+	size_t src_left = 0;
+	void * dst = NULL;
+	size_t dst_left = 0;
+
+	utf_converter_t converter;
+
+	/* in place, both ways */
+	memcpy(buf, utf16be, sizeof(utf16be));
+	assert(utf_converter_swap(UTF_CODEC_UTF16_BE, buf, sizeof(utf16be), &swap_size) == UTF_ERROR_NONE);
+	assert(swap_size == sizeof(utf16be));
+	assert(memcmp(buf, utf16le, sizeof(utf16le)) == 0);
+	assert(utf_converter_swap(UTF_CODEC_UTF16_LE, buf, sizeof(utf16le), &swap_size) == UTF_ERROR_NONE);
+	assert(memcmp(buf, utf16be, sizeof(utf16be)) == 0);
+
+	/* stops at the pair that's cut short */
+	assert(utf_converter_swap(UTF_CODEC_UTF16_BE, buf, 6, &swap_size) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(swap_size == 4);
+	assert(memcmp(buf, utf16le, 4) == 0);
+	assert(memcmp(&buf[4], &utf16be[4], 4) == 0);
+
+	/* UTF-32 isn't checked, but has to be whole characters */
+	assert(utf_converter_swap(UTF_CODEC_UTF32_LE, buf, 7, &swap_size) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(swap_size == 4);
+	assert(buf[0] == 0x20);
+	assert(buf[3] == 0x61);
+
+	assert(utf_converter_swap(UTF_CODEC_UTF8, buf, 8, &swap_size) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(swap_size == 0);
+
+	utf_converter_init(&converter);
+
+	utf_converter_set_decoder_codec(&converter, UTF_CODEC_UTF16_BE);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF16_LE);
+
+	/* the pair is split between writes */
+	assert(utf_converter_write(&converter, utf16be, 5) == 5);
+	assert(utf_converter_write(&converter, &utf16be[5], 3) == 3);
+	assert(utf_converter_read(&converter, output, sizeof(output)) == 8);
+	assert(memcmp(output, utf16le, 8) == 0);
+
+	/* a low surrogate on its own */
+	assert(utf_converter_write(&converter, &utf16be[6], 2) == 0);
+
+	utf_converter_set_decoder_codec(&converter, UTF_CODEC_UTF32_LE);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF32_BE);
+
+	src = "a\x00\x00\x00\xac\x20\x00\x00";
+	src_left = 8;
+	dst = output;
+	dst_left = 6;
+
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_OVERFLOW);
+	assert(src_left == 4);
+	assert(dst_left == 2);
+	assert(memcmp(output, "\x00\x00\x00" "a", 4) == 0);
+
+	utf_converter_free(&converter);
+}
+
+/* long enough for the transcoders to see the invalid sequences */
+static const char lossy_input[] =
+	"0123456789abcdef0123456789abcdef"
+	"\x61\xf1\x80\x80\xe1\x80\xc2\x62\x80\x63\x80\xbf\x64"
+	"\xc3\xa9\xe2\x82\xac\xed\xa0\x80\xc3\xa9"
+	"0123456789abcdef0123456789abcdef";
+
+static void test_lossy(void){
+
+	unsigned long int expected[32 + 16 + 32];
+	size_t expected_count = 0;
+	size_t i = 0;
+
+	const unsigned long int middle[] = {
+		0x61, 0xfffd, 0xfffd, 0xfffd, 0x62, 0xfffd, 0x63, 0xfffd, 0xfffd, 0x64,
+		0xe9, 0x20ac, 0xfffd, 0xfffd, 0xfffd, 0xe9 };
+
+	for (i = 0; i < 32; i++){
+		expected[expected_count++] = (unsigned char) lossy_input[i];
+	}
+	for (i = 0; i < (sizeof(middle) / sizeof(middle[0])); i++){
+		expected[expected_count++] = middle[i];
+	}
+	for (i = 0; i < 32; i++){
+		expected[expected_count++] = (unsigned char) lossy_input[i];
+	}
+
+	check_lossy(UTF_CODEC_UTF16_LE, UTF_DECODER_REPLACE, expected, expected_count);
+	check_lossy(UTF_CODEC_UTF32_BE, UTF_DECODER_REPLACE, expected, expected_count);
+	check_lossy(UTF_CODEC_UTF16_LE, UTF_DECODER_SKIP, expected, expected_count);
+	check_lossy(UTF_CODEC_UTF32_BE, UTF_DECODER_SKIP, expected, expected_count);
+}
+
+/** Converts the lossy input with utf_converter_write and
+ * utf_converter_convert, all at once and then a byte at a time.
+ * The expected characters are all in the BMP. */
+
+static void check_lossy(utf_codec_t dst_codec, utf_decoder_policy_t policy, const unsigned long int * expected, size_t expected_count){
+
+	unsigned char wanted[128 * 4];
+	unsigned char output[128 * 4];
+	size_t wanted_size = 0;
+	size_t output_size = 0;
+	size_t input_size = sizeof(lossy_input) - 1;
+	size_t invalid_count = 0;
+	size_t i = 0;
+	unsigned int pass = 0;
+
+	const void * src = NULL;
+	size_t src_left = 0;
+	void * dst = NULL;
+	size_t dst_left = 0;
+
+	utf_converter_t converter;
+
+	for (i = 0; i < expected_count; i++){
+		if (expected[i] == 0xfffd){
+			invalid_count++;
+			if (policy == UTF_DECODER_SKIP){
+				continue;
+			}
+		}
+		if (dst_codec == UTF_CODEC_UTF16_LE){
+			wanted[wanted_size++] = expected[i] & 0xff;
+			wanted[wanted_size++] = (expected[i] >> 8) & 0xff;
+		} else {
+			wanted[wanted_size++] = 0;
+			wanted[wanted_size++] = 0;
+			wanted[wanted_size++] = (expected[i] >> 8) & 0xff;
+			wanted[wanted_size++] = expected[i] & 0xff;
+		}
+	}
+
+	for (pass = 0; pass < 4; pass++){
+
+		utf_converter_init(&converter);
+		utf_converter_set_decoder_codec(&converter, UTF_CODEC_UTF8);
+		utf_converter_set_encoder_codec(&converter, dst_codec);
+		utf_decoder_set_policy(utf_converter_get_decoder(&converter), policy);
+
+		output_size = 0;
+
+		if (pass == 0){
+			assert(utf_converter_write(&converter, lossy_input, input_size) == input_size);
+			output_size = utf_converter_read(&converter, output, sizeof(output));
+		} else if (pass == 1){
+			for (i = 0; i < input_size; i++){
+				assert(utf_converter_write(&converter, &lossy_input[i], 1) == 1);
+				output_size += utf_converter_read(&converter, &output[output_size], sizeof(output) - output_size);
+			}
+		} else if (pass == 2){
+			src = lossy_input;
+			src_left = input_size;
+			dst = output;
+			dst_left = sizeof(output);
+			assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+			assert(src_left == 0);
+			output_size = sizeof(output) - dst_left;
+		} else {
+			for (i = 0; i < input_size; i++){
+				src = &lossy_input[i];
+				src_left = 1;
+				dst = &output[output_size];
+				dst_left = sizeof(output) - output_size;
+				assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+				assert(src_left == 0);
+				output_size = sizeof(output) - dst_left;
+			}
+		}
+
+		assert(output_size == wanted_size);
+		assert(memcmp(output, wanted, wanted_size) == 0);
+		assert(utf_decoder_get_invalid_count(utf_converter_get_decoder_const(&converter)) == invalid_count);
+
+		utf_converter_free(&converter);
+	}
+}
+
+static void test_detect(void){
+
+	/* "a€" */
+	const char utf16be_bom[] = "\xfe\xff" "\x00" "a\x20\xac";
+	const char utf8[] = "a\xe2\x82\xac";
+
+	unsigned char output[16];
+	size_t output_size = 0;
+	size_t i = 0;
+
+	const void * src = NULL;
+	size_t src_left = 0;
+	void * dst = NULL;
+	size_t dst_left = 0;
+
+	utf_converter_t converter;
+
+	utf_converter_init(&converter);
+	utf_converter_set_decoder_codec(&converter, UTF_CODEC_AUTO);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF8);
+
+	assert(utf_converter_write(&converter, utf16be_bom, sizeof(utf16be_bom) - 1) == (sizeof(utf16be_bom) - 1));
+	assert(utf_converter_get_decoder_codec(&converter) == UTF_CODEC_UTF16_BE);
+	assert(utf_converter_read(&converter, output, sizeof(output)) == (sizeof(utf8) - 1));
+	assert(memcmp(output, utf8, sizeof(utf8) - 1) == 0);
+
+	utf_converter_free(&converter);
+
+	/* a byte at a time, so that the mark is split between calls */
+	utf_converter_init(&converter);
+	utf_converter_set_decoder_codec(&converter, UTF_CODEC_AUTO);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF8);
+
+	for (i = 0; i < (sizeof(utf16be_bom) - 1); i++){
+		src = &utf16be_bom[i];
+		src_left = 1;
+		dst = &output[output_size];
+		dst_left = sizeof(output) - output_size;
+		assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+		assert(src_left == 0);
+		output_size = sizeof(output) - dst_left;
+	}
+
+	assert(utf_converter_get_decoder_codec(&converter) == UTF_CODEC_UTF16_BE);
+	assert(output_size == (sizeof(utf8) - 1));
+	assert(memcmp(output, utf8, sizeof(utf8) - 1) == 0);
+
+	utf_converter_free(&converter);
+
+	/* without a mark, the bytes that were kept to look for one are converted */
+	utf_converter_init(&converter);
+	utf_converter_set_decoder_codec(&converter, UTF_CODEC_AUTO);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF8);
+
+	src = &utf16be_bom[2];
+	src_left = 1;
+	dst = output;
+	dst_left = sizeof(output);
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(dst_left == sizeof(output));
+	src_left = 3;
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(src_left == 0);
+	assert(utf_converter_get_decoder_codec(&converter) == UTF_CODEC_UTF16_BE);
+	assert((sizeof(output) - dst_left) == (sizeof(utf8) - 1));
+	assert(memcmp(output, utf8, sizeof(utf8) - 1) == 0);
+
+	utf_converter_free(&converter);
+
+	/* nor is the codec guessed from the first byte, when it's UTF-32 */
+	utf_converter_init(&converter);
+	utf_converter_set_decoder_codec(&converter, UTF_CODEC_AUTO);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF8);
+
+	output_size = 0;
+	for (i = 0; i < 8; i++){
+		src = &"a\x00\x00\x00" "\xac\x20\x00\x00"[i];
+		src_left = 1;
+		dst = &output[output_size];
+		dst_left = sizeof(output) - output_size;
+		assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+		assert(src_left == 0);
+		output_size = sizeof(output) - dst_left;
+	}
+
+	assert(utf_converter_get_decoder_codec(&converter) == UTF_CODEC_UTF32_LE);
+	assert(output_size == (sizeof(utf8) - 1));
+	assert(memcmp(output, utf8, sizeof(utf8) - 1) == 0);
+
+	utf_converter_free(&converter);
+}
+
+static void test_codepage(void){
+
+	unsigned char input[256];
+	unsigned char utf8[256 * 3];
+	unsigned char output[256];
+	size_t input_size = 0;
+	size_t utf8_size = 0;
+	size_t output_size = 0;
+	size_t measure_size = 0;
+	size_t i = 0;
+	int codec = 0;
+	unsigned char c = 0;
+
+	utf_converter_t converter;
+
+	/* every byte that the codepage uses goes
+	 * through UTF-8 and back to the same byte */
+
+	for (codec = UTF_CODEC_CODEPAGE_FIRST; codec <= UTF_CODEC_CODEPAGE_LAST; codec++){
+
+		input_size = 0;
+		for (i = 0; i < 256; i++){
+			c = (unsigned char)(i);
+			utf_converter_init(&converter);
+			utf_converter_set_decoder_codec(&converter, (utf_codec_t) codec);
+			if (utf_converter_write(&converter, &c, 1) == 1){
+				input[input_size++] = c;
+			}
+			utf_converter_free(&converter);
+		}
+
+		assert(input_size >= 128);
+
+		utf8_size = convert_all((utf_codec_t) codec, input, input_size, UTF_CODEC_UTF8, utf8, sizeof(utf8));
+		assert(utf_converter_measure((utf_codec_t) codec, input, input_size, UTF_CODEC_UTF8, &measure_size) == UTF_ERROR_NONE);
+		assert(measure_size == utf8_size);
+		assert(utf_converter_measure(UTF_CODEC_UTF8, utf8, utf8_size, (utf_codec_t) codec, &measure_size) == UTF_ERROR_NONE);
+		assert(measure_size == input_size);
+
+		output_size = convert_all(UTF_CODEC_UTF8, utf8, utf8_size, (utf_codec_t) codec, output, sizeof(output));
+		assert(output_size == input_size);
+		assert(memcmp(output, input, input_size) == 0);
+
+		utf_converter_init(&converter);
+		utf_converter_set_decoder_codec(&converter, UTF_CODEC_UTF8);
+		utf_converter_set_encoder_codec(&converter, (utf_codec_t) codec);
+		assert(utf_converter_write(&converter, utf8, utf8_size) == utf8_size);
+		assert(utf_converter_read(&converter, output, sizeof(output)) == input_size);
+		assert(memcmp(output, input, input_size) == 0);
+		utf_converter_free(&converter);
+	}
+
+	/* a character that isn't in the codepage stops
+	 * the conversion, once it's been decoded */
+
+	utf_converter_init(&converter);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_WINDOWS_1251);
+	assert(utf_converter_write(&converter, "ab\xc3\xa9" "c", 5) == 4);
+	assert(utf_converter_read(&converter, output, sizeof(output)) == 2);
+	utf_converter_free(&converter);
+}
+
+static void test_latin1(void){
+
+	unsigned char input[256];
+	unsigned char utf16[512];
+	unsigned char output[512];
+	size_t utf16_size = 0;
+	size_t output_size = 0;
+	size_t i = 0;
+	const void * src = NULL;
+	void * dst = NULL;
+	size_t src_left = 0;
+	size_t dst_left = 0;
+
+	utf_converter_t converter;
+
+	for (i = 0; i < 256; i++){
+		input[i] = (unsigned char)(i);
+	}
+
+	/* every character widens to one code unit, and back */
+
+	utf16_size = convert_all(UTF_CODEC_LATIN1, input, 256, UTF_CODEC_UTF16_BE, utf16, sizeof(utf16));
+	assert(utf16_size == 512);
+	for (i = 0; i < 256; i++){
+		assert(utf16[(i * 2) + 0] == 0);
+		assert(utf16[(i * 2) + 1] == i);
+	}
+
+	output_size = convert_all(UTF_CODEC_UTF16_BE, utf16, utf16_size, UTF_CODEC_LATIN1, output, sizeof(output));
+	assert(output_size == 256);
+	assert(memcmp(output, input, 256) == 0);
+
+	utf_converter_init(&converter);
+	utf_converter_set_decoder_codec(&converter, UTF_CODEC_UTF16_BE);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_LATIN1);
+	assert(utf_converter_write(&converter, utf16, utf16_size) == utf16_size);
+	assert(utf_converter_read(&converter, output, sizeof(output)) == 256);
+	assert(memcmp(output, input, 256) == 0);
+	utf_converter_free(&converter);
+
+	/* narrowing stops at "€", unless the encoder replaces it */
+
+	utf16[4] = 0x20;
+	utf16[5] = 0xac;
+
+	utf_converter_init(&converter);
+	utf_converter_set_decoder_codec(&converter, UTF_CODEC_UTF16_BE);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_LATIN1);
+
+	src = utf16;
+	src_left = 8;
+	dst = output;
+	dst_left = sizeof(output);
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(src_left == 4);
+	assert(dst_left == (sizeof(output) - 2));
+
+	utf_encoder_set_policy(utf_converter_get_encoder(&converter), UTF_ENCODER_REPLACE);
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(src_left == 0);
+	assert(dst_left == (sizeof(output) - 4));
+	assert(memcmp(output, "\x00\x01?\x03", 4) == 0);
+	assert(utf_encoder_get_invalid_count(utf_converter_get_encoder(&converter)) == 1);
+
+	assert(utf_converter_write(&converter, utf16, 8) == 8);
+	assert(utf_converter_read(&converter, output, sizeof(output)) == 4);
+	assert(memcmp(output, "\x00\x01?\x03", 4) == 0);
+	assert(utf_encoder_get_invalid_count(utf_converter_get_encoder(&converter)) == 2);
+
+	utf_converter_free(&converter);
+}
+
+static void test_wtf8(void){
+
+	static unsigned char utf16le[8192];
+	static unsigned char utf16be[8192];
+	static unsigned char wtf8[8192];
+	static unsigned char cesu8[8192];
+
+	/* ASCII, "é", "€", "𐐷", and both surrogates on their own */
+	static const utf32_t units[] = { 'a', 0xe9, 0x20ac, 0xd801, 0xdc37, 0xd800, 0xdc00 };
+
+	size_t utf16_size = 0;
+	size_t wtf8_size = 0;
+	size_t cesu8_size = 0;
+	size_t i = 0;
+	size_t k = 0;
+	unsigned int seed = 1;
+	utf32_t unit = 0;
+	const void * src = NULL;
+	size_t src_left = 0;
+	void * dst = NULL;
+	size_t dst_size = 0;
+	size_t dst_left = 0;
+
+	utf_converter_t converter;
+
+	/* runs of ASCII, so that the kernels get to work between the surrogates */
+
+	while (utf16_size < (sizeof(utf16le) - 64)){
+		seed = (seed * 1103515245) + 12345;
+		k = (seed >> 16) % 16;
+		if (k >= 7){
+			k = 0;
+		}
+		for (i = 0; i < 2; i++){
+			unit = units[k + i];
+			utf16le[utf16_size + 0] = (unsigned char)(unit & 0xff);
+			utf16le[utf16_size + 1] = (unsigned char)(unit >> 8);
+			utf16be[utf16_size + 0] = (unsigned char)(unit >> 8);
+			utf16be[utf16_size + 1] = (unsigned char)(unit & 0xff);
+			utf16_size += 2;
+			cesu8_size += utf8_encode(unit, (char *)(&cesu8[cesu8_size]));
+			if (k != 3){
+				/* everything but the pair is one code unit */
+				break;
+			}
+		}
+		if (k == 3){
+			wtf8_size += utf8_encode(0x10437, (char *)(&wtf8[wtf8_size]));
+		} else {
+			wtf8_size += utf8_encode(units[k], (char *)(&wtf8[wtf8_size]));
+		}
+		if (k == 5){
+			/* so that the high surrogate isn't followed by a low one */
+			utf16le[utf16_size + 0] = 'x';
+			utf16le[utf16_size + 1] = 0;
+			utf16be[utf16_size + 0] = 0;
+			utf16be[utf16_size + 1] = 'x';
+			utf16_size += 2;
+			wtf8[wtf8_size++] = 'x';
+			cesu8[cesu8_size++] = 'x';
+		}
+	}
+
+	check_wtf8(UTF_CODEC_WTF8, utf16le, utf16_size, wtf8, wtf8_size);
+	check_wtf8(UTF_CODEC_CESU8, utf16le, utf16_size, cesu8, cesu8_size);
+
+	/* the same for big endian, which the helper takes from little endian */
+	assert(convert_all(UTF_CODEC_UTF16_BE, utf16be, utf16_size, UTF_CODEC_WTF8, utf16le, sizeof(utf16le)) == wtf8_size);
+	assert(memcmp(utf16le, wtf8, wtf8_size) == 0);
+	assert(convert_all(UTF_CODEC_CESU8, cesu8, cesu8_size, UTF_CODEC_UTF16_BE, utf16le, sizeof(utf16le)) == utf16_size);
+	assert(memcmp(utf16le, utf16be, utf16_size) == 0);
+
+	/* UTF-8 is WTF-8 as it is */
+	assert(convert_all(UTF_CODEC_UTF8, "a\xf0\x90\x90\xb7", 5, UTF_CODEC_WTF8, utf16le, sizeof(utf16le)) == 5);
+	assert(memcmp(utf16le, "a\xf0\x90\x90\xb7", 5) == 0);
+
+	/* CESU-8 pairs are put back together for the other codecs */
+	assert(convert_all(UTF_CODEC_CESU8, "\xed\xa0\x81\xed\xb0\xb7", 6, UTF_CODEC_UTF8, utf16le, sizeof(utf16le)) == 4);
+	assert(memcmp(utf16le, "\xf0\x90\x90\xb7", 4) == 0);
+	assert(convert_all(UTF_CODEC_UTF8, "\xf0\x90\x90\xb7", 4, UTF_CODEC_CESU8, utf16le, sizeof(utf16le)) == 6);
+	assert(memcmp(utf16le, "\xed\xa0\x81\xed\xb0\xb7", 6) == 0);
+
+	/* two high surrogates on their own, which come out the
+	 * same however the input is split between writes */
+	check_wtf8(UTF_CODEC_WTF8, (const unsigned char *)("\x9d\xda\x3c\xdb\x05\x49\x45\x06"), 8,
+	           (const unsigned char *)("\xed\xaa\x9d\xed\xac\xbc\xe4\xa4\x85\xd9\x85"), 11);
+
+	/* a high surrogate at the end waits for its pair, even for CESU-8,
+	 * and comes out on its own once the input ends */
+	utf_converter_init(&converter);
+	utf_converter_set_decoder_codec(&converter, UTF_CODEC_UTF16_LE);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_CESU8);
+	src = "\x00\xdc\x00\xd8";
+	src_left = 4;
+	dst = cesu8;
+	dst_left = sizeof(cesu8);
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(src_left == 0);
+	assert(dst_left == (sizeof(cesu8) - 3));
+	src = "\x00\xdc";
+	src_left = 2;
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(dst_left == (sizeof(cesu8) - 9));
+	assert(memcmp(cesu8, "\xed\xb0\x80\xed\xa0\x80\xed\xb0\x80", 9) == 0);
+	src = "\x00\xd8";
+	src_left = 2;
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(dst_left == (sizeof(cesu8) - 9));
+	assert(utf_converter_flush(&converter, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(dst_left == (sizeof(cesu8) - 12));
+	assert(memcmp(&cesu8[9], "\xed\xa0\x80", 3) == 0);
+	utf_converter_free(&converter);
+
+	check_end_surrogate(UTF_CODEC_WTF8);
+	check_end_surrogate(UTF_CODEC_CESU8);
+
+	check_utf32_pairs();
+
+	/* a WTF-8 pair is one sequence, it can't be written as two surrogates */
+	assert(utf_converter_measure(UTF_CODEC_WTF8, "\xed\xa0\x80\xed\xb0\x80", 6, UTF_CODEC_UTF16_LE, &dst_size) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(utf_converter_convert_parallel(UTF_CODEC_WTF8, "\xed\xa0\x80\xed\xb0\x80", 6, UTF_CODEC_UTF16_LE, &dst, &dst_size, 1) == UTF_ERROR_INVALID_SEQUENCE);
+	utf_converter_init(&converter);
+	utf_converter_set_decoder_codec(&converter, UTF_CODEC_WTF8);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF16_LE);
+	src = "a\xed\xa0\x80\xed\xb0\x80";
+	src_left = 7;
+	dst = utf16le;
+	dst_left = sizeof(utf16le);
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(src_left == 6);
+	assert(dst_left == (sizeof(utf16le) - 2));
+	utf_converter_free(&converter);
+
+	/* UTF-8 and UTF-32 don't have surrogates on their own */
+	check_surrogate(UTF_CODEC_WTF8, "a\xed\xa0\x80" "b", UTF_CODEC_UTF8, "a\xef\xbf\xbd" "b", 5);
+	check_surrogate(UTF_CODEC_CESU8, "a\xed\xb4\xa6" "b", UTF_CODEC_UTF8, "a\xef\xbf\xbd" "b", 5);
+	check_surrogate(UTF_CODEC_WTF8, "a\xed\xb0\x80" "b", UTF_CODEC_UTF32_LE, "a\x00\x00\x00\xfd\xff\x00\x00" "b\x00\x00\x00", 12);
+}
+
+/** Converts "a", a surrogate on its own and "b", which
+ * stops at the surrogate unless the encoder replaces it. */
+
+static void check_end_surrogate(utf_codec_t codec){
+
+	/* "A" and a high surrogate that ends the input */
+	const char utf16[] = "A\x00\x00\xd8";
+	const char expected[] = "A\xed\xa0\x80";
+
+	unsigned char output[16];
+	size_t output_size = 0;
+	const void * src = NULL;
+	size_t src_left = 0;
+	void * dst = NULL;
+	size_t dst_left = 0;
+
+	utf_converter_t converter;
+
+	assert(utf_converter_measure(UTF_CODEC_UTF16_LE, utf16, 4, codec, &output_size) == UTF_ERROR_NONE);
+	assert(output_size == 4);
+
+	assert(utf_converter_convert_parallel(UTF_CODEC_UTF16_LE, utf16, 4, codec, &dst, &output_size, 1) == UTF_ERROR_NONE);
+	assert(output_size == 4);
+	assert(memcmp(dst, expected, 4) == 0);
+	free(dst);
+
+	/* the converter holds it back until it's flushed */
+	utf_converter_init(&converter);
+	utf_converter_set_decoder_codec(&converter, UTF_CODEC_UTF16_LE);
+	utf_converter_set_encoder_codec(&converter, codec);
+	src = utf16;
+	src_left = 4;
+	dst = output;
+	dst_left = sizeof(output);
+	assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(src_left == 0);
+	assert(dst_left == (sizeof(output) - 1));
+	assert(utf_converter_flush(&converter, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(dst_left == (sizeof(output) - 4));
+	assert(memcmp(output, expected, 4) == 0);
+	utf_converter_free(&converter);
+
+	utf_converter_init(&converter);
+	utf_converter_set_decoder_codec(&converter, UTF_CODEC_UTF16_LE);
+	utf_converter_set_encoder_codec(&converter, codec);
+	assert(utf_converter_write(&converter, utf16, 4) == 4);
+	assert(utf_converter_flush(&converter, NULL, NULL) == UTF_ERROR_NONE);
+	assert(utf_converter_read(&converter, output, sizeof(output)) == 4);
+	assert(memcmp(output, expected, 4) == 0);
+	utf_converter_free(&converter);
+
+	/* and back */
+	assert(convert_all(codec, expected, 4, UTF_CODEC_UTF16_LE, output, sizeof(output)) == 4);
+	assert(memcmp(output, utf16, 4) == 0);
+}
+
+/** Converts UTF-32 with surrogates in it to WTF-8 and back. A pair of them
+ * is the character it makes, however the input is split, and the rest
+ * are kept as they are. */
+
+static void check_utf32_pairs(void){
+
+	/* "a", a pair, "b", a low surrogate and a high one on their own, and a pair */
+	static const utf32_t chars[] = { 'a', 0xd800, 0xdc00, 'b', 0xdc00, 0xdbff, 'c', 0xd801, 0xdc37 };
+	const char expected[] = "a\xf0\x90\x80\x80" "b\xed\xb0\x80\xed\xaf\xbf" "c\xf0\x90\x90\xb7";
+
+	static unsigned char utf32[9 * 4];
+	static unsigned char big[0x10000 * 4];
+	unsigned char output[64];
+	size_t output_size = 0;
+	size_t i = 0;
+	const void * src = NULL;
+	size_t src_left = 0;
+	void * dst = NULL;
+	size_t dst_left = 0;
+
+	utf_converter_t converter;
+
+	for (i = 0; i < 9; i++){
+		utf32[(i * 4) + 0] = (unsigned char)(chars[i] & 0xff);
+		utf32[(i * 4) + 1] = (unsigned char)(chars[i] >> 8);
+		utf32[(i * 4) + 2] = 0;
+		utf32[(i * 4) + 3] = 0;
+	}
+
+	assert(utf_converter_measure(UTF_CODEC_UTF32_LE, utf32, sizeof(utf32), UTF_CODEC_WTF8, &output_size) == UTF_ERROR_NONE);
+	assert(output_size == 17);
+
+	assert(convert_all(UTF_CODEC_UTF32_LE, utf32, sizeof(utf32), UTF_CODEC_WTF8, output, sizeof(output)) == 17);
+	assert(memcmp(output, expected, 17) == 0);
+
+	/* a code unit at a time, so that the pairs are split between calls */
+	utf_converter_init(&converter);
+	utf_converter_set_decoder_codec(&converter, UTF_CODEC_UTF32_LE);
+	utf_converter_set_encoder_codec(&converter, UTF_CODEC_WTF8);
+	dst = output;
+	dst_left = sizeof(output);
+	for (i = 0; i < 9; i++){
+		src = &utf32[i * 4];
+		src_left = 4;
+		assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+		assert(src_left == 0);
+	}
+	assert(utf_converter_flush(&converter, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(dst_left == (sizeof(output) - 17));
+	assert(memcmp(output, expected, 17) == 0);
+
+	for (i = 0; i < 9; i++){
+		assert(utf_converter_write(&converter, &utf32[i * 4], 4) == 4);
+	}
+	assert(utf_converter_read(&converter, output, sizeof(output)) == 17);
+	assert(memcmp(output, expected, 17) == 0);
+	utf_converter_free(&converter);
+
+	/* a high surrogate at the end waits for its pair, then comes out on its own */
+	assert(convert_all(UTF_CODEC_UTF32_LE, &utf32[5 * 4], 4, UTF_CODEC_WTF8, output, sizeof(output)) == 3);
+	assert(memcmp(output, "\xed\xaf\xbf", 3) == 0);
+
+	/* and back, where the pairs stay put together */
+	assert(convert_all(UTF_CODEC_WTF8, expected, 6, UTF_CODEC_UTF32_LE, utf32, sizeof(utf32)) == 12);
+	assert(memcmp(utf32, "a\x00\x00\x00\x00\x00\x01\x00" "b\x00\x00\x00", 12) == 0);
+	assert(convert_all(UTF_CODEC_UTF32_LE, utf32, 12, UTF_CODEC_WTF8, output, sizeof(output)) == 6);
+	assert(memcmp(output, expected, 6) == 0);
+
+	/* a pair that's split between the chunks of a parallel conversion */
+	for (i = 0; i < 0x10000; i++){
+		big[(i * 4) + 0] = (i == 0x7fff) ? 0x00 : ((i == 0x8000) ? 0x00 : 'a');
+		big[(i * 4) + 1] = (i == 0x7fff) ? 0xd8 : ((i == 0x8000) ? 0xdc : 0x00);
+		big[(i * 4) + 2] = 0;
+		big[(i * 4) + 3] = 0;
+	}
+	assert(utf_converter_convert_parallel(UTF_CODEC_UTF32_LE, big, sizeof(big), UTF_CODEC_WTF8, &dst, &output_size, 2) == UTF_ERROR_NONE);
+	assert(output_size == (0x10000 - 2 + 4));
+	assert(memcmp((unsigned char *)(dst) + 0x7fff, "\xf0\x90\x80\x80" "a", 5) == 0);
+	free(dst);
+}
+
+static void check_surrogate(utf_codec_t src_codec, const char * src, utf_codec_t dst_codec, const char * expected, size_t expected_size){
+
+	unsigned char output[16];
+	size_t output_size = 0;
+	const void * src_ptr = NULL;
+	size_t src_left = 0;
+	void * dst = NULL;
+	size_t dst_left = 0;
+
+	utf_converter_t converter;
+
+	assert(utf_converter_measure(src_codec, src, 5, dst_codec, &output_size) == UTF_ERROR_INVALID_SEQUENCE);
+
+	utf_converter_init(&converter);
+	utf_converter_set_decoder_codec(&converter, src_codec);
+	utf_converter_set_encoder_codec(&converter, dst_codec);
+
+	src_ptr = src;
+	src_left = 5;
+	dst = output;
+	dst_left = sizeof(output);
+	assert(utf_converter_convert(&converter, &src_ptr, &src_left, &dst, &dst_left) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(src_left == 4);
+	assert((sizeof(output) - dst_left) == ((dst_codec == UTF_CODEC_UTF8) ? 1 : 4));
+
+	utf_encoder_set_policy(utf_converter_get_encoder(&converter), UTF_ENCODER_REPLACE);
+	assert(utf_converter_convert(&converter, &src_ptr, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+	assert(src_left == 0);
+	assert((sizeof(output) - dst_left) == expected_size);
+	assert(memcmp(output, expected, expected_size) == 0);
+	assert(utf_encoder_get_invalid_count(utf_converter_get_encoder(&converter)) == 1);
+
+	assert(utf_converter_write(&converter, src, 5) == 5);
+	assert(utf_converter_read(&converter, output, sizeof(output)) == expected_size);
+	assert(memcmp(output, expected, expected_size) == 0);
+	assert(utf_encoder_get_invalid_count(utf_converter_get_encoder(&converter)) == 2);
+
+	utf_converter_free(&converter);
+}
+
+static void check_wtf8(utf_codec_t codec, const unsigned char * utf16, size_t utf16_size, const unsigned char * expected, size_t expected_size){
+
+	static unsigned char output[8192];
+
+	size_t output_size = 0;
+	size_t i = 0;
+	size_t step = 0;
+	size_t block_size = 0;
+	const void * src = NULL;
+	size_t src_left = 0;
+	void * dst = NULL;
+	size_t dst_size = 0;
+	size_t dst_left = 0;
+
+	utf_converter_t converter;
+
+	/* all at once, both ways */
+
+	assert(utf_converter_measure(UTF_CODEC_UTF16_LE, utf16, utf16_size, codec, &output_size) == UTF_ERROR_NONE);
+	assert(output_size == expected_size);
+	assert(convert_all(UTF_CODEC_UTF16_LE, utf16, utf16_size, codec, output, sizeof(output)) == expected_size);
+	assert(memcmp(output, expected, expected_size) == 0);
+
+	assert(utf_converter_measure(codec, expected, expected_size, UTF_CODEC_UTF16_LE, &output_size) == UTF_ERROR_NONE);
+	assert(output_size == utf16_size);
+	assert(convert_all(codec, expected, expected_size, UTF_CODEC_UTF16_LE, output, sizeof(output)) == utf16_size);
+	assert(memcmp(output, utf16, utf16_size) == 0);
+
+	assert(utf_converter_convert_parallel(UTF_CODEC_UTF16_LE, utf16, utf16_size, codec, &dst, &dst_size, 4) == UTF_ERROR_NONE);
+	assert(dst_size == expected_size);
+	assert(memcmp(dst, expected, expected_size) == 0);
+	free(dst);
+
+	assert(utf_converter_convert_parallel(codec, expected, expected_size, UTF_CODEC_UTF16_LE, &dst, &dst_size, 4) == UTF_ERROR_NONE);
+	assert(dst_size == utf16_size);
+	assert(memcmp(dst, utf16, utf16_size) == 0);
+	free(dst);
+
+	/* split between writes, so that every sequence is cut somewhere */
+
+	for (step = 1; step <= 7; step += 3){
+
+		utf_converter_init(&converter);
+		utf_converter_set_decoder_codec(&converter, UTF_CODEC_UTF16_LE);
+		utf_converter_set_encoder_codec(&converter, codec);
+		for (i = 0; i < utf16_size; i += block_size){
+			block_size = step;
+			if (block_size > (utf16_size - i)){
+				block_size = utf16_size - i;
+			}
+			assert(utf_converter_write(&converter, &utf16[i], block_size) == block_size);
+		}
+		assert(utf_converter_read(&converter, output, sizeof(output)) == expected_size);
+		assert(memcmp(output, expected, expected_size) == 0);
+		utf_converter_free(&converter);
+
+		utf_converter_init(&converter);
+		utf_converter_set_decoder_codec(&converter, codec);
+		utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF16_LE);
+		for (i = 0; i < expected_size; i += block_size){
+			block_size = step;
+			if (block_size > (expected_size - i)){
+				block_size = expected_size - i;
+			}
+			assert(utf_converter_write(&converter, &expected[i], block_size) == block_size);
+		}
+		assert(utf_converter_read(&converter, output, sizeof(output)) == utf16_size);
+		assert(memcmp(output, utf16, utf16_size) == 0);
+		utf_converter_free(&converter);
+
+		utf_converter_init(&converter);
+		utf_converter_set_decoder_codec(&converter, UTF_CODEC_UTF16_LE);
+		utf_converter_set_encoder_codec(&converter, codec);
+		dst = output;
+		dst_left = sizeof(output);
+		for (i = 0; i < utf16_size; i += block_size){
+			block_size = step;
+			if (block_size > (utf16_size - i)){
+				block_size = utf16_size - i;
+			}
+			src = &utf16[i];
+			src_left = block_size;
+			assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+			assert(src_left == 0);
+		}
+		assert((sizeof(output) - dst_left) == expected_size);
+		assert(memcmp(output, expected, expected_size) == 0);
+		utf_converter_free(&converter);
+
+		utf_converter_init(&converter);
+		utf_converter_set_decoder_codec(&converter, codec);
+		utf_converter_set_encoder_codec(&converter, UTF_CODEC_UTF16_LE);
+		dst = output;
+		dst_left = sizeof(output);
+		for (i = 0; i < expected_size; i += block_size){
+			block_size = step;
+			if (block_size > (expected_size - i)){
+				block_size = expected_size - i;
+			}
+			src = &expected[i];
+			src_left = block_size;
+			assert(utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left) == UTF_ERROR_NONE);
+			assert(src_left == 0);
+		}
+		assert((sizeof(output) - dst_left) == utf16_size);
+		assert(memcmp(output, utf16, utf16_size) == 0);
+		utf_converter_free(&converter);
+	}
+}
@@ -16,10 +16,91 @@
  */
 
 #include <libutf/converter.h>
+#include <libutf/utf8.h>
+#include <libutf/utf16.h>
+#include <libutf/utf32.h>
+
+#include "codepage.h"
+#include "kernel.h"
+#include "ring.h"
+#include "wtf8.h"
 
 #include <stdlib.h>
+#include <string.h>
+
+/** Transcodes the longest well-formed prefix of a block of input,
+ * directly from one codec to another.
+ * @param dst It must fit the number of bytes returned by @ref transcode_bound.
+ * @param dst_size Set to the number of bytes written to @p dst.
+ * @returns The number of bytes consumed from @p src.
+ */
+
+typedef size_t (*transcode_t)(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+/** The number of input bytes that are transcoded at a time,
+ * so that the space reserved in the encoder stays small. */
+
+#define TRANSCODE_BLOCK_SIZE 0x10000
+
+static utf_error_t utf_converter_transfer(utf_converter_t * converter, size_t * read_count, size_t * write_size);
+
+static void skip_decoded(utf_decoder_t * decoder, unsigned long int count);
+
+static transcode_t get_transcode(utf_codec_t decoder_codec, utf_codec_t encoder_codec);
+
+static size_t transcode_bound(utf_codec_t decoder_codec, utf_codec_t encoder_codec, size_t src_size);
+
+static int is_utf8_variant(utf_codec_t codec);
+
+static int keep_surrogates(utf_codec_t decoder_codec, utf_codec_t encoder_codec);
+
+static size_t copy_utf8(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+static size_t swap_utf16le(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+static size_t swap_utf16be(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+static size_t swap_utf32(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+static unsigned int write_direct(utf_converter_t * converter, transcode_t transcode, const unsigned char * src, size_t src_size);
+
+static size_t write_carry_direct(utf_converter_t * converter, transcode_t transcode, const unsigned char * src, size_t src_size);
+
+static unsigned int write_each(utf_converter_t * converter, const unsigned char * src, size_t src_size);
+
+static size_t convert_detect(utf_converter_t * converter, const unsigned char * src, size_t src_size);
+
+static utf_error_t convert_carry(utf_converter_t * converter, const unsigned char ** src, size_t * src_left, unsigned char ** dst, size_t * dst_left);
+
+static utf_error_t convert_carry_lossy(utf_converter_t * converter, const unsigned char ** src, size_t * src_left, unsigned char ** dst, size_t * dst_left);
+
+static size_t invalid_length(utf_codec_t codec, const unsigned char * src, size_t src_size, int keep);
+
+static size_t ascii_length(utf_codec_t codec, const unsigned char * src, size_t src_count);
+
+static size_t non_ascii_length(utf_codec_t codec, const unsigned char * src, size_t src_size);
+
+static int is_latin1_range(utf_codec_t codec);
+
+static size_t latin1_length(utf_codec_t codec, const unsigned char * src, size_t src_count);
+
+static size_t convert_ascii(utf_codec_t src_codec, const unsigned char * src, size_t src_size, utf_codec_t dst_codec, unsigned char * dst, size_t dst_size, size_t * write_size);
+
+static int convert_units(utf_codec_t src_codec, const unsigned char * src, size_t count, utf_codec_t dst_codec, unsigned char * dst);
+
+static int is_aligned32(const void * ptr);
+
+static size_t decode_one(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * c, int keep);
+
+static size_t decode_end(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * c, int keep);
 
-static unsigned int utf_converter_transfer(utf_converter_t * converter);
+static size_t encode_one(utf_codec_t codec, char32_t c, unsigned char * dst);
+
+static size_t encode_char(const utf_encoder_t * encoder, char32_t c, unsigned char * dst, int * replaced);
+
+static utf_error_t measure_each(utf_codec_t src_codec, const unsigned char * src, size_t src_size, utf_codec_t dst_codec, size_t * dst_size);
+
+static size_t encode_length(utf_codec_t codec, char32_t c);
 
 void utf_converter_init(utf_converter_t * converter){
 
@@ -40,6 +121,362 @@ void utf_converter_free(utf_converter_t * converter){
 	}
 }
 
+utf_error_t utf_converter_convert(utf_converter_t * converter, const void ** src, size_t * src_left, void ** dst, size_t * dst_left){
+
+	utf_error_t error = UTF_ERROR_NONE;
+	utf_decoder_t * decoder = NULL;
+	utf_encoder_t * encoder = NULL;
+	transcode_t transcode = NULL;
+	const unsigned char * in = (const unsigned char *)(*src);
+	unsigned char * out = (unsigned char *)(*dst);
+	size_t in_left = *src_left;
+	size_t out_left = *dst_left;
+	size_t block_size = 0;
+	size_t read_size = 0;
+	size_t write_size = 0;
+	size_t length = 0;
+	size_t invalid_size = 0;
+	unsigned char output[6];
+	char32_t c = 0;
+	int replaced = 0;
+	int keep = 0;
+
+	decoder = utf_converter_get_decoder(converter);
+	encoder = utf_converter_get_encoder(converter);
+
+	if (decoder->codec == UTF_CODEC_AUTO){
+		read_size = convert_detect(converter, in, in_left);
+		in += read_size;
+		in_left -= read_size;
+		if (decoder->codec == UTF_CODEC_AUTO){
+			*src = in;
+			*src_left = in_left;
+			return UTF_ERROR_NONE;
+		}
+	}
+
+	/* output left over from utf_converter_write goes first */
+
+	if (utf_decoder_avail(decoder) > 0){
+		error = utf_converter_transfer(converter, &read_size, &write_size);
+	}
+
+	write_size = utf_encoder_read(encoder, out, out_left);
+	out += write_size;
+	out_left -= write_size;
+
+	/* characters that couldn't be encoded stay in the decoder */
+
+	if (encoder->byte_count > 0){
+		error = UTF_ERROR_OVERFLOW;
+	} else if ((error == UTF_ERROR_NONE)
+	        && (decoder->input_byte_count > 0)
+	        && (decoder->policy == UTF_DECODER_STRICT)){
+		error = convert_carry(converter, &in, &in_left, &out, &out_left);
+	} else if ((error == UTF_ERROR_NONE)
+	        && (decoder->input_byte_count > 0)){
+		error = convert_carry_lossy(converter, &in, &in_left, &out, &out_left);
+	}
+
+	transcode = get_transcode(decoder->codec, encoder->codec);
+
+	keep = keep_surrogates(decoder->codec, encoder->codec);
+
+	while ((error == UTF_ERROR_NONE) && (in_left > 0)){
+
+		/* transcode as much as is sure to fit in the output */
+
+		if (transcode != NULL){
+			if (is_utf8_variant(decoder->codec)){
+				block_size = out_left / 2;
+			} else if (is_utf8_variant(encoder->codec)){
+				block_size = (out_left / 3) * 2;
+			} else {
+				block_size = out_left;
+			}
+			if (block_size > in_left){
+				block_size = in_left;
+			}
+			read_size = transcode(in, block_size, out, &write_size);
+			in += read_size;
+			in_left -= read_size;
+			out += write_size;
+			out_left -= write_size;
+			if (read_size > 0){
+				continue;
+			}
+		}
+
+		/* runs of ASCII are copied, widened or narrowed without decoding */
+
+		read_size = convert_ascii(decoder->codec, in, in_left, encoder->codec, out, out_left, &write_size);
+		if (read_size > 0){
+			in += read_size;
+			in_left -= read_size;
+			out += write_size;
+			out_left -= write_size;
+			continue;
+		}
+
+		/* one character at a time, for codecs that don't have a
+		 * transcoder, near the end of the output or to find out
+		 * why transcoding stopped */
+
+		length = decode_one(decoder->codec, in, in_left, &c, keep);
+
+		if (((length == 0) || (length > in_left))
+		 && (decoder->policy != UTF_DECODER_STRICT)){
+			invalid_size = invalid_length(decoder->codec, in, in_left, keep);
+		} else {
+			invalid_size = 0;
+		}
+
+		if ((invalid_size > 0) && (invalid_size <= in_left)){
+			/* the maximal subpart is replaced or skipped,
+			 * and transcoding picks up after it */
+			write_size = 0;
+			replaced = 0;
+			if (decoder->policy == UTF_DECODER_REPLACE){
+				write_size = encode_char(encoder, 0xfffd, output, &replaced);
+				if (write_size == 0){
+					error = UTF_ERROR_INVALID_SEQUENCE;
+					break;
+				} else if (write_size > out_left){
+					error = UTF_ERROR_OVERFLOW;
+					break;
+				}
+				memcpy(out, output, write_size);
+			}
+			out += write_size;
+			out_left -= write_size;
+			in += invalid_size;
+			in_left -= invalid_size;
+			decoder->invalid_count++;
+			encoder->invalid_count += replaced;
+			continue;
+		}
+
+		if (length == 0){
+			error = UTF_ERROR_INVALID_SEQUENCE;
+			break;
+		} else if (length > in_left){
+			/* keep the incomplete sequence for the next call */
+			memcpy(decoder->input_byte_array, in, in_left);
+			decoder->input_byte_count = in_left;
+			in += in_left;
+			in_left = 0;
+			break;
+		}
+
+		write_size = encode_char(encoder, c, output, &replaced);
+		if (write_size == 0){
+			error = UTF_ERROR_INVALID_SEQUENCE;
+			break;
+		} else if (write_size > out_left){
+			error = UTF_ERROR_OVERFLOW;
+			break;
+		}
+
+		memcpy(out, output, write_size);
+		out += write_size;
+		out_left -= write_size;
+		in += length;
+		in_left -= length;
+		encoder->invalid_count += replaced;
+	}
+
+	*src = in;
+	*src_left = in_left;
+	*dst = out;
+	*dst_left = out_left;
+
+	return error;
+}
+
+utf_error_t utf_converter_flush(utf_converter_t * converter, void ** dst, size_t * dst_left){
+
+	utf_error_t error = UTF_ERROR_NONE;
+	utf_decoder_t * decoder = NULL;
+	utf_encoder_t * encoder = NULL;
+	unsigned char head[4];
+	size_t head_size = 0;
+	size_t bom_size = 0;
+	size_t length = 0;
+	size_t read_count = 0;
+	size_t write_size = 0;
+	char32_t c = 0;
+	int keep = 0;
+
+	decoder = utf_converter_get_decoder(converter);
+	encoder = utf_converter_get_encoder(converter);
+
+	/* the input was too short to tell whether it
+	 * started with a byte order mark, so it doesn't */
+
+	if ((decoder->codec == UTF_CODEC_AUTO)
+	 && (decoder->input_byte_count > 0)){
+		head_size = decoder->input_byte_count;
+		memcpy(head, decoder->input_byte_array, head_size);
+		utf_decoder_set_codec(decoder, utf_codec_detect(head, head_size, &bom_size));
+		if (bom_size > head_size){
+			bom_size = 0;
+		}
+		decoder->input_byte_count = 0;
+		if (utf_converter_write(converter, &head[bom_size], head_size - bom_size) < (head_size - bom_size)){
+			error = UTF_ERROR_INVALID_SEQUENCE;
+		}
+	}
+
+	/* the characters that were decoded come before what's left of the input */
+
+	if ((error == UTF_ERROR_NONE) && (utf_decoder_avail(decoder) > 0)){
+		error = utf_converter_transfer(converter, &read_count, &write_size);
+	}
+
+	keep = keep_surrogates(decoder->codec, encoder->codec);
+
+	while ((error == UTF_ERROR_NONE) && (decoder->input_byte_count > 0)){
+
+		length = decode_end(decoder->codec, decoder->input_byte_array, decoder->input_byte_count, &c, keep);
+
+		if ((length > 0) && (length <= decoder->input_byte_count)){
+			error = utf_encoder_write(encoder, c);
+		} else if (decoder->policy == UTF_DECODER_STRICT){
+			error = UTF_ERROR_INVALID_SEQUENCE;
+		} else {
+			/* the sequence is cut short, so it's invalid up to the end */
+			length = invalid_length(decoder->codec, decoder->input_byte_array, decoder->input_byte_count, keep);
+			if ((length == 0) || (length > decoder->input_byte_count)){
+				length = decoder->input_byte_count;
+			}
+			if (decoder->policy == UTF_DECODER_REPLACE){
+				error = utf_encoder_write(encoder, 0xfffd);
+			}
+			if (error == UTF_ERROR_NONE){
+				decoder->invalid_count++;
+			}
+		}
+
+		if (error != UTF_ERROR_NONE){
+			break;
+		}
+
+		decoder->input_byte_count -= length;
+		memmove(decoder->input_byte_array,
+		        &decoder->input_byte_array[length],
+		        decoder->input_byte_count);
+	}
+
+	/* without an output buffer, it's read with utf_converter_read */
+
+	if (dst != NULL){
+		write_size = utf_encoder_read(encoder, *dst, *dst_left);
+		*dst = (unsigned char *)(*dst) + write_size;
+		*dst_left -= write_size;
+		if ((error == UTF_ERROR_NONE) && (encoder->byte_count > 0)){
+			error = UTF_ERROR_OVERFLOW;
+		}
+	}
+
+	return error;
+}
+
+utf_error_t utf_converter_measure(utf_codec_t src_codec, const void * src, size_t src_size, utf_codec_t dst_codec, size_t * dst_size){
+
+	const unsigned char * in = (const unsigned char *)(src);
+	size_t valid_size = 0;
+	size_t count = 0;
+	size_t long_count = 0;
+	size_t utf8_size = 0;
+
+	*dst_size = 0;
+
+	/* UTF-8 and UTF-16 are measured from their character counts,
+	 * everything else one character at a time */
+
+	switch (src_codec){
+		case UTF_CODEC_UTF8:
+			valid_size = utf_kernel_utf8_validate(in, src_size);
+			count = utf_kernel_utf8_count(in, valid_size, &long_count);
+			utf8_size = valid_size;
+			break;
+		case UTF_CODEC_UTF16_LE:
+		case UTF_CODEC_UTF16_BE:
+			if (src_codec == UTF_CODEC_UTF16_LE){
+				valid_size = utf_kernel_utf16le_measure(in, src_size, &utf8_size, &count);
+			} else {
+				valid_size = utf_kernel_utf16be_measure(in, src_size, &utf8_size, &count);
+			}
+			/* a pair is the only way for two code units to make one character */
+			long_count = (valid_size / 2) - count;
+			break;
+		default:
+			return measure_each(src_codec, in, src_size, dst_codec, dst_size);
+	}
+
+	switch (dst_codec){
+		case UTF_CODEC_UTF8:
+			*dst_size = utf8_size;
+			break;
+		case UTF_CODEC_WTF8:
+		case UTF_CODEC_CESU8:
+			if (valid_size < src_size){
+				/* UTF-16 may have surrogates on their own */
+				return measure_each(src_codec, in, src_size, dst_codec, dst_size);
+			}
+			/* CESU-8 takes six bytes for the characters that UTF-8 takes four for */
+			*dst_size = utf8_size;
+			if (dst_codec == UTF_CODEC_CESU8){
+				*dst_size += long_count * 2;
+			}
+			break;
+		case UTF_CODEC_UTF16_LE:
+		case UTF_CODEC_UTF16_BE:
+			*dst_size = (count + long_count) * 2;
+			break;
+		case UTF_CODEC_UTF32_LE:
+		case UTF_CODEC_UTF32_BE:
+			*dst_size = count * 4;
+			break;
+		default:
+			/* codepages don't have every character */
+			return measure_each(src_codec, in, src_size, dst_codec, dst_size);
+	}
+
+	if (valid_size < src_size){
+		return UTF_ERROR_INVALID_SEQUENCE;
+	}
+
+	return UTF_ERROR_NONE;
+}
+
+utf_error_t utf_converter_swap(utf_codec_t codec, void * buf, size_t size, size_t * swap_size){
+
+	unsigned char * data = (unsigned char *)(buf);
+
+	switch (codec){
+		case UTF_CODEC_UTF16_LE:
+			*swap_size = utf_kernel_utf16_swap(data, size, data, 0);
+			break;
+		case UTF_CODEC_UTF16_BE:
+			*swap_size = utf_kernel_utf16_swap(data, size, data, 1);
+			break;
+		case UTF_CODEC_UTF32_LE:
+		case UTF_CODEC_UTF32_BE:
+			*swap_size = utf_kernel_utf32_swap(data, size, data);
+			break;
+		default:
+			*swap_size = 0;
+			return UTF_ERROR_INVALID_SEQUENCE;
+	}
+
+	if (*swap_size < size){
+		return UTF_ERROR_INVALID_SEQUENCE;
+	}
+
+	return UTF_ERROR_NONE;
+}
+
 utf_decoder_t * utf_converter_get_decoder(utf_converter_t * converter){
 	return &converter->decoder;
 }
@@ -92,39 +529,1338 @@ void utf_converter_set_encoder_codec(utf_converter_t * converter, utf_codec_t en
 unsigned int utf_converter_write(utf_converter_t * converter, const void * src, unsigned int src_size){
 
 	utf_decoder_t * decoder = 0;
-	unsigned int write_count = 0;
+	transcode_t transcode = NULL;
+	size_t read_size = 0;
 
 	decoder = utf_converter_get_decoder(converter);
 
-	write_count = utf_decoder_write(decoder, src, src_size);
+	if (utf_decoder_get_codec(decoder) == UTF_CODEC_AUTO){
+		read_size = convert_detect(converter, (const unsigned char *)(src), src_size);
+		if (utf_decoder_get_codec(decoder) == UTF_CODEC_AUTO){
+			return read_size;
+		}
+		return read_size + utf_converter_write(converter, (const unsigned char *)(src) + read_size, src_size - read_size);
+	}
 
-	utf_converter_transfer(converter);
+	transcode = get_transcode(utf_decoder_get_codec(decoder),
+	                          utf_encoder_get_codec(utf_converter_get_encoder(converter)));
+	if (transcode != NULL){
+		return write_direct(converter, transcode, (const unsigned char *)(src), src_size);
+	}
 
-	return write_count;
+	return write_each(converter, (const unsigned char *)(src), src_size);
 }
 
-static unsigned int utf_converter_transfer(utf_converter_t * converter){
+/** Moves the characters that the decoder has over to the encoder.
+ * They're written a span at a time, straight from the decoder's ring.
+ * @param read_count Set to the number of characters taken from the decoder.
+ * @param write_size Set to the number of bytes that the encoder gained.
+ * @returns On success, @ref UTF_ERROR_NONE, and the decoder is left empty.
+ *  Otherwise, the characters from the one that couldn't be encoded on
+ *  are left in the decoder.
+ */
+
+static utf_error_t utf_converter_transfer(utf_converter_t * converter, size_t * read_count, size_t * write_size){
 
-	utf32_t c;
-	unsigned int read_count = 0;
+	utf_error_t error = UTF_ERROR_NONE;
 	utf_encoder_t * encoder;
 	utf_decoder_t * decoder;
+	const utf32_t * span;
+	unsigned long int span_count = 0;
+	unsigned long int byte_count = 0;
+	unsigned long int i = 0;
 
 	encoder = utf_converter_get_encoder(converter);
 	decoder = utf_converter_get_decoder(converter);
 
-	if (utf_decoder_flush(decoder) != UTF_ERROR_NONE){
-		return 0;
+	byte_count = encoder->byte_count;
+
+	*read_count = 0;
+
+	while ((error == UTF_ERROR_NONE) && (decoder->output_count > 0)){
+
+		/* the characters may wrap around the end of the ring */
+
+		span = &decoder->output_array[decoder->output_index];
+		span_count = decoder->output_count_res - decoder->output_index;
+		if (span_count > decoder->output_count){
+			span_count = decoder->output_count;
+		}
+
+		error = utf_encoder_write_array(encoder, span, span_count);
+		if (error == UTF_ERROR_INVALID_SEQUENCE){
+			/* nothing was written, so find out how far the span can go */
+			for (i = 0; i < span_count; i++){
+				if (utf_encoder_write(encoder, span[i]) != UTF_ERROR_NONE){
+					break;
+				}
+			}
+			span_count = i;
+		} else if (error != UTF_ERROR_NONE){
+			span_count = 0;
+		}
+
+		skip_decoded(decoder, span_count);
+
+		*read_count += span_count;
+	}
+
+	*write_size = encoder->byte_count - byte_count;
+
+	return error;
+}
+
+/** Drops characters from the front of the decoder's ring,
+ * the same way that @ref utf_decoder_read does. */
+
+static void skip_decoded(utf_decoder_t * decoder, unsigned long int count){
+
+	if (count == 0){
+		return;
+	}
+
+	decoder->output_index += count;
+	decoder->output_index &= decoder->output_count_res - 1;
+	decoder->output_count -= count;
+
+	if (decoder->output_count == 0){
+		decoder->output_index = 0;
+	}
+}
+
+
+/** Returns a function that transcodes directly between two codecs.
+ * @returns A null pointer, if the pair has to go through UTF-32.
+ */
+
+static transcode_t get_transcode(utf_codec_t decoder_codec, utf_codec_t encoder_codec){
+	if (decoder_codec == UTF_CODEC_UTF8){
+		if ((encoder_codec == UTF_CODEC_UTF8)
+		 || (encoder_codec == UTF_CODEC_WTF8)){
+			/* UTF-8 is also WTF-8 */
+			return copy_utf8;
+		} else if (encoder_codec == UTF_CODEC_UTF16_LE){
+			return utf_kernel_utf8_to_utf16le;
+		} else if (encoder_codec == UTF_CODEC_UTF16_BE){
+			return utf_kernel_utf8_to_utf16be;
+		}
+	} else if (encoder_codec == UTF_CODEC_UTF8){
+		if (decoder_codec == UTF_CODEC_UTF16_LE){
+			return utf_kernel_utf16le_to_utf8;
+		} else if (decoder_codec == UTF_CODEC_UTF16_BE){
+			return utf_kernel_utf16be_to_utf8;
+		}
+	} else if (decoder_codec == UTF_CODEC_WTF8){
+		if (encoder_codec == UTF_CODEC_UTF16_LE){
+			return utf_wtf8_to_utf16le;
+		} else if (encoder_codec == UTF_CODEC_UTF16_BE){
+			return utf_wtf8_to_utf16be;
+		}
+	} else if (encoder_codec == UTF_CODEC_WTF8){
+		if (decoder_codec == UTF_CODEC_UTF16_LE){
+			return utf_wtf8_from_utf16le;
+		} else if (decoder_codec == UTF_CODEC_UTF16_BE){
+			return utf_wtf8_from_utf16be;
+		}
+	} else if (decoder_codec == UTF_CODEC_CESU8){
+		if (encoder_codec == UTF_CODEC_UTF16_LE){
+			return utf_cesu8_to_utf16le;
+		} else if (encoder_codec == UTF_CODEC_UTF16_BE){
+			return utf_cesu8_to_utf16be;
+		}
+	} else if (encoder_codec == UTF_CODEC_CESU8){
+		if (decoder_codec == UTF_CODEC_UTF16_LE){
+			return utf_cesu8_from_utf16le;
+		} else if (decoder_codec == UTF_CODEC_UTF16_BE){
+			return utf_cesu8_from_utf16be;
+		}
+	} else if ((decoder_codec == UTF_CODEC_UTF16_LE) && (encoder_codec == UTF_CODEC_UTF16_BE)){
+		return swap_utf16le;
+	} else if ((decoder_codec == UTF_CODEC_UTF16_BE) && (encoder_codec == UTF_CODEC_UTF16_LE)){
+		return swap_utf16be;
+	} else if (((decoder_codec == UTF_CODEC_UTF32_LE) && (encoder_codec == UTF_CODEC_UTF32_BE))
+	        || ((decoder_codec == UTF_CODEC_UTF32_BE) && (encoder_codec == UTF_CODEC_UTF32_LE))){
+		return swap_utf32;
+	}
+	return NULL;
+}
+
+/** Validates UTF-8 and copies it as is. */
+
+static size_t copy_utf8(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+
+	size_t valid_size;
+
+	valid_size = utf_kernel_utf8_validate(src, src_size);
+
+	memcpy(dst, src, valid_size);
+
+	*dst_size = valid_size;
+
+	return valid_size;
+}
+
+/** Swaps UTF-16LE to UTF-16BE. */
+
+static size_t swap_utf16le(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+	*dst_size = utf_kernel_utf16_swap(src, src_size, dst, 0);
+	return *dst_size;
+}
+
+/** Swaps UTF-16BE to UTF-16LE. */
+
+static size_t swap_utf16be(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+	*dst_size = utf_kernel_utf16_swap(src, src_size, dst, 1);
+	return *dst_size;
+}
+
+/** Swaps UTF-32 from either byte order to the other. */
+
+static size_t swap_utf32(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+	*dst_size = utf_kernel_utf32_swap(src, src_size, dst);
+	return *dst_size;
+}
+
+/** Returns the most bytes that transcoding @p src_size bytes may output. */
+
+static size_t transcode_bound(utf_codec_t decoder_codec, utf_codec_t encoder_codec, size_t src_size){
+	if (is_utf8_variant(decoder_codec)){
+		/* one code unit for every byte */
+		return src_size * 2;
+	} else if (is_utf8_variant(encoder_codec)){
+		/* three bytes for every code unit */
+		return (src_size / 2) * 3;
+	}
+	/* only the byte order changes */
+	return src_size;
+}
+
+/** Returns whether a codec is UTF-8, WTF-8 or CESU-8, which are
+ * the same for every character below U+10000 that isn't a surrogate. */
+
+static int is_utf8_variant(utf_codec_t codec){
+	switch (codec){
+		case UTF_CODEC_UTF8:
+		case UTF_CODEC_WTF8:
+		case UTF_CODEC_CESU8:
+			return 1;
+		default:
+			break;
+	}
+	return 0;
+}
+
+/** Returns whether a surrogate that isn't part of a pair is converted as it is,
+ * rather than being invalid. That's the case between UTF-16 and WTF-8 or CESU-8,
+ * which are there to convert UTF-16 that isn't well-formed without losing anything.
+ * A CESU-8 surrogate pair is then also converted one code unit at a time.
+ * From UTF-32 to WTF-8, surrogates are kept anyway, but a pair of them
+ * is converted as the character it makes.
+ */
+
+static int keep_surrogates(utf_codec_t decoder_codec, utf_codec_t encoder_codec){
+
+	if ((decoder_codec == UTF_CODEC_UTF32_LE)
+	 || (decoder_codec == UTF_CODEC_UTF32_BE)){
+		return encoder_codec == UTF_CODEC_WTF8;
+	}
+
+	if ((decoder_codec == UTF_CODEC_UTF16_LE)
+	 || (decoder_codec == UTF_CODEC_UTF16_BE)){
+		return (encoder_codec == UTF_CODEC_WTF8)
+		    || (encoder_codec == UTF_CODEC_CESU8);
+	}
+
+	if ((encoder_codec == UTF_CODEC_UTF16_LE)
+	 || (encoder_codec == UTF_CODEC_UTF16_BE)){
+		return (decoder_codec == UTF_CODEC_WTF8)
+		    || (decoder_codec == UTF_CODEC_CESU8);
 	}
 
-	while (utf_decoder_avail(decoder) > 0){
-		if ((utf_decoder_read(decoder, &c, 1) != UTF_ERROR_NONE)
-		 || (utf_encoder_write(encoder, c) != UTF_ERROR_NONE)){
+	return 0;
+}
+
+/** Writes input to the converter without decoding it to UTF-32 first.
+ * The decoder is only used for a sequence that is split between writes,
+ * and to stop at an invalid sequence the same way that it would.
+ */
+
+static unsigned int write_direct(utf_converter_t * converter, transcode_t transcode, const unsigned char * src, size_t src_size){
+
+	utf_decoder_t * decoder = NULL;
+	utf_encoder_t * encoder = NULL;
+	unsigned char * tail = NULL;
+	size_t i = 0;
+	size_t block_size = 0;
+	size_t read_size = 0;
+	size_t write_size = 0;
+	size_t transfer_count = 0;
+	size_t transfer_size = 0;
+
+	decoder = utf_converter_get_decoder(converter);
+	encoder = utf_converter_get_encoder(converter);
+
+	while (i < src_size){
+
+		/* finish the sequence left over from the last write,
+		 * a few bytes at a time so that the rest can be transcoded */
+
+		if ((utf_decoder_avail(decoder) == 0)
+		 && (decoder->input_byte_count > 0)
+		 && (i < src_size)){
+			i += write_carry_direct(converter, transcode, &src[i], src_size - i);
+		}
+
+		while ((utf_decoder_avail(decoder) > 0)
+		    || (decoder->input_byte_count > 0)){
+			if (i >= src_size){
+				return i;
+			}
+			block_size = sizeof(decoder->input_byte_array) - decoder->input_byte_count;
+			if (block_size > (src_size - i)){
+				block_size = src_size - i;
+			}
+			read_size = utf_decoder_write(decoder, &src[i], block_size);
+			i += read_size;
+			if ((utf_converter_transfer(converter, &transfer_count, &transfer_size) != UTF_ERROR_NONE)
+			 || (read_size < block_size)){
+				return i;
+			}
+		}
+
+		/* less than a code unit has nothing to transcode */
+
+		while ((src_size - i) >= utf_codec_min_bytes(decoder->codec)){
+
+			block_size = src_size - i;
+			if (block_size > TRANSCODE_BLOCK_SIZE){
+				block_size = TRANSCODE_BLOCK_SIZE;
+			}
+
+			tail = utf_ring_reserve_tail(encoder, transcode_bound(decoder->codec, encoder->codec, block_size));
+			if (tail == NULL){
+				return i;
+			}
+
+			read_size = transcode(&src[i], block_size, tail, &write_size);
+
+			encoder->byte_count += write_size;
+
+			i += read_size;
+
+			if (read_size == 0){
+				break;
+			}
+		}
+
+		if (i >= src_size){
 			break;
 		}
-		read_count++;
+
+		/* let the decoder keep an incomplete sequence, or stop at an
+		 * invalid one. If it replaces or skips the invalid sequence,
+		 * it only gets that much, and transcoding picks up after it. */
+
+		block_size = src_size - i;
+		if ((utf_decoder_get_policy(decoder) != UTF_DECODER_STRICT)
+		 && (block_size > 4)){
+			block_size = 4;
+		}
+
+		read_size = utf_decoder_write(decoder, &src[i], block_size);
+		i += read_size;
+		if ((utf_converter_transfer(converter, &transfer_count, &transfer_size) != UTF_ERROR_NONE)
+		 || (read_size < block_size)){
+			return i;
+		}
 	}
 
-	return read_count;
+	return i;
 }
 
+/** Finishes the sequence left over from the last write with the transcoder,
+ * which is the only way that a surrogate on its own gets from UTF-16 to WTF-8,
+ * since the decoder would reject it.
+ * @returns The number of bytes taken from @p src. If the transcoder stops
+ *  before the end of the left over bytes, only what it got through is taken
+ *  out of them, and the decoder is left to finish the rest.
+ */
+
+static size_t write_carry_direct(utf_converter_t * converter, transcode_t transcode, const unsigned char * src, size_t src_size){
+
+	utf_decoder_t * decoder = NULL;
+	utf_encoder_t * encoder = NULL;
+	unsigned char * tail = NULL;
+	unsigned char head[12];
+	size_t carry_size = 0;
+	size_t head_size = 0;
+	size_t read_size = 0;
+	size_t write_size = 0;
+
+	decoder = utf_converter_get_decoder(converter);
+	encoder = utf_converter_get_encoder(converter);
+
+	/* a high surrogate that turns out to be on its own comes out
+	 * of the transcoder without the bytes after it, which may be
+	 * the start of another one, so it goes around again */
+
+	while (decoder->input_byte_count > 0){
+
+		carry_size = decoder->input_byte_count;
+
+		head_size = sizeof(head) - carry_size;
+		if (head_size > src_size){
+			head_size = src_size;
+		}
+
+		memcpy(head, decoder->input_byte_array, carry_size);
+		memcpy(&head[carry_size], src, head_size);
+		head_size += carry_size;
+
+		tail = utf_ring_reserve_tail(encoder, transcode_bound(decoder->codec, encoder->codec, head_size));
+		if (tail == NULL){
+			return 0;
+		}
+
+		read_size = transcode(head, head_size, tail, &write_size);
+		if (read_size == 0){
+			return 0;
+		}
+
+		encoder->byte_count += write_size;
+
+		if (read_size >= carry_size){
+			decoder->input_byte_count = 0;
+			return read_size - carry_size;
+		}
+
+		decoder->input_byte_count -= read_size;
+		memmove(decoder->input_byte_array,
+		        &decoder->input_byte_array[read_size],
+		        decoder->input_byte_count);
+	}
+
+	return 0;
+}
+
+/** Writes input to the converter through the decoder, one character at a time,
+ * except for runs of ASCII, which go straight to the encoder.
+ */
+
+static unsigned int write_each(utf_converter_t * converter, const unsigned char * src, size_t src_size){
+
+	utf_decoder_t * decoder = NULL;
+	utf_encoder_t * encoder = NULL;
+	unsigned char * tail = NULL;
+	size_t i = 0;
+	size_t src_unit = 0;
+	size_t dst_unit = 0;
+	size_t block_size = 0;
+	size_t tail_size = 0;
+	size_t span_size = 0;
+	size_t read_size = 0;
+	size_t write_size = 0;
+	size_t transfer_count = 0;
+	size_t transfer_size = 0;
+
+	decoder = utf_converter_get_decoder(converter);
+	encoder = utf_converter_get_encoder(converter);
+
+	src_unit = utf_codec_min_bytes(decoder->codec);
+	dst_unit = utf_codec_min_bytes(encoder->codec);
+
+	/* the decoder goes first if it's holding on to anything */
+
+	while (((src_size - i) >= src_unit)
+	    && (utf_decoder_avail(decoder) == 0)
+	    && (decoder->input_byte_count == 0)){
+
+		block_size = src_size - i;
+		if (block_size > TRANSCODE_BLOCK_SIZE){
+			block_size = TRANSCODE_BLOCK_SIZE;
+		}
+
+		tail_size = (block_size / src_unit) * dst_unit;
+
+		tail = utf_ring_reserve_tail(encoder, tail_size);
+		if (tail == NULL){
+			return i;
+		}
+
+		read_size = convert_ascii(decoder->codec, &src[i], block_size, encoder->codec, tail, tail_size, &write_size);
+
+		encoder->byte_count += write_size;
+
+		i += read_size;
+
+		if (read_size == block_size){
+			continue;
+		}
+
+		/* the characters up to the next ASCII character go through the decoder */
+
+		span_size = non_ascii_length(decoder->codec, &src[i], src_size - i);
+
+		read_size = utf_decoder_write(decoder, &src[i], span_size);
+		if ((utf_converter_transfer(converter, &transfer_count, &transfer_size) != UTF_ERROR_NONE)
+		 || (read_size < span_size)){
+			return i + read_size;
+		}
+
+		if ((decoder->input_byte_count > 0)
+		 && ((i + span_size) < src_size)
+		 && (utf_decoder_get_policy(decoder) != UTF_DECODER_STRICT)){
+			/* a sequence that ASCII cuts short is invalid, so the
+			 * decoder replaces or skips it once it gets the ASCII */
+			i += span_size;
+			block_size = src_size - i;
+			if (block_size > src_unit){
+				block_size = src_unit;
+			}
+			read_size = utf_decoder_write(decoder, &src[i], block_size);
+			i += read_size;
+			if ((utf_converter_transfer(converter, &transfer_count, &transfer_size) != UTF_ERROR_NONE)
+			 || (read_size < block_size)){
+				return i;
+			}
+			continue;
+		} else if ((decoder->input_byte_count > 0) && ((i + span_size) < src_size)){
+			/* a sequence that ASCII cuts short is invalid, so give
+			 * it back, for the decoder to stop at it with the rest */
+			i += span_size - decoder->input_byte_count;
+			decoder->input_byte_count = 0;
+			break;
+		}
+
+		i += span_size;
+	}
+
+	if (i < src_size){
+		i += utf_decoder_write(decoder, &src[i], src_size - i);
+		utf_converter_transfer(converter, &transfer_count, &transfer_size);
+	}
+
+	return i;
+}
+
+/** Completes the sequence that was split between the last call and this one.
+ * Nothing is taken from the input unless the sequence fits in the output.
+ */
+
+static utf_error_t convert_carry(utf_converter_t * converter, const unsigned char ** src, size_t * src_left, unsigned char ** dst, size_t * dst_left){
+
+	utf_error_t error = UTF_ERROR_NONE;
+	utf_decoder_t * decoder = NULL;
+	utf_encoder_t * encoder = NULL;
+	unsigned char sequence[8];
+	unsigned char output[6];
+	size_t sequence_size = 0;
+	size_t read_size = 0;
+	size_t write_size = 0;
+	size_t length = 0;
+	char32_t c = 0;
+	int replaced = 0;
+	int keep = 0;
+	int written = 0;
+
+	decoder = utf_converter_get_decoder(converter);
+	encoder = utf_converter_get_encoder(converter);
+
+	keep = keep_surrogates(decoder->codec, encoder->codec);
+
+	sequence_size = decoder->input_byte_count;
+	memcpy(sequence, decoder->input_byte_array, sequence_size);
+
+	/* a CESU-8 high surrogate turns out to be a sequence on its own
+	 * once a byte that doesn't start a low surrogate follows it,
+	 * and the bytes after it are decoded again */
+
+	while (sequence_size > 0){
+
+		length = decode_one(decoder->codec, sequence, sequence_size, &c, keep);
+
+		while ((length > sequence_size) && (read_size < *src_left)){
+			sequence[sequence_size++] = (*src)[read_size++];
+			length = decode_one(decoder->codec, sequence, sequence_size, &c, keep);
+		}
+
+		if (length == 0){
+			error = UTF_ERROR_INVALID_SEQUENCE;
+			break;
+		} else if (length > sequence_size){
+			/* still incomplete, wait for more input */
+			break;
+		}
+
+		write_size = encode_char(encoder, c, output, &replaced);
+		if (write_size == 0){
+			error = UTF_ERROR_INVALID_SEQUENCE;
+			break;
+		} else if (write_size > *dst_left){
+			error = UTF_ERROR_OVERFLOW;
+			break;
+		}
+
+		memcpy(*dst, output, write_size);
+		*dst += write_size;
+		*dst_left -= write_size;
+
+		encoder->invalid_count += replaced;
+
+		sequence_size -= length;
+		memmove(sequence, &sequence[length], sequence_size);
+
+		written = 1;
+	}
+
+	if ((error != UTF_ERROR_NONE) && !written){
+		return error;
+	} else if (error != UTF_ERROR_NONE){
+		/* the input that the failed sequence took is given back */
+		length = (read_size < sequence_size) ? read_size : sequence_size;
+		read_size -= length;
+		sequence_size -= length;
+	}
+
+	memcpy(decoder->input_byte_array, sequence, sequence_size);
+	decoder->input_byte_count = sequence_size;
+	*src += read_size;
+	*src_left -= read_size;
+
+	return error;
+}
+
+/** Picks the codec, for a decoder set to @ref UTF_CODEC_AUTO.
+ * This is the same as the decoder does, except that the input that was
+ * kept while it was too short to tell, after the byte order mark,
+ * is written to the converter.
+ * @returns The number of bytes taken from @p src, which includes
+ *  the part of the byte order mark that's in it.
+ */
+
+static size_t convert_detect(utf_converter_t * converter, const unsigned char * src, size_t src_size){
+
+	utf_decoder_t * decoder = NULL;
+	unsigned char head[4];
+	size_t head_size = 0;
+	size_t carry_size = 0;
+	size_t bom_size = 0;
+	size_t write_size = 0;
+	size_t i = 0;
+	utf_codec_t codec = UTF_CODEC_UTF8;
+
+	decoder = utf_converter_get_decoder(converter);
+
+	carry_size = decoder->input_byte_count;
+	memcpy(head, decoder->input_byte_array, carry_size);
+	head_size = carry_size;
+
+	while ((head_size < 4) && (i < src_size)){
+		head[head_size++] = src[i++];
+	}
+
+	if (head_size < 4){
+		memcpy(decoder->input_byte_array, head, head_size);
+		decoder->input_byte_count = head_size;
+		return src_size;
+	}
+
+	if (carry_size == 0){
+		codec = utf_codec_detect(src, src_size, &bom_size);
+	} else {
+		codec = utf_codec_detect(head, head_size, &bom_size);
+		if ((bom_size == 0) && ((src_size - i) > head_size)){
+			codec = utf_codec_detect(&src[i], src_size - i, &bom_size);
+			bom_size = 0;
+		}
+	}
+
+	utf_decoder_set_codec(decoder, codec);
+	decoder->input_byte_count = 0;
+
+	if (bom_size < carry_size){
+		write_size = utf_converter_write(converter, &head[bom_size], carry_size - bom_size);
+		if (write_size < (carry_size - bom_size)){
+			/* left for the next step to fail on */
+			memcpy(decoder->input_byte_array, &head[bom_size + write_size], carry_size - bom_size - write_size);
+			decoder->input_byte_count = carry_size - bom_size - write_size;
+		}
+		bom_size = carry_size;
+	}
+
+	return bom_size - carry_size;
+}
+
+/** Completes the sequence that was split between the last call and this one,
+ * replacing or skipping it if it turns out to be invalid, the same way that
+ * the decoder does. What's left of it if the output fills up is kept.
+ */
+
+static utf_error_t convert_carry_lossy(utf_converter_t * converter, const unsigned char ** src, size_t * src_left, unsigned char ** dst, size_t * dst_left){
+
+	utf_error_t error = UTF_ERROR_NONE;
+	utf_decoder_t * decoder = NULL;
+	utf_encoder_t * encoder = NULL;
+	unsigned char sequence[8];
+	unsigned char output[6];
+	size_t sequence_size = 0;
+	size_t read_size = 0;
+	size_t write_size = 0;
+	size_t length = 0;
+	char32_t c = 0;
+	int invalid = 0;
+	int replaced = 0;
+	int keep = 0;
+
+	decoder = utf_converter_get_decoder(converter);
+	encoder = utf_converter_get_encoder(converter);
+
+	keep = keep_surrogates(decoder->codec, encoder->codec);
+
+	sequence_size = decoder->input_byte_count;
+	memcpy(sequence, decoder->input_byte_array, sequence_size);
+
+	while (sequence_size > 0){
+
+		length = invalid_length(decoder->codec, sequence, sequence_size, keep);
+		if (length > sequence_size){
+			if (read_size >= *src_left){
+				/* still incomplete, wait for more input */
+				break;
+			}
+			sequence[sequence_size++] = (*src)[read_size++];
+			continue;
+		}
+
+		invalid = (length > 0);
+		write_size = 0;
+		replaced = 0;
+		if (!invalid){
+			length = decode_one(decoder->codec, sequence, sequence_size, &c, keep);
+			write_size = encode_char(encoder, c, output, &replaced);
+			if (write_size == 0){
+				error = UTF_ERROR_INVALID_SEQUENCE;
+				break;
+			}
+		} else if (decoder->policy == UTF_DECODER_REPLACE){
+			write_size = encode_char(encoder, 0xfffd, output, &replaced);
+			if (write_size == 0){
+				error = UTF_ERROR_INVALID_SEQUENCE;
+				break;
+			}
+		}
+
+		if (write_size > *dst_left){
+			error = UTF_ERROR_OVERFLOW;
+			break;
+		}
+
+		memcpy(*dst, output, write_size);
+		*dst += write_size;
+		*dst_left -= write_size;
+
+		if (invalid){
+			decoder->invalid_count++;
+		}
+
+		encoder->invalid_count += replaced;
+
+		sequence_size -= length;
+		memmove(sequence, &sequence[length], sequence_size);
+	}
+
+	memcpy(decoder->input_byte_array, sequence, sequence_size);
+	decoder->input_byte_count = sequence_size;
+	*src += read_size;
+	*src_left -= read_size;
+
+	return error;
+}
+
+/** Finds the maximal subpart of an invalid sequence,
+ * which is replaced or skipped as a whole.
+ * @param keep Whether surrogates on their own are valid, see @ref keep_surrogates.
+ * @returns The number of bytes in the subpart. Zero is returned if
+ *  @p src starts with a valid sequence, and more than @p src_size
+ *  if it starts with one that's cut short by the end of @p src.
+ */
+
+static size_t invalid_length(utf_codec_t codec, const unsigned char * src, size_t src_size, int keep){
+
+	char32_t c;
+	size_t length = 0;
+
+	if (keep){
+		/* only a sequence that doesn't make a code unit is invalid */
+		length = decode_one(codec, src, src_size, &c, keep);
+		if (length > src_size){
+			return length;
+		} else if (length > 0){
+			return 0;
+		}
+	}
+
+	if (utf_codepage_get(codec) != NULL){
+		if (src_size < 1){
+			return 1;
+		}
+		return utf_codepage_decode(utf_codepage_get(codec), src[0], &c) ? 0 : 1;
+	}
+
+	switch (codec){
+		case UTF_CODEC_UTF8:
+			return utf_kernel_utf8_subpart(src, src_size);
+		case UTF_CODEC_WTF8:
+			return utf_wtf8_subpart(src, src_size);
+		case UTF_CODEC_CESU8:
+			return utf_cesu8_subpart(src, src_size);
+		case UTF_CODEC_UTF16_LE:
+			return utf_kernel_utf16_subpart(src, src_size, 0);
+		case UTF_CODEC_UTF16_BE:
+			return utf_kernel_utf16_subpart(src, src_size, 1);
+		case UTF_CODEC_UTF32_LE:
+		case UTF_CODEC_UTF32_BE:
+			return (src_size < 4) ? 4 : 0;
+		default:
+			break;
+	}
+	return 0;
+}
+
+/** Counts the ASCII characters at the start of the input.
+ * @param src_count The number of code units in @p src.
+ * @returns The number of code units before the first one that isn't ASCII.
+ */
+
+static size_t ascii_length(utf_codec_t codec, const unsigned char * src, size_t src_count){
+
+	size_t k = 0;
+
+	if (utf_codepage_get(codec) != NULL){
+		/* codepages are ASCII below 0x80 */
+		return utf_kernel_ascii_length(src, src_count);
+	}
+
+	switch (codec){
+		case UTF_CODEC_UTF8:
+		case UTF_CODEC_WTF8:
+		case UTF_CODEC_CESU8:
+			return utf_kernel_ascii_length(src, src_count);
+		case UTF_CODEC_UTF16_LE:
+			while ((k < src_count) && (utf16le(&src[k * 2]) < 0x80)){
+				k++;
+			}
+			break;
+		case UTF_CODEC_UTF16_BE:
+			while ((k < src_count) && (utf16be(&src[k * 2]) < 0x80)){
+				k++;
+			}
+			break;
+		case UTF_CODEC_UTF32_LE:
+			while ((k < src_count) && (utf32le(&src[k * 4]) < 0x80)){
+				k++;
+			}
+			break;
+		case UTF_CODEC_UTF32_BE:
+			while ((k < src_count) && (utf32be(&src[k * 4]) < 0x80)){
+				k++;
+			}
+			break;
+		default:
+			break;
+	}
+
+	return k;
+}
+
+/** Finds the next ASCII character in the input.
+ * @returns The number of bytes before it, or @p src_size if there isn't one.
+ */
+
+static size_t non_ascii_length(utf_codec_t codec, const unsigned char * src, size_t src_size){
+
+	size_t i = 0;
+	size_t unit = utf_codec_min_bytes(codec);
+
+	while ((i + unit) <= src_size){
+		if (ascii_length(codec, &src[i], 1) == 1){
+			return i;
+		}
+		i += unit;
+	}
+
+	return src_size;
+}
+
+/** Returns whether every character below U+0100 is one code unit of the same value. */
+
+static int is_latin1_range(utf_codec_t codec){
+	switch (codec){
+		case UTF_CODEC_LATIN1:
+		case UTF_CODEC_UTF16_LE:
+		case UTF_CODEC_UTF16_BE:
+		case UTF_CODEC_UTF32_LE:
+		case UTF_CODEC_UTF32_BE:
+			return 1;
+		default:
+			break;
+	}
+	return 0;
+}
+
+/** Counts the characters below U+0100 at the start of the input.
+ * @param src_count The number of code units in @p src.
+ * @returns The number of code units before the first one that's larger.
+ */
+
+static size_t latin1_length(utf_codec_t codec, const unsigned char * src, size_t src_count){
+
+	size_t k = 0;
+
+	switch (codec){
+		case UTF_CODEC_LATIN1:
+			return src_count;
+		case UTF_CODEC_UTF16_LE:
+			while ((k < src_count) && (utf16le(&src[k * 2]) < 0x100)){
+				k++;
+			}
+			break;
+		case UTF_CODEC_UTF16_BE:
+			while ((k < src_count) && (utf16be(&src[k * 2]) < 0x100)){
+				k++;
+			}
+			break;
+		case UTF_CODEC_UTF32_LE:
+			while ((k < src_count) && (utf32le(&src[k * 4]) < 0x100)){
+				k++;
+			}
+			break;
+		case UTF_CODEC_UTF32_BE:
+			while ((k < src_count) && (utf32be(&src[k * 4]) < 0x100)){
+				k++;
+			}
+			break;
+		default:
+			break;
+	}
+
+	return k;
+}
+
+/** Converts the run of ASCII characters at the start of the input,
+ * as far as it fits in the output. ASCII is the same code unit in every
+ * codec, so it's copied, or each code unit is widened or narrowed.
+ * Between Latin-1 and UTF-16 or UTF-32, the same goes for every
+ * character below U+0100.
+ * @param write_size Set to the number of bytes written to @p dst.
+ * @returns The number of bytes consumed from @p src.
+ */
+
+static size_t convert_ascii(utf_codec_t src_codec, const unsigned char * src, size_t src_size, utf_codec_t dst_codec, unsigned char * dst, size_t dst_size, size_t * write_size){
+
+	size_t k = 0;
+	size_t count = 0;
+	size_t src_unit = utf_codec_min_bytes(src_codec);
+	size_t dst_unit = utf_codec_min_bytes(dst_codec);
+	size_t src_low = 0;
+	size_t dst_low = 0;
+	int latin1 = 0;
+
+	count = src_size / src_unit;
+	if (count > (dst_size / dst_unit)){
+		count = dst_size / dst_unit;
+	}
+
+	latin1 = ((src_codec == UTF_CODEC_LATIN1) || (dst_codec == UTF_CODEC_LATIN1))
+	      && is_latin1_range(src_codec)
+	      && is_latin1_range(dst_codec);
+
+	if ((src_codec == UTF_CODEC_UTF32) && (dst_unit == 1) && is_aligned32(src)){
+		/* the kernel finds the end of the run as it narrows it */
+		count = utf_kernel_utf32_to_latin1((const char32_t *)(src), count, dst, latin1 ? 0x100 : 0x80);
+	} else {
+		if (latin1){
+			count = latin1_length(src_codec, src, count);
+		} else {
+			count = ascii_length(src_codec, src, count);
+		}
+		if (src_codec == dst_codec){
+			memcpy(dst, src, count * src_unit);
+		} else if (!convert_units(src_codec, src, count, dst_codec, dst)){
+			/* the offset of the byte that holds the character */
+			if ((src_codec == UTF_CODEC_UTF16_BE) || (src_codec == UTF_CODEC_UTF32_BE)){
+				src_low = src_unit - 1;
+			}
+			if ((dst_codec == UTF_CODEC_UTF16_BE) || (dst_codec == UTF_CODEC_UTF32_BE)){
+				dst_low = dst_unit - 1;
+			}
+			memset(dst, 0, count * dst_unit);
+			for (k = 0; k < count; k++){
+				dst[(k * dst_unit) + dst_low] = src[(k * src_unit) + src_low];
+			}
+		}
+	}
+
+	*write_size = count * dst_unit;
+
+	return count * src_unit;
+}
+
+/** Widens or narrows a run that @ref convert_ascii found, with the kernels,
+ * if there's one for the pair of codecs. UTF-32 goes through them as
+ * characters, so only if it's aligned to them.
+ * @returns Non-zero if the run was converted, or zero if
+ *  it has to be done one code unit at a time.
+ */
+
+static int convert_units(utf_codec_t src_codec, const unsigned char * src, size_t count, utf_codec_t dst_codec, unsigned char * dst){
+
+	size_t size = 0;
+
+	if (is_utf8_variant(src_codec) && (dst_codec == UTF_CODEC_UTF16_LE)){
+		utf_kernel_utf8_to_utf16le(src, count, dst, &size);
+	} else if (is_utf8_variant(src_codec) && (dst_codec == UTF_CODEC_UTF16_BE)){
+		utf_kernel_utf8_to_utf16be(src, count, dst, &size);
+	} else if ((src_codec == UTF_CODEC_UTF16_LE) && is_utf8_variant(dst_codec)){
+		utf_kernel_utf16le_to_utf8(src, count * 2, dst, &size);
+	} else if ((src_codec == UTF_CODEC_UTF16_BE) && is_utf8_variant(dst_codec)){
+		utf_kernel_utf16be_to_utf8(src, count * 2, dst, &size);
+	} else if (((src_codec == UTF_CODEC_UTF16_LE) && (dst_codec == UTF_CODEC_UTF16_BE))
+	        || ((src_codec == UTF_CODEC_UTF16_BE) && (dst_codec == UTF_CODEC_UTF16_LE))){
+		utf_kernel_utf16_swap(src, count * 2, dst, src_codec == UTF_CODEC_UTF16_BE);
+	} else if (((src_codec == UTF_CODEC_UTF32_LE) && (dst_codec == UTF_CODEC_UTF32_BE))
+	        || ((src_codec == UTF_CODEC_UTF32_BE) && (dst_codec == UTF_CODEC_UTF32_LE))){
+		utf_kernel_utf32_swap(src, count * 4, dst);
+	} else if ((utf_codec_min_bytes(src_codec) == 1)
+	        && ((dst_codec == UTF_CODEC_UTF32_LE) || (dst_codec == UTF_CODEC_UTF32_BE))
+	        && is_aligned32(dst)){
+		utf_kernel_latin1_to_utf32(src, count, (char32_t *)(dst));
+		if (dst_codec != UTF_CODEC_UTF32){
+			utf_kernel_utf32_swap(dst, count * 4, dst);
+		}
+	} else if ((src_codec == UTF_CODEC_UTF32) && (dst_codec == UTF_CODEC_UTF16_LE) && is_aligned32(src)){
+		utf_kernel_utf32_to_utf16le((const char32_t *)(src), count, dst, &size);
+	} else if ((src_codec == UTF_CODEC_UTF32) && (dst_codec == UTF_CODEC_UTF16_BE) && is_aligned32(src)){
+		utf_kernel_utf32_to_utf16be((const char32_t *)(src), count, dst, &size);
+	} else {
+		return 0;
+	}
+
+	return 1;
+}
+
+/** Returns whether an address is aligned to a UTF-32 character. */
+
+static int is_aligned32(const void * ptr){
+	return (((size_t)(ptr)) % sizeof(char32_t)) == 0;
+}
+
+/** Decodes one character.
+ * @param keep Whether a surrogate on its own is decoded as it is, see @ref keep_surrogates.
+ *  A CESU-8 surrogate pair is then decoded as two surrogates,
+ *  and a UTF-32 one as the character it makes.
+ * @returns The length of the sequence, which is larger
+ *  than @p src_size if the sequence is incomplete.
+ *  If the sequence is invalid, zero is returned.
+ */
+
+static size_t decode_one(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * c, int keep){
+
+	size_t length = 0;
+	size_t count = 0;
+	char16_t in16[2];
+	char32_t out[4];
+
+	if (utf_codepage_get(codec) != NULL){
+		if (src_size < 1){
+			return 1;
+		}
+		return utf_codepage_decode(utf_codepage_get(codec), src[0], c);
+	}
+
+	switch (codec){
+		case UTF_CODEC_UTF8:
+			if (src_size < 1){
+				return 1;
+			}
+			length = utf8_decode_length((char)(src[0]));
+			if ((length > src_size)
+			 && (utf_kernel_utf8_subpart(src, src_size) <= src_size)){
+				/* it can't be completed, whatever comes next */
+				return 0;
+			} else if ((length == 0) || (length > src_size)){
+				return length;
+			} else if (utf_kernel_utf8_to_utf32(src, length, out, &count) != length){
+				return 0;
+			}
+			*c = out[0];
+			return length;
+		case UTF_CODEC_WTF8:
+			return utf_wtf8_decode(src, src_size, c, 0);
+		case UTF_CODEC_CESU8:
+			if (keep && (src_size > 3)){
+				/* one code unit, without looking for the other half of a pair */
+				return utf_cesu8_decode(src, 3, c, 1);
+			}
+			return utf_cesu8_decode(src, src_size, c, keep);
+		case UTF_CODEC_UTF16_LE:
+		case UTF_CODEC_UTF16_BE:
+			if (src_size < 2){
+				return 2;
+			}
+			if (codec == UTF_CODEC_UTF16_LE){
+				in16[0] = utf16le(src);
+			} else {
+				in16[0] = utf16be(src);
+			}
+			length = utf16_decode_length(in16[0]) * 2;
+			if ((length == 0) && keep){
+				/* a low surrogate on its own */
+				*c = in16[0];
+				return 2;
+			} else if ((length == 0) || (length > src_size)){
+				return length;
+			} else if (length == 4){
+				if (codec == UTF_CODEC_UTF16_LE){
+					in16[1] = utf16le(&src[2]);
+				} else {
+					in16[1] = utf16be(&src[2]);
+				}
+			}
+			if (utf16_decode(in16, c) == (length / 2)){
+				return length;
+			} else if (keep){
+				/* a high surrogate on its own */
+				*c = in16[0];
+				return 2;
+			}
+			return 0;
+		case UTF_CODEC_UTF32_LE:
+		case UTF_CODEC_UTF32_BE:
+			if (src_size < 4){
+				return 4;
+			}
+			*c = (codec == UTF_CODEC_UTF32_LE) ? utf32le(src) : utf32be(src);
+			if (!keep || (*c < 0xd800) || (*c > 0xdbff)){
+				return 4;
+			} else if (src_size < 8){
+				/* wait to see if a low surrogate follows */
+				return 8;
+			}
+			out[0] = (codec == UTF_CODEC_UTF32_LE) ? utf32le(&src[4]) : utf32be(&src[4]);
+			if ((out[0] < 0xdc00) || (out[0] > 0xdfff)){
+				return 4;
+			}
+			*c = 0x10000 + ((*c - 0xd800) << 10) + (out[0] - 0xdc00);
+			return 8;
+		default:
+			break;
+	}
+
+	return 0;
+}
+
+/** Decodes one character at the end of the input, where nothing follows it.
+ * A high surrogate that was waiting to see if its pair comes after it
+ * is then a character on its own, for the encoder to take or reject.
+ * In UTF-16 and UTF-32, that's only so if @p keep allows it.
+ * @returns The same as @ref decode_one, which is still larger
+ *  than @p src_size if the sequence is cut short.
+ */
+
+static size_t decode_end(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * c, int keep){
+
+	size_t length = 0;
+
+	length = decode_one(codec, src, src_size, c, keep);
+	if (length <= src_size){
+		return length;
+	}
+
+	switch (codec){
+		case UTF_CODEC_WTF8:
+			return utf_wtf8_decode(src, src_size, c, 1);
+		case UTF_CODEC_CESU8:
+			return utf_cesu8_decode(src, src_size, c, 1);
+		case UTF_CODEC_UTF16_LE:
+			if (keep && (src_size >= 2)){
+				*c = utf16le(src);
+				return 2;
+			}
+			break;
+		case UTF_CODEC_UTF16_BE:
+			if (keep && (src_size >= 2)){
+				*c = utf16be(src);
+				return 2;
+			}
+			break;
+		case UTF_CODEC_UTF32_LE:
+		case UTF_CODEC_UTF32_BE:
+			if (src_size >= 4){
+				/* the high surrogate of a pair, on its own */
+				*c = (codec == UTF_CODEC_UTF32_LE) ? utf32le(src) : utf32be(src);
+				return 4;
+			}
+			break;
+		default:
+			break;
+	}
+
+	return length;
+}
+
+/** Encodes one character.
+ * @param dst It must fit six bytes.
+ * @returns The number of bytes written to @p dst.
+ *  If the character can't be encoded, zero is returned.
+ */
+
+static size_t encode_one(utf_codec_t codec, char32_t c, unsigned char * dst){
+
+	size_t count = 0;
+	size_t k = 0;
+	char16_t out16[2];
+
+	if (utf_codepage_get(codec) != NULL){
+		return utf_codepage_encode(utf_codepage_get(codec), c, dst);
+	} else if (encode_length(codec, c) == 0){
+		return 0;
+	}
+
+	switch (codec){
+		case UTF_CODEC_UTF8:
+		case UTF_CODEC_WTF8:
+			return utf8_encode(c, (char *)(dst));
+		case UTF_CODEC_CESU8:
+			utf_cesu8_from_utf32(&c, 1, dst, &count);
+			return count;
+		case UTF_CODEC_UTF16_LE:
+		case UTF_CODEC_UTF16_BE:
+			count = utf16_encode(c, out16);
+			for (k = 0; k < count; k++){
+				if (codec == UTF_CODEC_UTF16_LE){
+					dst[(k * 2) + 0] = (unsigned char)(out16[k] & 0xff);
+					dst[(k * 2) + 1] = (unsigned char)(out16[k] >> 8);
+				} else {
+					dst[(k * 2) + 0] = (unsigned char)(out16[k] >> 8);
+					dst[(k * 2) + 1] = (unsigned char)(out16[k] & 0xff);
+				}
+			}
+			return count * 2;
+		case UTF_CODEC_UTF32_LE:
+			dst[0] = (c >> 0x00) & 0xff;
+			dst[1] = (c >> 0x08) & 0xff;
+			dst[2] = (c >> 0x10) & 0xff;
+			dst[3] = (c >> 0x18) & 0xff;
+			return 4;
+		case UTF_CODEC_UTF32_BE:
+			dst[0] = (c >> 0x18) & 0xff;
+			dst[1] = (c >> 0x10) & 0xff;
+			dst[2] = (c >> 0x08) & 0xff;
+			dst[3] = (c >> 0x00) & 0xff;
+			return 4;
+		default:
+			break;
+	}
+
+	return 0;
+}
+
+/** Encodes one character, or what the encoder replaces it with,
+ * if the codec doesn't have it and the encoder's policy allows.
+ * @param replaced Set to whether the character was replaced.
+ * @returns The number of bytes written to @p dst, or zero on failure.
+ */
+
+static size_t encode_char(const utf_encoder_t * encoder, char32_t c, unsigned char * dst, int * replaced){
+
+	size_t write_size = 0;
+
+	*replaced = 0;
+
+	write_size = encode_one(encoder->codec, c, dst);
+	if ((write_size == 0) && (encoder->policy == UTF_ENCODER_REPLACE)){
+		if (utf_codepage_get(encoder->codec) != NULL){
+			write_size = encode_one(encoder->codec, CODEPAGE_REPLACEMENT, dst);
+		} else {
+			write_size = encode_one(encoder->codec, 0xfffd, dst);
+		}
+		*replaced = 1;
+	}
+
+	return write_size;
+}
+
+/** Measures the output of a conversion one character at a time,
+ * for codecs that can't be measured from a character count.
+ * @param dst_size The output size is added to it.
+ */
+
+static utf_error_t measure_each(utf_codec_t src_codec, const unsigned char * src, size_t src_size, utf_codec_t dst_codec, size_t * dst_size){
+
+	size_t i = 0;
+	size_t length = 0;
+	size_t encoded_length = 0;
+	char32_t c = 0;
+	int keep = 0;
+
+	keep = keep_surrogates(src_codec, dst_codec);
+
+	/* the end of the buffer is the end of the input */
+
+	while (i < src_size){
+		length = decode_end(src_codec, &src[i], src_size - i, &c, keep);
+		if ((length == 0) || (length > (src_size - i))){
+			return UTF_ERROR_INVALID_SEQUENCE;
+		}
+		encoded_length = encode_length(dst_codec, c);
+		if (encoded_length == 0){
+			return UTF_ERROR_INVALID_SEQUENCE;
+		}
+		*dst_size += encoded_length;
+		i += length;
+	}
+
+	return UTF_ERROR_NONE;
+}
+
+/** Returns the number of bytes that @ref encode_one writes for a character.
+ * If the character can't be encoded, zero is returned.
+ */
+
+static size_t encode_length(utf_codec_t codec, char32_t c){
+
+	unsigned char byte;
+
+	if (utf_codepage_get(codec) != NULL){
+		return utf_codepage_encode(utf_codepage_get(codec), c, &byte);
+	}
+
+	/* only WTF-8, CESU-8 and UTF-16 keep surrogates */
+
+	if (((codec == UTF_CODEC_UTF8) || (codec == UTF_CODEC_UTF32_LE) || (codec == UTF_CODEC_UTF32_BE))
+	 && (c >= 0xd800) && (c <= 0xdfff)){
+		return 0;
+	}
+
+	switch (codec){
+		case UTF_CODEC_UTF8:
+		case UTF_CODEC_WTF8:
+			return utf8_encode_length(c);
+		case UTF_CODEC_CESU8:
+			/* a surrogate pair takes six bytes */
+			if ((c >= 0x10000) && (c < 0x110000)){
+				return 6;
+			}
+			return utf8_encode_length(c);
+		case UTF_CODEC_UTF16_LE:
+		case UTF_CODEC_UTF16_BE:
+			return utf16_encode_length(c) * 2;
+		case UTF_CODEC_UTF32_LE:
+		case UTF_CODEC_UTF32_BE:
+			return 4;
+		default:
+			break;
+	}
+	return 0;
+}
@@ -1,14 +1,124 @@
 #include <libutf/decoder.h>
 
 #include <assert.h>
+#include <string.h>
+
+static void test_utf8(void);
+
+static void test_utf8_split(void);
 
 static void test_utf16be(void);
 
+static void test_utf16le_split(void);
+
+static void test_ring(void);
+
+static void test_limit(void);
+
+static void test_lossy(void);
+
+static void test_detect(void);
+
+static void test_codepage(void);
+
+static void test_latin1(void);
+
+static void test_wtf8(void);
+
+static void test_cesu8(void);
+
+static void check_lossy(utf_codec_t codec, const char * input, unsigned int input_size, const utf32_t * expected, unsigned int expected_count);
+
 int main(void){
+	test_utf8();
+	test_utf8_split();
 	test_utf16be();
+	test_utf16le_split();
+	test_ring();
+	test_limit();
+	test_lossy();
+	test_detect();
+	test_codepage();
+	test_latin1();
+	test_wtf8();
+	test_cesu8();
 	return 0;
 }
 
+static void test_utf8(void){
+
+	/* "aó€𐐷" */
+	const char input[] = "a\xc3\xb3\xe2\x82\xac\xf0\x90\x90\xb7";
+
+	utf32_t output[4] = { 0, 0, 0, 0 };
+
+	utf_decoder_t decoder;
+
+	utf_decoder_init(&decoder);
+
+	assert(utf_decoder_write(&decoder, input, sizeof(input) - 1) == (sizeof(input) - 1));
+	assert(utf_decoder_avail(&decoder) == 4);
+	assert(utf_decoder_flush(&decoder) == UTF_ERROR_NONE);
+
+	assert(utf_decoder_read(&decoder, output, 4) == UTF_ERROR_NONE);
+	assert(output[0] == 0x61);
+	assert(output[1] == 0xf3);
+	assert(output[2] == 0x20ac);
+	assert(output[3] == 0x010437);
+	assert(utf_decoder_avail(&decoder) == 0);
+
+	/* invalid lead byte stops the write */
+	assert(utf_decoder_write(&decoder, "ab\xff" "c", 4) == 2);
+	assert(utf_decoder_avail(&decoder) == 2);
+	assert(utf_decoder_read(&decoder, output, 2) == UTF_ERROR_NONE);
+
+	/* so does an invalid sequence at the end, which isn't the start of one */
+	assert(utf_decoder_write(&decoder, "A\x80", 2) == 1);
+	assert(utf_decoder_write(&decoder, "A\xe0" "A", 3) == 1);
+	assert(utf_decoder_flush(&decoder) == UTF_ERROR_NONE);
+	assert(utf_decoder_avail(&decoder) == 2);
+	assert(utf_decoder_read(&decoder, output, 2) == UTF_ERROR_NONE);
+
+	/* or that the next write cuts short */
+	assert(utf_decoder_write(&decoder, "A\xe0", 2) == 2);
+	assert(utf_decoder_write(&decoder, "A", 1) == 0);
+	assert(utf_decoder_avail(&decoder) == 1);
+	assert(utf_decoder_flush(&decoder) == UTF_ERROR_INVALID_SEQUENCE);
+
+	utf_decoder_free(&decoder);
+}
+
+static void test_utf8_split(void){
+
+	/* "ó𐐷" split in the middle of each sequence */
+
+	utf32_t output[2] = { 0, 0 };
+
+	utf_decoder_t decoder;
+
+	utf_decoder_init(&decoder);
+
+	assert(utf_decoder_write(&decoder, "\xc3", 1) == 1);
+	assert(utf_decoder_avail(&decoder) == 0);
+	assert(utf_decoder_flush(&decoder) == UTF_ERROR_INVALID_SEQUENCE);
+
+	assert(utf_decoder_write(&decoder, "\xb3\xf0\x90", 3) == 3);
+	assert(utf_decoder_avail(&decoder) == 1);
+
+	assert(utf_decoder_write(&decoder, "\x90", 1) == 1);
+	assert(utf_decoder_avail(&decoder) == 1);
+
+	assert(utf_decoder_write(&decoder, "\xb7", 1) == 1);
+	assert(utf_decoder_avail(&decoder) == 2);
+	assert(utf_decoder_flush(&decoder) == UTF_ERROR_NONE);
+
+	assert(utf_decoder_read(&decoder, output, 2) == UTF_ERROR_NONE);
+	assert(output[0] == 0xf3);
+	assert(output[1] == 0x010437);
+
+	utf_decoder_free(&decoder);
+}
+
 static void test_utf16be(void){
 
 	/* UTF-32LE : 00 02 4B 62 */
@@ -45,3 +155,553 @@ static void test_utf16be(void){
 	utf_decoder_free(&decoder);
 }
 
+
+static void test_utf16le_split(void){
+
+	/* UTF-32    : 00 00 00 61, 00 01 04 37 */
+	/* UTF-16LE  : 61 00, 01 D8 37 DC */
+
+	utf32_t output[2] = { 0, 0 };
+
+	utf_decoder_t decoder;
+
+	utf_decoder_init(&decoder);
+
+	utf_decoder_set_codec(&decoder, UTF_CODEC_UTF16_LE);
+
+	assert(utf_decoder_write(&decoder, "\x61\x00\x01", 3) == 3);
+	assert(utf_decoder_avail(&decoder) == 1);
+
+	assert(utf_decoder_write(&decoder, "\xd8\x37", 2) == 2);
+	assert(utf_decoder_avail(&decoder) == 1);
+
+	assert(utf_decoder_write(&decoder, "\xdc", 1) == 1);
+	assert(utf_decoder_avail(&decoder) == 2);
+
+	assert(utf_decoder_read(&decoder, output, 2) == UTF_ERROR_NONE);
+	assert(output[0] == 0x61);
+	assert(output[1] == 0x010437);
+
+	/* unpaired low surrogate */
+	assert(utf_decoder_write(&decoder, "\x37\xdc", 2) == 0);
+	assert(utf_decoder_avail(&decoder) == 0);
+
+	utf_decoder_free(&decoder);
+}
+
+static void test_ring(void){
+
+	char input[128];
+
+	utf32_t output[64];
+
+	unsigned int i = 0;
+
+	utf_decoder_t decoder;
+
+	utf_decoder_init(&decoder);
+
+	for (i = 0; i < 20; i++){
+		input[i] = (char)('A' + i);
+	}
+
+	assert(utf_decoder_write(&decoder, input, 20) == 20);
+	assert(utf_decoder_read(&decoder, output, 16) == UTF_ERROR_NONE);
+	assert(output[0] == 'A');
+	assert(output[15] == 'P');
+	assert(utf_decoder_avail(&decoder) == 4);
+
+	/* "a" followed by "é", so that a sequence
+	 * is cut off by the end of the ring */
+
+	input[0] = 'a';
+	for (i = 0; i < 19; i++){
+		input[(i * 2) + 1] = '\xc3';
+		input[(i * 2) + 2] = '\xa9';
+	}
+
+	assert(utf_decoder_write(&decoder, input, 39) == 39);
+	assert(utf_decoder_avail(&decoder) == 24);
+
+	/* "€", which grows the ring while it's wrapped around */
+
+	for (i = 0; i < 40; i++){
+		input[(i * 3) + 0] = '\xe2';
+		input[(i * 3) + 1] = '\x82';
+		input[(i * 3) + 2] = '\xac';
+	}
+
+	assert(utf_decoder_write(&decoder, input, 120) == 120);
+	assert(utf_decoder_avail(&decoder) == 64);
+
+	assert(utf_decoder_read(&decoder, output, 64) == UTF_ERROR_NONE);
+	assert(utf_decoder_avail(&decoder) == 0);
+
+	for (i = 0; i < 4; i++){
+		assert(output[i] == ('Q' + i));
+	}
+
+	assert(output[4] == 'a');
+
+	for (i = 5; i < 24; i++){
+		assert(output[i] == 0xe9);
+	}
+
+	for (i = 24; i < 64; i++){
+		assert(output[i] == 0x20ac);
+	}
+
+	utf_decoder_free(&decoder);
+}
+
+static void test_limit(void){
+
+	const char input[] = "abcdefghijklmnopqrst";
+
+	utf32_t output[10];
+
+	utf_decoder_t decoder;
+
+	utf_decoder_init(&decoder);
+
+	utf_decoder_set_limit(&decoder, 10);
+	assert(utf_decoder_get_limit(&decoder) == 10);
+
+	assert(utf_decoder_write(&decoder, input, 20) == 10);
+	assert(utf_decoder_avail(&decoder) == 10);
+	assert(utf_decoder_write(&decoder, &input[10], 10) == 0);
+
+	assert(utf_decoder_read(&decoder, output, 4) == UTF_ERROR_NONE);
+	assert(output[0] == 'a');
+	assert(output[3] == 'd');
+
+	assert(utf_decoder_write(&decoder, &input[10], 10) == 4);
+	assert(utf_decoder_avail(&decoder) == 10);
+
+	assert(utf_decoder_read(&decoder, output, 10) == UTF_ERROR_NONE);
+	assert(output[0] == 'e');
+	assert(output[9] == 'n');
+
+	assert(utf_decoder_write(&decoder, &input[14], 6) == 6);
+	assert(utf_decoder_avail(&decoder) == 6);
+	assert(decoder.output_count_res <= 16);
+
+	utf_decoder_free(&decoder);
+}
+
+static void test_lossy(void){
+
+	/* the examples of maximal subparts from the Unicode standard, chapter 3 */
+
+	const char input1[] = "\x61\xf1\x80\x80\xe1\x80\xc2\x62\x80\x63\x80\xbf\x64";
+	const utf32_t expected1[] = { 'a', 0xfffd, 0xfffd, 0xfffd, 'b', 0xfffd, 'c', 0xfffd, 0xfffd, 'd' };
+
+	const char input2[] = "\xc0\xaf\xe0\x80\xbf\xf0\x81\x82\x41";
+	const utf32_t expected2[] = { 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 'A' };
+
+	const char input3[] = "\xed\xa0\x80\xed\xbf\xbf\xed\xaf\x41";
+	const utf32_t expected3[] = { 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 'A' };
+
+	const char input4[] = "\xf4\x91\x92\x93\xff\x41\x80\xbf\x42";
+	const utf32_t expected4[] = { 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 'A', 0xfffd, 0xfffd, 'B' };
+
+	const char input5[] = "\xe1\x80\xe2\xf0\x91\x92\xf1\xbf\x41";
+	const utf32_t expected5[] = { 0xfffd, 0xfffd, 0xfffd, 0xfffd, 'A' };
+
+	/* a sequence cut short by the end of the input */
+	const char input6[] = "\x41\xe2\x82";
+	const utf32_t expected6[] = { 'A', 0xfffd };
+
+	/* unpaired surrogates, and a pair */
+	const char input7[] = "\x41\x00\x3d\xd8\x42\x00\x00\xdc\x3d\xd8\x37\xdc\x3d\xd8";
+	const utf32_t expected7[] = { 'A', 0xfffd, 'B', 0xfffd, 0x1f437, 0xfffd };
+
+	check_lossy(UTF_CODEC_UTF8, input1, sizeof(input1) - 1, expected1, 10);
+	check_lossy(UTF_CODEC_UTF8, input2, sizeof(input2) - 1, expected2, 9);
+	check_lossy(UTF_CODEC_UTF8, input3, sizeof(input3) - 1, expected3, 9);
+	check_lossy(UTF_CODEC_UTF8, input4, sizeof(input4) - 1, expected4, 9);
+	check_lossy(UTF_CODEC_UTF8, input5, sizeof(input5) - 1, expected5, 5);
+	check_lossy(UTF_CODEC_UTF8, input6, sizeof(input6) - 1, expected6, 2);
+	check_lossy(UTF_CODEC_UTF16_LE, input7, sizeof(input7) - 1, expected7, 6);
+}
+
+/** Decodes the input with each lossy policy,
+ * all at once and then a byte at a time. */
+
+static void check_lossy(utf_codec_t codec, const char * input, unsigned int input_size, const utf32_t * expected, unsigned int expected_count){
+
+	utf32_t output[16];
+	unsigned int replace_count = 0;
+	unsigned int skip_count = 0;
+	unsigned int i = 0;
+	unsigned int j = 0;
+	unsigned int pass = 0;
+
+	utf_decoder_t decoder;
+
+	for (i = 0; i < expected_count; i++){
+		if (expected[i] == 0xfffd){
+			replace_count++;
+		}
+	}
+
+	for (pass = 0; pass < 4; pass++){
+
+		utf_decoder_init(&decoder);
+		utf_decoder_set_codec(&decoder, codec);
+		utf_decoder_set_policy(&decoder, (pass < 2) ? UTF_DECODER_REPLACE : UTF_DECODER_SKIP);
+
+		if ((pass % 2) == 0){
+			assert(utf_decoder_write(&decoder, input, input_size) == input_size);
+		} else {
+			for (i = 0; i < input_size; i++){
+				assert(utf_decoder_write(&decoder, &input[i], 1) == 1);
+			}
+		}
+
+		assert(utf_decoder_flush(&decoder) == UTF_ERROR_NONE);
+		assert(utf_decoder_get_invalid_count(&decoder) == replace_count);
+
+		if (pass < 2){
+			assert(utf_decoder_avail(&decoder) == expected_count);
+			assert(utf_decoder_read(&decoder, output, expected_count) == UTF_ERROR_NONE);
+			assert(memcmp(output, expected, expected_count * sizeof(utf32_t)) == 0);
+		} else {
+			skip_count = expected_count - replace_count;
+			assert(utf_decoder_avail(&decoder) == skip_count);
+			assert(utf_decoder_read(&decoder, output, skip_count) == UTF_ERROR_NONE);
+			for (i = 0, j = 0; i < expected_count; i++){
+				if (expected[i] != 0xfffd){
+					assert(output[j++] == expected[i]);
+				}
+			}
+		}
+
+		utf_decoder_free(&decoder);
+	}
+
+	/* and the default stops at the first invalid sequence */
+
+	utf_decoder_init(&decoder);
+	utf_decoder_set_codec(&decoder, codec);
+	assert(utf_decoder_get_policy(&decoder) == UTF_DECODER_STRICT);
+	i = 0;
+	while ((i < expected_count) && (expected[i] != 0xfffd)){
+		i++;
+	}
+	utf_decoder_write(&decoder, input, input_size);
+	assert(utf_decoder_avail(&decoder) == i);
+	assert(utf_decoder_get_invalid_count(&decoder) == 0);
+	utf_decoder_free(&decoder);
+}
+
+static void test_detect(void){
+
+	/* "a€" */
+	const char utf8_bom[] = "\xef\xbb\xbf" "a\xe2\x82\xac";
+	const char utf16le_bom[] = "\xff\xfe" "a\x00\xac\x20";
+	const char utf32le_bom[] = "\xff\xfe\x00\x00" "a\x00\x00\x00\xac\x20\x00\x00";
+	const char utf16be[] = "\x00" "a\x20\xac\x00" "b";
+
+	utf32_t output[4];
+	size_t bom_size = 0;
+	unsigned int i = 0;
+
+	utf_decoder_t decoder;
+
+	assert(utf_codec_detect(utf8_bom, sizeof(utf8_bom) - 1, &bom_size) == UTF_CODEC_UTF8);
+	assert(bom_size == 3);
+	assert(utf_codec_detect(utf16le_bom, sizeof(utf16le_bom) - 1, &bom_size) == UTF_CODEC_UTF16_LE);
+	assert(bom_size == 2);
+	assert(utf_codec_detect(utf32le_bom, sizeof(utf32le_bom) - 1, &bom_size) == UTF_CODEC_UTF32_LE);
+	assert(bom_size == 4);
+	assert(utf_codec_detect(utf16be, sizeof(utf16be) - 1, &bom_size) == UTF_CODEC_UTF16_BE);
+	assert(bom_size == 0);
+	assert(utf_codec_detect("a\x00\x00\x00" "b\x00\x00\x00", 8, &bom_size) == UTF_CODEC_UTF32_LE);
+	assert(utf_codec_detect("\x00\x00\x00" "a\x00\x00\x00" "b", 8, &bom_size) == UTF_CODEC_UTF32_BE);
+	assert(utf_codec_detect("plain ASCII", 11, &bom_size) == UTF_CODEC_UTF8);
+	assert(bom_size == 0);
+
+	/* too short to tell the UTF-32LE mark from the UTF-16LE one */
+	utf_codec_detect(utf32le_bom, 3, &bom_size);
+	assert(bom_size > 3);
+
+	/* the mark is dropped */
+	utf_decoder_init(&decoder);
+	utf_decoder_set_codec(&decoder, UTF_CODEC_AUTO);
+	assert(utf_decoder_write(&decoder, utf8_bom, sizeof(utf8_bom) - 1) == (sizeof(utf8_bom) - 1));
+	assert(utf_decoder_get_codec(&decoder) == UTF_CODEC_UTF8);
+	assert(utf_decoder_avail(&decoder) == 2);
+	assert(utf_decoder_read(&decoder, output, 2) == UTF_ERROR_NONE);
+	assert(output[0] == 0x61);
+	assert(output[1] == 0x20ac);
+	utf_decoder_free(&decoder);
+
+	/* and split between writes */
+	utf_decoder_init(&decoder);
+	utf_decoder_set_codec(&decoder, UTF_CODEC_AUTO);
+	for (i = 0; i < (sizeof(utf32le_bom) - 1); i++){
+		assert(utf_decoder_write(&decoder, &utf32le_bom[i], 1) == 1);
+		assert(utf_decoder_get_codec(&decoder) == ((i < 3) ? UTF_CODEC_AUTO : UTF_CODEC_UTF32_LE));
+	}
+	assert(utf_decoder_avail(&decoder) == 2);
+	assert(utf_decoder_read(&decoder, output, 2) == UTF_ERROR_NONE);
+	assert(output[0] == 0x61);
+	assert(output[1] == 0x20ac);
+	utf_decoder_free(&decoder);
+
+	/* the bytes that were kept to look for a mark are decoded */
+	utf_decoder_init(&decoder);
+	utf_decoder_set_codec(&decoder, UTF_CODEC_AUTO);
+	assert(utf_decoder_write(&decoder, utf16be, 1) == 1);
+	assert(utf_decoder_write(&decoder, &utf16be[1], sizeof(utf16be) - 2) == (sizeof(utf16be) - 2));
+	assert(utf_decoder_get_codec(&decoder) == UTF_CODEC_UTF16_BE);
+	assert(utf_decoder_avail(&decoder) == 3);
+	assert(utf_decoder_read(&decoder, output, 3) == UTF_ERROR_NONE);
+	assert(output[0] == 0x61);
+	assert(output[1] == 0x20ac);
+	assert(output[2] == 0x62);
+	utf_decoder_free(&decoder);
+
+	/* without a mark, the codec isn't guessed from the first byte */
+	utf_decoder_init(&decoder);
+	utf_decoder_set_codec(&decoder, UTF_CODEC_AUTO);
+	for (i = 0; i < 8; i++){
+		assert(utf_decoder_write(&decoder, &"a\x00" "b\x00" "c\x00" "d\x00"[i], 1) == 1);
+		assert(utf_decoder_get_codec(&decoder) == ((i < 3) ? UTF_CODEC_AUTO : UTF_CODEC_UTF16_LE));
+	}
+	assert(utf_decoder_avail(&decoder) == 4);
+	assert(utf_decoder_read(&decoder, output, 4) == UTF_ERROR_NONE);
+	assert(output[0] == 'a');
+	assert(output[3] == 'd');
+	utf_decoder_free(&decoder);
+
+	utf_decoder_init(&decoder);
+	utf_decoder_set_codec(&decoder, UTF_CODEC_AUTO);
+	for (i = 0; i < 8; i++){
+		assert(utf_decoder_write(&decoder, &"a\x00\x00\x00" "b\x00\x00\x00"[i], 1) == 1);
+	}
+	assert(utf_decoder_get_codec(&decoder) == UTF_CODEC_UTF32_LE);
+	assert(utf_decoder_avail(&decoder) == 2);
+	assert(utf_decoder_read(&decoder, output, 2) == UTF_ERROR_NONE);
+	assert(output[0] == 'a');
+	assert(output[1] == 'b');
+	utf_decoder_free(&decoder);
+
+	/* the input ends before there's enough to tell */
+	utf_decoder_init(&decoder);
+	utf_decoder_set_codec(&decoder, UTF_CODEC_AUTO);
+	assert(utf_decoder_write(&decoder, "\xfe", 1) == 1);
+	assert(utf_decoder_get_codec(&decoder) == UTF_CODEC_AUTO);
+	assert(utf_decoder_flush(&decoder) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(utf_decoder_get_codec(&decoder) == UTF_CODEC_UTF8);
+	utf_decoder_free(&decoder);
+
+	utf_decoder_init(&decoder);
+	utf_decoder_set_codec(&decoder, UTF_CODEC_AUTO);
+	assert(utf_decoder_flush(&decoder) == UTF_ERROR_NONE);
+	assert(utf_decoder_write(&decoder, "\x00", 1) == 1);
+	assert(utf_decoder_flush(&decoder) == UTF_ERROR_NONE);
+	assert(utf_decoder_avail(&decoder) == 1);
+	utf_decoder_free(&decoder);
+}
+
+static void test_codepage(void){
+
+	/* "a€é" and a byte that isn't used */
+	const char input[] = "a\x80\xe9\x81" "b";
+
+	utf32_t output[4];
+
+	utf_decoder_t decoder;
+
+	utf_decoder_init(&decoder);
+	utf_decoder_set_codec(&decoder, UTF_CODEC_WINDOWS_1252);
+
+	assert(utf_decoder_write(&decoder, input, sizeof(input) - 1) == 3);
+	assert(utf_decoder_avail(&decoder) == 3);
+	assert(utf_decoder_read(&decoder, output, 3) == UTF_ERROR_NONE);
+	assert(output[0] == 0x61);
+	assert(output[1] == 0x20ac);
+	assert(output[2] == 0xe9);
+
+	utf_decoder_set_policy(&decoder, UTF_DECODER_REPLACE);
+	assert(utf_decoder_write(&decoder, &input[3], 2) == 2);
+	assert(utf_decoder_avail(&decoder) == 2);
+	assert(utf_decoder_read(&decoder, output, 2) == UTF_ERROR_NONE);
+	assert(output[0] == 0xfffd);
+	assert(output[1] == 0x62);
+	assert(utf_decoder_get_invalid_count(&decoder) == 1);
+
+	/* the same bytes in other codepages */
+	utf_decoder_set_codec(&decoder, UTF_CODEC_ISO_8859_5);
+	assert(utf_decoder_write(&decoder, input, sizeof(input) - 1) == (sizeof(input) - 1));
+	assert(utf_decoder_read(&decoder, output, 4) == UTF_ERROR_NONE);
+	assert(output[1] == 0x80);
+	assert(output[2] == 0x449);
+	assert(output[3] == 0x81);
+
+	utf_decoder_free(&decoder);
+}
+
+static void test_latin1(void){
+
+	unsigned char input[256];
+	utf32_t output[256];
+	unsigned int i;
+
+	utf_decoder_t decoder;
+
+	for (i = 0; i < 256; i++){
+		input[i] = (unsigned char)(i);
+	}
+
+	utf_decoder_init(&decoder);
+
+	/* every byte is the character of the same value */
+	utf_decoder_set_codec(&decoder, UTF_CODEC_LATIN1);
+	assert(utf_decoder_write(&decoder, input, 256) == 256);
+	assert(utf_decoder_read(&decoder, output, 256) == UTF_ERROR_NONE);
+	for (i = 0; i < 256; i++){
+		assert(output[i] == i);
+	}
+
+	/* ASCII has none of the bytes from 0x80 on */
+	utf_decoder_set_codec(&decoder, UTF_CODEC_ASCII);
+	assert(utf_decoder_write(&decoder, input, 256) == 128);
+	assert(utf_decoder_read(&decoder, output, 128) == UTF_ERROR_NONE);
+	for (i = 0; i < 128; i++){
+		assert(output[i] == i);
+	}
+
+	utf_decoder_set_policy(&decoder, UTF_DECODER_REPLACE);
+	assert(utf_decoder_write(&decoder, &input[126], 4) == 4);
+	assert(utf_decoder_avail(&decoder) == 4);
+	assert(utf_decoder_read(&decoder, output, 4) == UTF_ERROR_NONE);
+	assert(output[0] == 0x7e);
+	assert(output[1] == 0x7f);
+	assert(output[2] == 0xfffd);
+	assert(output[3] == 0xfffd);
+	assert(utf_decoder_get_invalid_count(&decoder) == 2);
+
+	utf_decoder_free(&decoder);
+}
+
+static void test_wtf8(void){
+
+	/* "a", U+D800 on its own, "𐐷", U+DC00 on its own */
+	const char input[] = "a\xed\xa0\x80\xf0\x90\x90\xb7\xed\xb0\x80";
+	const utf32_t pair_expected[] = { 0xfffd, 0xdc00, 'a' };
+	utf32_t output[4];
+	unsigned int i;
+
+	utf_decoder_t decoder;
+
+	utf_decoder_init(&decoder);
+	utf_decoder_set_codec(&decoder, UTF_CODEC_WTF8);
+
+	assert(utf_decoder_write(&decoder, input, 11) == 11);
+	assert(utf_decoder_read(&decoder, output, 4) == UTF_ERROR_NONE);
+	assert(output[0] == 'a');
+	assert(output[1] == 0xd800);
+	assert(output[2] == 0x10437);
+	assert(output[3] == 0xdc00);
+
+	/* one byte at a time */
+	for (i = 0; i < 11; i++){
+		assert(utf_decoder_write(&decoder, &input[i], 1) == 1);
+	}
+	assert(utf_decoder_read(&decoder, output, 4) == UTF_ERROR_NONE);
+	assert(output[1] == 0xd800);
+	assert(output[3] == 0xdc00);
+
+	/* the rest of UTF-8 is as strict as ever */
+	assert(utf_decoder_write(&decoder, "\xc0\x80", 2) == 0);
+	assert(utf_decoder_write(&decoder, "\xed\xa0" "a", 3) == 0);
+	assert(utf_decoder_write(&decoder, "a\x80", 2) == 1);
+	assert(utf_decoder_write(&decoder, "a\xe0" "a", 3) == 1);
+	assert(utf_decoder_avail(&decoder) == 2);
+	assert(utf_decoder_flush(&decoder) == UTF_ERROR_NONE);
+
+	utf_decoder_free(&decoder);
+
+	utf_decoder_init(&decoder);
+	utf_decoder_set_codec(&decoder, UTF_CODEC_WTF8);
+
+	/* a pair is one sequence, it can't be written as two surrogates */
+	assert(utf_decoder_write(&decoder, "a\xed\xa0\x80\xed\xb0\x80", 7) == 1);
+	assert(utf_decoder_write(&decoder, "\xed\xa0\x80", 3) == 3);
+	assert(utf_decoder_avail(&decoder) == 1);
+	utf_decoder_write(&decoder, "\xed\xb0\x80", 3);
+	assert(utf_decoder_avail(&decoder) == 1);
+	assert(utf_decoder_flush(&decoder) == UTF_ERROR_INVALID_SEQUENCE);
+
+	utf_decoder_free(&decoder);
+
+	/* a high surrogate at the end waits to see what follows it */
+	utf_decoder_init(&decoder);
+	utf_decoder_set_codec(&decoder, UTF_CODEC_WTF8);
+	assert(utf_decoder_write(&decoder, "a\xed\xa0\x80", 4) == 4);
+	assert(utf_decoder_avail(&decoder) == 1);
+	assert(utf_decoder_flush(&decoder) == UTF_ERROR_NONE);
+	assert(utf_decoder_read(&decoder, output, 2) == UTF_ERROR_NONE);
+	assert(output[0] == 'a');
+	assert(output[1] == 0xd800);
+	utf_decoder_free(&decoder);
+
+	/* replaced, the high surrogate is the invalid part */
+	check_lossy(UTF_CODEC_WTF8, "\xed\xa0\x80\xed\xb0\x80" "a", 7, pair_expected, 3);
+}
+
+static void test_cesu8(void){
+
+	/* "a", "𐐷" as a pair, U+D800 on its own, "€", U+DC00 on its own */
+	const char input[] = "a\xed\xa0\x81\xed\xb0\xb7\xed\xa0\x80\xe2\x82\xac\xed\xb0\x80";
+	utf32_t output[5];
+	unsigned int i;
+
+	utf_decoder_t decoder;
+
+	utf_decoder_init(&decoder);
+	utf_decoder_set_codec(&decoder, UTF_CODEC_CESU8);
+
+	assert(utf_decoder_write(&decoder, input, 16) == 16);
+	assert(utf_decoder_avail(&decoder) == 5);
+	assert(utf_decoder_read(&decoder, output, 5) == UTF_ERROR_NONE);
+	assert(output[0] == 'a');
+	assert(output[1] == 0x10437);
+	assert(output[2] == 0xd800);
+	assert(output[3] == 0x20ac);
+	assert(output[4] == 0xdc00);
+
+	/* the pair is put back together across writes */
+	for (i = 0; i < 16; i++){
+		assert(utf_decoder_write(&decoder, &input[i], 1) == 1);
+	}
+	assert(utf_decoder_avail(&decoder) == 5);
+	assert(utf_decoder_read(&decoder, output, 5) == UTF_ERROR_NONE);
+	assert(output[1] == 0x10437);
+	assert(output[2] == 0xd800);
+
+	/* a high surrogate at the end waits for its pair, until the decoder is flushed */
+	assert(utf_decoder_write(&decoder, "\xed\xa0\x80", 3) == 3);
+	assert(utf_decoder_avail(&decoder) == 0);
+	assert(utf_decoder_flush(&decoder) == UTF_ERROR_NONE);
+	assert(utf_decoder_read(&decoder, output, 1) == UTF_ERROR_NONE);
+	assert(output[0] == 0xd800);
+
+	/* four byte sequences aren't CESU-8 */
+	assert(utf_decoder_write(&decoder, "\xf0\x90\x90\xb7", 4) == 0);
+
+	utf_decoder_set_policy(&decoder, UTF_DECODER_REPLACE);
+	/* where no byte starts a sequence, each one is replaced */
+	assert(utf_decoder_write(&decoder, "\xf0\x90\x90\xb7" "a", 5) == 5);
+	assert(utf_decoder_read(&decoder, output, 5) == UTF_ERROR_NONE);
+	for (i = 0; i < 4; i++){
+		assert(output[i] == 0xfffd);
+	}
+	assert(output[4] == 'a');
+	assert(utf_decoder_get_invalid_count(&decoder) == 4);
+
+	utf_decoder_free(&decoder);
+}
@@ -20,35 +20,78 @@
 #include <libutf/utf16.h>
 #include <libutf/utf32.h>
 
+#include "codepage.h"
+#include "kernel.h"
+#include "wtf8.h"
+
 #include <stdlib.h>
 #include <string.h>
 
-static utf_error_t add_output_char(utf_decoder_t * decoder, char32_t output);
+/** Decodes as many complete sequences as possible from a block of input.
+ * Decoding stops at the end of the input, at an incomplete sequence
+ * or at an invalid sequence.
+ * @param codec The codec of the input.
+ * @param src The encoded input.
+ * @param src_size The number of bytes in @p src.
+ * @param dst The address to write the decoded characters to.
+ *  It must fit one character for every code unit in @p src.
+ * @param dst_count Set to the number of characters written to @p dst.
+ * @returns The number of bytes consumed from @p src.
+ */
+
+typedef size_t (*decode_block_t)(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count);
+
+static decode_block_t get_decode_block(utf_codec_t codec);
+
+static size_t decode_utf8(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count);
+
+static size_t decode_utf16be(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count);
+
+static size_t decode_utf16le(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count);
+
+static size_t decode_utf32be(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count);
+
+static size_t decode_utf32le(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count);
+
+static size_t decode_codepage(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count);
+
+static size_t decode_wtf8(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count);
 
-static utf_error_t decode(utf_decoder_t * decoder);
+static size_t decode_cesu8(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count);
 
-static utf_error_t decode_utf8(utf_decoder_t * decoder);
+static int decode_sequence(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * c);
 
-static utf_error_t decode_utf16be(utf_decoder_t * decoder);
+static size_t sequence_length(utf_codec_t codec, const unsigned char * src, size_t src_size);
 
-static utf_error_t decode_utf16le(utf_decoder_t * decoder);
+static size_t invalid_length(utf_codec_t codec, const unsigned char * src, size_t src_size);
 
-static utf_error_t decode_utf32be(utf_decoder_t * decoder);
+static utf_error_t write_detect(utf_decoder_t * decoder, const unsigned char * src, size_t src_size, size_t * write_count);
 
-static utf_error_t decode_utf32le(utf_decoder_t * decoder);
+static utf_error_t write_carry(utf_decoder_t * decoder, const unsigned char * src, size_t src_size, size_t * write_count);
 
-static utf_error_t write_byte(utf_decoder_t * decoder, unsigned char byte);
+static utf_error_t write_carry_lossy(utf_decoder_t * decoder, const unsigned char * src, size_t src_size, size_t * write_count);
+
+static unsigned long int round_up(unsigned long int count);
+
+static unsigned long int output_space(const utf_decoder_t * decoder);
+
+static utf_error_t output_grow(utf_decoder_t * decoder, unsigned long int count);
+
+static unsigned long int output_tail(utf_decoder_t * decoder, char32_t ** tail);
+
+static utf_error_t output_push(utf_decoder_t * decoder, char32_t c);
 
 void utf_decoder_init(utf_decoder_t * decoder){
-	decoder->input_byte_array[0] = 0;
-	decoder->input_byte_array[1] = 0;
-	decoder->input_byte_array[2] = 0;
-	decoder->input_byte_array[3] = 0;
+	memset(decoder->input_byte_array, 0, sizeof(decoder->input_byte_array));
 	decoder->input_byte_count = 0;
 	decoder->codec = UTF_CODEC_UTF8;
 	decoder->output_array = NULL;
+	decoder->output_index = 0;
 	decoder->output_count = 0;
 	decoder->output_count_res = 0;
+	decoder->output_count_max = 0;
+	decoder->policy = UTF_DECODER_STRICT;
+	decoder->invalid_count = 0;
 }
 
 void utf_decoder_free(utf_decoder_t * decoder){
@@ -63,14 +106,73 @@ unsigned int utf_decoder_avail(const utf_decoder_t * decoder){
 
 utf_error_t utf_decoder_flush(utf_decoder_t * decoder){
 
-	size_t i = 0;
+	utf_error_t error = UTF_ERROR_NONE;
+	unsigned char head[4];
+	size_t head_size = 0;
+	size_t bom_size = 0;
+	char32_t c = 0;
+
+	/* the input was too short to tell whether it
+	 * started with a byte order mark, so it doesn't */
+
+	if ((decoder->codec == UTF_CODEC_AUTO)
+	 && (decoder->input_byte_count > 0)){
+		head_size = decoder->input_byte_count;
+		memcpy(head, decoder->input_byte_array, head_size);
+		decoder->codec = utf_codec_detect(head, head_size, &bom_size);
+		if (bom_size > head_size){
+			bom_size = 0;
+		}
+		decoder->input_byte_count = 0;
+		if (utf_decoder_write(decoder, &head[bom_size], head_size - bom_size) < (head_size - bom_size)){
+			return UTF_ERROR_INVALID_SEQUENCE;
+		}
+	}
 
-	for (i = decoder->input_byte_count; i < 4; i++){
-		decoder->input_byte_array[i] = 0;
+	/* a CESU-8 or WTF-8 high surrogate at the end waits to see if a low
+	 * one follows it, so with nothing after it, it's a character on its own */
+
+	if ((decoder->input_byte_count >= 3)
+	 && (((decoder->codec == UTF_CODEC_CESU8)
+	   && (utf_cesu8_decode(decoder->input_byte_array, decoder->input_byte_count, &c, 1) == 3))
+	  || ((decoder->codec == UTF_CODEC_WTF8)
+	   && (utf_wtf8_decode(decoder->input_byte_array, decoder->input_byte_count, &c, 1) == 3)))){
+		if (output_space(decoder) == 0){
+			return UTF_ERROR_OVERFLOW;
+		}
+		error = output_push(decoder, c);
+		if (error){
+			return error;
+		}
+		decoder->input_byte_count -= 3;
+		memmove(decoder->input_byte_array,
+		        &decoder->input_byte_array[3],
+		        decoder->input_byte_count);
 	}
 
-	while ((decoder->input_byte_count > 0)
-	    && (decode(decoder) == UTF_ERROR_NONE));
+	/* complete sequences are decoded as soon as they're written,
+	 * so anything left over is an incomplete sequence */
+
+	if (decoder->input_byte_count == 0){
+		return UTF_ERROR_NONE;
+	} else if (decoder->policy == UTF_DECODER_STRICT){
+		return UTF_ERROR_INVALID_SEQUENCE;
+	}
+
+	/* which is one maximal subpart */
+
+	if (decoder->policy == UTF_DECODER_REPLACE){
+		if (output_space(decoder) == 0){
+			return UTF_ERROR_OVERFLOW;
+		}
+		error = output_push(decoder, 0xfffd);
+		if (error){
+			return error;
+		}
+	}
+
+	decoder->input_byte_count = 0;
+	decoder->invalid_count++;
 
 	return UTF_ERROR_NONE;
 }
@@ -79,9 +181,22 @@ utf_codec_t utf_decoder_get_codec(const utf_decoder_t * decoder){
 	return decoder->codec;
 }
 
+unsigned long int utf_decoder_get_limit(const utf_decoder_t * decoder){
+	return decoder->output_count_max;
+}
+
+utf_decoder_policy_t utf_decoder_get_policy(const utf_decoder_t * decoder){
+	return decoder->policy;
+}
+
+unsigned long int utf_decoder_get_invalid_count(const utf_decoder_t * decoder){
+	return decoder->invalid_count;
+}
+
 utf_error_t utf_decoder_read(utf_decoder_t * decoder, char32_t * dst, unsigned long int dst_count){
 
 	unsigned long int read_count;
+	unsigned long int head_count;
 
 	if (dst_count > decoder->output_count){
 		read_count = decoder->output_count;
@@ -89,28 +204,77 @@ utf_error_t utf_decoder_read(utf_decoder_t * decoder, char32_t * dst, unsigned l
 		read_count = dst_count;
 	}
 
-	memcpy(dst, decoder->output_array, read_count * sizeof(char32_t));
+	if (read_count == 0){
+		return UTF_ERROR_NONE;
+	}
 
-	memmove(decoder->output_array,
-	        &decoder->output_array[read_count],
-	        (decoder->output_count - read_count) * sizeof(char32_t));
+	/* the characters may wrap around the end of the ring */
 
+	head_count = decoder->output_count_res - decoder->output_index;
+	if (head_count > read_count){
+		head_count = read_count;
+	}
+
+	memcpy(dst,
+	       &decoder->output_array[decoder->output_index],
+	       head_count * sizeof(char32_t));
+
+	memcpy(&dst[head_count],
+	       decoder->output_array,
+	       (read_count - head_count) * sizeof(char32_t));
+
+	decoder->output_index += read_count;
+	decoder->output_index &= decoder->output_count_res - 1;
 	decoder->output_count -= read_count;
 
+	if (decoder->output_count == 0){
+		decoder->output_index = 0;
+	}
+
 	return UTF_ERROR_NONE;
 }
 
 utf_error_t utf_decoder_reserve(utf_decoder_t * decoder, unsigned long int count){
-	char32_t * tmp;
-	tmp = realloc(decoder->output_array, count * sizeof(char32_t));
-	if ((tmp == NULL) && (count > 0)){
+
+	char32_t * tmp = NULL;
+	unsigned long int res = 0;
+	unsigned long int keep_count = 0;
+
+	if (count == 0){
+		free(decoder->output_array);
+		decoder->output_array = NULL;
+		decoder->output_index = 0;
+		decoder->output_count = 0;
+		decoder->output_count_res = 0;
+		return UTF_ERROR_NONE;
+	}
+
+	res = round_up(count);
+	if (res == 0){
 		return UTF_ERROR_MALLOC;
 	}
-	decoder->output_array = tmp;
-	decoder->output_count_res = count;
-	if (count < decoder->output_count){
-		decoder->output_count = count;
+
+	tmp = malloc(res * sizeof(char32_t));
+	if (tmp == NULL){
+		return UTF_ERROR_MALLOC;
+	}
+
+	/* unwrap the oldest characters into the new ring */
+
+	keep_count = decoder->output_count;
+	if (keep_count > count){
+		keep_count = count;
 	}
+
+	utf_decoder_read(decoder, tmp, keep_count);
+
+	free(decoder->output_array);
+
+	decoder->output_array = tmp;
+	decoder->output_index = 0;
+	decoder->output_count = keep_count;
+	decoder->output_count_res = res;
+
 	return UTF_ERROR_NONE;
 }
 
@@ -118,198 +282,718 @@ void utf_decoder_set_codec(utf_decoder_t * decoder, utf_codec_t codec){
 	decoder->codec = codec;
 }
 
+void utf_decoder_set_limit(utf_decoder_t * decoder, unsigned long int count){
+	decoder->output_count_max = count;
+}
+
+void utf_decoder_set_policy(utf_decoder_t * decoder, utf_decoder_policy_t policy){
+	decoder->policy = policy;
+}
+
 unsigned int utf_decoder_write(utf_decoder_t * decoder, const void * src, unsigned int src_size){
 
 	utf_error_t error = UTF_ERROR_NONE;
+	decode_block_t decode_block = NULL;
+	size_t i = 0;
+	size_t length = 0;
+	size_t min_bytes = 0;
+	size_t block_size = 0;
+	size_t block_count = 0;
+	size_t decode_size = 0;
+	unsigned long int space = 0;
+	unsigned long int tail_count = 0;
+	char32_t * tail = NULL;
+	const unsigned char * src8 = (const unsigned char *)(src);
 
-	unsigned int i = 0;
+	if (decoder->codec == UTF_CODEC_AUTO){
+		error = write_detect(decoder, src8, src_size, &i);
+		if ((error != UTF_ERROR_NONE)
+		 || (decoder->codec == UTF_CODEC_AUTO)){
+			return i;
+		}
+		return i + utf_decoder_write(decoder, &src8[i], src_size - i);
+	}
 
-	const unsigned char * src8 = (const unsigned char *)(src);
+	decode_block = get_decode_block(decoder->codec);
+	if (decode_block == NULL){
+		return 0;
+	}
 
-	for (i = 0; i < src_size; i++){
-		error = write_byte(decoder, src8[i]);
-		if (error != UTF_ERROR_NONE){
-			break;
+	min_bytes = utf_codec_min_bytes(decoder->codec);
+
+	/* finish the sequence left over from the last write */
+
+	if (decoder->input_byte_count > 0){
+		if (decoder->policy == UTF_DECODER_STRICT){
+			error = write_carry(decoder, src8, src_size, &i);
+		} else {
+			error = write_carry_lossy(decoder, src8, src_size, &i);
+		}
+		if ((error != UTF_ERROR_NONE)
+		 || (decoder->input_byte_count > 0)){
+			return i;
 		}
 	}
 
-	return i;
-}
+	while (i < src_size){
 
-static utf_error_t add_output_char(utf_decoder_t * decoder, char32_t output){
-	utf_error_t error;
-	if (decoder->output_count >= decoder->output_count_res){
-		error = utf_decoder_reserve(decoder, decoder->output_count_res + 32);
+		/* there can't be more characters
+		 * than code units left in the input */
+
+		space = output_space(decoder);
+		if (space > ((src_size - i) / min_bytes)){
+			space = (src_size - i) / min_bytes;
+		}
+
+		if (space == 0){
+			break;
+		}
+
+		error = output_grow(decoder, space);
 		if (error){
-			return error;
+			return i;
+		}
+
+		/* decode as much as fits before the end of the ring */
+
+		tail_count = output_tail(decoder, &tail);
+		if (tail_count > space){
+			tail_count = space;
+		}
+
+		block_size = tail_count * min_bytes;
+
+		decode_size = decode_block(decoder->codec, &src8[i], block_size, tail, &block_count);
+
+		decoder->output_count += block_count;
+
+		i += decode_size;
+
+		if (decode_size == block_size){
+			continue;
 		}
+
+		/* the block stopped early, at an invalid sequence, at an incomplete
+		 * sequence or at a sequence that was cut off by the end of the block */
+
+		if (decoder->policy != UTF_DECODER_STRICT){
+			length = invalid_length(decoder->codec, &src8[i], src_size - i);
+			if ((length > 0) && (length <= (src_size - i))){
+				/* there's room for the replacement, the same as below */
+				if (decoder->policy == UTF_DECODER_REPLACE){
+					tail[block_count] = 0xfffd;
+					decoder->output_count++;
+				}
+				decoder->invalid_count++;
+				i += length;
+				continue;
+			}
+		}
+
+		length = sequence_length(decoder->codec, &src8[i], src_size - i);
+		if ((length == 0)
+		 || (length > (src_size - i))
+		 || !decode_sequence(decoder->codec, &src8[i], length, &tail[block_count])){
+			break;
+		}
+
+		/* there's room for it, since the block
+		 * was cut off before tail_count characters */
+
+		decoder->output_count++;
+		i += length;
 	}
-	decoder->output_array[decoder->output_count] = output;
-	decoder->output_count++;
-	return UTF_ERROR_NONE;
-}
 
-static utf_error_t decode(utf_decoder_t * decoder){
+	/* keep an incomplete sequence at the end
+	 * of the input for the next write */
 
-	utf_error_t error = UTF_ERROR_NONE;
+	if ((i < src_size) && (output_space(decoder) > 0)){
+		length = sequence_length(decoder->codec, &src8[i], src_size - i);
+		if (length > (src_size - i)){
+			memcpy(decoder->input_byte_array, &src8[i], src_size - i);
+			decoder->input_byte_count = src_size - i;
+			i = src_size;
+		}
+	}
 
-	switch (decoder->codec){
+	return i;
+}
+
+static decode_block_t get_decode_block(utf_codec_t codec){
+	if (utf_codepage_get(codec) != NULL){
+		return decode_codepage;
+	}
+	switch (codec){
 		case UTF_CODEC_UTF8:
-			error = decode_utf8(decoder);
-			break;
+			return decode_utf8;
 		case UTF_CODEC_UTF16_LE:
-			error = decode_utf16le(decoder);
-			break;
+			return decode_utf16le;
 		case UTF_CODEC_UTF16_BE:
-			error = decode_utf16be(decoder);
-			break;
+			return decode_utf16be;
 		case UTF_CODEC_UTF32_LE:
-			error = decode_utf32le(decoder);
-			break;
+			return decode_utf32le;
 		case UTF_CODEC_UTF32_BE:
-			error = decode_utf32be(decoder);
-			break;
+			return decode_utf32be;
+		case UTF_CODEC_WTF8:
+			return decode_wtf8;
+		case UTF_CODEC_CESU8:
+			return decode_cesu8;
 		default:
 			break;
 	}
+	return NULL;
+}
 
-	return error;
+static size_t decode_utf8(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count){
+	(void) codec;
+	return utf_kernel_utf8_to_utf32(src, src_size, dst, dst_count);
 }
 
-static utf_error_t decode_utf8(utf_decoder_t * decoder){
+static size_t decode_utf16be(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count){
 
-	utf_error_t error;
-	unsigned int decode_length = 0;
-	char32_t out32;
+	size_t i = 0;
+	size_t j = 0;
+	char16_t in16[2];
 
-	decode_length = utf8_decode((const char *)(decoder->input_byte_array), &out32);
+	(void) codec;
 
-	if (decode_length == 0){
-		return UTF_ERROR_INVALID_SEQUENCE;
+	while ((i + 2) <= src_size){
+		in16[0] = (char16_t)((src[i] << 0x08) | src[i + 1]);
+		if ((in16[0] < 0xd800) || (in16[0] > 0xdfff)){
+			dst[j++] = in16[0];
+			i += 2;
+			continue;
+		}
+		if ((i + 4) > src_size){
+			break;
+		}
+		in16[1] = (char16_t)((src[i + 2] << 0x08) | src[i + 3]);
+		if (utf16_decode(in16, &dst[j]) != 2){
+			break;
+		}
+		i += 4;
+		j++;
 	}
 
-	memmove(decoder->input_byte_array,
-	       &decoder->input_byte_array[decode_length],
-	       4 - decode_length);
-	
-	decoder->input_byte_count -= decode_length;
+	*dst_count = j;
 
-	error = add_output_char(decoder, out32);
-	if (error){
-		return error;
+	return i;
+}
+
+static size_t decode_utf16le(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count){
+
+	size_t i = 0;
+	size_t j = 0;
+	char16_t in16[2];
+
+	(void) codec;
+
+	while ((i + 2) <= src_size){
+		in16[0] = (char16_t)(src[i] | (src[i + 1] << 0x08));
+		if ((in16[0] < 0xd800) || (in16[0] > 0xdfff)){
+			dst[j++] = in16[0];
+			i += 2;
+			continue;
+		}
+		if ((i + 4) > src_size){
+			break;
+		}
+		in16[1] = (char16_t)(src[i + 2] | (src[i + 3] << 0x08));
+		if (utf16_decode(in16, &dst[j]) != 2){
+			break;
+		}
+		i += 4;
+		j++;
 	}
 
-	return UTF_ERROR_NONE;
+	*dst_count = j;
+
+	return i;
 }
 
-static utf_error_t decode_utf16be(utf_decoder_t * decoder){
+static size_t decode_utf32be(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count){
 
-	utf_error_t error;
-	char16_t out16[2] = { 0, 0 };
-	char32_t out32;
-	unsigned int decode_length = 0;
+	size_t i = 0;
+	size_t j = 0;
 
-	out16[0] = utf16be(&decoder->input_byte_array[0]);
-	out16[1] = utf16be(&decoder->input_byte_array[2]);
+	(void) codec;
 
-	decode_length = utf16_decode(out16, &out32);
-	if (decode_length == 0){
-		return UTF_ERROR_INVALID_SEQUENCE;
-	} else if (decode_length == 1){
-		decoder->input_byte_array[0] = decoder->input_byte_array[2];
-		decoder->input_byte_array[1] = decoder->input_byte_array[3];
-		decoder->input_byte_count = 2;
-	} else if (decode_length == 2){
-		decoder->input_byte_count = 0;
+	for (i = 0; (i + 4) <= src_size; i += 4){
+		dst[j++] = utf32be(&src[i]);
 	}
 
-	error = add_output_char(decoder, out32);
-	if (error){
-		return error;
+	*dst_count = j;
+
+	return i;
+}
+
+static size_t decode_utf32le(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count){
+
+	size_t i = 0;
+	size_t j = 0;
+
+	(void) codec;
+
+	for (i = 0; (i + 4) <= src_size; i += 4){
+		dst[j++] = utf32le(&src[i]);
 	}
 
-	return UTF_ERROR_NONE;
+	*dst_count = j;
+
+	return i;
 }
 
-static utf_error_t decode_utf16le(utf_decoder_t * decoder){
+static size_t decode_codepage(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count){
 
-	utf_error_t error;
-	char16_t out16[2] = { 0, 0 };
-	char32_t out32;
-	unsigned int decode_length = 0;
+	size_t i = 0;
+	const struct codepage * codepage = NULL;
 
-	out16[0] = utf16le(decoder->input_byte_array);
-	out16[1] = utf16le(&decoder->input_byte_array[2]);
+	codepage = utf_codepage_get(codec);
 
-	decode_length = utf16_decode(out16, &out32);
-	if (decode_length == 0){
-		return UTF_ERROR_INVALID_SEQUENCE;
-	} else if (decode_length == 1){
-		decoder->input_byte_array[0] = decoder->input_byte_array[2];
-		decoder->input_byte_array[1] = decoder->input_byte_array[3];
-		decoder->input_byte_count = 2;
-	} else if (decode_length == 2){
-		decoder->input_byte_count = 0;
+	/* Latin-1 only has to be widened */
+
+	if (codepage->direct_limit > 0xff){
+		i = utf_kernel_latin1_to_utf32(src, src_size, dst);
+	} else {
+		i = utf_kernel_codepage_to_utf32(codepage->decode_table, src, src_size, dst);
 	}
 
-	error = add_output_char(decoder, out32);
-	if (error){
-		return error;
+	*dst_count = i;
+
+	return i;
+}
+
+static size_t decode_wtf8(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count){
+	(void) codec;
+	return utf_wtf8_to_utf32(src, src_size, dst, dst_count);
+}
+
+static size_t decode_cesu8(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count){
+	(void) codec;
+	return utf_cesu8_to_utf32(src, src_size, dst, dst_count);
+}
+
+/** Decodes one complete sequence, which is @p src_size bytes long.
+ * This is needed for CESU-8 and WTF-8, where the block decoder leaves a high
+ * surrogate at the end of its input, in case a low one is after it.
+ * @param c Set to the decoded character.
+ * @returns Whether the sequence was decoded.
+ */
+
+static int decode_sequence(utf_codec_t codec, const unsigned char * src, size_t src_size, char32_t * c){
+
+	size_t decode_count = 0;
+	char32_t output[6];
+
+	if (codec == UTF_CODEC_CESU8){
+		return utf_cesu8_decode(src, src_size, c, 1) == src_size;
+	} else if (codec == UTF_CODEC_WTF8){
+		return utf_wtf8_decode(src, src_size, c, 1) == src_size;
 	}
 
-	return UTF_ERROR_NONE;
+	get_decode_block(codec)(codec, src, src_size, output, &decode_count);
+	if (decode_count != 1){
+		return 0;
+	}
+
+	*c = output[0];
+
+	return 1;
 }
 
-static utf_error_t decode_utf32be(utf_decoder_t * decoder){
-	utf_error_t error;
-	error = add_output_char(decoder, utf32be(decoder->input_byte_array));
-	if (error){
-		return error;
+/** Calculates the number of bytes in the sequence starting at @p src.
+ * If @p src is too short to tell, the smallest possible
+ * length that is larger than @p src_size is returned.
+ * If the sequence can't be valid, zero is returned.
+ */
+
+static size_t sequence_length(utf_codec_t codec, const unsigned char * src, size_t src_size){
+
+	size_t length = 0;
+	char16_t in16;
+	char32_t c;
+
+	if (utf_codepage_get(codec) != NULL){
+		if (src_size < 1){
+			return 1;
+		}
+		return utf_codepage_decode(utf_codepage_get(codec), src[0], &c);
 	}
-	decoder->input_byte_count = 0;
-	return UTF_ERROR_NONE;
+
+	switch (codec){
+		case UTF_CODEC_UTF8:
+			if (src_size < 1){
+				return 1;
+			}
+			/* the lead byte only gives the length if
+			 * the bytes after it can still be valid */
+			length = utf_kernel_utf8_subpart(src, src_size);
+			if ((length > 0) && (length <= src_size)){
+				return 0;
+			}
+			return utf8_decode_length((char)(src[0]));
+		case UTF_CODEC_WTF8:
+			return utf_wtf8_decode(src, src_size, &c, 0);
+		case UTF_CODEC_CESU8:
+			return utf_cesu8_decode(src, src_size, &c, 0);
+		case UTF_CODEC_UTF16_LE:
+		case UTF_CODEC_UTF16_BE:
+			if (src_size < 2){
+				return 2;
+			}
+			if (codec == UTF_CODEC_UTF16_LE){
+				in16 = utf16le(src);
+			} else {
+				in16 = utf16be(src);
+			}
+			return utf16_decode_length(in16) * 2;
+		case UTF_CODEC_UTF32_LE:
+		case UTF_CODEC_UTF32_BE:
+			return 4;
+		default:
+			break;
+	}
+
+	return 0;
 }
 
-static utf_error_t decode_utf32le(utf_decoder_t * decoder){
-	utf_error_t error;
-	error = add_output_char(decoder, utf32le(decoder->input_byte_array));
-	if (error){
-		return error;
+/** Finds the maximal subpart of an invalid sequence,
+ * which is replaced or skipped as a whole.
+ * @returns The number of bytes in the subpart. Zero is returned if
+ *  @p src starts with a valid sequence, and more than @p src_size
+ *  if it starts with one that's cut short by the end of @p src.
+ */
+
+static size_t invalid_length(utf_codec_t codec, const unsigned char * src, size_t src_size){
+
+	char32_t c;
+
+	if (utf_codepage_get(codec) != NULL){
+		if (src_size < 1){
+			return 1;
+		}
+		return utf_codepage_decode(utf_codepage_get(codec), src[0], &c) ? 0 : 1;
+	}
+
+	switch (codec){
+		case UTF_CODEC_UTF8:
+			return utf_kernel_utf8_subpart(src, src_size);
+		case UTF_CODEC_WTF8:
+			return utf_wtf8_subpart(src, src_size);
+		case UTF_CODEC_CESU8:
+			return utf_cesu8_subpart(src, src_size);
+		case UTF_CODEC_UTF16_LE:
+			return utf_kernel_utf16_subpart(src, src_size, 0);
+		case UTF_CODEC_UTF16_BE:
+			return utf_kernel_utf16_subpart(src, src_size, 1);
+		case UTF_CODEC_UTF32_LE:
+		case UTF_CODEC_UTF32_BE:
+			return (src_size < 4) ? 4 : 0;
+		default:
+			break;
+	}
+	return 0;
+}
+
+/** Picks the codec, for a decoder set to @ref UTF_CODEC_AUTO.
+ * The start of the input is kept in the input byte array until
+ * there are four bytes of it, which is a whole code unit of every
+ * codec it could be, so that the codec isn't guessed from a byte or two.
+ * The input that was kept, after the byte order mark, is decoded.
+ * @param write_count Set to the number of bytes taken from @p src,
+ *  which includes the part of the byte order mark that's in it.
+ */
+
+static utf_error_t write_detect(utf_decoder_t * decoder, const unsigned char * src, size_t src_size, size_t * write_count){
+
+	unsigned char head[4];
+	size_t head_size = 0;
+	size_t carry_size = 0;
+	size_t bom_size = 0;
+	size_t i = 0;
+	utf_codec_t codec = UTF_CODEC_UTF8;
+
+	carry_size = decoder->input_byte_count;
+	memcpy(head, decoder->input_byte_array, carry_size);
+	head_size = carry_size;
+
+	while ((head_size < 4) && (i < src_size)){
+		head[head_size++] = src[i++];
+	}
+
+	if (head_size < 4){
+		/* all of the input fit in head */
+		memcpy(decoder->input_byte_array, head, head_size);
+		decoder->input_byte_count = head_size;
+		*write_count = src_size;
+		return UTF_ERROR_NONE;
 	}
+
+	if (carry_size == 0){
+		codec = utf_codec_detect(src, src_size, &bom_size);
+	} else {
+		codec = utf_codec_detect(head, head_size, &bom_size);
+		if ((bom_size == 0) && ((src_size - i) > head_size)){
+			/* the rest of the input is a bigger sample */
+			codec = utf_codec_detect(&src[i], src_size - i, &bom_size);
+			bom_size = 0;
+		}
+	}
+
+	decoder->codec = codec;
 	decoder->input_byte_count = 0;
+
+	if (bom_size < carry_size){
+		if (utf_decoder_write(decoder, &head[bom_size], carry_size - bom_size) < (carry_size - bom_size)){
+			*write_count = 0;
+			return UTF_ERROR_INVALID_SEQUENCE;
+		}
+		bom_size = carry_size;
+	}
+
+	*write_count = bom_size - carry_size;
+
 	return UTF_ERROR_NONE;
 }
 
-static utf_error_t write_byte(utf_decoder_t * decoder, unsigned char byte){
+/** Completes the sequence in the decoder's input byte array.
+ * @param write_count Set to the number of bytes taken from @p src.
+ */
+
+static utf_error_t write_carry(utf_decoder_t * decoder, const unsigned char * src, size_t src_size, size_t * write_count){
 
-	decoder->input_byte_count %= 4;
+	utf_error_t error = UTF_ERROR_NONE;
+	size_t i = 0;
+	size_t length = 0;
+	char32_t c = 0;
+
+	/* a CESU-8 high surrogate turns out to be one sequence on its own
+	 * once a byte that doesn't start a low surrogate follows it,
+	 * and the bytes after it are decoded again */
+
+	while ((decoder->input_byte_count > 0) && (output_space(decoder) > 0)){
+
+		length = sequence_length(decoder->codec, decoder->input_byte_array, decoder->input_byte_count);
+
+		while ((length > decoder->input_byte_count) && (i < src_size)){
+			decoder->input_byte_array[decoder->input_byte_count] = src[i];
+			length = sequence_length(decoder->codec, decoder->input_byte_array, decoder->input_byte_count + 1);
+			if (length == 0){
+				/* the byte cuts the sequence short, so the write stops at it */
+				break;
+			}
+			decoder->input_byte_count++;
+			i++;
+		}
 
-	switch (decoder->input_byte_count){
-		case 0:
-			decoder->input_byte_array[0] = byte;
-			decoder->input_byte_count = 1;
+		if (length == 0){
+			error = UTF_ERROR_INVALID_SEQUENCE;
 			break;
-		case 1:
-			decoder->input_byte_array[1] = byte;
-			decoder->input_byte_count = 2;
+		} else if (length > decoder->input_byte_count){
+			/* still incomplete, wait for more input */
 			break;
-		case 2:
-			decoder->input_byte_array[2] = byte;
-			decoder->input_byte_count = 3;
+		}
+
+		if (!decode_sequence(decoder->codec, decoder->input_byte_array, length, &c)){
+			error = UTF_ERROR_INVALID_SEQUENCE;
+			break;
+		}
+
+		error = output_push(decoder, c);
+		if (error){
 			break;
-		case 3:
-			decoder->input_byte_array[3] = byte;
-			decoder->input_byte_count = 4;
+		}
+
+		decoder->input_byte_count -= length;
+		memmove(decoder->input_byte_array,
+		        &decoder->input_byte_array[length],
+		        decoder->input_byte_count);
+	}
+
+	*write_count = i;
+
+	return error;
+}
+
+/** Completes the sequence in the decoder's input byte array,
+ * replacing or skipping it if it turns out to be invalid.
+ * The bytes after an invalid subpart are decoded again,
+ * since they may start the next sequence.
+ * @param write_count Set to the number of bytes taken from @p src.
+ */
+
+static utf_error_t write_carry_lossy(utf_decoder_t * decoder, const unsigned char * src, size_t src_size, size_t * write_count){
+
+	utf_error_t error = UTF_ERROR_NONE;
+	size_t i = 0;
+	size_t length = 0;
+	char32_t c = 0;
+
+	while ((decoder->input_byte_count > 0) && (output_space(decoder) > 0)){
+
+		length = invalid_length(decoder->codec, decoder->input_byte_array, decoder->input_byte_count);
+		if (length > decoder->input_byte_count){
+			if (i >= src_size){
+				/* still incomplete, wait for more input */
+				break;
+			}
+			decoder->input_byte_array[decoder->input_byte_count] = src[i];
+			decoder->input_byte_count++;
+			i++;
+			continue;
+		}
+
+		if (length == 0){
+			length = sequence_length(decoder->codec, decoder->input_byte_array, decoder->input_byte_count);
+			decode_sequence(decoder->codec, decoder->input_byte_array, length, &c);
+			error = output_push(decoder, c);
+		} else {
+			if (decoder->policy == UTF_DECODER_REPLACE){
+				error = output_push(decoder, 0xfffd);
+			}
+			if (error == UTF_ERROR_NONE){
+				decoder->invalid_count++;
+			}
+		}
+
+		if (error){
 			break;
-		default:
-			/* should be unreachable */
-			return UTF_ERROR_OVERFLOW;
+		}
+
+		decoder->input_byte_count -= length;
+		memmove(decoder->input_byte_array,
+		        &decoder->input_byte_array[length],
+		        decoder->input_byte_count);
 	}
 
-	if (decoder->input_byte_count >= 4){
-		return decode(decoder);
+	*write_count = i;
+
+	return error;
+}
+
+/** Rounds a character count up to a power of two.
+ * @returns The rounded count, or zero if it would overflow.
+ */
+
+static unsigned long int round_up(unsigned long int count){
+
+	unsigned long int res = 1;
+
+	while (res < count){
+		if (res > (((size_t) -1) / sizeof(char32_t) / 2)){
+			return 0;
+		}
+		res *= 2;
 	}
-	
+
+	return res;
+}
+
+/** Returns how many more characters the decoder may hold. */
+
+static unsigned long int output_space(const utf_decoder_t * decoder){
+	if (decoder->output_count_max == 0){
+		return ((unsigned long int) -1) - decoder->output_count;
+	} else if (decoder->output_count_max > decoder->output_count){
+		return decoder->output_count_max - decoder->output_count;
+	}
+	return 0;
+}
+
+/** Makes room in the ring for @p count more characters.
+ * The ring at least doubles when it grows, so appending
+ * characters is amortized constant time.
+ */
+
+static utf_error_t output_grow(utf_decoder_t * decoder, unsigned long int count){
+
+	char32_t * tmp = NULL;
+	unsigned long int res = 0;
+	unsigned long int min_res = 0;
+	unsigned long int old_res = 0;
+	unsigned long int wrap_count = 0;
+
+	if (count <= (decoder->output_count_res - decoder->output_count)){
+		return UTF_ERROR_NONE;
+	} else if (count > (((unsigned long int) -1) - decoder->output_count)){
+		return UTF_ERROR_MALLOC;
+	}
+
+	res = round_up(decoder->output_count + count);
+	if (res == 0){
+		return UTF_ERROR_MALLOC;
+	}
+
+	/* start with a few slots, unless the limit is less than that */
+
+	min_res = 32;
+	if ((decoder->output_count_max > 0) && (decoder->output_count_max < min_res)){
+		min_res = round_up(decoder->output_count_max);
+	}
+
+	if (res < min_res){
+		res = min_res;
+	}
+
+	tmp = realloc(decoder->output_array, res * sizeof(char32_t));
+	if (tmp == NULL){
+		return UTF_ERROR_MALLOC;
+	}
+
+	/* the ring at least doubled, so the characters that
+	 * wrapped around fit right after the old end of it */
+
+	old_res = decoder->output_count_res;
+
+	if ((decoder->output_index + decoder->output_count) > old_res){
+		wrap_count = decoder->output_index + decoder->output_count - old_res;
+		memcpy(&tmp[old_res], tmp, wrap_count * sizeof(char32_t));
+	}
+
+	decoder->output_array = tmp;
+	decoder->output_count_res = res;
+
 	return UTF_ERROR_NONE;
 }
 
+/** Finds the free slots at the end of the ring.
+ * @param tail Set to the first free slot.
+ * @returns The number of free slots that follow @p tail,
+ *  before the ring wraps around.
+ */
+
+static unsigned long int output_tail(utf_decoder_t * decoder, char32_t ** tail){
+
+	unsigned long int end;
+
+	end = decoder->output_index + decoder->output_count;
+
+	if (end >= decoder->output_count_res){
+		end -= decoder->output_count_res;
+		*tail = &decoder->output_array[end];
+		return decoder->output_index - end;
+	}
+
+	*tail = &decoder->output_array[end];
+
+	return decoder->output_count_res - end;
+}
+
+/** Appends a character to the ring. */
+
+static utf_error_t output_push(utf_decoder_t * decoder, char32_t c){
+
+	utf_error_t error = UTF_ERROR_NONE;
+	char32_t * tail = NULL;
+
+	error = output_grow(decoder, 1);
+	if (error){
+		return error;
+	}
+
+	output_tail(decoder, &tail);
+	tail[0] = c;
+	decoder->output_count++;
+
+	return UTF_ERROR_NONE;
+}
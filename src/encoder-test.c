@@ -1,14 +1,38 @@
 #include <libutf/encoder.h>
 
 #include <assert.h>
+#include <string.h>
 
 static void test_utf8(void);
 
 static void test_utf16be(void);
 
+static void test_ring(void);
+
+static void test_ring_reuse(void);
+
+static void test_write_array(void);
+
+static void test_write_array_invalid(void);
+
+static void test_codepage(void);
+
+static void test_latin1(void);
+
+static void test_wtf8(void);
+
+static void check_wtf8_pairs(utf_encoder_t * encoder);
+
 int main(void){
 	test_utf8();
 	test_utf16be();
+	test_ring();
+	test_ring_reuse();
+	test_write_array();
+	test_write_array_invalid();
+	test_codepage();
+	test_latin1();
+	test_wtf8();
 	return 0;
 }
 
@@ -83,3 +107,397 @@ static void test_utf16be(void){
 	utf_encoder_free(&encoder);
 }
 
+
+static void test_ring(void){
+
+	unsigned char output[128];
+
+	unsigned int i = 0;
+
+	utf_encoder_t encoder;
+
+	utf_encoder_init(&encoder);
+
+	/* nothing has been allocated yet */
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 0);
+
+	for (i = 0; i < 20; i++){
+		assert(utf_encoder_write(&encoder, 0x20ac) == UTF_ERROR_NONE);
+	}
+
+	assert(utf_encoder_read(&encoder, output, 50) == 50);
+	assert(output[0] == 0xe2);
+	assert(output[49] == 0x82);
+
+	/* wraps around the end of the ring */
+	for (i = 0; i < 10; i++){
+		assert(utf_encoder_write(&encoder, 0x20ac) == UTF_ERROR_NONE);
+	}
+
+	/* grows the ring while it's wrapped around */
+	for (i = 0; i < 30; i++){
+		assert(utf_encoder_write(&encoder, 0xe9) == UTF_ERROR_NONE);
+	}
+
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 100);
+
+	for (i = 0; i < 10; i++){
+		assert(output[i] == ((i % 3 == 0) ? 0xac : ((i % 3 == 1) ? 0xe2 : 0x82)));
+	}
+
+	for (i = 0; i < 10; i++){
+		assert(output[(i * 3) + 10] == 0xe2);
+		assert(output[(i * 3) + 11] == 0x82);
+		assert(output[(i * 3) + 12] == 0xac);
+	}
+
+	for (i = 0; i < 30; i++){
+		assert(output[(i * 2) + 40] == 0xc3);
+		assert(output[(i * 2) + 41] == 0xa9);
+	}
+
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 0);
+
+	utf_encoder_free(&encoder);
+}
+
+static void test_ring_reuse(void){
+
+	static const utf32_t input[] = { 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l' };
+	unsigned char output[64];
+	const unsigned char * byte_array = NULL;
+	unsigned int i = 0;
+
+	utf_encoder_t encoder;
+
+	utf_encoder_init(&encoder);
+
+	assert(utf_encoder_reserve(&encoder, 64) == UTF_ERROR_NONE);
+	byte_array = encoder.byte_array;
+
+	/* the same size again keeps what's there */
+	assert(utf_encoder_write_array(&encoder, input, 8) == UTF_ERROR_NONE);
+	assert(utf_encoder_reserve(&encoder, 64) == UTF_ERROR_NONE);
+	assert(encoder.byte_array == byte_array);
+	assert(encoder.byte_count == 8);
+
+	/* there's room for a block, but not after the bytes,
+	 * so they're moved back to the start of the ring */
+	for (i = 0; i < 40; i++){
+		assert(utf_encoder_write(&encoder, 'x') == UTF_ERROR_NONE);
+	}
+	assert(utf_encoder_read(&encoder, output, 44) == 44);
+	assert(utf_encoder_write_array(&encoder, input, 12) == UTF_ERROR_NONE);
+	assert(encoder.byte_array == byte_array);
+	assert(encoder.byte_count_res == 64);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 16);
+	assert(memcmp(output, "xxxxabcdefghijkl", 16) == 0);
+
+	/* the bytes wrap around, and the room is between their end and their start */
+	for (i = 0; i < 56; i++){
+		assert(utf_encoder_write(&encoder, 'x') == UTF_ERROR_NONE);
+	}
+	assert(utf_encoder_read(&encoder, output, 50) == 50);
+	for (i = 0; i < 10; i++){
+		assert(utf_encoder_write(&encoder, input[i]) == UTF_ERROR_NONE);
+	}
+	assert(utf_encoder_write_array(&encoder, input, 8) == UTF_ERROR_NONE);
+	assert(encoder.byte_array == byte_array);
+	assert(encoder.byte_count_res == 64);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 24);
+	assert(memcmp(output, "xxxxxxabcdefghijabcdefgh", 24) == 0);
+
+	/* a ring that's full grows, and keeps what's in it */
+	for (i = 0; i < 40; i++){
+		assert(utf_encoder_write(&encoder, 'x') == UTF_ERROR_NONE);
+	}
+	assert(utf_encoder_write_array(&encoder, input, 12) == UTF_ERROR_NONE);
+	assert(encoder.byte_count_res == 128);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 52);
+	assert(memcmp(&output[38], "xxabcdefghijkl", 14) == 0);
+
+	utf_encoder_free(&encoder);
+}
+
+static void test_write_array(void){
+
+	const utf32_t input[] = {
+		0x41, 0x62, 0x7f, 0x80, 0xe9, 0x7ff, 0x800, 0x20ac,
+		0xd800, 0xdfff, 0xfffd, 0xffff, 0x10000, 0x24b62, 0x10ffff, 0x30
+	};
+
+	unsigned char expected[512];
+	unsigned char output[512];
+	unsigned long int expected_size = 0;
+	unsigned long int output_size = 0;
+	unsigned int codec = 0;
+	unsigned int i = 0;
+	unsigned int j = 0;
+
+	utf_encoder_t expected_encoder;
+	utf_encoder_t encoder;
+
+	for (codec = UTF_CODEC_FIRST; codec <= UTF_CODEC_LAST; codec++){
+
+		utf_encoder_init(&expected_encoder);
+		utf_encoder_init(&encoder);
+
+		utf_encoder_set_codec(&expected_encoder, (utf_codec_t)(codec));
+		utf_encoder_set_codec(&encoder, (utf_codec_t)(codec));
+
+		/* UTF-8 and UTF-32 replace the surrogates */
+		utf_encoder_set_policy(&expected_encoder, UTF_ENCODER_REPLACE);
+		utf_encoder_set_policy(&encoder, UTF_ENCODER_REPLACE);
+
+		/* leaves the ring wrapped around before each array */
+		for (i = 0; i < 4; i++){
+
+			for (j = 0; j < 7; j++){
+				assert(utf_encoder_write(&expected_encoder, 0x20ac) == UTF_ERROR_NONE);
+				assert(utf_encoder_write(&encoder, 0x20ac) == UTF_ERROR_NONE);
+			}
+
+			for (j = 0; j < (sizeof(input) / sizeof(input[0])); j++){
+				assert(utf_encoder_write(&expected_encoder, input[j]) == UTF_ERROR_NONE);
+			}
+
+			assert(utf_encoder_write_array(&encoder, input, sizeof(input) / sizeof(input[0])) == UTF_ERROR_NONE);
+
+			expected_size = utf_encoder_read(&expected_encoder, expected, 13);
+			output_size = utf_encoder_read(&encoder, output, 13);
+			assert(expected_size == output_size);
+			assert(memcmp(expected, output, output_size) == 0);
+		}
+
+		expected_size = utf_encoder_read(&expected_encoder, expected, sizeof(expected));
+		output_size = utf_encoder_read(&encoder, output, sizeof(output));
+		assert(expected_size == output_size);
+		assert(memcmp(expected, output, output_size) == 0);
+
+		/* nothing is written for an empty array */
+		assert(utf_encoder_write_array(&encoder, input, 0) == UTF_ERROR_NONE);
+		assert(utf_encoder_read(&encoder, output, sizeof(output)) == 0);
+
+		utf_encoder_free(&expected_encoder);
+		utf_encoder_free(&encoder);
+	}
+}
+
+static void test_write_array_invalid(void){
+
+	const utf32_t input[] = { 0x41, 0x20ac, 0x110000, 0x42 };
+
+	unsigned char output[16];
+
+	utf_encoder_t encoder;
+
+	utf_encoder_init(&encoder);
+
+	assert(utf_encoder_write(&encoder, 0x43) == UTF_ERROR_NONE);
+
+	/* none of the array is written */
+	assert(utf_encoder_write_array(&encoder, input, 4) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 1);
+	assert(output[0] == 0x43);
+
+	utf_encoder_set_codec(&encoder, UTF_CODEC_UTF16_BE);
+
+	assert(utf_encoder_write_array(&encoder, input, 4) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 0);
+
+	assert(utf_encoder_write_array(&encoder, input, 2) == UTF_ERROR_NONE);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 4);
+	assert(output[0] == 0x00);
+	assert(output[1] == 0x41);
+	assert(output[2] == 0x20);
+	assert(output[3] == 0xac);
+
+	utf_encoder_free(&encoder);
+}
+
+static void test_codepage(void){
+
+	/* "a€é" */
+	const utf32_t input[] = { 0x61, 0x20ac, 0xe9 };
+
+	unsigned char output[8];
+
+	utf_encoder_t encoder;
+
+	utf_encoder_init(&encoder);
+	utf_encoder_set_codec(&encoder, UTF_CODEC_WINDOWS_1252);
+
+	assert(utf_encoder_write(&encoder, 0x20ac) == UTF_ERROR_NONE);
+	assert(utf_encoder_write(&encoder, 0x0100) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(utf_encoder_write(&encoder, 0x1f600) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(utf_encoder_write_array(&encoder, input, 3) == UTF_ERROR_NONE);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 4);
+	assert(memcmp(output, "\x80" "a\x80\xe9", 4) == 0);
+
+	/* nothing is written if a character isn't in the codepage */
+	utf_encoder_set_codec(&encoder, UTF_CODEC_ISO_8859_1);
+	assert(utf_encoder_write_array(&encoder, input, 3) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 0);
+
+	utf_encoder_set_codec(&encoder, UTF_CODEC_ISO_8859_15);
+	assert(utf_encoder_write_array(&encoder, input, 3) == UTF_ERROR_NONE);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 3);
+	assert(memcmp(output, "a\xa4\xe9", 3) == 0);
+
+	utf_encoder_free(&encoder);
+}
+
+static void test_latin1(void){
+
+	utf32_t input[256];
+	unsigned char output[256];
+	unsigned int i;
+
+	utf_encoder_t encoder;
+
+	for (i = 0; i < 256; i++){
+		input[i] = i;
+	}
+
+	utf_encoder_init(&encoder);
+	utf_encoder_set_codec(&encoder, UTF_CODEC_LATIN1);
+
+	assert(utf_encoder_get_policy(&encoder) == UTF_ENCODER_STRICT);
+	assert(utf_encoder_write_array(&encoder, input, 256) == UTF_ERROR_NONE);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 256);
+	for (i = 0; i < 256; i++){
+		assert(output[i] == i);
+	}
+
+	assert(utf_encoder_write(&encoder, 0x100) == UTF_ERROR_INVALID_SEQUENCE);
+
+	utf_encoder_set_codec(&encoder, UTF_CODEC_ASCII);
+	assert(utf_encoder_write_array(&encoder, input, 256) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 0);
+	assert(utf_encoder_write(&encoder, 0x80) == UTF_ERROR_INVALID_SEQUENCE);
+
+	/* out of range characters become question marks */
+	utf_encoder_set_policy(&encoder, UTF_ENCODER_REPLACE);
+	assert(utf_encoder_write_array(&encoder, &input[96], 64) == UTF_ERROR_NONE);
+	assert(utf_encoder_write(&encoder, 0x20ac) == UTF_ERROR_NONE);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 65);
+	for (i = 0; i < 32; i++){
+		assert(output[i] == (96 + i));
+		assert(output[32 + i] == '?');
+	}
+	assert(output[64] == '?');
+	assert(utf_encoder_get_invalid_count(&encoder) == 33);
+
+	/* and U+FFFD in the Unicode codecs */
+	input[1] = 0x110000;
+	utf_encoder_set_codec(&encoder, UTF_CODEC_UTF8);
+	assert(utf_encoder_write_array(&encoder, input, 3) == UTF_ERROR_NONE);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 5);
+	assert(memcmp(output, "\x00\xef\xbf\xbd\x02", 5) == 0);
+	assert(utf_encoder_get_invalid_count(&encoder) == 34);
+
+	/* which is also what a surrogate becomes */
+	input[1] = 0xdc00;
+	assert(utf_encoder_write_array(&encoder, input, 3) == UTF_ERROR_NONE);
+	assert(utf_encoder_write(&encoder, 0xd800) == UTF_ERROR_NONE);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 8);
+	assert(memcmp(output, "\x00\xef\xbf\xbd\x02\xef\xbf\xbd", 8) == 0);
+	utf_encoder_set_codec(&encoder, UTF_CODEC_UTF32_BE);
+	assert(utf_encoder_write(&encoder, 0xdfff) == UTF_ERROR_NONE);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 4);
+	assert(memcmp(output, "\x00\x00\xff\xfd", 4) == 0);
+	assert(utf_encoder_get_invalid_count(&encoder) == 37);
+
+	utf_encoder_free(&encoder);
+}
+
+static void test_wtf8(void){
+
+	/* "a", U+D800 on its own, "𐐷" */
+	const utf32_t input[] = { 'a', 0xd800, 0x10437 };
+	unsigned char output[16];
+
+	utf_encoder_t encoder;
+
+	utf_encoder_init(&encoder);
+
+	utf_encoder_set_codec(&encoder, UTF_CODEC_WTF8);
+	assert(utf_encoder_write_array(&encoder, input, 3) == UTF_ERROR_NONE);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 8);
+	assert(memcmp(output, "a\xed\xa0\x80\xf0\x90\x90\xb7", 8) == 0);
+
+	/* CESU-8 writes "𐐷" as a surrogate pair */
+	utf_encoder_set_codec(&encoder, UTF_CODEC_CESU8);
+	assert(utf_encoder_write_array(&encoder, input, 3) == UTF_ERROR_NONE);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 10);
+	assert(memcmp(output, "a\xed\xa0\x80\xed\xa0\x81\xed\xb0\xb7", 10) == 0);
+
+	assert(utf_encoder_write(&encoder, 0x10437) == UTF_ERROR_NONE);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 6);
+	assert(memcmp(output, "\xed\xa0\x81\xed\xb0\xb7", 6) == 0);
+
+	assert(utf_encoder_write(&encoder, 0x110000) == UTF_ERROR_INVALID_SEQUENCE);
+
+	check_wtf8_pairs(&encoder);
+
+	/* UTF-8 and UTF-32 don't have surrogates on their own */
+	utf_encoder_set_codec(&encoder, UTF_CODEC_UTF8);
+	assert(utf_encoder_write(&encoder, 0xd800) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(utf_encoder_write_array(&encoder, input, 3) == UTF_ERROR_INVALID_SEQUENCE);
+	utf_encoder_set_codec(&encoder, UTF_CODEC_UTF32_LE);
+	assert(utf_encoder_write(&encoder, 0xdfff) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(utf_encoder_write_array(&encoder, input, 3) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(utf_encoder_read(&encoder, output, sizeof(output)) == 0);
+	assert(utf_encoder_get_invalid_count(&encoder) == 0);
+
+	utf_encoder_free(&encoder);
+}
+
+/** A high surrogate followed by a low one is one character in WTF-8,
+ * whether they're written together or not, as long as the high one
+ * hasn't been read yet. */
+
+static void check_wtf8_pairs(utf_encoder_t * encoder){
+
+	static utf32_t input[0x4001];
+	static unsigned char bytes[0x4010];
+	const utf32_t pair[] = { 0xd800, 0xdc00, 'b', 0xd800 };
+	const utf32_t invalid[] = { 0xdc00, 0x110000 };
+	unsigned char output[16];
+	size_t i = 0;
+
+	utf_encoder_set_codec(encoder, UTF_CODEC_WTF8);
+
+	assert(utf_encoder_write_array(encoder, pair, 4) == UTF_ERROR_NONE);
+	assert(utf_encoder_write(encoder, 0xdc00) == UTF_ERROR_NONE);
+	assert(utf_encoder_read(encoder, output, sizeof(output)) == 9);
+	assert(memcmp(output, "\xf0\x90\x80\x80" "b" "\xf0\x90\x80\x80", 9) == 0);
+
+	assert(utf_encoder_write(encoder, 0xdbff) == UTF_ERROR_NONE);
+	assert(utf_encoder_write_array(encoder, &pair[1], 2) == UTF_ERROR_NONE);
+	assert(utf_encoder_read(encoder, output, sizeof(output)) == 5);
+	assert(memcmp(output, "\xf4\x8f\xb0\x80" "b", 5) == 0);
+
+	/* it's too late once the high surrogate has been read */
+	assert(utf_encoder_write(encoder, 0xd800) == UTF_ERROR_NONE);
+	assert(utf_encoder_read(encoder, output, sizeof(output)) == 3);
+	assert(utf_encoder_write(encoder, 0xdc00) == UTF_ERROR_NONE);
+	assert(utf_encoder_read(encoder, output, sizeof(output)) == 3);
+	assert(memcmp(output, "\xed\xb0\x80", 3) == 0);
+
+	/* the high surrogate is left as it was if the array fails */
+	assert(utf_encoder_write(encoder, 0xd800) == UTF_ERROR_NONE);
+	assert(utf_encoder_write_array(encoder, invalid, 2) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(utf_encoder_read(encoder, output, sizeof(output)) == 3);
+	assert(memcmp(output, "\xed\xa0\x80", 3) == 0);
+
+	/* a pair that's split between blocks */
+	for (i = 0; i < 0x3fff; i++){
+		input[i] = 'a';
+	}
+	input[0x3fff] = 0xd800;
+	input[0x4000] = 0xdc00;
+	assert(utf_encoder_write_array(encoder, input, 0x4001) == UTF_ERROR_NONE);
+	assert(utf_encoder_read(encoder, bytes, sizeof(bytes)) == (0x3fff + 4));
+	assert(memcmp(&bytes[0x3fff], "\xf0\x90\x80\x80", 4) == 0);
+}
@@ -19,14 +19,46 @@
 #include <libutf/utf8.h>
 #include <libutf/utf16.h>
 
+#include "codepage.h"
+#include "kernel.h"
+#include "ring.h"
+#include "wtf8.h"
+
 #include <stdlib.h>
 #include <string.h>
 
+/** The number of characters that are encoded at a time by
+ * @ref utf_encoder_write_array, so that the space reserved
+ * in the ring stays small. */
+
+#define ENCODE_BLOCK_COUNT 0x4000
+
+static unsigned long int round_up(unsigned long int size);
+
+static size_t encode_block(utf_codec_t codec, const utf32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size);
+
+static size_t encode_utf32(const utf32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size, int big_endian);
+
+static utf_error_t push_bytes(utf_encoder_t * encoder, const unsigned char * src, size_t src_size);
+
+static utf_error_t grow_ring(utf_encoder_t * encoder, unsigned long int res);
+
+static utf_error_t write_char(utf_encoder_t * encoder, char32_t input_char);
+
+static char32_t tail_surrogate(const utf_encoder_t * encoder);
+
+static void restore(utf_encoder_t * encoder, unsigned long int byte_count, unsigned long int invalid_count, char32_t high);
+
+static char32_t replacement_char(utf_codec_t codec);
+
 void utf_encoder_init(utf_encoder_t * encoder){
 	encoder->codec = UTF_CODEC_UTF8;
 	encoder->byte_array = NULL;
+	encoder->byte_index = 0;
 	encoder->byte_count = 0;
 	encoder->byte_count_res = 0;
+	encoder->policy = UTF_ENCODER_STRICT;
+	encoder->invalid_count = 0;
 }
 
 void utf_encoder_free(utf_encoder_t * encoder){
@@ -39,9 +71,19 @@ utf_codec_t utf_encoder_get_codec(const utf_encoder_t * encoder){
 	return encoder->codec;
 }
 
+utf_encoder_policy_t utf_encoder_get_policy(const utf_encoder_t * encoder){
+	return encoder->policy;
+}
+
+unsigned long int utf_encoder_get_invalid_count(const utf_encoder_t * encoder){
+	return encoder->invalid_count;
+}
+
 unsigned long int utf_encoder_read(utf_encoder_t * encoder, void * dst, unsigned long int dst_size){
 
 	unsigned long int read_size = 0;
+	unsigned long int head_size = 0;
+	unsigned char * dst8 = (unsigned char *)(dst);
 
 	if (dst_size < encoder->byte_count){
 		read_size = dst_size;
@@ -49,14 +91,29 @@ unsigned long int utf_encoder_read(utf_encoder_t * encoder, void * dst, unsigned
 		read_size = encoder->byte_count;
 	}
 
-	memcpy(dst, encoder->byte_array, read_size);
+	if (read_size == 0){
+		return 0;
+	}
 
-	memmove(encoder->byte_array,
-	       &encoder->byte_array[dst_size],
-	        encoder->byte_count - read_size);
+	/* the bytes may wrap around the end of the ring */
 
+	head_size = encoder->byte_count_res - encoder->byte_index;
+	if (head_size > read_size){
+		head_size = read_size;
+	}
+
+	memcpy(dst8, &encoder->byte_array[encoder->byte_index], head_size);
+
+	memcpy(&dst8[head_size], encoder->byte_array, read_size - head_size);
+
+	encoder->byte_index += read_size;
+	encoder->byte_index &= encoder->byte_count_res - 1;
 	encoder->byte_count -= read_size;
 
+	if (encoder->byte_count == 0){
+		encoder->byte_index = 0;
+	}
+
 	return read_size;
 }
 
@@ -64,27 +121,64 @@ void utf_encoder_set_codec(utf_encoder_t * encoder, utf_codec_t codec){
 	encoder->codec = codec;
 }
 
+void utf_encoder_set_policy(utf_encoder_t * encoder, utf_encoder_policy_t policy){
+	encoder->policy = policy;
+}
+
 utf_error_t utf_encoder_write(utf_encoder_t * encoder, char32_t input_char){
 
 	utf_error_t error = UTF_ERROR_NONE;
-	size_t index = 0;
 
-	if ((encoder->byte_count + 4) > encoder->byte_count_res){
-		error = utf_encoder_reserve(encoder, encoder->byte_count_res + 32);
-		if (error){
-			return error;
+	error = write_char(encoder, input_char);
+	if ((error == UTF_ERROR_INVALID_SEQUENCE) && (encoder->policy == UTF_ENCODER_REPLACE)){
+		error = write_char(encoder, replacement_char(encoder->codec));
+		if (error == UTF_ERROR_NONE){
+			encoder->invalid_count++;
+		}
+	}
+
+	return error;
+}
+
+/** Encodes a character the way @ref utf_encoder_write does,
+ * apart from replacing it. */
+
+static utf_error_t write_char(utf_encoder_t * encoder, char32_t input_char){
+
+	unsigned char output[6] = { 0, 0, 0, 0, 0, 0 };
+	size_t output_size = 0;
+	char32_t high = 0;
+	utf_error_t error = UTF_ERROR_NONE;
+
+	if ((encoder->codec == UTF_CODEC_WTF8)
+	 && (input_char >= 0xdc00)
+	 && (input_char <= 0xdfff)){
+		/* a low surrogate joins the high one before it,
+		 * the way that WTF-8 strings are concatenated */
+		high = tail_surrogate(encoder);
+		if (high != 0){
+			encoder->byte_count -= 3;
+			input_char = 0x10000 + ((high - 0xd800) << 10) + (input_char - 0xdc00);
 		}
 	}
 
-	index = encoder->byte_count;
+	if ((encoder->codec == UTF_CODEC_UTF8)
+	 || (encoder->codec == UTF_CODEC_UTF32_LE)
+	 || (encoder->codec == UTF_CODEC_UTF32_BE)){
+		/* only WTF-8, CESU-8 and UTF-16 keep surrogates */
+		if ((input_char >= 0xd800) && (input_char <= 0xdfff)){
+			return UTF_ERROR_INVALID_SEQUENCE;
+		}
+	}
 
-	if (encoder->codec == UTF_CODEC_UTF8){
+	if ((encoder->codec == UTF_CODEC_UTF8)
+	 || (encoder->codec == UTF_CODEC_WTF8)){
 
-		size_t result = utf8_encode(input_char, (char *)(&encoder->byte_array[index]));
+		size_t result = utf8_encode(input_char, (char *)(output));
 		if (!result){
 			return UTF_ERROR_INVALID_SEQUENCE;
 		} else {
-			encoder->byte_count += result;
+			output_size = result;
 		}
 
 	} else if (encoder->codec == UTF_CODEC_UTF16_LE){
@@ -95,13 +189,13 @@ utf_error_t utf_encoder_write(utf_encoder_t * encoder, char32_t input_char){
 		if (!result){
 			return UTF_ERROR_INVALID_SEQUENCE;
 		} else {
-			encoder->byte_count += result * 2;
+			output_size = result * 2;
 		}
 
-		encoder->byte_array[index + 0] = (output_char[0] >> 0) & 0xff;
-		encoder->byte_array[index + 1] = (output_char[0] >> 8) & 0xff;
-		encoder->byte_array[index + 2] = (output_char[1] >> 0) & 0xff;
-		encoder->byte_array[index + 3] = (output_char[1] >> 8) & 0xff;
+		output[0] = (output_char[0] >> 0) & 0xff;
+		output[1] = (output_char[0] >> 8) & 0xff;
+		output[2] = (output_char[1] >> 0) & 0xff;
+		output[3] = (output_char[1] >> 8) & 0xff;
 
 	} else if (encoder->codec == UTF_CODEC_UTF16_BE){
 
@@ -111,42 +205,392 @@ utf_error_t utf_encoder_write(utf_encoder_t * encoder, char32_t input_char){
 		if (!result){
 			return UTF_ERROR_INVALID_SEQUENCE;
 		} else {
-			encoder->byte_count += result * 2;
+			output_size = result * 2;
 		}
 
-		encoder->byte_array[index + 0] = (output_char[0] >> 8) & 0xff;
-		encoder->byte_array[index + 1] = (output_char[0] >> 0) & 0xff;
-		encoder->byte_array[index + 2] = (output_char[1] >> 8) & 0xff;
-		encoder->byte_array[index + 3] = (output_char[1] >> 0) & 0xff;
+		output[0] = (output_char[0] >> 8) & 0xff;
+		output[1] = (output_char[0] >> 0) & 0xff;
+		output[2] = (output_char[1] >> 8) & 0xff;
+		output[3] = (output_char[1] >> 0) & 0xff;
 
 	} else if (encoder->codec == UTF_CODEC_UTF32_LE){
-		encoder->byte_array[index + 0] = (input_char >> 0x00) & 0xff;
-		encoder->byte_array[index + 1] = (input_char >> 0x08) & 0xff;
-		encoder->byte_array[index + 2] = (input_char >> 0x10) & 0xff;
-		encoder->byte_array[index + 3] = (input_char >> 0x18) & 0xff;
-		encoder->byte_count += 4;
+		output[0] = (input_char >> 0x00) & 0xff;
+		output[1] = (input_char >> 0x08) & 0xff;
+		output[2] = (input_char >> 0x10) & 0xff;
+		output[3] = (input_char >> 0x18) & 0xff;
+		output_size = 4;
 	} else if (encoder->codec == UTF_CODEC_UTF32_BE){
-		encoder->byte_array[index + 0] = (input_char >> 0x18) & 0xff;
-		encoder->byte_array[index + 1] = (input_char >> 0x10) & 0xff;
-		encoder->byte_array[index + 2] = (input_char >> 0x08) & 0xff;
-		encoder->byte_array[index + 3] = (input_char >> 0x00) & 0xff;
-		encoder->byte_count += 4;
+		output[0] = (input_char >> 0x18) & 0xff;
+		output[1] = (input_char >> 0x10) & 0xff;
+		output[2] = (input_char >> 0x08) & 0xff;
+		output[3] = (input_char >> 0x00) & 0xff;
+		output_size = 4;
+	} else if (encoder->codec == UTF_CODEC_CESU8){
+		if (!utf_cesu8_from_utf32(&input_char, 1, output, &output_size)){
+			return UTF_ERROR_INVALID_SEQUENCE;
+		}
+	} else if (utf_codepage_get(encoder->codec) != NULL){
+
+		if (!utf_codepage_encode(utf_codepage_get(encoder->codec), input_char, output)){
+			return UTF_ERROR_INVALID_SEQUENCE;
+		}
+
+		output_size = 1;
 	}
 
-	return UTF_ERROR_NONE;
+	error = push_bytes(encoder, output, output_size);
+	if ((error != UTF_ERROR_NONE) && (high != 0)){
+		/* the high surrogate is still there */
+		encoder->byte_count += 3;
+	}
+
+	return error;
+}
+
+/** Returns the high surrogate that the encoded bytes end with,
+ * if they're WTF-8 and haven't been read yet.
+ * @returns The surrogate, or zero if they don't end with one.
+ */
+
+static char32_t tail_surrogate(const utf_encoder_t * encoder){
+
+	unsigned char bytes[3];
+	unsigned long int end = 0;
+	unsigned long int k = 0;
+
+	if (encoder->byte_count < 3){
+		return 0;
+	}
+
+	end = encoder->byte_index + encoder->byte_count;
+
+	/* the bytes may wrap around the end of the ring */
+
+	for (k = 0; k < 3; k++){
+		bytes[k] = encoder->byte_array[(end - 3 + k) & (encoder->byte_count_res - 1)];
+	}
+
+	if ((bytes[0] != 0xed) || (bytes[1] < 0xa0) || (bytes[1] > 0xaf)){
+		return 0;
+	}
+
+	return 0xd000 | ((bytes[1] & 0x3f) << 6) | (bytes[2] & 0x3f);
 }
 
 utf_error_t utf_encoder_reserve(utf_encoder_t * encoder, unsigned long int size){
-	unsigned char * tmp;
-	tmp = realloc(encoder->byte_array, size);
-	if ((tmp == NULL) && (size > 0)){
+
+	unsigned char * tmp = NULL;
+	unsigned long int res = 0;
+	unsigned long int keep_size = 0;
+
+	if (size == 0){
+		free(encoder->byte_array);
+		encoder->byte_array = NULL;
+		encoder->byte_index = 0;
+		encoder->byte_count = 0;
+		encoder->byte_count_res = 0;
+		return UTF_ERROR_NONE;
+	}
+
+	res = round_up(size);
+	if (res == 0){
+		return UTF_ERROR_MALLOC;
+	} else if (res > encoder->byte_count_res){
+		/* the bytes all fit, and stay where they are */
+		return grow_ring(encoder, res);
+	} else if (res == encoder->byte_count_res){
+		if (encoder->byte_count > size){
+			encoder->byte_count = size;
+		}
+		return UTF_ERROR_NONE;
+	}
+
+	tmp = malloc(res);
+	if (tmp == NULL){
 		return UTF_ERROR_MALLOC;
 	}
+
+	/* unwrap the oldest bytes into the new ring */
+
+	keep_size = encoder->byte_count;
+	if (keep_size > size){
+		keep_size = size;
+	}
+
+	utf_encoder_read(encoder, tmp, keep_size);
+
+	free(encoder->byte_array);
+
 	encoder->byte_array = tmp;
-	encoder->byte_count_res = size;
-	if (size < encoder->byte_count){
-		encoder->byte_count = size;
+	encoder->byte_index = 0;
+	encoder->byte_count = keep_size;
+	encoder->byte_count_res = res;
+
+	return UTF_ERROR_NONE;
+}
+
+utf_error_t utf_encoder_write_array(utf_encoder_t * encoder, const utf32_t * src, size_t src_count){
+
+	unsigned char * tail = NULL;
+	unsigned long int byte_count = 0;
+	unsigned long int invalid_count = 0;
+	size_t i = 0;
+	size_t block_count = 0;
+	size_t read_count = 0;
+	size_t write_size = 0;
+	char32_t replacement = 0;
+	char32_t high = 0;
+	utf_error_t error = UTF_ERROR_NONE;
+
+	/* on failure, the bytes that were added are dropped */
+
+	byte_count = encoder->byte_count;
+	invalid_count = encoder->invalid_count;
+
+	replacement = replacement_char(encoder->codec);
+
+	while (i < src_count){
+
+		/* a block can't join a low surrogate to the high one
+		 * that the last block ended with, write_char does */
+
+		if ((encoder->codec == UTF_CODEC_WTF8)
+		 && (src[i] >= 0xdc00)
+		 && (src[i] <= 0xdfff)
+		 && (tail_surrogate(encoder) != 0)){
+			if (i == 0){
+				high = tail_surrogate(encoder);
+			}
+			error = write_char(encoder, src[i]);
+			if (error != UTF_ERROR_NONE){
+				restore(encoder, byte_count, invalid_count, high);
+				return error;
+			}
+			i++;
+			continue;
+		}
+
+		block_count = src_count - i;
+		if (block_count > ENCODE_BLOCK_COUNT){
+			block_count = ENCODE_BLOCK_COUNT;
+		}
+
+		/* four bytes is the most that any codec takes for a character,
+		 * apart from CESU-8, which takes six for a surrogate pair */
+
+		if (encoder->codec == UTF_CODEC_CESU8){
+			tail = utf_ring_reserve_tail(encoder, block_count * 6);
+		} else {
+			tail = utf_ring_reserve_tail(encoder, block_count * 4);
+		}
+		if (tail == NULL){
+			restore(encoder, byte_count, invalid_count, high);
+			return UTF_ERROR_MALLOC;
+		}
+
+		read_count = encode_block(encoder->codec, &src[i], block_count, tail, &write_size);
+
+		encoder->byte_count += write_size;
+
+		if ((read_count < block_count)
+		 && (encoder->policy == UTF_ENCODER_REPLACE)){
+			/* the replacement takes the place that was made for the character */
+			encode_block(encoder->codec, &replacement, 1, &tail[write_size], &write_size);
+			encoder->byte_count += write_size;
+			encoder->invalid_count++;
+			read_count++;
+		} else if (read_count < block_count){
+			restore(encoder, byte_count, invalid_count, high);
+			return UTF_ERROR_INVALID_SEQUENCE;
+		}
+
+		i += read_count;
+	}
+
+	return UTF_ERROR_NONE;
+}
+
+/** Drops what @ref utf_encoder_write_array added to the encoder.
+ * @param high The high surrogate that the first character was joined to,
+ *  which is written back, or zero if it wasn't joined to one.
+ */
+
+static void restore(utf_encoder_t * encoder, unsigned long int byte_count, unsigned long int invalid_count, char32_t high){
+
+	unsigned char output[3];
+
+	encoder->byte_count = byte_count;
+	encoder->invalid_count = invalid_count;
+
+	if (high != 0){
+		/* it's where it was, and the ring can't grow here */
+		encoder->byte_count -= 3;
+		utf8_encode(high, (char *)(output));
+		push_bytes(encoder, output, 3);
+	}
+}
+
+/** Rounds a byte count up to a power of two.
+ * @returns The rounded count, or zero if it would overflow.
+ */
+
+static unsigned long int round_up(unsigned long int size){
+
+	unsigned long int res = 1;
+
+	while (res < size){
+		if (res > (((size_t) -1) / 2)){
+			return 0;
+		}
+		res *= 2;
+	}
+
+	return res;
+}
+
+/** Appends encoded bytes to the end of the ring.
+ * The ring at least doubles when it grows, so appending
+ * bytes is amortized constant time.
+ */
+
+static utf_error_t push_bytes(utf_encoder_t * encoder, const unsigned char * src, size_t src_size){
+
+	unsigned long int res = 0;
+	unsigned long int end = 0;
+	unsigned long int tail_size = 0;
+
+	if ((encoder->byte_count + src_size) > encoder->byte_count_res){
+
+		res = round_up(encoder->byte_count + src_size);
+		if (res == 0){
+			return UTF_ERROR_MALLOC;
+		} else if (res < 64){
+			res = 64;
+		}
+
+		if (grow_ring(encoder, res) != UTF_ERROR_NONE){
+			return UTF_ERROR_MALLOC;
+		}
+	}
+
+	end = (encoder->byte_index + encoder->byte_count) & (encoder->byte_count_res - 1);
+
+	tail_size = encoder->byte_count_res - end;
+	if (tail_size > src_size){
+		tail_size = src_size;
+	}
+
+	memcpy(&encoder->byte_array[end], src, tail_size);
+
+	memcpy(encoder->byte_array, &src[tail_size], src_size - tail_size);
+
+	encoder->byte_count += src_size;
+
+	return UTF_ERROR_NONE;
+}
+
+/** Grows the ring to a larger power of two, without moving the bytes
+ * in it any more than it has to.
+ */
+
+static utf_error_t grow_ring(utf_encoder_t * encoder, unsigned long int res){
+
+	unsigned char * tmp = NULL;
+	unsigned long int old_res = 0;
+
+	tmp = realloc(encoder->byte_array, res);
+	if (tmp == NULL){
+		return UTF_ERROR_MALLOC;
 	}
+
+	/* the ring at least doubled, so the bytes that
+	 * wrapped around fit right after the old end of it */
+
+	old_res = encoder->byte_count_res;
+
+	if ((encoder->byte_index + encoder->byte_count) > old_res){
+		memcpy(&tmp[old_res], tmp, encoder->byte_index + encoder->byte_count - old_res);
+	}
+
+	encoder->byte_array = tmp;
+	encoder->byte_count_res = res;
+
 	return UTF_ERROR_NONE;
 }
 
+/** Encodes a block of characters.
+ * @param dst It must fit four bytes for every character,
+ *  or six if @p codec is @ref UTF_CODEC_CESU8.
+ * @param dst_size Set to the number of bytes written to @p dst.
+ * @returns The number of characters encoded, which is less
+ *  than @p src_count if a character can't be encoded.
+ */
+
+static size_t encode_block(utf_codec_t codec, const utf32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size){
+
+	*dst_size = 0;
+
+	if (utf_codepage_get(codec) != NULL){
+		*dst_size = utf_codepage_encode_array(utf_codepage_get(codec), src, src_count, dst);
+		return *dst_size;
+	}
+
+	switch (codec){
+		case UTF_CODEC_UTF8:
+			return utf_kernel_utf32_to_utf8(src, src_count, dst, dst_size);
+		case UTF_CODEC_WTF8:
+			return utf_wtf8_from_utf32(src, src_count, dst, dst_size);
+		case UTF_CODEC_CESU8:
+			return utf_cesu8_from_utf32(src, src_count, dst, dst_size);
+		case UTF_CODEC_UTF16_LE:
+			return utf_kernel_utf32_to_utf16le(src, src_count, dst, dst_size);
+		case UTF_CODEC_UTF16_BE:
+			return utf_kernel_utf32_to_utf16be(src, src_count, dst, dst_size);
+		case UTF_CODEC_UTF32_LE:
+			return encode_utf32(src, src_count, dst, dst_size, 0);
+		case UTF_CODEC_UTF32_BE:
+			return encode_utf32(src, src_count, dst, dst_size, 1);
+		default:
+			break;
+	}
+
+	return src_count;
+}
+
+/** Writes characters as UTF-32, the same way that @ref utf_encoder_write
+ * does, which only checks that they aren't surrogates.
+ * @param dst_size Set to the number of bytes written to @p dst.
+ * @returns The number of characters written.
+ */
+
+static size_t encode_utf32(const utf32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size, int big_endian){
+
+	size_t i = 0;
+	int k0 = big_endian ? 3 : 0;
+	int k1 = big_endian ? 2 : 1;
+	int k2 = big_endian ? 1 : 2;
+	int k3 = big_endian ? 0 : 3;
+
+	for (i = 0; i < src_count; i++){
+		if ((src[i] >= 0xd800) && (src[i] <= 0xdfff)){
+			break;
+		}
+		dst[(i * 4) + k0] = (src[i] >> 0x00) & 0xff;
+		dst[(i * 4) + k1] = (src[i] >> 0x08) & 0xff;
+		dst[(i * 4) + k2] = (src[i] >> 0x10) & 0xff;
+		dst[(i * 4) + k3] = (src[i] >> 0x18) & 0xff;
+	}
+
+	*dst_size = i * 4;
+
+	return i;
+}
+
+/** Returns what characters that a codec doesn't have are replaced with. */
+
+static char32_t replacement_char(utf_codec_t codec){
+	if (utf_codepage_get(codec) != NULL){
+		return CODEPAGE_REPLACEMENT;
+	}
+	return 0xfffd;
+}
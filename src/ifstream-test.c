@@ -1,10 +1,32 @@
 #include <libutf/ifstream.h>
 #include <assert.h>
+#include <stdio.h>
+#include <string.h>
 
 void test_utf8(void);
 
+void test_utf16le_to_utf8(void);
+
+void test_utf8_to_utf32(void);
+
+void test_map(void);
+
+void test_detect(void);
+
+void test_cesu8(void);
+
+void test_end(void);
+
+static size_t read_file(const char * path, void * data, size_t data_max);
+
 int main(void){
 	test_utf8();
+	test_utf16le_to_utf8();
+	test_utf8_to_utf32();
+	test_map();
+	test_detect();
+	test_cesu8();
+	test_end();
 	return 0;
 }
 
@@ -22,3 +44,276 @@ void test_utf8(void){
 	utf_ifstream_free(&ifstream);
 }
 
+void test_utf16le_to_utf8(void){
+
+	struct utf_ifstream ifstream;
+	char expected[128];
+	char actual[128];
+	size_t expected_size;
+	size_t actual_size;
+	size_t read_count;
+
+	expected_size = read_file("testing/arabic/UTF-8.txt", expected, sizeof(expected));
+
+	/* opened without utf_ifstream_open, so that the file
+	 * is read through stdio instead of being mapped */
+	utf_ifstream_init(&ifstream);
+
+	utf_istream_set_data(&ifstream.istream, fopen("testing/arabic/UTF-16LE.txt", "rb"));
+	assert(ifstream.istream.stream.data != NULL);
+
+	utf_istream_set_codec(&ifstream.istream, UTF_CODEC_UTF16_LE);
+
+	/* small enough that surrogates and sequences are split between reads */
+	assert(utf_istream_set_buffer_size(&ifstream.istream, 3) == 0);
+
+	/* one byte at a time splits the two byte sequences in the output */
+	actual_size = 0;
+	while ((read_count = utf_ifstream_read_utf8(&ifstream, &actual[actual_size], 1)) > 0){
+		actual_size += read_count;
+		if (actual_size == 9){
+			break;
+		}
+	}
+
+	while ((read_count = utf_ifstream_read_utf8(&ifstream, &actual[actual_size], 5)) > 0){
+		actual_size += read_count;
+	}
+
+	assert(actual_size == expected_size);
+	assert(memcmp(actual, expected, expected_size) == 0);
+
+	utf_ifstream_free(&ifstream);
+}
+
+void test_utf8_to_utf32(void){
+
+	struct utf_ifstream ifstream;
+	char32_t expected[64];
+	char32_t actual[64];
+	size_t expected_count;
+	size_t actual_count;
+	size_t read_count;
+
+	if (UTF_CODEC_UTF32 == UTF_CODEC_UTF32_LE){
+		expected_count = read_file("testing/arabic/UTF-32LE.txt", expected, sizeof(expected)) / 4;
+	} else {
+		expected_count = read_file("testing/arabic/UTF-32BE.txt", expected, sizeof(expected)) / 4;
+	}
+
+	utf_ifstream_init(&ifstream);
+
+	assert(utf_ifstream_open(&ifstream, "testing/arabic/UTF-8.txt") == 0);
+
+	assert(utf_istream_set_buffer_size(&ifstream.istream, 5) == 0);
+
+	actual_count = 0;
+	while ((read_count = utf_ifstream_read_utf32(&ifstream, &actual[actual_count], 3)) > 0){
+		actual_count += read_count;
+	}
+
+	assert(actual_count == expected_count);
+	assert(memcmp(actual, expected, expected_count * 4) == 0);
+
+	utf_ifstream_free(&ifstream);
+}
+
+void test_cesu8(void){
+
+	struct utf_ifstream ifstream;
+	char actual[8];
+	size_t actual_size;
+	size_t read_count;
+
+	utf_ifstream_init(&ifstream);
+
+	/* U+10000 as a surrogate pair, which is six bytes of CESU-8 */
+	utf_istream_set_memory(&ifstream.istream, "\xed\xa0\x80\xed\xb0\x80" "A", 7);
+	utf_istream_set_codec(&ifstream.istream, UTF_CODEC_CESU8);
+
+	/* one byte at a time is less than a character of UTF-8 */
+	actual_size = 0;
+	while ((read_count = utf_ifstream_read_utf8(&ifstream, &actual[actual_size], 1)) > 0){
+		assert(read_count == 1);
+		actual_size += read_count;
+		assert(actual_size < sizeof(actual));
+	}
+
+	assert(actual_size == 5);
+	assert(memcmp(actual, "\xf0\x90\x80\x80" "A", 5) == 0);
+
+	utf_ifstream_free(&ifstream);
+}
+
+void test_end(void){
+
+	struct utf_ifstream ifstream;
+	char16_t utf16[8];
+	char utf8[8];
+
+	/* a WTF-8 high surrogate that ends the source is a code unit on its own */
+	utf_ifstream_init(&ifstream);
+	utf_istream_set_memory(&ifstream.istream, "A\xed\xa0\x80", 4);
+	utf_istream_set_codec(&ifstream.istream, UTF_CODEC_WTF8);
+	assert(utf_ifstream_read_utf16(&ifstream, utf16, 8) == 2);
+	assert(utf16[0] == 'A');
+	assert(utf16[1] == 0xd800);
+	assert(utf_istream_get_error(&ifstream.istream) == UTF_ERROR_NONE);
+	assert(utf_ifstream_read_utf16(&ifstream, utf16, 8) == 0);
+	utf_ifstream_free(&ifstream);
+
+	/* the same, one code unit at a time */
+	utf_ifstream_init(&ifstream);
+	utf_istream_set_memory(&ifstream.istream, "A\xed\xa0\x80", 4);
+	utf_istream_set_codec(&ifstream.istream, UTF_CODEC_WTF8);
+	assert(utf_ifstream_read_utf16(&ifstream, utf16, 1) == 1);
+	assert(utf_ifstream_read_utf16(&ifstream, &utf16[1], 1) == 1);
+	assert(utf16[1] == 0xd800);
+	assert(utf_ifstream_read_utf16(&ifstream, utf16, 1) == 0);
+	assert(utf_istream_get_error(&ifstream.istream) == UTF_ERROR_NONE);
+	utf_ifstream_free(&ifstream);
+
+	/* a stray continuation byte stops the read, and is reported */
+	utf_ifstream_init(&ifstream);
+	utf_istream_set_memory(&ifstream.istream, "A\x80", 2);
+	utf_istream_set_codec(&ifstream.istream, UTF_CODEC_UTF8);
+	assert(utf_ifstream_read_utf8(&ifstream, utf8, 8) == 1);
+	assert(utf_istream_get_error(&ifstream.istream) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(utf_ifstream_read_utf8(&ifstream, utf8, 8) == 0);
+	assert(utf_istream_get_error(&ifstream.istream) == UTF_ERROR_INVALID_SEQUENCE);
+	utf_ifstream_free(&ifstream);
+
+	/* and so does a sequence that the source ends in the middle of */
+	utf_ifstream_init(&ifstream);
+	utf_istream_set_memory(&ifstream.istream, "AB\xe2\x82", 4);
+	utf_istream_set_codec(&ifstream.istream, UTF_CODEC_UTF8);
+	assert(utf_ifstream_read_utf8(&ifstream, utf8, 8) == 2);
+	assert(memcmp(utf8, "AB", 2) == 0);
+	assert(utf_istream_get_error(&ifstream.istream) == UTF_ERROR_INVALID_SEQUENCE);
+	utf_ifstream_free(&ifstream);
+}
+
+static size_t read_file(const char * path, void * data, size_t data_max){
+
+	FILE * file;
+	size_t size;
+
+	file = fopen(path, "rb");
+	assert(file != NULL);
+
+	size = fread(data, 1, data_max, file);
+
+	fclose(file);
+
+	return size;
+}
+
+void test_map(void){
+
+	struct utf_ifstream ifstream;
+	char expected[128];
+	char actual[128];
+	size_t expected_size;
+	size_t actual_size;
+	size_t read_count;
+
+	expected_size = read_file("testing/arabic/UTF-8.txt", expected, sizeof(expected));
+
+	assert(utf_ifstream_open(&ifstream, "testing/arabic/UTF-16BE.txt") == 0);
+
+#if (defined __unix__) || (defined __APPLE__)
+	assert(ifstream.map != NULL);
+	assert(ifstream.map_size == read_file("testing/arabic/UTF-16BE.txt", actual, sizeof(actual)));
+#endif
+
+	utf_istream_set_codec(&ifstream.istream, UTF_CODEC_UTF16_BE);
+
+	actual_size = 0;
+	while ((read_count = utf_ifstream_read_utf8(&ifstream, &actual[actual_size], 7)) > 0){
+		actual_size += read_count;
+	}
+
+	assert(actual_size == expected_size);
+	assert(memcmp(actual, expected, expected_size) == 0);
+
+	utf_ifstream_free(&ifstream);
+
+	assert(ifstream.map == NULL);
+}
+
+void test_detect(void){
+
+	static const char * paths[] = {
+		"testing/arabic/UTF-8.txt",
+		"testing/arabic/UTF-16LE.txt",
+		"testing/arabic/UTF-16BE.txt",
+		"testing/arabic/UTF-32LE.txt",
+		"testing/arabic/UTF-32BE.txt",
+		"testing/english/UTF-8.txt",
+		"testing/english/UTF-16LE.txt",
+		"testing/english/UTF-16BE.txt",
+		"testing/english/UTF-32LE.txt",
+		"testing/english/UTF-32BE.txt"
+	};
+
+	static const utf_codec_t codecs[] = {
+		UTF_CODEC_UTF8,
+		UTF_CODEC_UTF16_LE,
+		UTF_CODEC_UTF16_BE,
+		UTF_CODEC_UTF32_LE,
+		UTF_CODEC_UTF32_BE
+	};
+
+	struct utf_ifstream ifstream;
+	unsigned char input[256];
+	char expected[128];
+	char actual[128];
+	size_t input_size;
+	size_t expected_size;
+	size_t actual_size;
+	size_t read_count;
+	size_t i;
+
+	for (i = 0; i < 10; i++){
+
+		expected_size = read_file(paths[(i / 5) * 5], expected, sizeof(expected));
+
+		utf_ifstream_init(&ifstream);
+		assert(utf_ifstream_open(&ifstream, paths[i]) == 0);
+
+		utf_istream_set_codec(&ifstream.istream, UTF_CODEC_AUTO);
+
+		actual_size = 0;
+		while ((read_count = utf_ifstream_read_utf8(&ifstream, &actual[actual_size], 16)) > 0){
+			actual_size += read_count;
+		}
+
+		assert(utf_istream_get_codec(&ifstream.istream) == codecs[i % 5]);
+		assert(actual_size == expected_size);
+		assert(memcmp(actual, expected, expected_size) == 0);
+
+		utf_ifstream_free(&ifstream);
+	}
+
+	/* the same text after a byte order mark, which is dropped */
+
+	expected_size = read_file("testing/english/UTF-8.txt", expected, sizeof(expected));
+
+	input[0] = 0xff;
+	input[1] = 0xfe;
+	input[2] = 0x00;
+	input[3] = 0x00;
+	input_size = 4 + read_file("testing/english/UTF-32LE.txt", &input[4], sizeof(input) - 4);
+
+	utf_ifstream_init(&ifstream);
+	utf_istream_set_memory(&ifstream.istream, input, input_size);
+	utf_istream_set_codec(&ifstream.istream, UTF_CODEC_AUTO);
+
+	actual_size = utf_ifstream_read_utf8(&ifstream, actual, sizeof(actual));
+
+	assert(utf_istream_get_codec(&ifstream.istream) == UTF_CODEC_UTF32_LE);
+	assert(actual_size == expected_size);
+	assert(memcmp(actual, expected, expected_size) == 0);
+
+	utf_ifstream_free(&ifstream);
+}
@@ -1,8 +1,26 @@
+/* fileno, mmap and posix_madvise are POSIX, which -ansi hides. */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include <libutf/ifstream.h>
 
 #include <stdio.h>
 #include <errno.h>
 
+#if (defined __unix__) || (defined __APPLE__)
+#include <unistd.h>
+#endif
+
+#if (defined _POSIX_MAPPED_FILES) && (_POSIX_MAPPED_FILES > 0)
+#define LIBUTF_IFSTREAM_MMAP
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static void ifstream_map(struct utf_ifstream * ifstream, FILE * file);
+
 static void ifstream_free(void * data){
 	fclose((FILE *)(data));
 }
@@ -25,10 +43,18 @@ void utf_ifstream_init(struct utf_ifstream * ifstream){
 	utf_istream_init(&ifstream->istream);
 	utf_istream_set_free(&ifstream->istream, ifstream_free);
 	utf_istream_set_read(&ifstream->istream, ifstream_read);
+	ifstream->map = NULL;
+	ifstream->map_size = 0;
 }
 
 void utf_ifstream_free(struct utf_ifstream * ifstream){
 	utf_istream_free(&ifstream->istream);
+#ifdef LIBUTF_IFSTREAM_MMAP
+	if (ifstream->map != NULL){
+		munmap(ifstream->map, ifstream->map_size);
+		ifstream->map = NULL;
+	}
+#endif /* LIBUTF_IFSTREAM_MMAP */
 }
 
 int utf_ifstream_open(struct utf_ifstream * ifstream, const char * path){
@@ -56,6 +82,8 @@ int utf_ifstream_open(struct utf_ifstream * ifstream, const char * path){
 
 	utf_istream_set_data(&ifstream->istream, file);
 
+	ifstream_map(ifstream, file);
+
 	return 0;
 }
 
@@ -77,3 +105,41 @@ size_t utf_ifstream_read_utf32(struct utf_ifstream * ifstream, utf32_t * data, s
 	return utf_istream_read_utf32(&ifstream->istream, data, data_max);
 }
 
+
+/** Maps a regular file into memory, so that it's converted in
+ * place instead of being copied through stdio. Pipes, terminals and
+ * anything else that can't be mapped are read with fread instead. */
+
+static void ifstream_map(struct utf_ifstream * ifstream, FILE * file){
+#ifdef LIBUTF_IFSTREAM_MMAP
+
+	struct stat file_stat;
+	void * map;
+
+	if (fstat(fileno(file), &file_stat) != 0){
+		return;
+	} else if (!S_ISREG(file_stat.st_mode)){
+		return;
+	} else if ((file_stat.st_size <= 0)
+	        || ((uintmax_t)(file_stat.st_size) > SIZE_MAX)){
+		return;
+	}
+
+	map = mmap(NULL, (size_t)(file_stat.st_size), PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	if (map == MAP_FAILED){
+		return;
+	}
+
+	/* the file is read once, from start to end */
+	posix_madvise(map, (size_t)(file_stat.st_size), POSIX_MADV_SEQUENTIAL);
+
+	ifstream->map = map;
+	ifstream->map_size = (size_t)(file_stat.st_size);
+
+	utf_istream_set_memory(&ifstream->istream, map, ifstream->map_size);
+
+#else /* LIBUTF_IFSTREAM_MMAP */
+	(void) ifstream;
+	(void) file;
+#endif /* LIBUTF_IFSTREAM_MMAP */
+}
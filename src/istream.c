@@ -2,26 +2,100 @@
 #include <libutf/converter.h>
 
 #include <stdlib.h>
+#include <string.h>
 
 static size_t utf_istream_read_any(struct utf_istream * istream, unsigned char * bytes, size_t data_max, utf_codec_t dst_codec);
 
+static size_t utf_istream_read_split(struct utf_istream * istream, unsigned char * bytes, size_t data_max);
+
+static int utf_istream_fill(struct utf_istream * istream);
+
 void utf_istream_init(struct utf_istream * istream){
 	utf_stream_init(&istream->stream);
 	istream->read_cb = NULL;
+	istream->buffer = NULL;
+	istream->buffer_size = LIBUTF_ISTREAM_BUFFER_SIZE;
+	istream->buffer_index = 0;
+	istream->buffer_count = 0;
+	istream->buffer_borrowed = LIBUTF_FALSE;
+	utf_converter_init(&istream->converter);
+	istream->error = UTF_ERROR_NONE;
 }
 
 void utf_istream_free(struct utf_istream * istream){
 	utf_stream_free(&istream->stream);
+	utf_converter_free(&istream->converter);
+	if (!istream->buffer_borrowed){
+		free(istream->buffer);
+	}
+	istream->buffer = NULL;
 }
 
 utf_codec_t utf_istream_get_codec(const struct utf_istream * istream){
 	return utf_stream_get_codec(&istream->stream);
 }
 
+/* An invalid sequence, or one that the source ends in the middle of,
+ * stops a read short. The read after it stops at the same place. */
+
+utf_error_t utf_istream_get_error(const struct utf_istream * istream){
+	return istream->error;
+}
+
 void utf_istream_set_codec(struct utf_istream * istream, utf_codec_t codec){
 	utf_stream_set_codec(&istream->stream, codec);
 }
 
+int utf_istream_set_buffer_size(struct utf_istream * istream, size_t buffer_size){
+
+	unsigned char * tmp;
+
+	if (buffer_size == 0){
+		return -1;
+	}
+
+	if ((istream->buffer == NULL)
+	 || (istream->buffer_borrowed)){
+		istream->buffer_size = buffer_size;
+		return 0;
+	}
+
+	/* keep the bytes that haven't been converted yet */
+	memmove(istream->buffer, &istream->buffer[istream->buffer_index], istream->buffer_count);
+	istream->buffer_index = 0;
+
+	if (buffer_size < istream->buffer_count){
+		buffer_size = istream->buffer_count;
+	}
+
+	tmp = realloc(istream->buffer, buffer_size);
+	if (tmp == NULL){
+		return -1;
+	}
+
+	istream->buffer = tmp;
+	istream->buffer_size = buffer_size;
+
+	return 0;
+}
+
+/* The memory is converted in place, and read_cb isn't called
+ * once it's used up. It must outlive the stream. */
+
+void utf_istream_set_memory(struct utf_istream * istream, const void * data, size_t data_size){
+
+	if (!istream->buffer_borrowed){
+		free(istream->buffer);
+	}
+
+	/* the buffer is only written to by utf_istream_fill,
+	 * which isn't called for borrowed memory */
+	istream->buffer = (unsigned char *)(data);
+	istream->buffer_index = 0;
+	istream->buffer_count = data_size;
+	istream->buffer_borrowed = LIBUTF_TRUE;
+}
+
 void utf_istream_set_data(struct utf_istream * istream, void * data){
 	utf_stream_set_data(&istream->stream, data);
 }
@@ -49,40 +123,140 @@ size_t utf_istream_read_utf16(struct utf_istream * istream, char16_t * data, siz
 }
 
 size_t utf_istream_read_utf32(struct utf_istream * istream, char32_t * data, size_t data_max){
-	return utf_istream_read_any(istream, (unsigned char *)(data), data_max * sizeof(char16_t), UTF_CODEC_UTF32) / 4;
+	return utf_istream_read_any(istream, (unsigned char *)(data), data_max * sizeof(char32_t), UTF_CODEC_UTF32) / 4;
 }
 
 static size_t utf_istream_read_any(struct utf_istream * istream, unsigned char * bytes, size_t data_max, utf_codec_t dst_codec){
-	size_t i;
+
+	utf_error_t error;
+	const void * src;
+	size_t src_left;
+	void * dst;
+	size_t dst_left;
+	int end;
+
+	utf_converter_set_decoder_codec(&istream->converter, utf_istream_get_codec(istream));
+	utf_converter_set_encoder_codec(&istream->converter, dst_codec);
+
+	istream->error = UTF_ERROR_NONE;
+
+	dst = bytes;
+	dst_left = data_max;
+
+	while (dst_left > 0){
+
+		end = (istream->buffer_count == 0) && (utf_istream_fill(istream) != 0);
+
+		if (end){
+			/* the end of the source is the end of the input, so what the
+			 * converter kept of a character that was split between reads
+			 * comes out, or it's an invalid sequence. A source that's
+			 * shorter than a byte order mark gets its codec here too. */
+			error = utf_converter_flush(&istream->converter, &dst, &dst_left);
+		} else {
+			src = &istream->buffer[istream->buffer_index];
+			src_left = istream->buffer_count;
+
+			error = utf_converter_convert(&istream->converter, &src, &src_left, &dst, &dst_left);
+
+			istream->buffer_index += istream->buffer_count - src_left;
+			istream->buffer_count = src_left;
+		}
+
+		if (error == UTF_ERROR_OVERFLOW){
+			if (dst_left == data_max){
+				/* the caller's buffer is smaller than one character */
+				dst_left -= utf_istream_read_split(istream, bytes, data_max);
+			}
+			break;
+		} else if (error != UTF_ERROR_NONE){
+			istream->error = error;
+			break;
+		} else if (end){
+			break;
+		}
+	}
+
+	/* later reads go on with the codec that was detected */
+
+	if (utf_istream_get_codec(istream) == UTF_CODEC_AUTO){
+		utf_istream_set_codec(istream, utf_converter_get_decoder_codec(&istream->converter));
+	}
+
+	return data_max - dst_left;
+}
+
+/** Reads the start of a character that doesn't fit in the caller's buffer.
+ * The rest of it is kept by the converter for the next read.
+ */
+
+static size_t utf_istream_read_split(struct utf_istream * istream, unsigned char * bytes, size_t data_max){
+
+	utf_encoder_t * encoder;
 	size_t write_count;
-	size_t read_count;
-	utf_converter_t converter;
-	unsigned char byte;
+	size_t write_max;
+
+	encoder = utf_converter_get_encoder(&istream->converter);
 
-	utf_converter_init(&converter);
-	utf_converter_set_decoder_codec(&converter, utf_istream_get_codec(istream));
-	utf_converter_set_encoder_codec(&converter, dst_codec);
+	/* a sequence at a time, until the converter has something to read,
+	 * since a CESU-8 surrogate pair only comes out once all six bytes are in */
 
-	i = 0;
-	while (1){
-		if (istream->read_cb(istream->stream.data, &byte, 1) != 1){
+	while (encoder->byte_count == 0){
+
+		if ((istream->buffer_count == 0)
+		 && (utf_istream_fill(istream) != 0)){
+			istream->error = utf_converter_flush(&istream->converter, NULL, NULL);
 			break;
 		}
-		write_count = utf_converter_write(&converter, &byte, 1);
-		if (write_count != 1){
+
+		if (utf_converter_get_decoder_codec(&istream->converter) == UTF_CODEC_CESU8){
+			write_max = 6;
+		} else {
+			write_max = 4;
+		}
+
+		if (write_max > istream->buffer_count){
+			write_max = istream->buffer_count;
+		}
+
+		write_count = utf_converter_write(&istream->converter, &istream->buffer[istream->buffer_index], write_max);
+
+		istream->buffer_index += write_count;
+		istream->buffer_count -= write_count;
+
+		if (write_count < write_max){
+			/* an invalid sequence */
+			istream->error = UTF_ERROR_INVALID_SEQUENCE;
 			break;
 		}
-		read_count = utf_converter_read(&converter, &bytes[i], 1);
-		if (read_count == 1){
-			i++;
-			if (i == data_max){
-				break;
-			}
+	}
+
+	return utf_converter_read(&istream->converter, bytes, data_max);
+}
+
+/** Reads the next chunk of the source into the read-ahead buffer.
+ * @returns Zero on success, non-zero at the end of the source or on failure.
+ */
+
+static int utf_istream_fill(struct utf_istream * istream){
+
+	if ((istream->read_cb == NULL)
+	 || (istream->buffer_borrowed)){
+		return -1;
+	}
+
+	if (istream->buffer == NULL){
+		istream->buffer = malloc(istream->buffer_size);
+		if (istream->buffer == NULL){
+			return -1;
 		}
 	}
 
-	utf_converter_free(&converter);
+	istream->buffer_index = 0;
+	istream->buffer_count = istream->read_cb(istream->stream.data, istream->buffer, istream->buffer_size);
+	if (istream->buffer_count == 0){
+		return -1;
+	}
 
-	return i;
+	return 0;
 }
-
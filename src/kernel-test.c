@@ -0,0 +1,834 @@
+#include "codepage.h"
+#include "kernel.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLE_SIZE 4096
+
+static void test_utf8_validate(void);
+
+static void test_utf8_to_utf32(void);
+
+static void test_utf8_random(void);
+
+static void test_utf8_scalar(void);
+
+static void test_ascii_length(void);
+
+static void test_utf16(void);
+
+static void test_utf16_random(void);
+
+static void test_measure_random(void);
+
+static void test_length_random(void);
+
+static void test_utf32_random(void);
+
+static void test_swap_random(void);
+
+static void test_zero_count(void);
+
+static void test_codepage_random(void);
+
+static void test_latin1_random(void);
+
+static size_t make_sample(unsigned char * sample, size_t sample_max, unsigned int seed);
+
+int main(void){
+	test_utf8_validate();
+	test_utf8_to_utf32();
+	test_utf8_random();
+	test_utf8_scalar();
+	test_ascii_length();
+	test_utf16();
+	test_utf16_random();
+	test_measure_random();
+	test_length_random();
+	test_utf32_random();
+	test_swap_random();
+	test_zero_count();
+	test_codepage_random();
+	test_latin1_random();
+	return EXIT_SUCCESS;
+}
+
+static void test_utf8_validate(void){
+
+	unsigned char in[64];
+
+	/* "ó€𐐷" */
+	assert(utf_kernel_utf8_validate((const unsigned char *) "\xc3\xb3\xe2\x82\xac\xf0\x90\x90\xb7", 9) == 9);
+	/* incomplete */
+	assert(utf_kernel_utf8_validate((const unsigned char *) "a\xe2\x82", 3) == 1);
+	/* overlong */
+	assert(utf_kernel_utf8_validate((const unsigned char *) "a\xc0\xaf", 3) == 1);
+	assert(utf_kernel_utf8_validate((const unsigned char *) "a\xe0\x80\xaf", 4) == 1);
+	assert(utf_kernel_utf8_validate((const unsigned char *) "a\xf0\x80\x80\xaf", 5) == 1);
+	/* surrogate */
+	assert(utf_kernel_utf8_validate((const unsigned char *) "a\xed\xa0\x80", 4) == 1);
+	/* above U+10FFFF */
+	assert(utf_kernel_utf8_validate((const unsigned char *) "a\xf4\x90\x80\x80", 5) == 1);
+	assert(utf_kernel_utf8_validate((const unsigned char *) "a\xf5\x80\x80\x80", 5) == 1);
+	/* stray continuation byte */
+	assert(utf_kernel_utf8_validate((const unsigned char *) "ab\x80", 3) == 2);
+
+	/* errors past the first vector */
+	memset(in, 'a', sizeof(in));
+	in[40] = 0xed;
+	in[41] = 0xa0;
+	in[42] = 0x80;
+	assert(utf_kernel_utf8_validate(in, sizeof(in)) == 40);
+	assert(utf_kernel_utf8_validate_scalar(in, sizeof(in)) == 40);
+
+	/* sequence split over two vectors */
+	memset(in, 'a', sizeof(in));
+	in[15] = 0xf0;
+	in[16] = 0x90;
+	in[17] = 0x90;
+	in[18] = 0xb7;
+	assert(utf_kernel_utf8_validate(in, sizeof(in)) == sizeof(in));
+	in[17] = 'a';
+	assert(utf_kernel_utf8_validate(in, sizeof(in)) == 15);
+}
+
+static void test_utf8_to_utf32(void){
+
+	unsigned char in[48];
+	char32_t out[48];
+	size_t out_count = 0;
+
+	memset(in, 'a', sizeof(in));
+	in[20] = 0xc3;
+	in[21] = 0xb3;
+	in[31] = 0xe2;
+	in[32] = 0x82;
+	in[33] = 0xac;
+
+	assert(utf_kernel_utf8_to_utf32(in, sizeof(in), out, &out_count) == sizeof(in));
+	assert(out_count == (sizeof(in) - 3));
+	assert(out[19] == 'a');
+	assert(out[20] == 0xf3);
+	assert(out[21] == 'a');
+	assert(out[29] == 'a');
+	assert(out[30] == 0x20ac);
+	assert(out[31] == 'a');
+
+	/* decoding stops at the incomplete sequence */
+	assert(utf_kernel_utf8_to_utf32(in, 33, out, &out_count) == 31);
+	assert(out_count == 30);
+}
+
+static void test_utf8_random(void){
+
+	unsigned int seed;
+	unsigned char * sample;
+	size_t sample_size;
+	size_t scalar_size;
+	size_t scalar_count;
+	size_t vector_size;
+	size_t vector_count;
+	char32_t * scalar_out;
+	char32_t * vector_out;
+
+	sample = malloc(SAMPLE_SIZE);
+	scalar_out = malloc(SAMPLE_SIZE * sizeof(char32_t));
+	vector_out = malloc(SAMPLE_SIZE * sizeof(char32_t));
+	assert(sample != NULL);
+	assert(scalar_out != NULL);
+	assert(vector_out != NULL);
+
+	for (seed = 0; seed < 256; seed++){
+
+		sample_size = make_sample(sample, SAMPLE_SIZE, seed);
+
+		/* every so often, corrupt a byte */
+		if (seed % 4 == 0){
+			sample[(seed * 7919) % sample_size] ^= (unsigned char)(seed | 0x80);
+		}
+
+		scalar_size = utf_kernel_utf8_to_utf32_scalar(sample, sample_size, scalar_out, &scalar_count);
+		vector_size = utf_kernel_utf8_to_utf32(sample, sample_size, vector_out, &vector_count);
+		assert(scalar_size == vector_size);
+		assert(scalar_count == vector_count);
+		assert(memcmp(scalar_out, vector_out, scalar_count * sizeof(char32_t)) == 0);
+
+		assert(utf_kernel_utf8_validate_scalar(sample, sample_size) == scalar_size);
+		assert(utf_kernel_utf8_validate(sample, sample_size) == scalar_size);
+	}
+
+	free(sample);
+	free(scalar_out);
+	free(vector_out);
+}
+
+static void test_utf8_scalar(void){
+
+	unsigned int lead;
+	unsigned int second;
+	unsigned char min;
+	unsigned char max;
+	unsigned char in[4];
+	size_t length;
+	size_t expected;
+	size_t count;
+	char32_t out[4];
+	char32_t valid_out[4];
+
+	/* every lead byte, followed by every second byte,
+	 * against RFC 3629, table 3-7 */
+
+	for (lead = 0xc0; lead <= 0xff; lead++){
+		min = 0x80;
+		max = 0xbf;
+		if (lead < 0xc2){
+			length = 0;
+		} else if (lead < 0xe0){
+			length = 2;
+		} else if (lead < 0xf0){
+			length = 3;
+			min = (lead == 0xe0) ? 0xa0 : min;
+			max = (lead == 0xed) ? 0x9f : max;
+		} else if (lead < 0xf5){
+			length = 4;
+			min = (lead == 0xf0) ? 0x90 : min;
+			max = (lead == 0xf4) ? 0x8f : max;
+		} else {
+			length = 0;
+		}
+		for (second = 0; second <= 0xff; second++){
+			in[0] = (unsigned char)(lead);
+			in[1] = (unsigned char)(second);
+			in[2] = 0xbf;
+			in[3] = 0x80;
+			expected = length;
+			if ((second < min) || (second > max)){
+				expected = 0;
+			}
+			assert(utf_kernel_utf8_validate_scalar(in, 4) == expected);
+			assert(utf_kernel_utf8_length_scalar(in, 4, &count) == expected);
+			assert(count == (expected > 0));
+			assert(utf_kernel_utf8_to_utf32_scalar(in, 4, out, &count) == expected);
+			assert(count == (expected > 0));
+			if (expected > 0){
+				utf_kernel_utf8_to_utf32_valid(in, expected, valid_out);
+				assert(out[0] == valid_out[0]);
+				/* one byte short */
+				assert(utf_kernel_utf8_validate_scalar(in, expected - 1) == 0);
+			}
+		}
+	}
+}
+
+static void test_ascii_length(void){
+
+	unsigned char in[100];
+	size_t i;
+	size_t size;
+
+	memset(in, 'a', sizeof(in));
+
+	assert(utf_kernel_ascii_length(in, sizeof(in)) == sizeof(in));
+	assert(utf_kernel_ascii_length_scalar(in, sizeof(in)) == sizeof(in));
+
+	/* the run ends at a byte that isn't ASCII, in every position of a word or vector */
+	for (i = 0; i < sizeof(in); i++){
+		in[i] = 0x80 | (unsigned char)(i);
+		for (size = i; size <= sizeof(in); size++){
+			assert(utf_kernel_ascii_length(in, size) == i);
+			assert(utf_kernel_ascii_length_scalar(in, size) == i);
+		}
+		assert(utf_kernel_ascii_length(in, i / 2) == (i / 2));
+		in[i] = 'a';
+	}
+}
+
+static void test_utf16(void){
+
+	unsigned char in[80];
+	unsigned char out[160];
+	size_t out_size = 0;
+
+	/* "aó€𐐷" */
+	assert(utf_kernel_utf8_to_utf16le((const unsigned char *) "a\xc3\xb3\xe2\x82\xac\xf0\x90\x90\xb7", 10, out, &out_size) == 10);
+	assert(out_size == 10);
+	assert(memcmp(out, "a\x00\xf3\x00\xac\x20\x01\xd8\x37\xdc", 10) == 0);
+
+	assert(utf_kernel_utf8_to_utf16be((const unsigned char *) "a\xc3\xb3\xe2\x82\xac\xf0\x90\x90\xb7", 10, out, &out_size) == 10);
+	assert(out_size == 10);
+	assert(memcmp(out, "\x00" "a\x00\xf3\x20\xac\xd8\x01\xdc\x37", 10) == 0);
+
+	assert(utf_kernel_utf16le_to_utf8((const unsigned char *) "a\x00\xf3\x00\xac\x20\x01\xd8\x37\xdc", 10, out, &out_size) == 10);
+	assert(out_size == 10);
+	assert(memcmp(out, "a\xc3\xb3\xe2\x82\xac\xf0\x90\x90\xb7", 10) == 0);
+
+	assert(utf_kernel_utf16be_to_utf8((const unsigned char *) "\x00" "a\x00\xf3\x20\xac\xd8\x01\xdc\x37", 10, out, &out_size) == 10);
+	assert(out_size == 10);
+	assert(memcmp(out, "a\xc3\xb3\xe2\x82\xac\xf0\x90\x90\xb7", 10) == 0);
+
+	/* incomplete pair */
+	assert(utf_kernel_utf16le_to_utf8((const unsigned char *) "a\x00\x01\xd8", 4, out, &out_size) == 2);
+	assert(out_size == 1);
+	/* unpaired low surrogate */
+	assert(utf_kernel_utf16le_to_utf8((const unsigned char *) "a\x00\x37\xdc" "a\x00", 6, out, &out_size) == 2);
+
+	/* a pair that straddles two vectors, followed by an error */
+	for (out_size = 0; out_size < sizeof(in); out_size += 2){
+		in[out_size + 0] = 'a';
+		in[out_size + 1] = 0;
+	}
+	in[30] = 0x01;
+	in[31] = 0xd8;
+	in[32] = 0x37;
+	in[33] = 0xdc;
+	in[70] = 0x37;
+	in[71] = 0xdc;
+	assert(utf_kernel_utf16le_to_utf8(in, sizeof(in), out, &out_size) == 70);
+	assert(out_size == 37);
+	assert(memcmp(&out[15], "\xf0\x90\x90\xb7", 4) == 0);
+	assert(out[36] == 'a');
+}
+
+static void test_utf16_random(void){
+
+	unsigned int seed;
+	unsigned char * sample;
+	size_t sample_size;
+	size_t scalar_size;
+	size_t scalar_out_size;
+	size_t vector_size;
+	size_t vector_out_size;
+	unsigned char * scalar_out;
+	unsigned char * vector_out;
+	unsigned char * utf8_out;
+
+	sample = malloc(SAMPLE_SIZE);
+	scalar_out = malloc(SAMPLE_SIZE * 2);
+	vector_out = malloc(SAMPLE_SIZE * 2);
+	utf8_out = malloc(SAMPLE_SIZE * 3);
+	assert(sample != NULL);
+	assert(scalar_out != NULL);
+	assert(vector_out != NULL);
+	assert(utf8_out != NULL);
+
+	for (seed = 0; seed < 256; seed++){
+
+		sample_size = make_sample(sample, SAMPLE_SIZE, seed);
+
+		if (seed % 4 == 0){
+			sample[(seed * 7919) % sample_size] ^= (unsigned char)(seed | 0x80);
+		}
+
+		scalar_size = utf_kernel_utf8_to_utf16le_scalar(sample, sample_size, scalar_out, &scalar_out_size);
+		vector_size = utf_kernel_utf8_to_utf16le(sample, sample_size, vector_out, &vector_out_size);
+		assert(scalar_size == vector_size);
+		assert(scalar_out_size == vector_out_size);
+		assert(memcmp(scalar_out, vector_out, scalar_out_size) == 0);
+
+		/* and back again */
+		assert(utf_kernel_utf16le_to_utf8_scalar(scalar_out, scalar_out_size, utf8_out, &vector_out_size) == scalar_out_size);
+		assert(vector_out_size == scalar_size);
+		assert(memcmp(utf8_out, sample, scalar_size) == 0);
+		assert(utf_kernel_utf16le_to_utf8(scalar_out, scalar_out_size, utf8_out, &vector_out_size) == scalar_out_size);
+		assert(vector_out_size == scalar_size);
+		assert(memcmp(utf8_out, sample, scalar_size) == 0);
+	}
+
+	free(sample);
+	free(scalar_out);
+	free(vector_out);
+	free(utf8_out);
+}
+
+static void test_utf32_random(void){
+
+	unsigned int seed;
+	unsigned int i;
+	char32_t * sample;
+	size_t sample_count;
+	size_t scalar_count;
+	size_t scalar_out_size;
+	size_t vector_count;
+	size_t vector_out_size;
+	unsigned char * scalar_out;
+	unsigned char * vector_out;
+
+	sample = malloc(SAMPLE_SIZE * sizeof(char32_t));
+	scalar_out = malloc(SAMPLE_SIZE * 4);
+	vector_out = malloc(SAMPLE_SIZE * 4);
+	assert(sample != NULL);
+	assert(scalar_out != NULL);
+	assert(vector_out != NULL);
+
+	for (seed = 0; seed < 256; seed++){
+
+		srand(seed);
+
+		sample_count = SAMPLE_SIZE - (seed % 61);
+
+		/* long runs of ASCII or BMP characters */
+		for (i = 0; i < sample_count; i++){
+			if (((i / 64) + seed) % 3 == 0){
+				sample[i] = rand() % 0x80;
+			} else if (((i / 64) + seed) % 3 == 1){
+				sample[i] = rand() % 0x10000;
+			} else {
+				sample[i] = rand() % 0x110000;
+			}
+			if ((sample[i] >= 0xd800) && (sample[i] <= 0xdfff)){
+				sample[i] ^= 0x8000;
+			}
+		}
+
+		/* with the odd value that UTF-8 doesn't have */
+		if (seed % 4 == 0){
+			sample[(seed * 7919) % sample_count] = 0x110000 + seed;
+		} else if (seed % 4 == 1){
+			sample[(seed * 7919) % sample_count] = 0xd800 + seed;
+		}
+
+		scalar_count = utf_kernel_utf32_to_utf8_scalar(sample, sample_count, scalar_out, &scalar_out_size);
+		vector_count = utf_kernel_utf32_to_utf8(sample, sample_count, vector_out, &vector_out_size);
+		assert(scalar_count == vector_count);
+		assert(scalar_out_size == vector_out_size);
+		assert(memcmp(scalar_out, vector_out, scalar_out_size) == 0);
+		if (seed % 4 <= 1){
+			assert(scalar_count == ((seed * 7919) % sample_count));
+		} else {
+			assert(scalar_count == sample_count);
+		}
+
+		scalar_count = utf_kernel_utf32_to_utf16le_scalar(sample, sample_count, scalar_out, &scalar_out_size);
+		vector_count = utf_kernel_utf32_to_utf16le(sample, sample_count, vector_out, &vector_out_size);
+		assert(scalar_count == vector_count);
+		assert(scalar_out_size == vector_out_size);
+		assert(memcmp(scalar_out, vector_out, scalar_out_size) == 0);
+
+		/* the same code units, the other way around */
+		vector_count = utf_kernel_utf32_to_utf16be(sample, sample_count, vector_out, &vector_out_size);
+		assert(scalar_count == vector_count);
+		assert(scalar_out_size == vector_out_size);
+		for (i = 0; i < scalar_out_size; i += 2){
+			assert(scalar_out[i] == vector_out[i + 1]);
+			assert(scalar_out[i + 1] == vector_out[i]);
+		}
+	}
+
+	free(sample);
+	free(scalar_out);
+	free(vector_out);
+}
+
+static void test_swap_random(void){
+
+	unsigned int seed;
+	unsigned int big_endian;
+	unsigned char * sample;
+	unsigned char * utf16;
+	unsigned char * scalar_out;
+	unsigned char * vector_out;
+	size_t sample_size;
+	size_t utf16_size;
+	size_t scalar_size;
+	size_t vector_size;
+	size_t i;
+
+	sample = malloc(SAMPLE_SIZE);
+	utf16 = malloc((SAMPLE_SIZE * 2) + 1);
+	scalar_out = malloc((SAMPLE_SIZE * 2) + 1);
+	vector_out = malloc((SAMPLE_SIZE * 2) + 1);
+	assert(sample != NULL);
+	assert(utf16 != NULL);
+	assert(scalar_out != NULL);
+	assert(vector_out != NULL);
+
+	for (seed = 0; seed < 256; seed++){
+
+		sample_size = make_sample(sample, SAMPLE_SIZE, seed);
+
+		utf_kernel_utf8_to_utf16le_scalar(sample, sample_size, utf16, &utf16_size);
+
+		/* an unpaired surrogate, or an odd byte at the end */
+		if (seed % 4 == 0){
+			utf16[((seed * 7919) % (utf16_size / 2)) * 2 + 1] = 0xdc;
+		} else if (seed % 4 == 1){
+			utf16[utf16_size++] = 0x41;
+		}
+
+		for (big_endian = 0; big_endian < 2; big_endian++){
+
+			scalar_size = utf_kernel_utf16_swap_scalar(utf16, utf16_size, scalar_out, big_endian);
+			vector_size = utf_kernel_utf16_swap(utf16, utf16_size, vector_out, big_endian);
+			assert(scalar_size == vector_size);
+			assert(memcmp(scalar_out, vector_out, scalar_size) == 0);
+			assert((seed % 4 == 0) || (scalar_size == (utf16_size & ~((size_t) 1))));
+
+			for (i = 0; i < scalar_size; i += 2){
+				assert(scalar_out[i + 0] == utf16[i + 1]);
+				assert(scalar_out[i + 1] == utf16[i + 0]);
+			}
+
+			/* and in place, back again */
+			assert(utf_kernel_utf16_swap(vector_out, vector_size, vector_out, !big_endian) == vector_size);
+			assert(memcmp(vector_out, utf16, vector_size) == 0);
+
+			/* the same bytes are swapped the other way around */
+			memcpy(utf16, scalar_out, scalar_size);
+		}
+
+		scalar_size = utf_kernel_utf32_swap_scalar(sample, sample_size, scalar_out);
+		vector_size = utf_kernel_utf32_swap(sample, sample_size, vector_out);
+		assert(scalar_size == (sample_size & ~((size_t) 3)));
+		assert(scalar_size == vector_size);
+		assert(memcmp(scalar_out, vector_out, scalar_size) == 0);
+		assert((scalar_size == 0) || (scalar_out[0] == sample[3]));
+	}
+
+	free(sample);
+	free(utf16);
+	free(scalar_out);
+	free(vector_out);
+}
+
+/** Generates well-formed UTF-8, mixing runs of ASCII
+ * with two, three and four byte sequences. */
+
+static void test_measure_random(void){
+
+	unsigned int seed;
+	unsigned long int state;
+	unsigned int unit;
+	unsigned char * sample;
+	unsigned char * utf16;
+	unsigned char * utf8;
+	size_t i;
+	size_t sample_size;
+	size_t valid_size;
+	size_t utf16_size;
+	size_t utf8_size;
+	size_t count;
+	size_t long_count;
+	size_t scalar_count;
+	size_t scalar_long_count;
+	size_t measure_size;
+	size_t measure_count;
+	size_t scalar_measure_size;
+	size_t scalar_measure_count;
+
+	sample = malloc(SAMPLE_SIZE);
+	utf16 = malloc(SAMPLE_SIZE * 2);
+	utf8 = malloc(SAMPLE_SIZE * 3);
+	assert(sample != NULL);
+	assert(utf16 != NULL);
+	assert(utf8 != NULL);
+
+	for (seed = 0; seed < 256; seed++){
+
+		/* UTF-8 counts match the transcoded sizes */
+
+		sample_size = make_sample(sample, SAMPLE_SIZE - (seed % 29), seed);
+
+		valid_size = utf_kernel_utf8_to_utf16le_scalar(sample, sample_size, utf16, &utf16_size);
+		assert(valid_size == sample_size);
+
+		scalar_count = utf_kernel_utf8_count_scalar(sample, sample_size, &scalar_long_count);
+		count = utf_kernel_utf8_count(sample, sample_size, &long_count);
+		assert(count == scalar_count);
+		assert(long_count == scalar_long_count);
+		assert(((count + long_count) * 2) == utf16_size);
+
+		/* mostly the basic plane, so that
+		 * whole vectors are measured at once */
+
+		state = seed + 1;
+		utf16_size = 0;
+		while ((utf16_size + 4) <= (SAMPLE_SIZE * 2) - (seed % 13)){
+			state = (state * 1103515245UL + 12345UL) & 0x7fffffffUL;
+			switch ((state >> 16) % 64){
+				case 0:
+					unit = 0xd800 + ((state >> 4) % 0x400);
+					utf16[utf16_size++] = (unsigned char)(unit & 0xff);
+					utf16[utf16_size++] = (unsigned char)(unit >> 8);
+					unit = 0xdc00 + ((state >> 2) % 0x400);
+					break;
+				case 1:
+				case 2:
+					unit = 0xe000 + ((state >> 4) % 0x2000);
+					break;
+				case 3:
+				case 4:
+				case 5:
+					unit = 0x800 + ((state >> 4) % 0xd000);
+					break;
+				case 6:
+				case 7:
+				case 8:
+					unit = 0x80 + ((state >> 4) % 0x780);
+					break;
+				default:
+					unit = 0x20 + ((state >> 8) % 0x5f);
+					break;
+			}
+			utf16[utf16_size++] = (unsigned char)(unit & 0xff);
+			utf16[utf16_size++] = (unsigned char)(unit >> 8);
+		}
+
+		/* and an unpaired surrogate in some */
+		if (seed % 4 == 0){
+			i = ((seed * 7919) % utf16_size) & ~((size_t) 1);
+			utf16[i + 0] = 0x00;
+			utf16[i + 1] = (unsigned char)(0xd8 + (seed % 8));
+		}
+
+		valid_size = utf_kernel_utf16le_to_utf8_scalar(utf16, utf16_size, utf8, &utf8_size);
+
+		assert(utf_kernel_utf16le_measure_scalar(utf16, utf16_size, &scalar_measure_size, &scalar_measure_count) == valid_size);
+		assert(scalar_measure_size == utf8_size);
+		assert(utf_kernel_utf16le_measure(utf16, utf16_size, &measure_size, &measure_count) == valid_size);
+		assert(measure_size == utf8_size);
+		assert(measure_count == scalar_measure_count);
+		assert(measure_count == utf_kernel_utf8_count_scalar(utf8, utf8_size, &long_count));
+	}
+
+	free(sample);
+	free(utf16);
+	free(utf8);
+}
+
+static void test_length_random(void){
+
+	unsigned int seed;
+	unsigned char * sample;
+	unsigned char * utf16le;
+	char16_t * utf16;
+	size_t i;
+	size_t sample_size;
+	size_t utf16_size;
+	size_t utf16_count;
+	size_t valid_size;
+	size_t count;
+	size_t scalar_count;
+	size_t long_count;
+
+	sample = malloc(SAMPLE_SIZE);
+	utf16le = malloc(SAMPLE_SIZE * 2);
+	utf16 = malloc(SAMPLE_SIZE * sizeof(char16_t));
+	assert(sample != NULL);
+	assert(utf16le != NULL);
+	assert(utf16 != NULL);
+
+	for (seed = 0; seed < 256; seed++){
+
+		sample_size = make_sample(sample, SAMPLE_SIZE - (seed % 31), seed);
+
+		utf_kernel_utf8_to_utf16le_scalar(sample, sample_size, utf16le, &utf16_size);
+		utf16_count = utf16_size / 2;
+		for (i = 0; i < utf16_count; i++){
+			utf16[i] = (char16_t)(utf16le[(i * 2) + 0] | (utf16le[(i * 2) + 1] << 8));
+		}
+
+		if (seed % 4 == 0){
+			sample[(seed * 7919) % sample_size] ^= (unsigned char)(seed | 0x80);
+			/* a lone high or low surrogate, or a pair cut in half */
+			utf16[(seed * 7919) % utf16_count] = (char16_t)(0xd800 + (seed * 0x40));
+		}
+
+		valid_size = utf_kernel_utf8_length_scalar(sample, sample_size, &scalar_count);
+		assert(valid_size == utf_kernel_utf8_validate_scalar(sample, sample_size));
+		assert(scalar_count == utf_kernel_utf8_count_scalar(sample, valid_size, &long_count));
+		assert(utf_kernel_utf8_length(sample, sample_size, &count) == valid_size);
+		assert(count == scalar_count);
+
+		valid_size = utf_kernel_utf16_length_scalar(utf16, utf16_count, &scalar_count);
+		assert(utf_kernel_utf16_length(utf16, utf16_count, &count) == valid_size);
+		assert(count == scalar_count);
+		if (seed % 4 != 0){
+			assert(valid_size == utf16_count);
+			assert(count == utf_kernel_utf8_count_scalar(sample, sample_size, &long_count));
+		}
+	}
+
+	free(sample);
+	free(utf16le);
+	free(utf16);
+}
+
+static void test_zero_count(void){
+
+	unsigned char * in;
+	size_t in_size;
+	size_t scalar_counts[4];
+	size_t vector_counts[4];
+	size_t offset;
+	size_t i;
+
+	/* more than 255 vectors, so the byte counters are added up more than once */
+	in_size = 0x4000 + 7;
+
+	in = malloc(in_size);
+	assert(in != NULL);
+
+	for (i = 0; i < in_size; i++){
+		in[i] = ((i * 7919) % 3 == 0) ? 0 : (unsigned char)(i | 1);
+	}
+
+	for (offset = 0; offset < 4; offset++){
+		assert(utf_kernel_zero_count(&in[offset], in_size - offset, vector_counts)
+		    == utf_kernel_zero_count_scalar(&in[offset], in_size - offset, scalar_counts));
+		assert(memcmp(scalar_counts, vector_counts, sizeof(scalar_counts)) == 0);
+	}
+
+	/* every byte at one position is zero */
+	memset(in, 'a', in_size);
+	for (i = 2; i < in_size; i += 4){
+		in[i] = 0;
+	}
+
+	assert(utf_kernel_zero_count(in, in_size, vector_counts) == (in_size / 4) + 1);
+	assert(vector_counts[0] == 0);
+	assert(vector_counts[1] == 0);
+	assert(vector_counts[2] == (in_size / 4) + 1);
+	assert(vector_counts[3] == 0);
+
+	free(in);
+}
+
+static void test_codepage_random(void){
+
+	unsigned int seed;
+	int codec;
+	const char16_t * table;
+	unsigned char * sample;
+	char32_t * scalar_out;
+	char32_t * vector_out;
+	size_t sample_size;
+	size_t scalar_size;
+	size_t vector_size;
+	size_t i;
+
+	sample = malloc(SAMPLE_SIZE);
+	scalar_out = malloc(SAMPLE_SIZE * sizeof(char32_t));
+	vector_out = malloc(SAMPLE_SIZE * sizeof(char32_t));
+	assert(sample != NULL);
+	assert(scalar_out != NULL);
+	assert(vector_out != NULL);
+
+	for (codec = UTF_CODEC_CODEPAGE_FIRST; codec <= UTF_CODEC_CODEPAGE_LAST; codec++){
+
+		table = utf_codepage_get((utf_codec_t) codec)->decode_table;
+
+		for (seed = 0; seed < 16; seed++){
+
+			/* mostly ASCII, with runs of other bytes, some of which may not be used */
+			sample_size = make_sample(sample, SAMPLE_SIZE, seed);
+			for (i = 0; i < sample_size; i++){
+				if ((sample[i] >= 0x80) && (seed % 2 == 0)){
+					sample[i] = (unsigned char)(0x80 | ((i * 31) & 0x7f));
+				}
+			}
+
+			scalar_size = utf_kernel_codepage_to_utf32_scalar(table, sample, sample_size, scalar_out);
+			vector_size = utf_kernel_codepage_to_utf32(table, sample, sample_size, vector_out);
+			assert(scalar_size == vector_size);
+			assert(memcmp(scalar_out, vector_out, scalar_size * sizeof(char32_t)) == 0);
+			assert((scalar_size == sample_size) || (table[sample[scalar_size] - 0x80] == 0));
+		}
+	}
+
+	free(sample);
+	free(scalar_out);
+	free(vector_out);
+}
+
+static size_t make_sample(unsigned char * sample, size_t sample_max, unsigned int seed){
+
+	size_t i = 0;
+	unsigned long int state = seed + 1;
+	unsigned long int c;
+
+	while ((i + 4) <= sample_max){
+		state = (state * 1103515245UL + 12345UL) & 0x7fffffffUL;
+		switch ((state >> 16) % 8){
+			case 0:
+				c = 0x80 + ((state >> 4) % 0x780);
+				sample[i++] = (unsigned char)(0xc0 | (c >> 6));
+				sample[i++] = (unsigned char)(0x80 | (c & 0x3f));
+				break;
+			case 1:
+				c = 0x800 + ((state >> 4) % 0xf800);
+				if ((c >= 0xd800) && (c <= 0xdfff)){
+					c -= 0x800;
+				}
+				sample[i++] = (unsigned char)(0xe0 | (c >> 12));
+				sample[i++] = (unsigned char)(0x80 | ((c >> 6) & 0x3f));
+				sample[i++] = (unsigned char)(0x80 | (c & 0x3f));
+				break;
+			case 2:
+				c = 0x10000 + ((state >> 2) % 0x100000);
+				sample[i++] = (unsigned char)(0xf0 | (c >> 18));
+				sample[i++] = (unsigned char)(0x80 | ((c >> 12) & 0x3f));
+				sample[i++] = (unsigned char)(0x80 | ((c >> 6) & 0x3f));
+				sample[i++] = (unsigned char)(0x80 | (c & 0x3f));
+				break;
+			default:
+				sample[i++] = (unsigned char)(0x20 + ((state >> 8) % 0x5f));
+				break;
+		}
+	}
+
+	return i;
+}
+
+static void test_latin1_random(void){
+
+	unsigned int seed;
+	unsigned char * sample;
+	unsigned char * scalar_out;
+	unsigned char * vector_out;
+	char32_t * wide;
+	char32_t limit;
+	size_t sample_size;
+	size_t scalar_count;
+	size_t vector_count;
+	size_t i;
+
+	sample = malloc(SAMPLE_SIZE);
+	scalar_out = malloc(SAMPLE_SIZE);
+	vector_out = malloc(SAMPLE_SIZE);
+	wide = malloc(SAMPLE_SIZE * sizeof(char32_t));
+	assert(sample != NULL);
+	assert(scalar_out != NULL);
+	assert(vector_out != NULL);
+	assert(wide != NULL);
+
+	for (seed = 0; seed < 16; seed++){
+
+		sample_size = make_sample(sample, SAMPLE_SIZE, seed);
+
+		assert(utf_kernel_latin1_to_utf32(sample, sample_size, wide) == sample_size);
+		for (i = 0; i < sample_size; i++){
+			assert(wide[i] == sample[i]);
+		}
+
+		/* a character that's too large, somewhere past the vectors */
+		if (seed % 2 == 0){
+			wide[(seed * 97) % sample_size] = 0x100 + seed;
+		}
+
+		for (limit = 0x80; limit <= 0x100; limit *= 2){
+			scalar_count = utf_kernel_utf32_to_latin1_scalar(wide, sample_size, scalar_out, limit);
+			vector_count = utf_kernel_utf32_to_latin1(wide, sample_size, vector_out, limit);
+			assert(scalar_count == vector_count);
+			assert(memcmp(scalar_out, vector_out, scalar_count) == 0);
+			assert((scalar_count == sample_size) || (wide[scalar_count] >= limit));
+			assert(memcmp(scalar_out, sample, scalar_count) == 0);
+		}
+	}
+
+	free(sample);
+	free(scalar_out);
+	free(vector_out);
+	free(wide);
+}
@@ -0,0 +1,1493 @@
+/*
+ *    This file is part of libutf.
+ *
+ *    libutf is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    libutf is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with libutf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "kernel.h"
+
+#ifdef LIBUTF_KERNEL_X86
+
+#include <immintrin.h>
+
+/* UTF-8 validation is done with the lookup algorithm from
+ * "Validating UTF-8 In Less Than One Instruction Per Byte"
+ * (Keiser and Lemire). Each byte is classified by the high
+ * and low nibble of the byte before it, and its own high nibble.
+ * Each bit is an error that the three lookups must all agree on. */
+
+/* 11______ 0_______ */
+/* 11______ 11______ */
+#define TOO_SHORT (1 << 0)
+/* 0_______ 10______ */
+#define TOO_LONG (1 << 1)
+/* 11100000 100_____ */
+#define OVERLONG_3 (1 << 2)
+/* 11110100 1001____ */
+/* 11110100 101_____ */
+/* 11110101 1001____ */
+/* 11110101 101_____ */
+/* 1111011_ 1001____ */
+/* 1111011_ 101_____ */
+/* 11111___ 1001____ */
+/* 11111___ 101_____ */
+#define TOO_LARGE (1 << 3)
+/* 11101101 101_____ */
+#define SURROGATE (1 << 4)
+/* 1100000_ 10______ */
+#define OVERLONG_2 (1 << 5)
+/* 11110101 1000____ */
+/* 1111011_ 1000____ */
+/* 11111___ 1000____ */
+#define TOO_LARGE_1000 (1 << 6)
+/* 11110000 1000____ */
+#define OVERLONG_4 (1 << 6)
+/* 10______ 10______ */
+#define TWO_CONTS (1 << 7)
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define B(x) ((char)(x))
+
+#define BYTE_1_HIGH \
+	B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), \
+	B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), \
+	B(TWO_CONTS), B(TWO_CONTS), B(TWO_CONTS), B(TWO_CONTS), \
+	B(TOO_SHORT | OVERLONG_2), \
+	B(TOO_SHORT), \
+	B(TOO_SHORT | OVERLONG_3 | SURROGATE), \
+	B(TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4)
+
+#define BYTE_1_LOW \
+	B(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4), \
+	B(CARRY | OVERLONG_2), \
+	B(CARRY), \
+	B(CARRY), \
+	B(CARRY | TOO_LARGE), \
+	B(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+	B(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+	B(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+	B(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+	B(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+	B(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+	B(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+	B(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+	B(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE), \
+	B(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+	B(CARRY | TOO_LARGE | TOO_LARGE_1000)
+
+#define BYTE_2_HIGH \
+	B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), \
+	B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), \
+	B(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4), \
+	B(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE), \
+	B(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE), \
+	B(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE), \
+	B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT)
+
+/** Finds where the last sequence that starts before @p end begins,
+ * if it doesn't also end before @p end.
+ * @returns The offset of the incomplete sequence, or @p end.
+ */
+
+static size_t utf8_boundary(const unsigned char * src, size_t end){
+	if (src[end - 1] >= 0xc0){
+		return end - 1;
+	} else if (src[end - 2] >= 0xe0){
+		return end - 2;
+	} else if (src[end - 3] >= 0xf0){
+		return end - 3;
+	}
+	return end;
+}
+
+LIBUTF_TARGET("sse4.2")
+static __m128i utf8_check_sse42(__m128i input, __m128i prev_input){
+
+	const __m128i low_nibble = _mm_set1_epi8(0x0f);
+	__m128i prev1;
+	__m128i prev2;
+	__m128i prev3;
+	__m128i byte_1_high;
+	__m128i byte_1_low;
+	__m128i byte_2_high;
+	__m128i is_third_byte;
+	__m128i is_fourth_byte;
+	__m128i must_be_continuation;
+
+	prev1 = _mm_alignr_epi8(input, prev_input, 15);
+
+	byte_1_high = _mm_and_si128(_mm_srli_epi16(prev1, 4), low_nibble);
+	byte_1_high = _mm_shuffle_epi8(_mm_setr_epi8(BYTE_1_HIGH), byte_1_high);
+
+	byte_1_low = _mm_and_si128(prev1, low_nibble);
+	byte_1_low = _mm_shuffle_epi8(_mm_setr_epi8(BYTE_1_LOW), byte_1_low);
+
+	byte_2_high = _mm_and_si128(_mm_srli_epi16(input, 4), low_nibble);
+	byte_2_high = _mm_shuffle_epi8(_mm_setr_epi8(BYTE_2_HIGH), byte_2_high);
+
+	/* the third and fourth bytes of a sequence
+	 * are the only places two continuation bytes
+	 * may follow each other */
+
+	prev2 = _mm_alignr_epi8(input, prev_input, 14);
+	prev3 = _mm_alignr_epi8(input, prev_input, 13);
+	is_third_byte = _mm_subs_epu8(prev2, _mm_set1_epi8(B(0xe0 - 0x80)));
+	is_fourth_byte = _mm_subs_epu8(prev3, _mm_set1_epi8(B(0xf0 - 0x80)));
+	must_be_continuation = _mm_or_si128(is_third_byte, is_fourth_byte);
+	must_be_continuation = _mm_and_si128(must_be_continuation, _mm_set1_epi8(B(0x80)));
+
+	return _mm_xor_si128(must_be_continuation,
+	                     _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high));
+}
+
+LIBUTF_TARGET("avx2")
+static __m256i utf8_check_avx2(__m256i input, __m256i prev_input){
+
+	const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+	__m256i prev;
+	__m256i prev1;
+	__m256i prev2;
+	__m256i prev3;
+	__m256i byte_1_high;
+	__m256i byte_1_low;
+	__m256i byte_2_high;
+	__m256i is_third_byte;
+	__m256i is_fourth_byte;
+	__m256i must_be_continuation;
+
+	/* alignr works on each 128 bit lane, so the
+	 * lane before each lane is lined up first */
+	prev = _mm256_permute2x128_si256(prev_input, input, 0x21);
+
+	prev1 = _mm256_alignr_epi8(input, prev, 15);
+
+	byte_1_high = _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low_nibble);
+	byte_1_high = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_setr_epi8(BYTE_1_HIGH)), byte_1_high);
+
+	byte_1_low = _mm256_and_si256(prev1, low_nibble);
+	byte_1_low = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_setr_epi8(BYTE_1_LOW)), byte_1_low);
+
+	byte_2_high = _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibble);
+	byte_2_high = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_setr_epi8(BYTE_2_HIGH)), byte_2_high);
+
+	prev2 = _mm256_alignr_epi8(input, prev, 14);
+	prev3 = _mm256_alignr_epi8(input, prev, 13);
+	is_third_byte = _mm256_subs_epu8(prev2, _mm256_set1_epi8(B(0xe0 - 0x80)));
+	is_fourth_byte = _mm256_subs_epu8(prev3, _mm256_set1_epi8(B(0xf0 - 0x80)));
+	must_be_continuation = _mm256_or_si256(is_third_byte, is_fourth_byte);
+	must_be_continuation = _mm256_and_si256(must_be_continuation, _mm256_set1_epi8(B(0x80)));
+
+	return _mm256_xor_si256(must_be_continuation,
+	                        _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high));
+}
+
+LIBUTF_TARGET("avx2")
+static void ascii_to_utf32_avx2(__m256i input, char32_t * dst){
+
+	__m128i low = _mm256_castsi256_si128(input);
+	__m128i high = _mm256_extracti128_si256(input, 1);
+
+	_mm256_storeu_si256((__m256i *)(&dst[0x00]), _mm256_cvtepu8_epi32(low));
+	_mm256_storeu_si256((__m256i *)(&dst[0x08]), _mm256_cvtepu8_epi32(_mm_srli_si128(low, 8)));
+	_mm256_storeu_si256((__m256i *)(&dst[0x10]), _mm256_cvtepu8_epi32(high));
+	_mm256_storeu_si256((__m256i *)(&dst[0x18]), _mm256_cvtepu8_epi32(_mm_srli_si128(high, 8)));
+}
+
+LIBUTF_TARGET("sse4.2")
+static void ascii_to_utf32_sse42(__m128i input, char32_t * dst){
+	_mm_storeu_si128((__m128i *)(&dst[0x00]), _mm_cvtepu8_epi32(input));
+	_mm_storeu_si128((__m128i *)(&dst[0x04]), _mm_cvtepu8_epi32(_mm_srli_si128(input, 4)));
+	_mm_storeu_si128((__m128i *)(&dst[0x08]), _mm_cvtepu8_epi32(_mm_srli_si128(input, 8)));
+	_mm_storeu_si128((__m128i *)(&dst[0x0c]), _mm_cvtepu8_epi32(_mm_srli_si128(input, 12)));
+}
+
+LIBUTF_TARGET("avx2")
+static void ascii_to_utf16le_avx2(__m256i input, unsigned char * dst){
+	_mm256_storeu_si256((__m256i *)(&dst[0x00]), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(input)));
+	_mm256_storeu_si256((__m256i *)(&dst[0x20]), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(input, 1)));
+}
+
+LIBUTF_TARGET("sse4.2")
+static void ascii_to_utf16le_sse42(__m128i input, unsigned char * dst){
+	_mm_storeu_si128((__m128i *)(&dst[0x00]), _mm_cvtepu8_epi16(input));
+	_mm_storeu_si128((__m128i *)(&dst[0x10]), _mm_cvtepu8_epi16(_mm_srli_si128(input, 8)));
+}
+
+LIBUTF_TARGET("sse4.2")
+size_t utf_kernel_utf8_validate_sse42(const unsigned char * src, size_t src_size){
+
+	size_t i = 0;
+	size_t valid_size = 0;
+	__m128i input;
+	__m128i error;
+	__m128i prev_input = _mm_setzero_si128();
+
+	/* valid_size is always on a sequence boundary,
+	 * everything before it is well-formed */
+
+	while ((i + 16) <= src_size){
+		input = _mm_loadu_si128((const __m128i *)(&src[i]));
+		if ((valid_size != i) || (_mm_movemask_epi8(input) != 0)){
+			error = utf8_check_sse42(input, prev_input);
+			if (!_mm_testz_si128(error, error)){
+				break;
+			}
+		}
+		prev_input = input;
+		i += 16;
+		valid_size = utf8_boundary(src, i);
+	}
+
+	return valid_size + utf_kernel_utf8_validate_scalar(&src[valid_size], src_size - valid_size);
+}
+
+LIBUTF_TARGET("sse4.2")
+size_t utf_kernel_utf8_to_utf32_sse42(const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count){
+
+	size_t i = 0;
+	size_t j = 0;
+	size_t tail_count = 0;
+	size_t decode_size = 0;
+	size_t valid_size = 0;
+	__m128i input;
+	__m128i error;
+	__m128i prev_input = _mm_setzero_si128();
+
+	/* bytes from decode_size to valid_size are well-formed,
+	 * but haven't been decoded yet */
+
+	while ((i + 16) <= src_size){
+		input = _mm_loadu_si128((const __m128i *)(&src[i]));
+		if ((valid_size == i) && (_mm_movemask_epi8(input) == 0)){
+			j += utf_kernel_utf8_to_utf32_valid(&src[decode_size], valid_size - decode_size, &dst[j]);
+			ascii_to_utf32_sse42(input, &dst[j]);
+			j += 16;
+			i += 16;
+			decode_size = i;
+			valid_size = i;
+		} else {
+			error = utf8_check_sse42(input, prev_input);
+			if (!_mm_testz_si128(error, error)){
+				break;
+			}
+			i += 16;
+			valid_size = utf8_boundary(src, i);
+		}
+		prev_input = input;
+	}
+
+	j += utf_kernel_utf8_to_utf32_valid(&src[decode_size], valid_size - decode_size, &dst[j]);
+
+	/* the scalar kernel finishes the tail and
+	 * finds the exact location of an error */
+
+	valid_size += utf_kernel_utf8_to_utf32_scalar(&src[valid_size], src_size - valid_size, &dst[j], &tail_count);
+
+	*dst_count = j + tail_count;
+
+	return valid_size;
+}
+
+LIBUTF_TARGET("avx2")
+size_t utf_kernel_utf8_validate_avx2(const unsigned char * src, size_t src_size){
+
+	size_t i = 0;
+	size_t valid_size = 0;
+	__m256i input;
+	__m256i error;
+	__m256i prev_input = _mm256_setzero_si256();
+
+	while ((i + 32) <= src_size){
+		input = _mm256_loadu_si256((const __m256i *)(&src[i]));
+		if ((valid_size != i) || (_mm256_movemask_epi8(input) != 0)){
+			error = utf8_check_avx2(input, prev_input);
+			if (!_mm256_testz_si256(error, error)){
+				break;
+			}
+		}
+		prev_input = input;
+		i += 32;
+		valid_size = utf8_boundary(src, i);
+	}
+
+	return valid_size + utf_kernel_utf8_validate_scalar(&src[valid_size], src_size - valid_size);
+}
+
+LIBUTF_TARGET("avx2")
+size_t utf_kernel_utf8_to_utf32_avx2(const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count){
+
+	size_t i = 0;
+	size_t j = 0;
+	size_t tail_count = 0;
+	size_t decode_size = 0;
+	size_t valid_size = 0;
+	__m256i input;
+	__m256i error;
+	__m256i prev_input = _mm256_setzero_si256();
+
+	while ((i + 32) <= src_size){
+		input = _mm256_loadu_si256((const __m256i *)(&src[i]));
+		if ((valid_size == i) && (_mm256_movemask_epi8(input) == 0)){
+			j += utf_kernel_utf8_to_utf32_valid(&src[decode_size], valid_size - decode_size, &dst[j]);
+			ascii_to_utf32_avx2(input, &dst[j]);
+			j += 32;
+			i += 32;
+			decode_size = i;
+			valid_size = i;
+		} else {
+			error = utf8_check_avx2(input, prev_input);
+			if (!_mm256_testz_si256(error, error)){
+				break;
+			}
+			i += 32;
+			valid_size = utf8_boundary(src, i);
+		}
+		prev_input = input;
+	}
+
+	j += utf_kernel_utf8_to_utf32_valid(&src[decode_size], valid_size - decode_size, &dst[j]);
+
+	valid_size += utf_kernel_utf8_to_utf32_scalar(&src[valid_size], src_size - valid_size, &dst[j], &tail_count);
+
+	*dst_count = j + tail_count;
+
+	return valid_size;
+}
+
+/* UTF-8 to UTF-16LE has the same structure as UTF-8 to UTF-32,
+ * except that ASCII is widened to 16 bits instead of 32. */
+
+LIBUTF_TARGET("sse4.2")
+size_t utf_kernel_utf8_to_utf16le_sse42(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+
+	size_t i = 0;
+	size_t j = 0;
+	size_t tail_size = 0;
+	size_t decode_size = 0;
+	size_t valid_size = 0;
+	__m128i input;
+	__m128i error;
+	__m128i prev_input = _mm_setzero_si128();
+
+	while ((i + 16) <= src_size){
+		input = _mm_loadu_si128((const __m128i *)(&src[i]));
+		if ((valid_size == i) && (_mm_movemask_epi8(input) == 0)){
+			j += utf_kernel_utf8_to_utf16le_valid(&src[decode_size], valid_size - decode_size, &dst[j]);
+			ascii_to_utf16le_sse42(input, &dst[j]);
+			j += 32;
+			i += 16;
+			decode_size = i;
+			valid_size = i;
+		} else {
+			error = utf8_check_sse42(input, prev_input);
+			if (!_mm_testz_si128(error, error)){
+				break;
+			}
+			i += 16;
+			valid_size = utf8_boundary(src, i);
+		}
+		prev_input = input;
+	}
+
+	j += utf_kernel_utf8_to_utf16le_valid(&src[decode_size], valid_size - decode_size, &dst[j]);
+
+	valid_size += utf_kernel_utf8_to_utf16le_scalar(&src[valid_size], src_size - valid_size, &dst[j], &tail_size);
+
+	*dst_size = j + tail_size;
+
+	return valid_size;
+}
+
+/* UTF-16LE to UTF-8 packs vectors of ASCII code units down
+ * to bytes, and leaves everything else to the scalar kernel. */
+
+LIBUTF_TARGET("sse4.2")
+size_t utf_kernel_utf16le_to_utf8_sse42(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+
+	size_t i = 0;
+	size_t j = 0;
+	size_t n = 0;
+	size_t tail_size = 0;
+	__m128i input;
+	const __m128i non_ascii = _mm_set1_epi16((short) 0xff80);
+
+	while ((i + 16) <= src_size){
+		input = _mm_loadu_si128((const __m128i *)(&src[i]));
+		if (_mm_testz_si128(input, non_ascii)){
+			_mm_storel_epi64((__m128i *)(&dst[j]), _mm_packus_epi16(input, input));
+			j += 8;
+			i += 16;
+			continue;
+		}
+		/* a pair may straddle the vector, in which case the
+		 * scalar kernel stops before it and picks it up next */
+		n = utf_kernel_utf16le_to_utf8_scalar(&src[i], 16, &dst[j], &tail_size);
+		if (n == 0){
+			break;
+		}
+		j += tail_size;
+		i += n;
+	}
+
+	i += utf_kernel_utf16le_to_utf8_scalar(&src[i], src_size - i, &dst[j], &tail_size);
+
+	*dst_size = j + tail_size;
+
+	return i;
+}
+
+LIBUTF_TARGET("avx2")
+size_t utf_kernel_utf8_to_utf16le_avx2(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+
+	size_t i = 0;
+	size_t j = 0;
+	size_t tail_size = 0;
+	size_t decode_size = 0;
+	size_t valid_size = 0;
+	__m256i input;
+	__m256i error;
+	__m256i prev_input = _mm256_setzero_si256();
+
+	while ((i + 32) <= src_size){
+		input = _mm256_loadu_si256((const __m256i *)(&src[i]));
+		if ((valid_size == i) && (_mm256_movemask_epi8(input) == 0)){
+			j += utf_kernel_utf8_to_utf16le_valid(&src[decode_size], valid_size - decode_size, &dst[j]);
+			ascii_to_utf16le_avx2(input, &dst[j]);
+			j += 64;
+			i += 32;
+			decode_size = i;
+			valid_size = i;
+		} else {
+			error = utf8_check_avx2(input, prev_input);
+			if (!_mm256_testz_si256(error, error)){
+				break;
+			}
+			i += 32;
+			valid_size = utf8_boundary(src, i);
+		}
+		prev_input = input;
+	}
+
+	j += utf_kernel_utf8_to_utf16le_valid(&src[decode_size], valid_size - decode_size, &dst[j]);
+
+	valid_size += utf_kernel_utf8_to_utf16le_scalar(&src[valid_size], src_size - valid_size, &dst[j], &tail_size);
+
+	*dst_size = j + tail_size;
+
+	return valid_size;
+}
+
+LIBUTF_TARGET("avx2")
+size_t utf_kernel_utf16le_to_utf8_avx2(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+
+	size_t i = 0;
+	size_t j = 0;
+	size_t n = 0;
+	size_t tail_size = 0;
+	__m256i input;
+	__m256i packed;
+	const __m256i non_ascii = _mm256_set1_epi16((short) 0xff80);
+
+	while ((i + 32) <= src_size){
+		input = _mm256_loadu_si256((const __m256i *)(&src[i]));
+		if (_mm256_testz_si256(input, non_ascii)){
+			/* packus works within each 128-bit lane,
+			 * so the low halves of the lanes are joined */
+			packed = _mm256_packus_epi16(input, input);
+			packed = _mm256_permute4x64_epi64(packed, 0x08);
+			_mm_storeu_si128((__m128i *)(&dst[j]), _mm256_castsi256_si128(packed));
+			j += 16;
+			i += 32;
+			continue;
+		}
+		n = utf_kernel_utf16le_to_utf8_scalar(&src[i], 32, &dst[j], &tail_size);
+		if (n == 0){
+			break;
+		}
+		j += tail_size;
+		i += n;
+	}
+
+	i += utf_kernel_utf16le_to_utf8_scalar(&src[i], src_size - i, &dst[j], &tail_size);
+
+	*dst_size = j + tail_size;
+
+	return i;
+}
+
+/* Counting adds the comparison masks of each vector, which are -1
+ * where they match, to bytes or words that are summed up before
+ * they can overflow. */
+
+/** The most vectors that are counted before the byte sums can overflow. */
+
+#define COUNT_BYTES_MAX 255
+
+/** The most vectors that are measured before the word sums can overflow. */
+
+#define COUNT_WORDS_MAX 8192
+
+LIBUTF_TARGET("sse4.2")
+static size_t sum_bytes_sse42(__m128i sums){
+	sums = _mm_sad_epu8(sums, _mm_setzero_si128());
+	return (size_t)(_mm_extract_epi16(sums, 0)) + (size_t)(_mm_extract_epi16(sums, 4));
+}
+
+LIBUTF_TARGET("sse4.2")
+static size_t sum_dwords_sse42(__m128i sums){
+	sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, 0x4e));
+	sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, 0xb1));
+	return (size_t)(_mm_cvtsi128_si32(sums));
+}
+
+LIBUTF_TARGET("sse4.2")
+static size_t sum_words_sse42(__m128i sums){
+	return sum_dwords_sse42(_mm_madd_epi16(sums, _mm_set1_epi16(1)));
+}
+
+LIBUTF_TARGET("sse4.2")
+size_t utf_kernel_utf8_count_sse42(const unsigned char * src, size_t src_size, size_t * long_count){
+
+	size_t i = 0;
+	size_t k = 0;
+	size_t count = 0;
+	size_t four_count = 0;
+	size_t tail_count = 0;
+	__m128i input;
+	__m128i counts;
+	__m128i four_counts;
+	/* continuation bytes are -128 to -65, as signed bytes */
+	const __m128i continuation_max = _mm_set1_epi8(-65);
+	const __m128i four_min = _mm_set1_epi8((char) 0xf0);
+
+	while ((i + 16) <= src_size){
+		counts = _mm_setzero_si128();
+		four_counts = _mm_setzero_si128();
+		for (k = 0; (k < COUNT_BYTES_MAX) && ((i + 16) <= src_size); k++){
+			input = _mm_loadu_si128((const __m128i *)(&src[i]));
+			counts = _mm_sub_epi8(counts, _mm_cmpgt_epi8(input, continuation_max));
+			four_counts = _mm_sub_epi8(four_counts, _mm_cmpeq_epi8(_mm_max_epu8(input, four_min), input));
+			i += 16;
+		}
+		count += sum_bytes_sse42(counts);
+		four_count += sum_bytes_sse42(four_counts);
+	}
+
+	count += utf_kernel_utf8_count_scalar(&src[i], src_size - i, &tail_count);
+
+	*long_count = four_count + tail_count;
+
+	return count;
+}
+
+/* UTF-16LE is measured from the code units that are at least
+ * 0x80 and 0x800, each of which adds a byte in UTF-8. Vectors
+ * with surrogates are left to the scalar kernel. */
+
+LIBUTF_TARGET("sse4.2")
+size_t utf_kernel_utf16le_measure_sse42(const unsigned char * src, size_t src_size, size_t * utf8_size, size_t * count){
+
+	size_t i = 0;
+	size_t k = 0;
+	size_t n = 0;
+	size_t size = 0;
+	size_t units = 0;
+	size_t tail_size = 0;
+	size_t tail_count = 0;
+	__m128i input;
+	__m128i sums;
+	const __m128i two_bytes = _mm_set1_epi16((short) 0xff80);
+	const __m128i three_bytes = _mm_set1_epi16((short) 0xf800);
+	const __m128i surrogate = _mm_set1_epi16((short) 0xd800);
+	const __m128i zero = _mm_setzero_si128();
+
+	while ((i + 16) <= src_size){
+		/* every unit takes three bytes, less one
+		 * if it's below 0x800 and another if it's below 0x80 */
+		sums = _mm_setzero_si128();
+		for (k = 0; (k < COUNT_WORDS_MAX) && ((i + 16) <= src_size); k++){
+			input = _mm_loadu_si128((const __m128i *)(&src[i]));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(input, three_bytes), surrogate)) != 0){
+				break;
+			}
+			sums = _mm_sub_epi16(sums, _mm_cmpeq_epi16(_mm_and_si128(input, two_bytes), zero));
+			sums = _mm_sub_epi16(sums, _mm_cmpeq_epi16(_mm_and_si128(input, three_bytes), zero));
+			i += 16;
+		}
+		size += (k * 24) - sum_words_sse42(sums);
+		units += k * 8;
+		if ((k < COUNT_WORDS_MAX) && ((i + 16) <= src_size)){
+			/* a pair may straddle the vector, in which case the
+			 * scalar kernel stops before it and picks it up next */
+			n = utf_kernel_utf16le_measure_scalar(&src[i], 16, &tail_size, &tail_count);
+			if (n == 0){
+				break;
+			}
+			size += tail_size;
+			units += tail_count;
+			i += n;
+		}
+	}
+
+	i += utf_kernel_utf16le_measure_scalar(&src[i], src_size - i, &tail_size, &tail_count);
+
+	*utf8_size = size + tail_size;
+	*count = units + tail_count;
+
+	return i;
+}
+
+LIBUTF_TARGET("avx2")
+static size_t sum_bytes_avx2(__m256i sums){
+	__m128i half;
+	sums = _mm256_sad_epu8(sums, _mm256_setzero_si256());
+	half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+	return (size_t)(_mm_extract_epi16(half, 0)) + (size_t)(_mm_extract_epi16(half, 4));
+}
+
+LIBUTF_TARGET("avx2")
+static size_t sum_words_avx2(__m256i sums){
+	sums = _mm256_madd_epi16(sums, _mm256_set1_epi16(1));
+	return sum_dwords_sse42(_mm_add_epi32(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1)));
+}
+
+LIBUTF_TARGET("avx2")
+size_t utf_kernel_utf8_count_avx2(const unsigned char * src, size_t src_size, size_t * long_count){
+
+	size_t i = 0;
+	size_t k = 0;
+	size_t count = 0;
+	size_t four_count = 0;
+	size_t tail_count = 0;
+	__m256i input;
+	__m256i counts;
+	__m256i four_counts;
+	const __m256i continuation_max = _mm256_set1_epi8(-65);
+	const __m256i four_min = _mm256_set1_epi8((char) 0xf0);
+
+	while ((i + 32) <= src_size){
+		counts = _mm256_setzero_si256();
+		four_counts = _mm256_setzero_si256();
+		for (k = 0; (k < COUNT_BYTES_MAX) && ((i + 32) <= src_size); k++){
+			input = _mm256_loadu_si256((const __m256i *)(&src[i]));
+			counts = _mm256_sub_epi8(counts, _mm256_cmpgt_epi8(input, continuation_max));
+			four_counts = _mm256_sub_epi8(four_counts, _mm256_cmpeq_epi8(_mm256_max_epu8(input, four_min), input));
+			i += 32;
+		}
+		count += sum_bytes_avx2(counts);
+		four_count += sum_bytes_avx2(four_counts);
+	}
+
+	count += utf_kernel_utf8_count_scalar(&src[i], src_size - i, &tail_count);
+
+	*long_count = four_count + tail_count;
+
+	return count;
+}
+
+LIBUTF_TARGET("avx2")
+size_t utf_kernel_utf16le_measure_avx2(const unsigned char * src, size_t src_size, size_t * utf8_size, size_t * count){
+
+	size_t i = 0;
+	size_t k = 0;
+	size_t n = 0;
+	size_t size = 0;
+	size_t units = 0;
+	size_t tail_size = 0;
+	size_t tail_count = 0;
+	__m256i input;
+	__m256i sums;
+	const __m256i two_bytes = _mm256_set1_epi16((short) 0xff80);
+	const __m256i three_bytes = _mm256_set1_epi16((short) 0xf800);
+	const __m256i surrogate = _mm256_set1_epi16((short) 0xd800);
+	const __m256i zero = _mm256_setzero_si256();
+
+	while ((i + 32) <= src_size){
+		sums = _mm256_setzero_si256();
+		for (k = 0; (k < COUNT_WORDS_MAX) && ((i + 32) <= src_size); k++){
+			input = _mm256_loadu_si256((const __m256i *)(&src[i]));
+			if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(input, three_bytes), surrogate)) != 0){
+				break;
+			}
+			sums = _mm256_sub_epi16(sums, _mm256_cmpeq_epi16(_mm256_and_si256(input, two_bytes), zero));
+			sums = _mm256_sub_epi16(sums, _mm256_cmpeq_epi16(_mm256_and_si256(input, three_bytes), zero));
+			i += 32;
+		}
+		size += (k * 48) - sum_words_avx2(sums);
+		units += k * 16;
+		if ((k < COUNT_WORDS_MAX) && ((i + 32) <= src_size)){
+			n = utf_kernel_utf16le_measure_scalar(&src[i], 32, &tail_size, &tail_count);
+			if (n == 0){
+				break;
+			}
+			size += tail_size;
+			units += tail_count;
+			i += n;
+		}
+	}
+
+	i += utf_kernel_utf16le_measure_scalar(&src[i], src_size - i, &tail_size, &tail_count);
+
+	*utf8_size = size + tail_size;
+	*count = units + tail_count;
+
+	return i;
+}
+
+/* Lengths are counted along with validation. UTF-8 counts every byte
+ * that isn't a continuation byte, up to the last whole vector, and
+ * takes away the lead byte of a sequence that the vector cut off.
+ * UTF-16 takes away low surrogates from the number of code units. */
+
+LIBUTF_TARGET("sse4.2")
+size_t utf_kernel_utf8_length_sse42(const unsigned char * src, size_t src_size, size_t * count){
+
+	size_t i = 0;
+	size_t k = 0;
+	size_t valid_size = 0;
+	size_t lead_count = 0;
+	size_t tail_count = 0;
+	size_t long_count = 0;
+	__m128i input;
+	__m128i error;
+	__m128i counts = _mm_setzero_si128();
+	__m128i prev_input = _mm_setzero_si128();
+	const __m128i continuation_max = _mm_set1_epi8(-65);
+
+	while ((i + 16) <= src_size){
+		input = _mm_loadu_si128((const __m128i *)(&src[i]));
+		if ((valid_size != i) || (_mm_movemask_epi8(input) != 0)){
+			error = utf8_check_sse42(input, prev_input);
+			if (!_mm_testz_si128(error, error)){
+				break;
+			}
+		}
+		counts = _mm_sub_epi8(counts, _mm_cmpgt_epi8(input, continuation_max));
+		if (++k == COUNT_BYTES_MAX){
+			lead_count += sum_bytes_sse42(counts);
+			counts = _mm_setzero_si128();
+			k = 0;
+		}
+		prev_input = input;
+		i += 16;
+		valid_size = utf8_boundary(src, i);
+	}
+
+	lead_count += sum_bytes_sse42(counts);
+	lead_count -= utf_kernel_utf8_count_scalar(&src[valid_size], i - valid_size, &long_count);
+
+	valid_size += utf_kernel_utf8_length_scalar(&src[valid_size], src_size - valid_size, &tail_count);
+
+	*count = lead_count + tail_count;
+
+	return valid_size;
+}
+
+/* A low surrogate has to follow a high surrogate, so the mask of
+ * low surrogates has to be the mask of high surrogates moved along
+ * by one code unit, with the last unit of the vector before carried in. */
+
+LIBUTF_TARGET("sse4.2")
+size_t utf_kernel_utf16_length_sse42(const char16_t * src, size_t src_count, size_t * count){
+
+	size_t i = 0;
+	size_t k = 0;
+	size_t low_count = 0;
+	size_t tail_count = 0;
+	unsigned int high_mask = 0;
+	unsigned int low_mask = 0;
+	unsigned int carry = 0;
+	__m128i input;
+	__m128i lows;
+	__m128i low_counts = _mm_setzero_si128();
+	const __m128i surrogate_bits = _mm_set1_epi16((short) 0xfc00);
+	const __m128i high_surrogate = _mm_set1_epi16((short) 0xd800);
+	const __m128i low_surrogate = _mm_set1_epi16((short) 0xdc00);
+
+	while ((i + 8) <= src_count){
+		input = _mm_and_si128(_mm_loadu_si128((const __m128i *)(&src[i])), surrogate_bits);
+		lows = _mm_cmpeq_epi16(input, low_surrogate);
+		high_mask = (unsigned int)(_mm_movemask_epi8(_mm_cmpeq_epi16(input, high_surrogate)));
+		low_mask = (unsigned int)(_mm_movemask_epi8(lows));
+		if ((((high_mask << 2) | carry) & 0xffff) != low_mask){
+			break;
+		}
+		carry = high_mask >> 14;
+		low_counts = _mm_sub_epi16(low_counts, lows);
+		if (++k == COUNT_WORDS_MAX){
+			low_count += sum_words_sse42(low_counts);
+			low_counts = _mm_setzero_si128();
+			k = 0;
+		}
+		i += 8;
+	}
+
+	low_count += sum_words_sse42(low_counts);
+
+	/* the scalar kernel pairs up a high surrogate that ended the last vector */
+	if (carry != 0){
+		i--;
+	}
+
+	*count = i - low_count;
+
+	i += utf_kernel_utf16_length_scalar(&src[i], src_count - i, &tail_count);
+
+	*count += tail_count;
+
+	return i;
+}
+
+LIBUTF_TARGET("avx2")
+size_t utf_kernel_utf8_length_avx2(const unsigned char * src, size_t src_size, size_t * count){
+
+	size_t i = 0;
+	size_t k = 0;
+	size_t valid_size = 0;
+	size_t lead_count = 0;
+	size_t tail_count = 0;
+	size_t long_count = 0;
+	__m256i input;
+	__m256i error;
+	__m256i counts = _mm256_setzero_si256();
+	__m256i prev_input = _mm256_setzero_si256();
+	const __m256i continuation_max = _mm256_set1_epi8(-65);
+
+	while ((i + 32) <= src_size){
+		input = _mm256_loadu_si256((const __m256i *)(&src[i]));
+		if ((valid_size != i) || (_mm256_movemask_epi8(input) != 0)){
+			error = utf8_check_avx2(input, prev_input);
+			if (!_mm256_testz_si256(error, error)){
+				break;
+			}
+		}
+		counts = _mm256_sub_epi8(counts, _mm256_cmpgt_epi8(input, continuation_max));
+		if (++k == COUNT_BYTES_MAX){
+			lead_count += sum_bytes_avx2(counts);
+			counts = _mm256_setzero_si256();
+			k = 0;
+		}
+		prev_input = input;
+		i += 32;
+		valid_size = utf8_boundary(src, i);
+	}
+
+	lead_count += sum_bytes_avx2(counts);
+	lead_count -= utf_kernel_utf8_count_scalar(&src[valid_size], i - valid_size, &long_count);
+
+	valid_size += utf_kernel_utf8_length_scalar(&src[valid_size], src_size - valid_size, &tail_count);
+
+	*count = lead_count + tail_count;
+
+	return valid_size;
+}
+
+LIBUTF_TARGET("avx2")
+size_t utf_kernel_utf16_length_avx2(const char16_t * src, size_t src_count, size_t * count){
+
+	size_t i = 0;
+	size_t k = 0;
+	size_t low_count = 0;
+	size_t tail_count = 0;
+	unsigned long int high_mask = 0;
+	unsigned long int low_mask = 0;
+	unsigned long int carry = 0;
+	__m256i input;
+	__m256i lows;
+	__m256i low_counts = _mm256_setzero_si256();
+	const __m256i surrogate_bits = _mm256_set1_epi16((short) 0xfc00);
+	const __m256i high_surrogate = _mm256_set1_epi16((short) 0xd800);
+	const __m256i low_surrogate = _mm256_set1_epi16((short) 0xdc00);
+
+	while ((i + 16) <= src_count){
+		input = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(&src[i])), surrogate_bits);
+		lows = _mm256_cmpeq_epi16(input, low_surrogate);
+		high_mask = (unsigned long int)(unsigned int)(_mm256_movemask_epi8(_mm256_cmpeq_epi16(input, high_surrogate)));
+		low_mask = (unsigned long int)(unsigned int)(_mm256_movemask_epi8(lows));
+		if ((((high_mask << 2) | carry) & 0xffffffffUL) != low_mask){
+			break;
+		}
+		carry = high_mask >> 30;
+		low_counts = _mm256_sub_epi16(low_counts, lows);
+		if (++k == COUNT_WORDS_MAX){
+			low_count += sum_words_avx2(low_counts);
+			low_counts = _mm256_setzero_si256();
+			k = 0;
+		}
+		i += 16;
+	}
+
+	low_count += sum_words_avx2(low_counts);
+
+	if (carry != 0){
+		i--;
+	}
+
+	*count = i - low_count;
+
+	i += utf_kernel_utf16_length_scalar(&src[i], src_count - i, &tail_count);
+
+	*count += tail_count;
+
+	return i;
+}
+
+LIBUTF_TARGET("sse4.2")
+size_t utf_kernel_ascii_length_sse42(const unsigned char * src, size_t src_size){
+
+	size_t i = 0;
+
+	while ((i + 16) <= src_size){
+		if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(&src[i]))) != 0){
+			break;
+		}
+		i += 16;
+	}
+
+	/* the scalar kernel finds the exact end of the run */
+
+	return i + utf_kernel_ascii_length_scalar(&src[i], src_size - i);
+}
+
+LIBUTF_TARGET("avx2")
+size_t utf_kernel_ascii_length_avx2(const unsigned char * src, size_t src_size){
+
+	size_t i = 0;
+
+	while ((i + 32) <= src_size){
+		if (_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(&src[i]))) != 0){
+			break;
+		}
+		i += 32;
+	}
+
+	return i + utf_kernel_ascii_length_scalar(&src[i], src_size - i);
+}
+
+/* UTF-32 to UTF-8 and UTF-16 pack vectors of characters that
+ * take one code unit down to bytes or words, and leave everything
+ * else to the scalar kernels. The packs saturate, so they're only
+ * used once every character is known to be in range. */
+
+LIBUTF_TARGET("sse4.2")
+size_t utf_kernel_utf32_to_utf8_sse42(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size){
+
+	size_t i = 0;
+	size_t j = 0;
+	size_t n = 0;
+	size_t tail_size = 0;
+	__m128i a;
+	__m128i b;
+	__m128i words;
+	const __m128i non_ascii = _mm_set1_epi32((int) 0xffffff80);
+
+	while ((i + 8) <= src_count){
+		a = _mm_loadu_si128((const __m128i *)(&src[i + 0]));
+		b = _mm_loadu_si128((const __m128i *)(&src[i + 4]));
+		if (_mm_testz_si128(_mm_or_si128(a, b), non_ascii)){
+			words = _mm_packus_epi32(a, b);
+			_mm_storel_epi64((__m128i *)(&dst[j]), _mm_packus_epi16(words, words));
+			j += 8;
+			i += 8;
+			continue;
+		}
+		n = utf_kernel_utf32_to_utf8_scalar(&src[i], 8, &dst[j], &tail_size);
+		j += tail_size;
+		i += n;
+		if (n < 8){
+			break;
+		}
+	}
+
+	i += utf_kernel_utf32_to_utf8_scalar(&src[i], src_count - i, &dst[j], &tail_size);
+
+	*dst_size = j + tail_size;
+
+	return i;
+}
+
+LIBUTF_TARGET("sse4.2")
+size_t utf_kernel_utf32_to_utf16le_sse42(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size){
+
+	size_t i = 0;
+	size_t j = 0;
+	size_t n = 0;
+	size_t tail_size = 0;
+	__m128i a;
+	__m128i b;
+	const __m128i non_bmp = _mm_set1_epi32((int) 0xffff0000);
+
+	while ((i + 8) <= src_count){
+		a = _mm_loadu_si128((const __m128i *)(&src[i + 0]));
+		b = _mm_loadu_si128((const __m128i *)(&src[i + 4]));
+		if (_mm_testz_si128(_mm_or_si128(a, b), non_bmp)){
+			_mm_storeu_si128((__m128i *)(&dst[j]), _mm_packus_epi32(a, b));
+			j += 16;
+			i += 8;
+			continue;
+		}
+		n = utf_kernel_utf32_to_utf16le_scalar(&src[i], 8, &dst[j], &tail_size);
+		j += tail_size;
+		i += n;
+		if (n < 8){
+			break;
+		}
+	}
+
+	i += utf_kernel_utf32_to_utf16le_scalar(&src[i], src_count - i, &dst[j], &tail_size);
+
+	*dst_size = j + tail_size;
+
+	return i;
+}
+
+/* The AVX2 packs work within each 128 bit lane,
+ * so the words are put back in order with a permute. */
+
+LIBUTF_TARGET("avx2")
+size_t utf_kernel_utf32_to_utf8_avx2(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size){
+
+	size_t i = 0;
+	size_t j = 0;
+	size_t n = 0;
+	size_t tail_size = 0;
+	__m256i a;
+	__m256i b;
+	__m256i words;
+	const __m256i non_ascii = _mm256_set1_epi32((int) 0xffffff80);
+
+	while ((i + 16) <= src_count){
+		a = _mm256_loadu_si256((const __m256i *)(&src[i + 0]));
+		b = _mm256_loadu_si256((const __m256i *)(&src[i + 8]));
+		if (_mm256_testz_si256(_mm256_or_si256(a, b), non_ascii)){
+			words = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xd8);
+			_mm_storeu_si128((__m128i *)(&dst[j]), _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1)));
+			j += 16;
+			i += 16;
+			continue;
+		}
+		n = utf_kernel_utf32_to_utf8_scalar(&src[i], 16, &dst[j], &tail_size);
+		j += tail_size;
+		i += n;
+		if (n < 16){
+			break;
+		}
+	}
+
+	i += utf_kernel_utf32_to_utf8_scalar(&src[i], src_count - i, &dst[j], &tail_size);
+
+	*dst_size = j + tail_size;
+
+	return i;
+}
+
+LIBUTF_TARGET("avx2")
+size_t utf_kernel_utf32_to_utf16le_avx2(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size){
+
+	size_t i = 0;
+	size_t j = 0;
+	size_t n = 0;
+	size_t tail_size = 0;
+	__m256i a;
+	__m256i b;
+	const __m256i non_bmp = _mm256_set1_epi32((int) 0xffff0000);
+
+	while ((i + 16) <= src_count){
+		a = _mm256_loadu_si256((const __m256i *)(&src[i + 0]));
+		b = _mm256_loadu_si256((const __m256i *)(&src[i + 8]));
+		if (_mm256_testz_si256(_mm256_or_si256(a, b), non_bmp)){
+			_mm256_storeu_si256((__m256i *)(&dst[j]), _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xd8));
+			j += 32;
+			i += 16;
+			continue;
+		}
+		n = utf_kernel_utf32_to_utf16le_scalar(&src[i], 16, &dst[j], &tail_size);
+		j += tail_size;
+		i += n;
+		if (n < 16){
+			break;
+		}
+	}
+
+	i += utf_kernel_utf32_to_utf16le_scalar(&src[i], src_count - i, &dst[j], &tail_size);
+
+	*dst_size = j + tail_size;
+
+	return i;
+}
+
+/* A vector of UTF-16 is swapped with one shuffle, if every high surrogate
+ * in it is followed by a low one, and every low surrogate follows a high one.
+ * The masks have two bits for each code unit, so a pair shows up as a high
+ * bit that's two places below a low bit. If the last code unit is a high
+ * surrogate, or the vector is invalid, the scalar kernel takes it, along
+ * with one more code unit, for a pair that may straddle the end. */
+
+LIBUTF_TARGET("sse4.2")
+size_t utf_kernel_utf16_swap_sse42(const unsigned char * src, size_t src_size, unsigned char * dst, int big_endian){
+
+	size_t i = 0;
+	size_t n = 0;
+	unsigned int high;
+	unsigned int low;
+	__m128i v;
+	__m128i masked;
+	const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	const __m128i surrogate_mask = _mm_set1_epi16(big_endian ? 0x00fc : (short) 0xfc00);
+	const __m128i high_surrogate = _mm_set1_epi16(big_endian ? 0x00d8 : (short) 0xd800);
+	const __m128i low_surrogate = _mm_set1_epi16(big_endian ? 0x00dc : (short) 0xdc00);
+
+	while ((i + 16) <= src_size){
+		v = _mm_loadu_si128((const __m128i *)(&src[i]));
+		masked = _mm_and_si128(v, surrogate_mask);
+		high = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi16(masked, high_surrogate));
+		low = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi16(masked, low_surrogate));
+		if ((((high << 2) & 0xffff) == low) && ((high & 0x8000) == 0)){
+			_mm_storeu_si128((__m128i *)(&dst[i]), _mm_shuffle_epi8(v, swap));
+			i += 16;
+			continue;
+		}
+		n = utf_kernel_utf16_swap_scalar(&src[i], ((src_size - i) < 18) ? (src_size - i) : 18, &dst[i], big_endian);
+		i += n;
+		if (n == 0){
+			break;
+		}
+	}
+
+	i += utf_kernel_utf16_swap_scalar(&src[i], src_size - i, &dst[i], big_endian);
+
+	return i;
+}
+
+LIBUTF_TARGET("sse4.2")
+size_t utf_kernel_utf32_swap_sse42(const unsigned char * src, size_t src_size, unsigned char * dst){
+
+	size_t i = 0;
+	const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+	for (i = 0; (i + 16) <= src_size; i += 16){
+		_mm_storeu_si128((__m128i *)(&dst[i]), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(&src[i])), swap));
+	}
+
+	i += utf_kernel_utf32_swap_scalar(&src[i], src_size - i, &dst[i]);
+
+	return i;
+}
+
+LIBUTF_TARGET("avx2")
+size_t utf_kernel_utf16_swap_avx2(const unsigned char * src, size_t src_size, unsigned char * dst, int big_endian){
+
+	size_t i = 0;
+	size_t n = 0;
+	unsigned int high;
+	unsigned int low;
+	__m256i v;
+	__m256i masked;
+	const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+	                                      1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	const __m256i surrogate_mask = _mm256_set1_epi16(big_endian ? 0x00fc : (short) 0xfc00);
+	const __m256i high_surrogate = _mm256_set1_epi16(big_endian ? 0x00d8 : (short) 0xd800);
+	const __m256i low_surrogate = _mm256_set1_epi16(big_endian ? 0x00dc : (short) 0xdc00);
+
+	while ((i + 32) <= src_size){
+		v = _mm256_loadu_si256((const __m256i *)(&src[i]));
+		masked = _mm256_and_si256(v, surrogate_mask);
+		high = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi16(masked, high_surrogate));
+		low = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi16(masked, low_surrogate));
+		if (((high << 2) == low) && ((high & 0x80000000U) == 0)){
+			_mm256_storeu_si256((__m256i *)(&dst[i]), _mm256_shuffle_epi8(v, swap));
+			i += 32;
+			continue;
+		}
+		n = utf_kernel_utf16_swap_scalar(&src[i], ((src_size - i) < 34) ? (src_size - i) : 34, &dst[i], big_endian);
+		i += n;
+		if (n == 0){
+			break;
+		}
+	}
+
+	i += utf_kernel_utf16_swap_scalar(&src[i], src_size - i, &dst[i], big_endian);
+
+	return i;
+}
+
+LIBUTF_TARGET("avx2")
+size_t utf_kernel_utf32_swap_avx2(const unsigned char * src, size_t src_size, unsigned char * dst){
+
+	size_t i = 0;
+	const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+	                                      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+	for (i = 0; (i + 32) <= src_size; i += 32){
+		_mm256_storeu_si256((__m256i *)(&dst[i]), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(&src[i])), swap));
+	}
+
+	i += utf_kernel_utf32_swap_scalar(&src[i], src_size - i, &dst[i]);
+
+	return i;
+}
+
+/* The zero counts add up the compare masks bytewise, for up to 255
+ * vectors at a time so that they can't wrap around, and then sum
+ * the bytes at each position with SAD against zero. */
+
+LIBUTF_TARGET("sse4.2")
+size_t utf_kernel_zero_count_sse42(const unsigned char * src, size_t src_size, size_t * counts){
+
+	size_t i = 0;
+	size_t n = 0;
+	size_t k = 0;
+	size_t p = 0;
+	size_t tail[4];
+	__m128i acc;
+	__m128i sums;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i position = _mm_set1_epi32(0xff);
+
+	counts[0] = 0;
+	counts[1] = 0;
+	counts[2] = 0;
+	counts[3] = 0;
+
+	while ((i + 16) <= src_size){
+		n = (src_size - i) / 16;
+		if (n > 255){
+			n = 255;
+		}
+		acc = zero;
+		for (k = 0; k < n; k++){
+			acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(&src[i])), zero));
+			i += 16;
+		}
+		for (p = 0; p < 4; p++){
+			sums = _mm_sad_epu8(_mm_and_si128(_mm_srli_epi32(acc, (int)(p * 8)), position), zero);
+			counts[p] += (size_t) _mm_cvtsi128_si32(sums) + (size_t) _mm_extract_epi16(sums, 4);
+		}
+	}
+
+	/* i is a multiple of four, so the positions line up */
+
+	utf_kernel_zero_count_scalar(&src[i], src_size - i, tail);
+
+	for (p = 0; p < 4; p++){
+		counts[p] += tail[p];
+	}
+
+	return counts[0] + counts[1] + counts[2] + counts[3];
+}
+
+LIBUTF_TARGET("avx2")
+size_t utf_kernel_zero_count_avx2(const unsigned char * src, size_t src_size, size_t * counts){
+
+	size_t i = 0;
+	size_t n = 0;
+	size_t k = 0;
+	size_t p = 0;
+	size_t tail[4];
+	__m256i acc;
+	__m256i sums;
+	__m128i half;
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i position = _mm256_set1_epi32(0xff);
+
+	counts[0] = 0;
+	counts[1] = 0;
+	counts[2] = 0;
+	counts[3] = 0;
+
+	while ((i + 32) <= src_size){
+		n = (src_size - i) / 32;
+		if (n > 255){
+			n = 255;
+		}
+		acc = zero;
+		for (k = 0; k < n; k++){
+			acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(&src[i])), zero));
+			i += 32;
+		}
+		for (p = 0; p < 4; p++){
+			sums = _mm256_sad_epu8(_mm256_and_si256(_mm256_srli_epi32(acc, (int)(p * 8)), position), zero);
+			half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+			counts[p] += (size_t) _mm_cvtsi128_si32(half) + (size_t) _mm_extract_epi16(half, 4);
+		}
+	}
+
+	utf_kernel_zero_count_scalar(&src[i], src_size - i, tail);
+
+	for (p = 0; p < 4; p++){
+		counts[p] += tail[p];
+	}
+
+	return counts[0] + counts[1] + counts[2] + counts[3];
+}
+
+/* A codepage is ASCII below 0x80, so runs of ASCII are only widened.
+ * SSE4.2 has no gather, so it leaves anything else to the scalar kernel,
+ * a vector at a time. AVX2 gathers the characters from the table, reading
+ * two entries for each byte, which is why the table has a 129th entry. */
+
+LIBUTF_TARGET("sse4.2")
+size_t utf_kernel_codepage_to_utf32_sse42(const char16_t * table, const unsigned char * src, size_t src_size, char32_t * dst){
+
+	size_t i = 0;
+	size_t n = 0;
+	__m128i v;
+
+	while ((i + 16) <= src_size){
+		v = _mm_loadu_si128((const __m128i *)(&src[i]));
+		if (_mm_movemask_epi8(v) != 0){
+			n = utf_kernel_codepage_to_utf32_scalar(table, &src[i], 16, &dst[i]);
+			i += n;
+			if (n < 16){
+				return i;
+			}
+			continue;
+		}
+		_mm_storeu_si128((__m128i *)(&dst[i + 0]), _mm_cvtepu8_epi32(v));
+		_mm_storeu_si128((__m128i *)(&dst[i + 4]), _mm_cvtepu8_epi32(_mm_srli_si128(v, 4)));
+		_mm_storeu_si128((__m128i *)(&dst[i + 8]), _mm_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+		_mm_storeu_si128((__m128i *)(&dst[i + 12]), _mm_cvtepu8_epi32(_mm_srli_si128(v, 12)));
+		i += 16;
+	}
+
+	return i + utf_kernel_codepage_to_utf32_scalar(table, &src[i], src_size - i, &dst[i]);
+}
+
+LIBUTF_TARGET("avx2")
+size_t utf_kernel_codepage_to_utf32_avx2(const char16_t * table, const unsigned char * src, size_t src_size, char32_t * dst){
+
+	size_t i = 0;
+	__m256i bytes;
+	__m256i high;
+	__m256i chars;
+	const __m256i ascii_max = _mm256_set1_epi32(0x7f);
+	const __m256i high_base = _mm256_set1_epi32(0x80);
+	const __m256i low_half = _mm256_set1_epi32(0xffff);
+	const __m256i zero = _mm256_setzero_si256();
+
+	while ((i + 8) <= src_size){
+		bytes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(&src[i])));
+		high = _mm256_cmpgt_epi32(bytes, ascii_max);
+		if (_mm256_testz_si256(high, high)){
+			_mm256_storeu_si256((__m256i *)(&dst[i]), bytes);
+			i += 8;
+			continue;
+		}
+		chars = _mm256_mask_i32gather_epi32(bytes, (const int *)(table), _mm256_sub_epi32(bytes, high_base), high, 2);
+		chars = _mm256_and_si256(chars, low_half);
+		if (!_mm256_testz_si256(_mm256_cmpeq_epi32(chars, zero), high)){
+			/* a byte that isn't used, which the scalar kernel finds */
+			break;
+		}
+		_mm256_storeu_si256((__m256i *)(&dst[i]), chars);
+		i += 8;
+	}
+
+	return i + utf_kernel_codepage_to_utf32_scalar(table, &src[i], src_size - i, &dst[i]);
+}
+
+/* Latin-1 is widened with zero extension. It's narrowed by packing with
+ * unsigned saturation, once none of the characters in the vectors have
+ * bits from the limit on, so that the saturation never happens. */
+
+LIBUTF_TARGET("sse4.2")
+size_t utf_kernel_latin1_to_utf32_sse42(const unsigned char * src, size_t src_size, char32_t * dst){
+
+	size_t i = 0;
+	__m128i v;
+
+	while ((i + 16) <= src_size){
+		v = _mm_loadu_si128((const __m128i *)(&src[i]));
+		_mm_storeu_si128((__m128i *)(&dst[i + 0]), _mm_cvtepu8_epi32(v));
+		_mm_storeu_si128((__m128i *)(&dst[i + 4]), _mm_cvtepu8_epi32(_mm_srli_si128(v, 4)));
+		_mm_storeu_si128((__m128i *)(&dst[i + 8]), _mm_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+		_mm_storeu_si128((__m128i *)(&dst[i + 12]), _mm_cvtepu8_epi32(_mm_srli_si128(v, 12)));
+		i += 16;
+	}
+
+	return i + utf_kernel_latin1_to_utf32_scalar(&src[i], src_size - i, &dst[i]);
+}
+
+LIBUTF_TARGET("sse4.2")
+size_t utf_kernel_utf32_to_latin1_sse42(const char32_t * src, size_t src_count, unsigned char * dst, char32_t limit){
+
+	size_t i = 0;
+	__m128i a;
+	__m128i b;
+	__m128i c;
+	__m128i d;
+	const __m128i high = _mm_set1_epi32((int)(~(limit - 1)));
+
+	while ((i + 16) <= src_count){
+		a = _mm_loadu_si128((const __m128i *)(&src[i + 0]));
+		b = _mm_loadu_si128((const __m128i *)(&src[i + 4]));
+		c = _mm_loadu_si128((const __m128i *)(&src[i + 8]));
+		d = _mm_loadu_si128((const __m128i *)(&src[i + 12]));
+		if (!_mm_testz_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), high)){
+			break;
+		}
+		_mm_storeu_si128((__m128i *)(&dst[i]), _mm_packus_epi16(_mm_packus_epi32(a, b), _mm_packus_epi32(c, d)));
+		i += 16;
+	}
+
+	return i + utf_kernel_utf32_to_latin1_scalar(&src[i], src_count - i, &dst[i], limit);
+}
+
+LIBUTF_TARGET("avx2")
+size_t utf_kernel_latin1_to_utf32_avx2(const unsigned char * src, size_t src_size, char32_t * dst){
+
+	size_t i = 0;
+	__m128i v;
+
+	while ((i + 16) <= src_size){
+		v = _mm_loadu_si128((const __m128i *)(&src[i]));
+		_mm256_storeu_si256((__m256i *)(&dst[i + 0]), _mm256_cvtepu8_epi32(v));
+		_mm256_storeu_si256((__m256i *)(&dst[i + 8]), _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+		i += 16;
+	}
+
+	return i + utf_kernel_latin1_to_utf32_scalar(&src[i], src_size - i, &dst[i]);
+}
+
+LIBUTF_TARGET("avx2")
+size_t utf_kernel_utf32_to_latin1_avx2(const char32_t * src, size_t src_count, unsigned char * dst, char32_t limit){
+
+	size_t i = 0;
+	__m256i a;
+	__m256i b;
+	__m256i c;
+	__m256i d;
+	__m256i packed;
+	const __m256i high = _mm256_set1_epi32((int)(~(limit - 1)));
+	/* packing works within each half, which leaves four bytes of
+	 * each input vector in each half of the output */
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	while ((i + 32) <= src_count){
+		a = _mm256_loadu_si256((const __m256i *)(&src[i + 0]));
+		b = _mm256_loadu_si256((const __m256i *)(&src[i + 8]));
+		c = _mm256_loadu_si256((const __m256i *)(&src[i + 16]));
+		d = _mm256_loadu_si256((const __m256i *)(&src[i + 24]));
+		if (!_mm256_testz_si256(_mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d)), high)){
+			break;
+		}
+		packed = _mm256_packus_epi16(_mm256_packus_epi32(a, b), _mm256_packus_epi32(c, d));
+		_mm256_storeu_si256((__m256i *)(&dst[i]), _mm256_permutevar8x32_epi32(packed, order));
+		i += 32;
+	}
+
+	return i + utf_kernel_utf32_to_latin1_scalar(&src[i], src_count - i, &dst[i], limit);
+}
+
+#endif /* LIBUTF_KERNEL_X86 */
@@ -0,0 +1,994 @@
+/*
+ *    This file is part of libutf.
+ *
+ *    libutf is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    libutf is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with libutf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "kernel.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif /* _MSC_VER */
+
+/** A set of kernels for one instruction set. */
+
+struct kernel_table {
+	/** The name of the instruction set, as used by LIBUTF_KERNEL */
+	const char * name;
+	size_t (*utf8_validate)(const unsigned char * src, size_t src_size);
+	size_t (*utf8_to_utf32)(const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count);
+	size_t (*utf8_to_utf16le)(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+	size_t (*utf16le_to_utf8)(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+	size_t (*utf8_count)(const unsigned char * src, size_t src_size, size_t * long_count);
+	size_t (*utf16le_measure)(const unsigned char * src, size_t src_size, size_t * utf8_size, size_t * count);
+	size_t (*utf8_length)(const unsigned char * src, size_t src_size, size_t * count);
+	size_t (*utf16_length)(const char16_t * src, size_t src_count, size_t * count);
+	size_t (*ascii_length)(const unsigned char * src, size_t src_size);
+	size_t (*utf32_to_utf8)(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size);
+	size_t (*utf32_to_utf16le)(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size);
+	size_t (*utf16_swap)(const unsigned char * src, size_t src_size, unsigned char * dst, int big_endian);
+	size_t (*utf32_swap)(const unsigned char * src, size_t src_size, unsigned char * dst);
+	size_t (*zero_count)(const unsigned char * src, size_t src_size, size_t * counts);
+	size_t (*codepage_to_utf32)(const char16_t * table, const unsigned char * src, size_t src_size, char32_t * dst);
+	size_t (*latin1_to_utf32)(const unsigned char * src, size_t src_size, char32_t * dst);
+	size_t (*utf32_to_latin1)(const char32_t * src, size_t src_count, unsigned char * dst, char32_t limit);
+};
+
+static const struct kernel_table scalar_table = {
+	"scalar",
+	utf_kernel_utf8_validate_scalar,
+	utf_kernel_utf8_to_utf32_scalar,
+	utf_kernel_utf8_to_utf16le_scalar,
+	utf_kernel_utf16le_to_utf8_scalar,
+	utf_kernel_utf8_count_scalar,
+	utf_kernel_utf16le_measure_scalar,
+	utf_kernel_utf8_length_scalar,
+	utf_kernel_utf16_length_scalar,
+	utf_kernel_ascii_length_scalar,
+	utf_kernel_utf32_to_utf8_scalar,
+	utf_kernel_utf32_to_utf16le_scalar,
+	utf_kernel_utf16_swap_scalar,
+	utf_kernel_utf32_swap_scalar,
+	utf_kernel_zero_count_scalar,
+	utf_kernel_codepage_to_utf32_scalar,
+	utf_kernel_latin1_to_utf32_scalar,
+	utf_kernel_utf32_to_latin1_scalar
+};
+
+#ifdef LIBUTF_KERNEL_X86
+
+static const struct kernel_table sse42_table = {
+	"sse4.2",
+	utf_kernel_utf8_validate_sse42,
+	utf_kernel_utf8_to_utf32_sse42,
+	utf_kernel_utf8_to_utf16le_sse42,
+	utf_kernel_utf16le_to_utf8_sse42,
+	utf_kernel_utf8_count_sse42,
+	utf_kernel_utf16le_measure_sse42,
+	utf_kernel_utf8_length_sse42,
+	utf_kernel_utf16_length_sse42,
+	utf_kernel_ascii_length_sse42,
+	utf_kernel_utf32_to_utf8_sse42,
+	utf_kernel_utf32_to_utf16le_sse42,
+	utf_kernel_utf16_swap_sse42,
+	utf_kernel_utf32_swap_sse42,
+	utf_kernel_zero_count_sse42,
+	utf_kernel_codepage_to_utf32_sse42,
+	utf_kernel_latin1_to_utf32_sse42,
+	utf_kernel_utf32_to_latin1_sse42
+};
+
+static const struct kernel_table avx2_table = {
+	"avx2",
+	utf_kernel_utf8_validate_avx2,
+	utf_kernel_utf8_to_utf32_avx2,
+	utf_kernel_utf8_to_utf16le_avx2,
+	utf_kernel_utf16le_to_utf8_avx2,
+	utf_kernel_utf8_count_avx2,
+	utf_kernel_utf16le_measure_avx2,
+	utf_kernel_utf8_length_avx2,
+	utf_kernel_utf16_length_avx2,
+	utf_kernel_ascii_length_avx2,
+	utf_kernel_utf32_to_utf8_avx2,
+	utf_kernel_utf32_to_utf16le_avx2,
+	utf_kernel_utf16_swap_avx2,
+	utf_kernel_utf32_swap_avx2,
+	utf_kernel_zero_count_avx2,
+	utf_kernel_codepage_to_utf32_avx2,
+	utf_kernel_latin1_to_utf32_avx2,
+	utf_kernel_utf32_to_latin1_avx2
+};
+
+#endif /* LIBUTF_KERNEL_X86 */
+
+/* The states of the table-driven UTF-8 decoder.
+ * Each one is the offset of its field in the rows of utf8_transitions. */
+
+#define UTF8_ACCEPT 0
+
+#define UTF8_REJECT 6
+
+/* The number of bytes that the decoder steps through before
+ * it looks for a run of ASCII again, if it's between sequences */
+
+#define UTF8_BLOCK_SIZE 16
+
+/** The classes of bytes in UTF-8, after Bjoern Hoehrmann's DFA.
+ * Bytes in the same class have the same transitions.
+ */
+
+static const unsigned char utf8_classes[256] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+	7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	8, 8, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	10, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 4, 3, 3,
+	11, 6, 6, 6, 5, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8
+};
+
+/** The transitions of the table-driven UTF-8 decoder, one row for each class.
+ * A row packs the next state for each of the nine states into six bit fields,
+ * so that the next state is (row >> state) & 63. Unlike a lookup indexed by
+ * the state, the row doesn't depend on the last step, so each byte costs a
+ * shift instead of a load. The states are accept, reject, one or two
+ * continuation bytes left, and the second byte after 0xe0, 0xed, 0xf0,
+ * 0xf1 to 0xf3 and 0xf4. They reject the same sequences as RFC 3629, table 3-7.
+ * The top byte of a row masks the payload bits of the bytes in its class.
+ */
+
+static const uint64_t utf8_transitions[12] = {
+	UINT64_C(0x7f06186186186180),
+	UINT64_C(0x3f12486306300186),
+	UINT64_C(0x1f0618618618618c),
+	UINT64_C(0x0f06186186186192),
+	UINT64_C(0x0f0618618618619e),
+	UINT64_C(0x07061861861861b0),
+	UINT64_C(0x07061861861861aa),
+	UINT64_C(0x3f0649218c300186),
+	UINT64_C(0x0006186186186186),
+	UINT64_C(0x3f06492306300186),
+	UINT64_C(0x0f06186186186198),
+	UINT64_C(0x07061861861861a4)
+};
+
+/** The kernels selected for this process.
+ * This is set once, and every thread that
+ * sets it selects the same table. */
+
+static const struct kernel_table * kernel_table = NULL;
+
+static const struct kernel_table * get_kernel_table(void);
+
+static const struct kernel_table * select_kernel_table(void);
+
+static size_t utf8_block_end(size_t i, size_t src_size);
+
+static size_t utf8_to_utf16(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size, int big_endian);
+
+static size_t utf16_to_utf8(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size, int big_endian);
+
+static size_t utf16_measure(const unsigned char * src, size_t src_size, size_t * utf8_size, size_t * count, int big_endian);
+
+static size_t utf32_to_utf16(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size, int big_endian);
+
+static size_t put_utf16(unsigned char * dst, char32_t c, int big_endian);
+
+static size_t put_utf8(unsigned char * dst, char32_t c);
+
+#ifdef __GNUC__
+
+/* select the kernels when the library is loaded,
+ * instead of on the first call */
+
+__attribute__((constructor)) static void kernel_init(void){
+	get_kernel_table();
+}
+
+#endif /* __GNUC__ */
+
+const char * utf_kernel_name(void){
+	return get_kernel_table()->name;
+}
+
+size_t utf_kernel_utf8_validate(const unsigned char * src, size_t src_size){
+	return get_kernel_table()->utf8_validate(src, src_size);
+}
+
+size_t utf_kernel_utf8_to_utf32(const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count){
+	return get_kernel_table()->utf8_to_utf32(src, src_size, dst, dst_count);
+}
+
+size_t utf_kernel_utf8_to_utf16le(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+	return get_kernel_table()->utf8_to_utf16le(src, src_size, dst, dst_size);
+}
+
+size_t utf_kernel_utf8_to_utf16be(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+	return utf8_to_utf16(src, src_size, dst, dst_size, 1);
+}
+
+size_t utf_kernel_utf16le_to_utf8(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+	return get_kernel_table()->utf16le_to_utf8(src, src_size, dst, dst_size);
+}
+
+size_t utf_kernel_utf16be_to_utf8(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+	return utf16_to_utf8(src, src_size, dst, dst_size, 1);
+}
+
+size_t utf_kernel_utf8_count(const unsigned char * src, size_t src_size, size_t * long_count){
+	return get_kernel_table()->utf8_count(src, src_size, long_count);
+}
+
+size_t utf_kernel_utf16le_measure(const unsigned char * src, size_t src_size, size_t * utf8_size, size_t * count){
+	return get_kernel_table()->utf16le_measure(src, src_size, utf8_size, count);
+}
+
+size_t utf_kernel_utf16be_measure(const unsigned char * src, size_t src_size, size_t * utf8_size, size_t * count){
+	return utf16_measure(src, src_size, utf8_size, count, 1);
+}
+
+size_t utf_kernel_utf8_length(const unsigned char * src, size_t src_size, size_t * count){
+	return get_kernel_table()->utf8_length(src, src_size, count);
+}
+
+size_t utf_kernel_utf16_length(const char16_t * src, size_t src_count, size_t * count){
+	return get_kernel_table()->utf16_length(src, src_count, count);
+}
+
+size_t utf_kernel_ascii_length(const unsigned char * src, size_t src_size){
+	return get_kernel_table()->ascii_length(src, src_size);
+}
+
+size_t utf_kernel_utf32_to_utf8(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size){
+	return get_kernel_table()->utf32_to_utf8(src, src_count, dst, dst_size);
+}
+
+size_t utf_kernel_utf32_to_utf16le(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size){
+	return get_kernel_table()->utf32_to_utf16le(src, src_count, dst, dst_size);
+}
+
+size_t utf_kernel_utf16_swap(const unsigned char * src, size_t src_size, unsigned char * dst, int big_endian){
+	return get_kernel_table()->utf16_swap(src, src_size, dst, big_endian);
+}
+
+size_t utf_kernel_utf32_swap(const unsigned char * src, size_t src_size, unsigned char * dst){
+	return get_kernel_table()->utf32_swap(src, src_size, dst);
+}
+
+size_t utf_kernel_zero_count(const unsigned char * src, size_t src_size, size_t * counts){
+	return get_kernel_table()->zero_count(src, src_size, counts);
+}
+
+size_t utf_kernel_codepage_to_utf32(const char16_t * table, const unsigned char * src, size_t src_size, char32_t * dst){
+	return get_kernel_table()->codepage_to_utf32(table, src, src_size, dst);
+}
+
+size_t utf_kernel_latin1_to_utf32(const unsigned char * src, size_t src_size, char32_t * dst){
+	return get_kernel_table()->latin1_to_utf32(src, src_size, dst);
+}
+
+size_t utf_kernel_utf32_to_latin1(const char32_t * src, size_t src_count, unsigned char * dst, char32_t limit){
+	return get_kernel_table()->utf32_to_latin1(src, src_count, dst, limit);
+}
+
+size_t utf_kernel_utf32_to_utf16be(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size){
+	return utf32_to_utf16(src, src_count, dst, dst_size, 1);
+}
+
+size_t utf_kernel_utf8_subpart(const unsigned char * src, size_t src_size){
+
+	size_t i = 0;
+	unsigned int state = UTF8_ACCEPT;
+
+	/* the decoder rejects the first byte that no well-formed
+	 * sequence could go on with, so the subpart ends before it */
+
+	for (i = 0; i < src_size; i++){
+		state = (unsigned int)(utf8_transitions[utf8_classes[src[i]]] >> state) & 63;
+		if (state == UTF8_ACCEPT){
+			return 0;
+		} else if (state == UTF8_REJECT){
+			return (i > 0) ? i : 1;
+		}
+	}
+
+	return src_size + 1;
+}
+
+size_t utf_kernel_utf16_subpart(const unsigned char * src, size_t src_size, int big_endian){
+
+	size_t high = big_endian ? 0 : 1;
+
+	if (src_size < 2){
+		return 2;
+	} else if ((src[high] & 0xf8) != 0xd8){
+		return 0;
+	} else if ((src[high] & 0xfc) != 0xd8){
+		/* a low surrogate on its own */
+		return 2;
+	} else if (src_size < 4){
+		return 4;
+	} else if ((src[2 + high] & 0xfc) != 0xdc){
+		return 2;
+	}
+
+	return 0;
+}
+
+size_t utf_kernel_utf8_validate_scalar(const unsigned char * src, size_t src_size){
+
+	size_t i = 0;
+	size_t end = 0;
+	size_t valid_size = 0;
+	unsigned int state = UTF8_ACCEPT;
+
+	while ((i < src_size) && (state != UTF8_REJECT)){
+		if (state == UTF8_ACCEPT){
+			i += utf_kernel_ascii_length_scalar(&src[i], src_size - i);
+			valid_size = i;
+		}
+		end = utf8_block_end(i, src_size);
+		for (; i < end; i++){
+			state = (unsigned int)(utf8_transitions[utf8_classes[src[i]]] >> state) & 63;
+			if (state == UTF8_REJECT){
+				break;
+			}
+			valid_size = (state == UTF8_ACCEPT) ? (i + 1) : valid_size;
+		}
+	}
+
+	return valid_size;
+}
+
+size_t utf_kernel_utf8_to_utf32_scalar(const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count){
+
+	size_t i = 0;
+	size_t j = 0;
+	size_t k = 0;
+	size_t end = 0;
+	size_t ascii_size = 0;
+	size_t valid_size = 0;
+	unsigned int state = UTF8_ACCEPT;
+	uint64_t row = 0;
+	char32_t c = 0;
+
+	while ((i < src_size) && (state != UTF8_REJECT)){
+		if (state == UTF8_ACCEPT){
+			ascii_size = utf_kernel_ascii_length_scalar(&src[i], src_size - i);
+			for (k = 0; k < ascii_size; k++){
+				dst[j + k] = src[i + k];
+			}
+			i += ascii_size;
+			j += ascii_size;
+			valid_size = i;
+		}
+		end = utf8_block_end(i, src_size);
+		for (; i < end; i++){
+			row = utf8_transitions[utf8_classes[src[i]]];
+			/* the bits of the last character are cleared by a lead byte */
+			c = ((c << 6) & (0 - (char32_t)(state != UTF8_ACCEPT))) | (src[i] & (char32_t)(row >> 56));
+			state = (unsigned int)(row >> state) & 63;
+			if (state == UTF8_REJECT){
+				break;
+			}
+			/* the character is stored after every byte, and
+			 * only kept once its last byte has been decoded */
+			dst[j] = c;
+			j += (state == UTF8_ACCEPT);
+			valid_size = (state == UTF8_ACCEPT) ? (i + 1) : valid_size;
+		}
+	}
+
+	*dst_count = j;
+
+	return valid_size;
+}
+
+size_t utf_kernel_utf8_to_utf32_valid(const unsigned char * src, size_t src_size, char32_t * dst){
+
+	size_t i = 0;
+	size_t j = 0;
+
+	while (i < src_size){
+		if (src[i] < 0x80){
+			dst[j] = src[i];
+			i += 1;
+		} else if (src[i] < 0xe0){
+			dst[j]  = (char32_t)(src[i + 0] & 0x1f) << 0x06;
+			dst[j] |= (char32_t)(src[i + 1] & 0x3f);
+			i += 2;
+		} else if (src[i] < 0xf0){
+			dst[j]  = (char32_t)(src[i + 0] & 0x0f) << 0x0c;
+			dst[j] |= (char32_t)(src[i + 1] & 0x3f) << 0x06;
+			dst[j] |= (char32_t)(src[i + 2] & 0x3f);
+			i += 3;
+		} else {
+			dst[j]  = (char32_t)(src[i + 0] & 0x07) << 0x12;
+			dst[j] |= (char32_t)(src[i + 1] & 0x3f) << 0x0c;
+			dst[j] |= (char32_t)(src[i + 2] & 0x3f) << 0x06;
+			dst[j] |= (char32_t)(src[i + 3] & 0x3f);
+			i += 4;
+		}
+		j++;
+	}
+
+	return j;
+}
+
+size_t utf_kernel_utf8_to_utf16le_scalar(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+	return utf8_to_utf16(src, src_size, dst, dst_size, 0);
+}
+
+size_t utf_kernel_utf8_to_utf16le_valid(const unsigned char * src, size_t src_size, unsigned char * dst){
+
+	size_t i = 0;
+	size_t j = 0;
+	size_t length = 0;
+	char32_t c = 0;
+
+	while (i < src_size){
+		if (src[i] < 0x80){
+			dst[j + 0] = src[i];
+			dst[j + 1] = 0;
+			i += 1;
+			j += 2;
+			continue;
+		} else if (src[i] < 0xe0){
+			length = 2;
+		} else if (src[i] < 0xf0){
+			length = 3;
+		} else {
+			length = 4;
+		}
+		utf_kernel_utf8_to_utf32_valid(&src[i], length, &c);
+		j += put_utf16(&dst[j], c, 0);
+		i += length;
+	}
+
+	return j;
+}
+
+size_t utf_kernel_utf16le_to_utf8_scalar(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+	return utf16_to_utf8(src, src_size, dst, dst_size, 0);
+}
+
+size_t utf_kernel_utf8_count_scalar(const unsigned char * src, size_t src_size, size_t * long_count){
+
+	size_t i = 0;
+	size_t count = 0;
+	size_t four_count = 0;
+
+	for (i = 0; i < src_size; i++){
+		/* every byte but a continuation byte starts a character */
+		if ((src[i] & 0xc0) != 0x80){
+			count++;
+		}
+		if (src[i] >= 0xf0){
+			four_count++;
+		}
+	}
+
+	*long_count = four_count;
+
+	return count;
+}
+
+size_t utf_kernel_utf16le_measure_scalar(const unsigned char * src, size_t src_size, size_t * utf8_size, size_t * count){
+	return utf16_measure(src, src_size, utf8_size, count, 0);
+}
+
+size_t utf_kernel_utf8_length_scalar(const unsigned char * src, size_t src_size, size_t * count){
+
+	size_t i = 0;
+	size_t k = 0;
+	size_t end = 0;
+	size_t ascii_size = 0;
+	size_t valid_size = 0;
+	unsigned int state = UTF8_ACCEPT;
+
+	while ((i < src_size) && (state != UTF8_REJECT)){
+		if (state == UTF8_ACCEPT){
+			ascii_size = utf_kernel_ascii_length_scalar(&src[i], src_size - i);
+			i += ascii_size;
+			k += ascii_size;
+			valid_size = i;
+		}
+		end = utf8_block_end(i, src_size);
+		for (; i < end; i++){
+			state = (unsigned int)(utf8_transitions[utf8_classes[src[i]]] >> state) & 63;
+			if (state == UTF8_REJECT){
+				break;
+			}
+			k += (state == UTF8_ACCEPT);
+			valid_size = (state == UTF8_ACCEPT) ? (i + 1) : valid_size;
+		}
+	}
+
+	*count = k;
+
+	return valid_size;
+}
+
+size_t utf_kernel_utf16_length_scalar(const char16_t * src, size_t src_count, size_t * count){
+
+	size_t i = 0;
+	size_t k = 0;
+
+	while (i < src_count){
+		if ((src[i] < 0xd800) || (src[i] > 0xdfff)){
+			i += 1;
+		} else if ((src[i] > 0xdbff)
+		        || ((i + 1) >= src_count)
+		        || (src[i + 1] < 0xdc00)
+		        || (src[i + 1] > 0xdfff)){
+			/* unpaired low surrogate, or incomplete pair */
+			break;
+		} else {
+			i += 2;
+		}
+		k++;
+	}
+
+	*count = k;
+
+	return i;
+}
+
+size_t utf_kernel_ascii_length_scalar(const unsigned char * src, size_t src_size){
+
+	size_t i = 0;
+	uint64_t word = 0;
+
+	/* eight bytes at a time, until a word has a byte that isn't ASCII */
+
+	while ((i + 8) <= src_size){
+		memcpy(&word, &src[i], 8);
+		if (word & UINT64_C(0x8080808080808080)){
+			break;
+		}
+		i += 8;
+	}
+
+	while ((i < src_size) && (src[i] < 0x80)){
+		i++;
+	}
+
+	return i;
+}
+
+size_t utf_kernel_utf32_to_utf8_scalar(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size){
+
+	size_t i = 0;
+	size_t j = 0;
+
+	for (i = 0; i < src_count; i++){
+		if ((src[i] > 0x10ffff)
+		 || ((src[i] >= 0xd800) && (src[i] <= 0xdfff))){
+			break;
+		}
+		j += put_utf8(&dst[j], src[i]);
+	}
+
+	*dst_size = j;
+
+	return i;
+}
+
+size_t utf_kernel_utf32_to_utf16le_scalar(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size){
+	return utf32_to_utf16(src, src_count, dst, dst_size, 0);
+}
+
+size_t utf_kernel_utf16_swap_scalar(const unsigned char * src, size_t src_size, unsigned char * dst, int big_endian){
+
+	size_t i = 0;
+	size_t high = big_endian ? 0 : 1;
+	unsigned char unit[4];
+
+	/* every byte is read before it's written, so that src may be dst */
+
+	while ((i + 2) <= src_size){
+		unit[0] = src[i + 0];
+		unit[1] = src[i + 1];
+		if ((src[i + high] & 0xf8) != 0xd8){
+			dst[i + 0] = unit[1];
+			dst[i + 1] = unit[0];
+			i += 2;
+			continue;
+		}
+		if (((i + 4) > src_size)
+		 || ((src[i + high] & 0xfc) != 0xd8)
+		 || ((src[i + 2 + high] & 0xfc) != 0xdc)){
+			break;
+		}
+		unit[2] = src[i + 2];
+		unit[3] = src[i + 3];
+		dst[i + 0] = unit[1];
+		dst[i + 1] = unit[0];
+		dst[i + 2] = unit[3];
+		dst[i + 3] = unit[2];
+		i += 4;
+	}
+
+	return i;
+}
+
+size_t utf_kernel_utf32_swap_scalar(const unsigned char * src, size_t src_size, unsigned char * dst){
+
+	size_t i = 0;
+	unsigned char unit[4];
+
+	for (i = 0; (i + 4) <= src_size; i += 4){
+		unit[0] = src[i + 0];
+		unit[1] = src[i + 1];
+		unit[2] = src[i + 2];
+		unit[3] = src[i + 3];
+		dst[i + 0] = unit[3];
+		dst[i + 1] = unit[2];
+		dst[i + 2] = unit[1];
+		dst[i + 3] = unit[0];
+	}
+
+	return i;
+}
+
+size_t utf_kernel_zero_count_scalar(const unsigned char * src, size_t src_size, size_t * counts){
+
+	size_t i = 0;
+
+	counts[0] = 0;
+	counts[1] = 0;
+	counts[2] = 0;
+	counts[3] = 0;
+
+	for (i = 0; i < src_size; i++){
+		if (src[i] == 0){
+			counts[i % 4]++;
+		}
+	}
+
+	return counts[0] + counts[1] + counts[2] + counts[3];
+}
+
+size_t utf_kernel_codepage_to_utf32_scalar(const char16_t * table, const unsigned char * src, size_t src_size, char32_t * dst){
+
+	size_t i = 0;
+
+	for (i = 0; i < src_size; i++){
+		if (src[i] < 0x80){
+			dst[i] = src[i];
+		} else if (table[src[i] - 0x80] != 0){
+			dst[i] = table[src[i] - 0x80];
+		} else {
+			break;
+		}
+	}
+
+	return i;
+}
+
+size_t utf_kernel_latin1_to_utf32_scalar(const unsigned char * src, size_t src_size, char32_t * dst){
+
+	size_t i = 0;
+
+	for (i = 0; i < src_size; i++){
+		dst[i] = src[i];
+	}
+
+	return src_size;
+}
+
+size_t utf_kernel_utf32_to_latin1_scalar(const char32_t * src, size_t src_count, unsigned char * dst, char32_t limit){
+
+	size_t i = 0;
+
+	for (i = 0; i < src_count; i++){
+		if (src[i] >= limit){
+			break;
+		}
+		dst[i] = (unsigned char)(src[i]);
+	}
+
+	return i;
+}
+
+/** Returns where the decoder stops stepping through bytes,
+ * to look for a run of ASCII again. */
+
+static size_t utf8_block_end(size_t i, size_t src_size){
+	if ((src_size - i) > UTF8_BLOCK_SIZE){
+		return i + UTF8_BLOCK_SIZE;
+	}
+	return src_size;
+}
+
+static size_t utf8_to_utf16(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size, int big_endian){
+
+	size_t i = 0;
+	size_t j = 0;
+	size_t k = 0;
+	size_t end = 0;
+	size_t ascii_size = 0;
+	size_t valid_size = 0;
+	unsigned int state = UTF8_ACCEPT;
+	uint64_t row = 0;
+	char32_t c = 0;
+	int h = big_endian ? 0 : 1;
+	int l = big_endian ? 1 : 0;
+
+	while ((i < src_size) && (state != UTF8_REJECT)){
+		if (state == UTF8_ACCEPT){
+			ascii_size = utf_kernel_ascii_length_scalar(&src[i], src_size - i);
+			for (k = 0; k < ascii_size; k++){
+				dst[j + (k * 2) + h] = 0;
+				dst[j + (k * 2) + l] = src[i + k];
+			}
+			i += ascii_size;
+			j += ascii_size * 2;
+			valid_size = i;
+		}
+		end = utf8_block_end(i, src_size);
+		for (; i < end; i++){
+			row = utf8_transitions[utf8_classes[src[i]]];
+			/* the bits of the last character are cleared by a lead byte */
+			c = ((c << 6) & (0 - (char32_t)(state != UTF8_ACCEPT))) | (src[i] & (char32_t)(row >> 56));
+			state = (unsigned int)(row >> state) & 63;
+			if (state == UTF8_REJECT){
+				break;
+			} else if (state == UTF8_ACCEPT){
+				j += put_utf16(&dst[j], c, big_endian);
+				valid_size = i + 1;
+			}
+		}
+	}
+
+	*dst_size = j;
+
+	return valid_size;
+}
+
+static size_t utf16_to_utf8(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size, int big_endian){
+
+	size_t i = 0;
+	size_t j = 0;
+	unsigned int high = 0;
+	unsigned int low = 0;
+	int h = big_endian ? 0 : 1;
+	int l = big_endian ? 1 : 0;
+
+	while ((i + 2) <= src_size){
+		high = (src[i + h] << 8) | src[i + l];
+		if (high < 0x80){
+			dst[j++] = (unsigned char)(high);
+			i += 2;
+			continue;
+		} else if ((high < 0xd800) || (high > 0xdfff)){
+			j += put_utf8(&dst[j], high);
+			i += 2;
+			continue;
+		} else if ((high > 0xdbff) || ((i + 4) > src_size)){
+			/* unpaired low surrogate, or incomplete pair */
+			break;
+		}
+		low = (src[i + 2 + h] << 8) | src[i + 2 + l];
+		if ((low < 0xdc00) || (low > 0xdfff)){
+			break;
+		}
+		j += put_utf8(&dst[j], 0x10000 + ((high - 0xd800) << 10) + (low - 0xdc00));
+		i += 4;
+	}
+
+	*dst_size = j;
+
+	return i;
+}
+
+/** Measures UTF-16 the same way that @ref utf16_to_utf8 transcodes it. */
+
+static size_t utf16_measure(const unsigned char * src, size_t src_size, size_t * utf8_size, size_t * count, int big_endian){
+
+	size_t i = 0;
+	size_t j = 0;
+	size_t k = 0;
+	unsigned int high = 0;
+	unsigned int low = 0;
+	int h = big_endian ? 0 : 1;
+	int l = big_endian ? 1 : 0;
+
+	while ((i + 2) <= src_size){
+		high = (src[i + h] << 8) | src[i + l];
+		if (high < 0x80){
+			j += 1;
+		} else if (high < 0x800){
+			j += 2;
+		} else if ((high < 0xd800) || (high > 0xdfff)){
+			j += 3;
+		} else if ((high > 0xdbff) || ((i + 4) > src_size)){
+			/* unpaired low surrogate, or incomplete pair */
+			break;
+		} else {
+			low = (src[i + 2 + h] << 8) | src[i + 2 + l];
+			if ((low < 0xdc00) || (low > 0xdfff)){
+				break;
+			}
+			j += 4;
+			i += 2;
+		}
+		i += 2;
+		k++;
+	}
+
+	*utf8_size = j;
+	*count = k;
+
+	return i;
+}
+
+static size_t utf32_to_utf16(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size, int big_endian){
+
+	size_t i = 0;
+	size_t j = 0;
+
+	for (i = 0; i < src_count; i++){
+		if (src[i] > 0x10ffff){
+			break;
+		}
+		j += put_utf16(&dst[j], src[i], big_endian);
+	}
+
+	*dst_size = j;
+
+	return i;
+}
+
+/** Writes a character as one or two UTF-16 code units.
+ * @returns The number of bytes written.
+ */
+
+static size_t put_utf16(unsigned char * dst, char32_t c, int big_endian){
+
+	unsigned int unit[2];
+	size_t count = 1;
+	size_t k = 0;
+
+	if (c < 0x10000){
+		unit[0] = c;
+	} else {
+		unit[0] = 0xd800 | ((c - 0x10000) >> 10);
+		unit[1] = 0xdc00 | ((c - 0x10000) & 0x3ff);
+		count = 2;
+	}
+
+	for (k = 0; k < count; k++){
+		if (big_endian){
+			dst[(k * 2) + 0] = (unsigned char)(unit[k] >> 8);
+			dst[(k * 2) + 1] = (unsigned char)(unit[k] & 0xff);
+		} else {
+			dst[(k * 2) + 0] = (unsigned char)(unit[k] & 0xff);
+			dst[(k * 2) + 1] = (unsigned char)(unit[k] >> 8);
+		}
+	}
+
+	return count * 2;
+}
+
+/** Writes a character as UTF-8.
+ * A surrogate is written as a three byte sequence.
+ * @returns The number of bytes written.
+ */
+
+static size_t put_utf8(unsigned char * dst, char32_t c){
+	if (c < 0x80){
+		dst[0] = (unsigned char)(c);
+		return 1;
+	} else if (c < 0x800){
+		dst[0] = (unsigned char)(0xc0 | (c >> 6));
+		dst[1] = (unsigned char)(0x80 | (c & 0x3f));
+		return 2;
+	} else if (c < 0x10000){
+		dst[0] = (unsigned char)(0xe0 | (c >> 12));
+		dst[1] = (unsigned char)(0x80 | ((c >> 6) & 0x3f));
+		dst[2] = (unsigned char)(0x80 | (c & 0x3f));
+		return 3;
+	}
+	dst[0] = (unsigned char)(0xf0 | (c >> 18));
+	dst[1] = (unsigned char)(0x80 | ((c >> 12) & 0x3f));
+	dst[2] = (unsigned char)(0x80 | ((c >> 6) & 0x3f));
+	dst[3] = (unsigned char)(0x80 | (c & 0x3f));
+	return 4;
+}
+
+static const struct kernel_table * get_kernel_table(void){
+	if (kernel_table == NULL){
+		kernel_table = select_kernel_table();
+	}
+	return kernel_table;
+}
+
+/** Selects the best kernels that the CPU supports.
+ * The LIBUTF_KERNEL environment variable may be set to
+ * "scalar", "sse4.2" or "avx2" to cap the instruction set
+ * that is used, so that the kernels can be compared.
+ */
+
+static const struct kernel_table * select_kernel_table(void){
+
+	const struct kernel_table * table = &scalar_table;
+	char * cap = NULL;
+#ifdef _MSC_VER
+	size_t cap_size = 0;
+#ifdef LIBUTF_KERNEL_X86
+	int info[4];
+#endif /* LIBUTF_KERNEL_X86 */
+#endif /* _MSC_VER */
+
+#if (defined LIBUTF_KERNEL_X86) && (defined _MSC_VER)
+	__cpuid(info, 1);
+	if ((info[2] >> 20) & 1){
+		table = &sse42_table;
+	}
+	/* AVX needs both the CPU and the OS (which saves the YMM registers) */
+	if (((info[2] >> 27) & 1) && ((info[2] >> 28) & 1)
+	 && ((_xgetbv(0) & 0x06) == 0x06)){
+		__cpuidex(info, 7, 0);
+		if ((info[1] >> 5) & 1){
+			table = &avx2_table;
+		}
+	}
+#elif defined LIBUTF_KERNEL_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")){
+		table = &sse42_table;
+	}
+	if (__builtin_cpu_supports("avx2")){
+		table = &avx2_table;
+	}
+#endif
+
+#ifdef _MSC_VER
+	if (_dupenv_s(&cap, &cap_size, "LIBUTF_KERNEL") != 0){
+		cap = NULL;
+	}
+#else /* _MSC_VER */
+	cap = getenv("LIBUTF_KERNEL");
+#endif /* _MSC_VER */
+
+	if (cap != NULL){
+		if (strcmp(cap, scalar_table.name) == 0){
+			table = &scalar_table;
+		}
+#ifdef LIBUTF_KERNEL_X86
+		else if ((strcmp(cap, sse42_table.name) == 0) && (table == &avx2_table)){
+			table = &sse42_table;
+		}
+#endif /* LIBUTF_KERNEL_X86 */
+	}
+
+#ifdef _MSC_VER
+	free(cap);
+#endif /* _MSC_VER */
+
+	return table;
+}
@@ -0,0 +1,417 @@
+/*
+ *    This file is part of libutf.
+ *
+ *    libutf is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    libutf is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with libutf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This header is private to the library, it is not installed. */
+
+#ifndef LIBUTF_KERNEL_H
+#define LIBUTF_KERNEL_H
+
+/* for size_t */
+#include <stdlib.h>
+
+/* for char32_t */
+#include <uchar.h>
+
+#if (defined __GNUC__) && ((defined __x86_64__) || (defined __i386__))
+#define LIBUTF_KERNEL_X86
+#define LIBUTF_TARGET(isa) __attribute__((target(isa)))
+#elif (defined _MSC_VER) && ((defined _M_X64) || (defined _M_IX86))
+#define LIBUTF_KERNEL_X86
+#define LIBUTF_TARGET(isa)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* Each kernel has a scalar implementation, and may have
+ * SSE4.2 and AVX2 implementations on x86. The functions without
+ * a suffix call the best implementation for the CPU, which is
+ * selected once per process (see kernel.c). */
+
+/** Returns the name of the instruction set that the kernels use.
+ * @returns "scalar", "sse4.2" or "avx2".
+ */
+
+const char * utf_kernel_name(void);
+
+/** Finds the longest prefix of well-formed UTF-8 (RFC 3629).
+ * Overlong forms, surrogates and values above U+10FFFF are rejected.
+ * @param src The UTF-8 input.
+ * @param src_size The number of bytes in @p src.
+ * @returns The number of bytes, up to the first invalid or
+ *  incomplete sequence, that are well-formed.
+ */
+
+size_t utf_kernel_utf8_validate(const unsigned char * src, size_t src_size);
+
+/** Decodes the longest prefix of well-formed UTF-8 to UTF-32.
+ * @param src The UTF-8 input.
+ * @param src_size The number of bytes in @p src.
+ * @param dst The decoded output.
+ *  It must fit @p src_size characters, or exactly the number
+ *  of characters in the input if it's known to be well-formed.
+ * @param dst_count Set to the number of characters written to @p dst.
+ * @returns The number of bytes consumed from @p src.
+ *  Decoding stops at the first invalid or incomplete sequence.
+ */
+
+size_t utf_kernel_utf8_to_utf32(const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count);
+
+/** Decodes UTF-8 that is already known to be well-formed.
+ * @param src Well-formed, complete UTF-8 sequences.
+ * @param src_size The number of bytes in @p src.
+ * @param dst The decoded output.
+ * @returns The number of characters written to @p dst.
+ */
+
+size_t utf_kernel_utf8_to_utf32_valid(const unsigned char * src, size_t src_size, char32_t * dst);
+
+/** Transcodes the longest prefix of well-formed UTF-8 to UTF-16LE.
+ * @param src The UTF-8 input.
+ * @param src_size The number of bytes in @p src.
+ * @param dst The UTF-16LE output.
+ *  It must fit two bytes for every byte in @p src.
+ * @param dst_size Set to the number of bytes written to @p dst.
+ * @returns The number of bytes consumed from @p src.
+ *  Transcoding stops at the first invalid or incomplete sequence.
+ */
+
+size_t utf_kernel_utf8_to_utf16le(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+/** Transcodes the longest prefix of well-formed UTF-8 to UTF-16BE.
+ * This is the same as @ref utf_kernel_utf8_to_utf16le, except for the byte order.
+ * There is only a scalar implementation.
+ */
+
+size_t utf_kernel_utf8_to_utf16be(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+/** Transcodes UTF-8 that is already known to be well-formed to UTF-16LE.
+ * @returns The number of bytes written to @p dst.
+ */
+
+size_t utf_kernel_utf8_to_utf16le_valid(const unsigned char * src, size_t src_size, unsigned char * dst);
+
+/** Transcodes the longest prefix of well-formed UTF-16LE to UTF-8.
+ * @param src The UTF-16LE input.
+ * @param src_size The number of bytes in @p src.
+ * @param dst The UTF-8 output.
+ *  It must fit three bytes for every two bytes in @p src.
+ * @param dst_size Set to the number of bytes written to @p dst.
+ * @returns The number of bytes consumed from @p src.
+ *  Transcoding stops at the first unpaired or incomplete surrogate.
+ */
+
+size_t utf_kernel_utf16le_to_utf8(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+/** Transcodes the longest prefix of well-formed UTF-16BE to UTF-8.
+ * This is the same as @ref utf_kernel_utf16le_to_utf8, except for the byte order.
+ * There is only a scalar implementation.
+ */
+
+size_t utf_kernel_utf16be_to_utf8(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+/** Counts the characters in UTF-8 that is already known to be well-formed.
+ * @param src Well-formed, complete UTF-8 sequences.
+ * @param src_size The number of bytes in @p src.
+ * @param long_count Set to the number of four byte sequences,
+ *  which are the characters that take a surrogate pair in UTF-16.
+ * @returns The number of characters in @p src.
+ */
+
+size_t utf_kernel_utf8_count(const unsigned char * src, size_t src_size, size_t * long_count);
+
+/** Measures the longest prefix of well-formed UTF-16LE, without transcoding it.
+ * @param src The UTF-16LE input.
+ * @param src_size The number of bytes in @p src.
+ * @param utf8_size Set to the number of bytes that the prefix takes in UTF-8.
+ * @param count Set to the number of characters in the prefix.
+ * @returns The number of bytes in the prefix.
+ *  It stops at the first unpaired or incomplete surrogate.
+ */
+
+size_t utf_kernel_utf16le_measure(const unsigned char * src, size_t src_size, size_t * utf8_size, size_t * count);
+
+/** Measures the longest prefix of well-formed UTF-16BE.
+ * This is the same as @ref utf_kernel_utf16le_measure, except for the byte order.
+ * There is only a scalar implementation.
+ */
+
+size_t utf_kernel_utf16be_measure(const unsigned char * src, size_t src_size, size_t * utf8_size, size_t * count);
+
+/** Finds the longest prefix of well-formed UTF-8,
+ * and counts its characters in the same pass.
+ * @param src The UTF-8 input.
+ * @param src_size The number of bytes in @p src.
+ * @param count Set to the number of characters in the prefix.
+ * @returns The number of bytes in the prefix, the same as
+ *  @ref utf_kernel_utf8_validate would return.
+ */
+
+size_t utf_kernel_utf8_length(const unsigned char * src, size_t src_size, size_t * count);
+
+/** Finds the longest prefix of well-formed UTF-16, in the
+ * native byte order, and counts its characters in the same pass.
+ * @param src The UTF-16 input.
+ * @param src_count The number of code units in @p src.
+ * @param count Set to the number of characters in the prefix.
+ * @returns The number of code units in the prefix.
+ *  It stops at the first unpaired or incomplete surrogate.
+ */
+
+size_t utf_kernel_utf16_length(const char16_t * src, size_t src_count, size_t * count);
+
+/** Finds the run of ASCII bytes at the start of a block.
+ * @param src The input.
+ * @param src_size The number of bytes in @p src.
+ * @returns The number of bytes before the first byte that isn't ASCII.
+ */
+
+size_t utf_kernel_ascii_length(const unsigned char * src, size_t src_size);
+
+/** Encodes UTF-32 as UTF-8.
+ * @param src The characters to encode.
+ * @param src_count The number of characters in @p src.
+ * @param dst The UTF-8 output.
+ *  It must fit four bytes for every character in @p src.
+ * @param dst_size Set to the number of bytes written to @p dst.
+ * @returns The number of characters encoded.
+ *  Encoding stops at the first surrogate or value above U+10FFFF,
+ *  since UTF-8 doesn't have them.
+ */
+
+size_t utf_kernel_utf32_to_utf8(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size);
+
+/** Encodes UTF-32 as UTF-16LE.
+ * Like @ref utf16_encode, surrogates are encoded as they are.
+ * @param src The characters to encode.
+ * @param src_count The number of characters in @p src.
+ * @param dst The UTF-16LE output.
+ *  It must fit four bytes for every character in @p src.
+ * @param dst_size Set to the number of bytes written to @p dst.
+ * @returns The number of characters encoded.
+ *  Encoding stops at the first value above U+10FFFF.
+ */
+
+size_t utf_kernel_utf32_to_utf16le(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size);
+
+/** Encodes UTF-32 as UTF-16BE.
+ * This is the same as @ref utf_kernel_utf32_to_utf16le, except for the byte order.
+ * There is only a scalar implementation.
+ */
+
+size_t utf_kernel_utf32_to_utf16be(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size);
+
+/** Swaps the byte order of UTF-16.
+ * Only well-formed UTF-16 is swapped.
+ * @param src The UTF-16 input.
+ * @param src_size The number of bytes in @p src.
+ * @param dst The output, which must fit @p src_size bytes.
+ *  It may be the same as @p src, to swap in place.
+ * @param big_endian Whether @p src is UTF-16BE, rather than UTF-16LE.
+ * @returns The number of bytes swapped, which is less than @p src_size
+ *  if there's an unpaired surrogate, or a sequence is cut short.
+ */
+
+size_t utf_kernel_utf16_swap(const unsigned char * src, size_t src_size, unsigned char * dst, int big_endian);
+
+/** Swaps the byte order of UTF-32.
+ * Like the decoder, this doesn't check the characters.
+ * @param src The UTF-32 input.
+ * @param src_size The number of bytes in @p src.
+ * @param dst The output, which must fit @p src_size bytes.
+ *  It may be the same as @p src, to swap in place.
+ * @returns The number of bytes swapped, which is
+ *  @p src_size rounded down to a whole character.
+ */
+
+size_t utf_kernel_utf32_swap(const unsigned char * src, size_t src_size, unsigned char * dst);
+
+/** Finds the maximal subpart of an ill-formed UTF-8 sequence,
+ * as the Unicode standard defines it. It's the longest run of bytes
+ * that starts a well-formed sequence, or the first byte if none do.
+ * There is only a scalar implementation.
+ * @param src The input, which starts at the sequence.
+ * @param src_size The number of bytes in @p src.
+ * @returns The length of the maximal subpart.
+ *  Zero is returned if @p src starts with a well-formed sequence,
+ *  and more than @p src_size if it's cut short by the end of @p src.
+ */
+
+size_t utf_kernel_utf8_subpart(const unsigned char * src, size_t src_size);
+
+/** Finds the maximal subpart of an ill-formed UTF-16 sequence,
+ * which is a surrogate that isn't part of a pair.
+ * This is the same as @ref utf_kernel_utf8_subpart, except for the encoding.
+ * @param big_endian Whether @p src is UTF-16BE, rather than UTF-16LE.
+ */
+
+size_t utf_kernel_utf16_subpart(const unsigned char * src, size_t src_size, int big_endian);
+
+/** Counts the zero bytes at each position modulo four,
+ * which tells UTF-16 and UTF-32 apart from UTF-8, and one byte order from the other.
+ * @param src The input.
+ * @param src_size The number of bytes in @p src.
+ * @param counts Set to the four counts. The first one is the number of zero
+ *  bytes at offsets 0, 4, 8 and so on, from @p src.
+ * @returns The number of zero bytes in @p src.
+ */
+
+size_t utf_kernel_zero_count(const unsigned char * src, size_t src_size, size_t * counts);
+
+/** Decodes a single-byte codepage to UTF-32.
+ * @param table The character of each byte from 0x80 on, or zero if the
+ *  byte isn't used, with a 129th entry that's zero (see codepage.h).
+ * @param src The input.
+ * @param src_size The number of bytes in @p src.
+ * @param dst The output, which must fit @p src_size characters.
+ * @returns The number of bytes decoded, which is also the number of
+ *  characters written. It's less than @p src_size if a byte isn't used.
+ */
+
+size_t utf_kernel_codepage_to_utf32(const char16_t * table, const unsigned char * src, size_t src_size, char32_t * dst);
+
+/** Widens Latin-1 to UTF-32, where each byte is the character of the same value.
+ * @param src The input.
+ * @param src_size The number of bytes in @p src.
+ * @param dst The output, which must fit @p src_size characters.
+ * @returns The number of characters written, which is @p src_size.
+ */
+
+size_t utf_kernel_latin1_to_utf32(const unsigned char * src, size_t src_size, char32_t * dst);
+
+/** Narrows UTF-32 to bytes of the same value, until a character that's too large.
+ * @param src The input.
+ * @param src_count The number of characters in @p src.
+ * @param dst The output, which must fit @p src_count bytes.
+ * @param limit The first character that doesn't fit, which is 0x80 or 0x100.
+ * @returns The number of characters narrowed, which is also the number of bytes written.
+ */
+
+size_t utf_kernel_utf32_to_latin1(const char32_t * src, size_t src_count, unsigned char * dst, char32_t limit);
+
+size_t utf_kernel_utf8_validate_scalar(const unsigned char * src, size_t src_size);
+
+size_t utf_kernel_utf8_to_utf32_scalar(const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count);
+
+size_t utf_kernel_utf8_to_utf16le_scalar(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+size_t utf_kernel_utf16le_to_utf8_scalar(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+size_t utf_kernel_utf8_count_scalar(const unsigned char * src, size_t src_size, size_t * long_count);
+
+size_t utf_kernel_utf16le_measure_scalar(const unsigned char * src, size_t src_size, size_t * utf8_size, size_t * count);
+
+size_t utf_kernel_utf8_length_scalar(const unsigned char * src, size_t src_size, size_t * count);
+
+size_t utf_kernel_utf16_length_scalar(const char16_t * src, size_t src_count, size_t * count);
+
+size_t utf_kernel_ascii_length_scalar(const unsigned char * src, size_t src_size);
+
+size_t utf_kernel_utf32_to_utf8_scalar(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size);
+
+size_t utf_kernel_utf32_to_utf16le_scalar(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size);
+
+size_t utf_kernel_utf16_swap_scalar(const unsigned char * src, size_t src_size, unsigned char * dst, int big_endian);
+
+size_t utf_kernel_utf32_swap_scalar(const unsigned char * src, size_t src_size, unsigned char * dst);
+
+size_t utf_kernel_zero_count_scalar(const unsigned char * src, size_t src_size, size_t * counts);
+
+size_t utf_kernel_codepage_to_utf32_scalar(const char16_t * table, const unsigned char * src, size_t src_size, char32_t * dst);
+
+size_t utf_kernel_latin1_to_utf32_scalar(const unsigned char * src, size_t src_size, char32_t * dst);
+
+size_t utf_kernel_utf32_to_latin1_scalar(const char32_t * src, size_t src_count, unsigned char * dst, char32_t limit);
+
+#ifdef LIBUTF_KERNEL_X86
+
+size_t utf_kernel_utf8_validate_sse42(const unsigned char * src, size_t src_size);
+
+size_t utf_kernel_utf8_to_utf32_sse42(const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count);
+
+size_t utf_kernel_utf8_to_utf16le_sse42(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+size_t utf_kernel_utf16le_to_utf8_sse42(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+size_t utf_kernel_utf8_count_sse42(const unsigned char * src, size_t src_size, size_t * long_count);
+
+size_t utf_kernel_utf16le_measure_sse42(const unsigned char * src, size_t src_size, size_t * utf8_size, size_t * count);
+
+size_t utf_kernel_utf8_length_sse42(const unsigned char * src, size_t src_size, size_t * count);
+
+size_t utf_kernel_utf16_length_sse42(const char16_t * src, size_t src_count, size_t * count);
+
+size_t utf_kernel_ascii_length_sse42(const unsigned char * src, size_t src_size);
+
+size_t utf_kernel_utf32_to_utf8_sse42(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size);
+
+size_t utf_kernel_utf32_to_utf16le_sse42(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size);
+
+size_t utf_kernel_utf16_swap_sse42(const unsigned char * src, size_t src_size, unsigned char * dst, int big_endian);
+
+size_t utf_kernel_utf32_swap_sse42(const unsigned char * src, size_t src_size, unsigned char * dst);
+
+size_t utf_kernel_zero_count_sse42(const unsigned char * src, size_t src_size, size_t * counts);
+
+size_t utf_kernel_codepage_to_utf32_sse42(const char16_t * table, const unsigned char * src, size_t src_size, char32_t * dst);
+
+size_t utf_kernel_latin1_to_utf32_sse42(const unsigned char * src, size_t src_size, char32_t * dst);
+
+size_t utf_kernel_utf32_to_latin1_sse42(const char32_t * src, size_t src_count, unsigned char * dst, char32_t limit);
+
+size_t utf_kernel_utf8_validate_avx2(const unsigned char * src, size_t src_size);
+
+size_t utf_kernel_utf8_to_utf32_avx2(const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count);
+
+size_t utf_kernel_utf8_to_utf16le_avx2(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+size_t utf_kernel_utf16le_to_utf8_avx2(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+size_t utf_kernel_utf8_count_avx2(const unsigned char * src, size_t src_size, size_t * long_count);
+
+size_t utf_kernel_utf16le_measure_avx2(const unsigned char * src, size_t src_size, size_t * utf8_size, size_t * count);
+
+size_t utf_kernel_utf8_length_avx2(const unsigned char * src, size_t src_size, size_t * count);
+
+size_t utf_kernel_utf16_length_avx2(const char16_t * src, size_t src_count, size_t * count);
+
+size_t utf_kernel_ascii_length_avx2(const unsigned char * src, size_t src_size);
+
+size_t utf_kernel_utf32_to_utf8_avx2(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size);
+
+size_t utf_kernel_utf32_to_utf16le_avx2(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size);
+
+size_t utf_kernel_utf16_swap_avx2(const unsigned char * src, size_t src_size, unsigned char * dst, int big_endian);
+
+size_t utf_kernel_utf32_swap_avx2(const unsigned char * src, size_t src_size, unsigned char * dst);
+
+size_t utf_kernel_zero_count_avx2(const unsigned char * src, size_t src_size, size_t * counts);
+
+size_t utf_kernel_codepage_to_utf32_avx2(const char16_t * table, const unsigned char * src, size_t src_size, char32_t * dst);
+
+size_t utf_kernel_latin1_to_utf32_avx2(const unsigned char * src, size_t src_size, char32_t * dst);
+
+size_t utf_kernel_utf32_to_latin1_avx2(const char32_t * src, size_t src_count, unsigned char * dst, char32_t limit);
+
+#endif /* LIBUTF_KERNEL_X86 */
+
+#ifdef __cplusplus
+} /* extern "C" { */
+#endif /* __cplusplus */
+
+#endif /* LIBUTF_KERNEL_H */
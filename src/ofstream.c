@@ -1,6 +1,11 @@
 #include <libutf/ofstream.h>
 
 #include <stdio.h>
+#include <errno.h>
+
+static void ofstream_free(void * data){
+	fclose((FILE *)(data));
+}
 
 static size_t ofstream_write(void * file_ptr, const void * data, size_t data_max){
 	return fwrite(data, 1, data_max, (FILE *)(file_ptr));
@@ -15,6 +20,37 @@ void utf_ofstream_free(struct utf_ofstream * ofstream){
 	utf_ostream_free(&ofstream->ostream);
 }
 
+int utf_ofstream_flush(struct utf_ofstream * ofstream){
+	return utf_ostream_flush(&ofstream->ostream);
+}
+
+int utf_ofstream_open(struct utf_ofstream * ofstream, const char * path){
+
+	FILE * file;
+#ifdef _MSC_VER
+	errno_t err;
+#endif /* _MSC_VER */
+
+	utf_ofstream_init(ofstream);
+
+#ifdef _MSC_VER
+	err = fopen_s(&file, path, "wb");
+	if (err != 0){
+		return err;
+	}
+#else /* _MSC_VER */
+	file = fopen(path, "wb");
+	if (file == NULL){
+		return errno;
+	}
+#endif /* _MSC_VER */
+
+	utf_ostream_set_data(&ofstream->ostream, file);
+	utf_ostream_set_free(&ofstream->ostream, ofstream_free);
+
+	return 0;
+}
+
 size_t utf_ofstream_write(struct utf_ofstream * ofstream, const struct utf_string * string){
 	return utf_ostream_write(&ofstream->ostream, string);
 }
@@ -39,6 +75,9 @@ void utf_stdout_init(struct utf_ofstream * ofstream){
 	}
 	utf_ofstream_init(ofstream);
 	utf_ostream_set_data(&ofstream->ostream, stdout);
+	/* stdio already buffers stdout, and output
+	 * shouldn't be lost if the stream isn't freed */
+	utf_ostream_set_auto_flush(&ofstream->ostream, LIBUTF_TRUE);
 }
 
 struct utf_ofstream utf_stderr;
@@ -49,5 +88,6 @@ void utf_stderr_init(struct utf_ofstream * ofstream){
 	}
 	utf_ofstream_init(ofstream);
 	utf_ostream_set_data(&ofstream->ostream, stderr);
+	utf_ostream_set_auto_flush(&ofstream->ostream, LIBUTF_TRUE);
 }
 
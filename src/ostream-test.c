@@ -6,6 +6,7 @@
 struct ostream_data {
 	const char * expected_str;
 	size_t i;
+	size_t call_count;
 };
 
 static utf_unit_count_t write_cb(void * stream_data_ptr, const void * chars_ptr, size_t chars_len){
@@ -17,6 +18,8 @@ static utf_unit_count_t write_cb(void * stream_data_ptr, const void * chars_ptr,
 	data = (struct ostream_data *)(stream_data_ptr);
 	chars = (const char *)(chars_ptr);
 
+	data->call_count++;
+
 	for (j = 0; j < chars_len; j++){
 		assert(data->expected_str[data->i] == chars[j]);
 		data->i++;
@@ -33,6 +36,7 @@ static void test_write(void){
 
 	data.expected_str = "hello, world!";
 	data.i = 0;
+	data.call_count = 0;
 
 	utf_ostream_init(&ostream);
 	utf_ostream_set_data(&ostream, &data);
@@ -43,10 +47,79 @@ static void test_write(void){
 	string.data_res = 13;
 
 	assert(utf_ostream_write(&ostream, &string) == 13);
+
+	/* nothing is written until the buffer is flushed */
+	assert(data.i == 0);
+	assert(utf_ostream_flush(&ostream) == 0);
+	assert(data.i == 13);
+	assert(data.call_count == 1);
+
+	utf_ostream_free(&ostream);
+}
+
+static void test_write_buffered(void){
+
+	struct utf_ostream ostream;
+	struct ostream_data data;
+
+	/* "héllo, 𐐷!" in UTF-16LE */
+	data.expected_str = "h\x00\xe9\x00l\x00l\x00o\x00,\x00 \x00\x01\xd8\x37\xdc!\x00";
+	data.i = 0;
+	data.call_count = 0;
+
+	utf_ostream_init(&ostream);
+	utf_ostream_set_data(&ostream, &data);
+	utf_ostream_set_write(&ostream, write_cb);
+	utf_ostream_set_codec(&ostream, UTF_CODEC_UTF16_LE);
+
+	assert(utf_ostream_set_buffer_size(&ostream, 6) == 0);
+
+	/* the buffer is written out whenever it fills up */
+	assert(utf_ostream_write_utf8(&ostream, "h\xc3\xa9llo, ") == 14);
+	assert(data.i == 12);
+	assert(data.call_count == 2);
+
+	/* sequences may be split between writes */
+	assert(utf_ostream_write_utf8(&ostream, "\xf0\x90") == 0);
+	assert(utf_ostream_write_utf8(&ostream, "\x90\xb7!") == 6);
+
+	/* freeing the stream flushes it */
+	utf_ostream_free(&ostream);
+	assert(data.i == 20);
+	assert(data.call_count == 4);
+}
+
+static void test_write_cesu8(void){
+
+	struct utf_ostream ostream;
+	struct ostream_data data;
+
+	/* U+1F600 as a CESU-8 surrogate pair, then "a" */
+	data.expected_str = "\xed\xa0\xbd\xed\xb8\x80" "a";
+	data.i = 0;
+	data.call_count = 0;
+
+	utf_ostream_init(&ostream);
+	utf_ostream_set_data(&ostream, &data);
+	utf_ostream_set_write(&ostream, write_cb);
+	utf_ostream_set_codec(&ostream, UTF_CODEC_CESU8);
+
+	/* the buffer is made big enough for the pair */
+	assert(utf_ostream_set_buffer_size(&ostream, 4) == 0);
+
+	assert(utf_ostream_write_utf8(&ostream, "\xf0\x9f\x98\x80" "a") == 7);
+	assert(data.i == 6);
+	assert(data.call_count == 1);
+
+	utf_ostream_free(&ostream);
+	assert(data.i == 7);
+	assert(data.call_count == 2);
 }
 
 int main(void){
 	test_write();
+	test_write_buffered();
+	test_write_cesu8();
 	return EXIT_SUCCESS;
 }
 
@@ -2,6 +2,7 @@
 
 #include <libutf/converter.h>
 
+#include <stdlib.h>
 #include <string.h>
 
 static size_t utf_ostream_write_any(struct utf_ostream * ostream, const unsigned char * bytes, size_t data_max, utf_codec_t src_codec);
@@ -9,10 +10,50 @@ static size_t utf_ostream_write_any(struct utf_ostream * ostream, const unsigned
 void utf_ostream_init(struct utf_ostream * ostream){
 	utf_stream_init(&ostream->stream);
 	ostream->write_cb = NULL;
+	ostream->buffer = NULL;
+	ostream->buffer_size = LIBUTF_OSTREAM_BUFFER_SIZE;
+	ostream->buffer_count = 0;
+	ostream->auto_flush = LIBUTF_FALSE;
+	utf_converter_init(&ostream->converter);
 }
 
 void utf_ostream_free(struct utf_ostream * ostream){
+	utf_ostream_flush(ostream);
 	utf_stream_free(&ostream->stream);
+	utf_converter_free(&ostream->converter);
+	free(ostream->buffer);
+	ostream->buffer = NULL;
+	ostream->buffer_count = 0;
+}
+
+int utf_ostream_flush(struct utf_ostream * ostream){
+
+	size_t write_count;
+	size_t i;
+
+	if (ostream->write_cb == NULL){
+		return -1;
+	}
+
+	i = 0;
+
+	while (i < ostream->buffer_count){
+		write_count = ostream->write_cb(ostream->stream.data, &ostream->buffer[i], ostream->buffer_count - i);
+		if (write_count == 0){
+			break;
+		}
+		i += write_count;
+	}
+
+	/* keep what couldn't be written */
+	memmove(ostream->buffer, &ostream->buffer[i], ostream->buffer_count - i);
+	ostream->buffer_count -= i;
+
+	if (ostream->buffer_count > 0){
+		return -1;
+	}
+
+	return 0;
 }
 
 utf_codec_t utf_ostream_get_codec(const struct utf_ostream * ostream){
@@ -23,6 +64,42 @@ void utf_ostream_set_codec(struct utf_ostream * ostream, utf_codec_t codec){
 	utf_stream_set_codec(&ostream->stream, codec);
 }
 
+void utf_ostream_set_auto_flush(struct utf_ostream * ostream, utf_bool_t auto_flush){
+	ostream->auto_flush = auto_flush;
+}
+
+int utf_ostream_set_buffer_size(struct utf_ostream * ostream, size_t buffer_size){
+
+	unsigned char * tmp;
+
+	/* fit at least one character, which
+	 * takes up to six bytes in CESU-8 */
+	if (buffer_size < 6){
+		buffer_size = 6;
+	}
+
+	if (buffer_size < ostream->buffer_count){
+		if (utf_ostream_flush(ostream) != 0){
+			return -1;
+		}
+	}
+
+	if (ostream->buffer == NULL){
+		ostream->buffer_size = buffer_size;
+		return 0;
+	}
+
+	tmp = realloc(ostream->buffer, buffer_size);
+	if (tmp == NULL){
+		return -1;
+	}
+
+	ostream->buffer = tmp;
+	ostream->buffer_size = buffer_size;
+
+	return 0;
+}
+
 void utf_ostream_set_data(struct utf_ostream * ostream, void * data){
 	utf_stream_set_data(&ostream->stream, data);
 }
@@ -78,39 +155,53 @@ size_t utf_ostream_write_utf32(struct utf_ostream * ostream, const char32_t * da
 
 static size_t utf_ostream_write_any(struct utf_ostream * ostream, const unsigned char * bytes, size_t data_max, utf_codec_t src_codec){
 
-	size_t i;
+	utf_error_t error;
+	const void * src;
+	size_t src_left;
+	void * dst;
+	size_t dst_left;
 	size_t write_count;
-	utf_converter_t converter;
-	unsigned char byte;
 
 	if (ostream->write_cb == NULL){
 		return 0;
 	}
 
-	utf_converter_init(&converter);
-	utf_converter_set_decoder_codec(&converter, src_codec);
-	utf_converter_set_encoder_codec(&converter, utf_ostream_get_codec(ostream));
-
-	write_count = utf_converter_write(&converter, bytes, data_max);
-	if (write_count < data_max){
-		utf_converter_free(&converter);
-		return 0;
+	if (ostream->buffer == NULL){
+		ostream->buffer = malloc(ostream->buffer_size);
+		if (ostream->buffer == NULL){
+			return 0;
+		}
 	}
 
-	i = 0;
+	utf_converter_set_decoder_codec(&ostream->converter, src_codec);
+	utf_converter_set_encoder_codec(&ostream->converter, utf_ostream_get_codec(ostream));
+
+	src = bytes;
+	src_left = data_max;
+	write_count = 0;
 
 	while (1){
-		if (utf_converter_read(&converter, &byte, 1) != 1){
-			break;
-		}
-		if (ostream->write_cb(ostream->stream.data, &byte, 1) != 1){
+
+		dst = &ostream->buffer[ostream->buffer_count];
+		dst_left = ostream->buffer_size - ostream->buffer_count;
+
+		error = utf_converter_convert(&ostream->converter, &src, &src_left, &dst, &dst_left);
+
+		write_count += (ostream->buffer_size - ostream->buffer_count) - dst_left;
+		ostream->buffer_count = ostream->buffer_size - dst_left;
+
+		/* when the buffer is full, write it out and keep converting,
+		 * unless it's empty and still can't fit the next character */
+		if ((error != UTF_ERROR_OVERFLOW)
+		 || (ostream->buffer_count == 0)
+		 || (utf_ostream_flush(ostream) != 0)){
 			break;
 		}
-		i++;
 	}
 
-	utf_converter_free(&converter);
+	if (ostream->auto_flush){
+		utf_ostream_flush(ostream);
+	}
 
-	return i;
+	return write_count;
 }
-
@@ -0,0 +1,403 @@
+/*
+ *    This file is part of libutf.
+ *
+ *    libutf is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    libutf is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with libutf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libutf/converter.h>
+#include <libutf/utf16.h>
+#include <libutf/utf32.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined _WIN32)
+#define LIBUTF_PARALLEL_WIN32
+#include <windows.h>
+#elif (defined __unix__) || (defined __APPLE__)
+#include <unistd.h>
+#if (defined _POSIX_THREADS) && (_POSIX_THREADS > 0)
+#define LIBUTF_PARALLEL_PTHREAD
+#include <pthread.h>
+#endif
+#endif
+
+/** When the thread count is picked automatically,
+ * no thread gets less input than this. */
+
+#define PARALLEL_CHUNK_MIN 0x100000
+
+/** The most threads that are used for one conversion. */
+
+#define PARALLEL_THREAD_MAX 256
+
+/** A part of the input, which is converted by one thread. */
+
+struct chunk {
+	/** The work that is done on the chunk */
+	void (*task)(struct chunk * chunk);
+	/** The codec of the input */
+	utf_codec_t src_codec;
+	/** The codec of the output */
+	utf_codec_t dst_codec;
+	/** The part of the input, starting and ending on a character boundary */
+	const unsigned char * src;
+	/** The number of bytes at src */
+	size_t src_size;
+	/** Where the chunk is converted to, in the output */
+	unsigned char * dst;
+	/** The number of bytes that the chunk takes in the output */
+	size_t dst_size;
+	/** The error that stopped the conversion of the chunk */
+	utf_error_t error;
+};
+
+static unsigned int thread_count_default(void);
+
+static size_t unit_size(utf_codec_t codec);
+
+static size_t split_point(utf_codec_t codec, const unsigned char * src, size_t src_size, size_t index);
+
+static void run_chunks(struct chunk * chunks, unsigned int chunk_count);
+
+static void measure_chunk(struct chunk * chunk);
+
+static void convert_chunk(struct chunk * chunk);
+
+#ifdef LIBUTF_PARALLEL_PTHREAD
+static void * chunk_thread(void * data);
+#endif /* LIBUTF_PARALLEL_PTHREAD */
+
+#ifdef LIBUTF_PARALLEL_WIN32
+static DWORD WINAPI chunk_thread(LPVOID data);
+#endif /* LIBUTF_PARALLEL_WIN32 */
+
+utf_error_t utf_converter_convert_parallel(utf_codec_t src_codec, const void * src, size_t src_size, utf_codec_t dst_codec, void ** dst, size_t * dst_size, unsigned int thread_count){
+
+	struct chunk chunks[PARALLEL_THREAD_MAX];
+	const unsigned char * in = (const unsigned char *)(src);
+	unsigned char * out = NULL;
+	size_t out_size = 0;
+	size_t begin = 0;
+	size_t end = 0;
+	unsigned int chunk_count = 0;
+	unsigned int i = 0;
+
+	*dst = NULL;
+	*dst_size = 0;
+
+	if (thread_count == 0){
+		thread_count = thread_count_default();
+		if (thread_count > (src_size / PARALLEL_CHUNK_MIN)){
+			thread_count = (unsigned int)(src_size / PARALLEL_CHUNK_MIN);
+		}
+	}
+
+	if (thread_count > PARALLEL_THREAD_MAX){
+		thread_count = PARALLEL_THREAD_MAX;
+	}
+
+	/* no chunk is smaller than a few characters */
+	if (thread_count > (src_size / 16)){
+		thread_count = (unsigned int)(src_size / 16);
+	}
+
+	if (thread_count == 0){
+		thread_count = 1;
+	}
+
+	/* every chunk starts where the last one ended, so the
+	 * chunks are converted exactly as the whole input would be */
+
+	for (i = 0; i < thread_count; i++){
+		if (i == (thread_count - 1)){
+			end = src_size;
+		} else {
+			end = split_point(src_codec, in, src_size, (src_size / thread_count) * (i + 1));
+		}
+		if (end <= begin){
+			continue;
+		}
+		chunks[chunk_count].task = measure_chunk;
+		chunks[chunk_count].src_codec = src_codec;
+		chunks[chunk_count].dst_codec = dst_codec;
+		chunks[chunk_count].src = &in[begin];
+		chunks[chunk_count].src_size = end - begin;
+		chunks[chunk_count].dst = NULL;
+		chunks[chunk_count].dst_size = 0;
+		chunks[chunk_count].error = UTF_ERROR_NONE;
+		chunk_count++;
+		begin = end;
+	}
+
+	/* the chunks are measured first, so that the output is
+	 * allocated once and each chunk converted in place */
+
+	run_chunks(chunks, chunk_count);
+
+	for (i = 0; i < chunk_count; i++){
+		if (chunks[i].error != UTF_ERROR_NONE){
+			return chunks[i].error;
+		}
+		out_size += chunks[i].dst_size;
+	}
+
+	/* one extra byte, so that empty output isn't a null pointer */
+	out = malloc(out_size + 1);
+	if (out == NULL){
+		return UTF_ERROR_MALLOC;
+	}
+
+	/* the offset of each chunk in the output is
+	 * the sum of the output sizes before it */
+
+	out_size = 0;
+	for (i = 0; i < chunk_count; i++){
+		chunks[i].task = convert_chunk;
+		chunks[i].dst = &out[out_size];
+		out_size += chunks[i].dst_size;
+	}
+
+	run_chunks(chunks, chunk_count);
+
+	for (i = 0; i < chunk_count; i++){
+		if (chunks[i].error != UTF_ERROR_NONE){
+			free(out);
+			return chunks[i].error;
+		}
+	}
+
+	*dst = out;
+	*dst_size = out_size;
+
+	return UTF_ERROR_NONE;
+}
+
+/** Returns the number of processors that are online,
+ * or one if it can't be found. */
+
+static unsigned int thread_count_default(void){
+#if (defined LIBUTF_PARALLEL_WIN32)
+	SYSTEM_INFO system_info;
+	GetSystemInfo(&system_info);
+	return (unsigned int)(system_info.dwNumberOfProcessors);
+#elif (defined LIBUTF_PARALLEL_PTHREAD) && (defined _SC_NPROCESSORS_ONLN)
+	long int count;
+	count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (count < 1){
+		return 1;
+	}
+	return (unsigned int)(count);
+#else
+	return 1;
+#endif
+}
+
+/** Returns the size of one code unit of a codec. */
+
+static size_t unit_size(utf_codec_t codec){
+	switch (codec){
+		case UTF_CODEC_UTF16_LE:
+		case UTF_CODEC_UTF16_BE:
+			return 2;
+		case UTF_CODEC_UTF32_LE:
+		case UTF_CODEC_UTF32_BE:
+			return 4;
+		default:
+			break;
+	}
+	return 1;
+}
+
+/** Moves a split point forward to the start of a character.
+ * The index is aligned to a code unit, and then moved past
+ * UTF-8 continuation bytes, and past any high surrogate just before it.
+ * A chunk never ends with a high surrogate, since the converter waits
+ * to see if its pair comes after it, so a pair stays in one chunk and
+ * a high surrogate on its own is converted as it is by a single pass.
+ * If the input is invalid there, the index is moved at most one
+ * character, and the chunk that has the invalid sequence fails.
+ * @returns An index no larger than @p src_size.
+ */
+
+static size_t split_point(utf_codec_t codec, const unsigned char * src, size_t src_size, size_t index){
+
+	size_t i = 0;
+	size_t unit = 0;
+	char32_t c = 0;
+
+	unit = unit_size(codec);
+
+	index -= index % unit;
+
+	switch (codec){
+		case UTF_CODEC_UTF8:
+		case UTF_CODEC_WTF8:
+		case UTF_CODEC_CESU8:
+			for (;;){
+				/* utf8_decode_length takes continuation
+				 * bytes for the lead of a two byte sequence */
+				for (i = 0; (i < 3) && (index < src_size); i++){
+					if ((src[index] & 0xc0) != 0x80){
+						break;
+					}
+					index++;
+				}
+				if ((codec == UTF_CODEC_UTF8)
+				 || (index < 3)
+				 || (index >= src_size)
+				 || (src[index - 3] != 0xed)
+				 || ((src[index - 2] & 0xf0) != 0xa0)){
+					break;
+				}
+				index++;
+			}
+			break;
+		case UTF_CODEC_UTF16_LE:
+			while ((index >= 2)
+			    && ((index + 2) <= src_size)
+			    && (utf16_decode_length(utf16le(&src[index - 2])) == 2)){
+				index += 2;
+			}
+			break;
+		case UTF_CODEC_UTF16_BE:
+			while ((index >= 2)
+			    && ((index + 2) <= src_size)
+			    && (utf16_decode_length(utf16be(&src[index - 2])) == 2)){
+				index += 2;
+			}
+			break;
+		case UTF_CODEC_UTF32_LE:
+		case UTF_CODEC_UTF32_BE:
+			/* WTF-8 takes a surrogate pair as one character */
+			if ((index >= 4) && ((index + 4) <= src_size)){
+				c = (codec == UTF_CODEC_UTF32_LE) ? utf32le(&src[index - 4]) : utf32be(&src[index - 4]);
+				if ((c >= 0xd800) && (c <= 0xdbff)){
+					index += 4;
+				}
+			}
+			break;
+		default:
+			break;
+	}
+
+	if (index > src_size){
+		index = src_size;
+	}
+
+	return index;
+}
+
+/** Runs the task of each chunk, on its own thread.
+ * The first chunk is run by the calling thread, and so is
+ * every chunk that a thread couldn't be started for.
+ */
+
+static void run_chunks(struct chunk * chunks, unsigned int chunk_count){
+
+	unsigned int i = 0;
+#if (defined LIBUTF_PARALLEL_PTHREAD)
+	pthread_t threads[PARALLEL_THREAD_MAX];
+	utf_bool_t started[PARALLEL_THREAD_MAX];
+#elif (defined LIBUTF_PARALLEL_WIN32)
+	HANDLE threads[PARALLEL_THREAD_MAX];
+#endif
+
+	for (i = 1; i < chunk_count; i++){
+#if (defined LIBUTF_PARALLEL_PTHREAD)
+		started[i] = (pthread_create(&threads[i], NULL, chunk_thread, &chunks[i]) == 0);
+		if (!started[i]){
+			chunks[i].task(&chunks[i]);
+		}
+#elif (defined LIBUTF_PARALLEL_WIN32)
+		threads[i] = CreateThread(NULL, 0, chunk_thread, &chunks[i], 0, NULL);
+		if (threads[i] == NULL){
+			chunks[i].task(&chunks[i]);
+		}
+#else
+		chunks[i].task(&chunks[i]);
+#endif
+	}
+
+	if (chunk_count > 0){
+		chunks[0].task(&chunks[0]);
+	}
+
+	for (i = 1; i < chunk_count; i++){
+#if (defined LIBUTF_PARALLEL_PTHREAD)
+		if (started[i]){
+			pthread_join(threads[i], NULL);
+		}
+#elif (defined LIBUTF_PARALLEL_WIN32)
+		if (threads[i] != NULL){
+			WaitForSingleObject(threads[i], INFINITE);
+			CloseHandle(threads[i]);
+		}
+#endif
+	}
+}
+
+#ifdef LIBUTF_PARALLEL_PTHREAD
+
+static void * chunk_thread(void * data){
+	struct chunk * chunk = (struct chunk *)(data);
+	chunk->task(chunk);
+	return NULL;
+}
+
+#endif /* LIBUTF_PARALLEL_PTHREAD */
+
+#ifdef LIBUTF_PARALLEL_WIN32
+
+static DWORD WINAPI chunk_thread(LPVOID data){
+	struct chunk * chunk = (struct chunk *)(data);
+	chunk->task(chunk);
+	return 0;
+}
+
+#endif /* LIBUTF_PARALLEL_WIN32 */
+
+/** Finds the size of the output of a chunk. */
+
+static void measure_chunk(struct chunk * chunk){
+	chunk->error = utf_converter_measure(chunk->src_codec, chunk->src, chunk->src_size, chunk->dst_codec, &chunk->dst_size);
+}
+
+/** Converts a chunk into its place in the output,
+ * which fits exactly the size that it was measured to be. */
+
+static void convert_chunk(struct chunk * chunk){
+
+	utf_converter_t converter;
+	const void * src = chunk->src;
+	size_t src_left = chunk->src_size;
+	void * dst = chunk->dst;
+	size_t dst_left = chunk->dst_size;
+
+	utf_converter_init(&converter);
+	utf_converter_set_decoder_codec(&converter, chunk->src_codec);
+	utf_converter_set_encoder_codec(&converter, chunk->dst_codec);
+
+	chunk->error = utf_converter_convert(&converter, &src, &src_left, &dst, &dst_left);
+	if (chunk->error == UTF_ERROR_NONE){
+		/* the last chunk ends where the input does */
+		chunk->error = utf_converter_flush(&converter, &dst, &dst_left);
+	}
+	if ((chunk->error == UTF_ERROR_NONE)
+	 && ((src_left > 0) || (dst_left > 0))){
+		chunk->error = UTF_ERROR_UNKNOWN;
+	}
+
+	utf_converter_free(&converter);
+}
@@ -0,0 +1,57 @@
+/*
+ *    This file is part of libutf.
+ *
+ *    libutf is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    libutf is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with libutf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ring.h"
+
+#include <string.h>
+
+unsigned char * utf_ring_reserve_tail(utf_encoder_t * encoder, unsigned long int size){
+
+	unsigned long int res = 0;
+	unsigned long int end = 0;
+
+	if (encoder->byte_count == 0){
+		encoder->byte_index = 0;
+	}
+
+	if ((encoder->byte_count + size) > encoder->byte_count_res){
+		/* only a ring that's full grows */
+		res = encoder->byte_count + size;
+		if (res < encoder->byte_count_res){
+			res = encoder->byte_count_res;
+		}
+		if (utf_encoder_reserve(encoder, res) != UTF_ERROR_NONE){
+			return NULL;
+		}
+	}
+
+	end = encoder->byte_index + encoder->byte_count;
+
+	if ((end >= encoder->byte_count_res) && (encoder->byte_count_res > 0)){
+		/* the bytes reach the end of the ring, so the free space is
+		 * all in one piece, between the end of them and the start of them */
+		return &encoder->byte_array[end - encoder->byte_count_res];
+	} else if ((end + size) > encoder->byte_count_res){
+		/* there's room, but not all of it after the bytes,
+		 * so they're moved back to the start of the ring */
+		memmove(encoder->byte_array, &encoder->byte_array[encoder->byte_index], encoder->byte_count);
+		encoder->byte_index = 0;
+		end = encoder->byte_count;
+	}
+
+	return &encoder->byte_array[end];
+}
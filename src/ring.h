@@ -0,0 +1,43 @@
+/*
+ *    This file is part of libutf.
+ *
+ *    libutf is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    libutf is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with libutf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This header is private to the library, it is not installed. */
+
+#ifndef LIBUTF_RING_H
+#define LIBUTF_RING_H
+
+#include <libutf/encoder.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/** Makes room for @p size bytes at the end of the encoder's ring,
+ * without the ring wrapping around in between.
+ * The encoder and the converter write into the room directly,
+ * then add what they wrote to the byte count.
+ * The ring only grows if it doesn't have @p size bytes free.
+ * @returns The address of the first free byte, or a null pointer on failure.
+ */
+
+unsigned char * utf_ring_reserve_tail(utf_encoder_t * encoder, unsigned long int size);
+
+#ifdef __cplusplus
+} /* extern "C" { */
+#endif /* __cplusplus */
+
+#endif /* LIBUTF_RING_H */
@@ -118,6 +118,38 @@ static void test_strlen(void){
 		0xD801, 0xDC37,
 		0x20AC,
 		0xD852, 0xDF62 };
+	char16_t long_in[64];
+	size_t valid_size = 0;
+	size_t i = 0;
+
 	assert(utf16_strlen(in, sizeof(in) / sizeof(in[0])) == 3);
+
+	assert(utf16_strlen_valid(in, sizeof(in) / sizeof(in[0]), &valid_size) == 3);
+	assert(valid_size == 5);
+
+	/* an incomplete pair */
+	assert(utf16_strlen_valid(in, 4, &valid_size) == 2);
+	assert(valid_size == 3);
+
+	/* an unpaired low surrogate */
+	assert(utf16_strlen_valid(&in[1], 4, &valid_size) == 0);
+	assert(valid_size == 0);
+
+	/* long enough to be counted a vector at a time,
+	 * with pairs that straddle the vectors */
+	for (i = 0; i < 64; i++){
+		long_in[i] = (char16_t)(0x41 + i);
+	}
+	for (i = 7; (i + 1) < 64; i += 8){
+		long_in[i + 0] = 0xd83d;
+		long_in[i + 1] = 0xde00;
+	}
+	assert(utf16_strlen_valid(long_in, 64, &valid_size) == 57);
+	assert(valid_size == 64);
+
+	/* a high surrogate that isn't followed by a low surrogate */
+	long_in[56] = 0x41;
+	assert(utf16_strlen_valid(long_in, 64, &valid_size) == 49);
+	assert(valid_size == 55);
 }
 
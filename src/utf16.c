@@ -17,6 +17,8 @@
 
 #include <libutf/utf16.h>
 
+#include "kernel.h"
+
 size_t utf16_decode_length(char16_t in){
 	if (in < 0xd800 || in > 0xdfff){
 		return 1;
@@ -85,17 +87,13 @@ char16_t utf16le(const void * in){
 }
 
 size_t utf16_strlen(const char16_t * in, size_t in_size){
-	size_t size = 0;
-	size_t i = 0;
-	size_t j = 0;
-	while (i < in_size){
-		j = utf16_decode_length(in[i]);
-		if (j == 0){
-			break;
-		}
-		i += j;
-		size++;
-	}
-	return size;
+	size_t valid_size;
+	return utf16_strlen_valid(in, in_size, &valid_size);
+}
+
+size_t utf16_strlen_valid(const char16_t * in, size_t in_size, size_t * valid_size){
+	size_t count = 0;
+	*valid_size = utf_kernel_utf16_length(in, in_size, &count);
+	return count;
 }
 
@@ -25,9 +25,18 @@ static void test_decode(void);
 
 static void test_encode(void);
 
+static void test_to_utf32(void);
+
+static void test_to_utf32_into(void);
+
+static void test_strlen(void);
+
 int main(void){
 	test_decode();
 	test_encode();
+	test_to_utf32();
+	test_to_utf32_into();
+	test_strlen();
 	return EXIT_SUCCESS;
 }
 
@@ -47,3 +56,85 @@ static void test_encode(void){
 	assert(memcmp(out, out_expected, sizeof(out_expected) - 1) == 0);
 }
 
+
+static void test_to_utf32(void){
+
+	char32_t * out;
+	size_t out_len = 0;
+
+	out = utf8_to_utf32_s(u8"¿Cómo estás?", 15, &out_len);
+	assert(out != NULL);
+	assert(out_len == 12);
+	assert(memcmp(out, U"¿Cómo estás?", 13 * sizeof(char32_t)) == 0);
+	free(out);
+
+	/* stops at an overlong sequence */
+	out = utf8_to_utf32_s("ab\xc0\xaf" "cd", 6, &out_len);
+	assert(out != NULL);
+	assert(out_len == 2);
+	assert(out[2] == 0);
+	free(out);
+
+	out = utf8_to_utf32("");
+	assert(out != NULL);
+	assert(out[0] == 0);
+	free(out);
+}
+
+static void test_to_utf32_into(void){
+
+	char32_t out[16];
+
+	assert(utf8_to_utf32_into(u8"¿Cómo estás?", 15, out, 16) == 12);
+	assert(memcmp(out, U"¿Cómo estás?", 13 * sizeof(char32_t)) == 0);
+
+	/* only the length */
+	assert(utf8_to_utf32_into(u8"¿Cómo estás?", 15, NULL, 0) == 12);
+
+	/* cut short, but still null-terminated */
+	out[4] = U'x';
+	assert(utf8_to_utf32_into(u8"¿Cómo estás?", 15, out, 4) == 12);
+	assert(memcmp(out, U"¿Có", 4 * sizeof(char32_t)) == 0);
+
+	/* exactly one too small for the terminator */
+	assert(utf8_to_utf32_into(u8"¿Cómo estás?", 15, out, 12) == 12);
+	assert(memcmp(out, U"¿Cómo estás", 12 * sizeof(char32_t)) == 0);
+
+	/* stops at an overlong sequence */
+	assert(utf8_to_utf32_into("ab\xc0\xaf" "cd", 6, out, 16) == 2);
+	assert(memcmp(out, U"ab", 3 * sizeof(char32_t)) == 0);
+}
+
+static void test_strlen(void){
+
+	char in[100];
+	size_t valid_size = 0;
+	size_t i = 0;
+
+	assert(utf8_strlen(u8"¿Cómo estás?", 15) == 12);
+
+	assert(utf8_strlen_valid(u8"¿Cómo estás?", 15, &valid_size) == 12);
+	assert(valid_size == 15);
+
+	/* stops at an overlong sequence */
+	assert(utf8_strlen_valid("ab\xc0\xaf" "cd", 6, &valid_size) == 2);
+	assert(valid_size == 2);
+
+	/* and at an incomplete one */
+	assert(utf8_strlen_valid("ab\xe2\x82", 4, &valid_size) == 2);
+	assert(valid_size == 2);
+
+	/* long enough to be counted a vector at a time,
+	 * with sequences that straddle the vectors */
+	for (i = 0; (i + 3) <= sizeof(in); i += 3){
+		memcpy(&in[i], "\xe2\x82\xac", 3);
+	}
+	in[99] = 'a';
+	assert(utf8_strlen_valid(in, sizeof(in), &valid_size) == 34);
+	assert(valid_size == 100);
+
+	/* a continuation byte where a sequence should start */
+	in[63] = (char) 0x82;
+	assert(utf8_strlen_valid(in, sizeof(in), &valid_size) == 21);
+	assert(valid_size == 63);
+}
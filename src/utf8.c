@@ -17,6 +17,10 @@
 
 #include <libutf/utf8.h>
 
+#include "kernel.h"
+
+static size_t utf8_prefix(const char * in, size_t in_len, size_t count);
+
 size_t utf8_decode(const char * in_s, char32_t * out){
 
 	const unsigned char * in = (const unsigned char *)(in_s);
@@ -124,19 +128,15 @@ size_t utf8_encode_length(char32_t in){
 	return 0;
 }
 
-size_t utf8_strlen(const char * in, unsigned int in_size){
-	size_t i = 0;
-	size_t j = 0;
-	size_t size = 0;
-	while (i < in_size){
-		j = utf8_decode_length(in[i]);
-		if (j == 0){
-			break;
-		}
-		i += j;
-		size++;
-	}
-	return size;
+size_t utf8_strlen(const char * in, size_t in_size){
+	size_t valid_size;
+	return utf8_strlen_valid(in, in_size, &valid_size);
+}
+
+size_t utf8_strlen_valid(const char * in, size_t in_size, size_t * valid_size){
+	size_t count = 0;
+	*valid_size = utf_kernel_utf8_length((const unsigned char *)(in), in_size, &count);
+	return count;
 }
 
 char32_t * utf8_to_utf32(const char * in){
@@ -150,35 +150,24 @@ char32_t * utf8_to_utf32(const char * in){
 
 char32_t * utf8_to_utf32_s(const char * in, size_t in_len, size_t * out_len_ptr){
 
-	char32_t out_char;
-	char32_t * tmp;
-	char32_t * out = NULL;
+	char32_t * out;
+	size_t valid_len = 0;
 	size_t out_len = 0;
-	size_t i;
-	size_t point_size;
 
-	i = 0;
+	/* the characters are counted first, so that
+	 * the output is allocated once and fits exactly */
 
-	while (i < in_len){
-		point_size = utf8_decode_length(in[i]);
-		if ((point_size == 0) || (point_size > (in_len - i))){
-			break;
-		}
-		if (utf8_decode(&in[i], &out_char) != point_size){
-			break;
-		}
-		out_len++;
-		tmp = realloc(out, sizeof(*out) * (out_len + 1));
-		if (tmp == NULL){
-			free(out);
-			return NULL;
-		}
-		out = tmp;
-		out[out_len - 1] = out_char;
-		out[out_len - 0] = 0;
-		i += point_size;
+	valid_len = utf_kernel_utf8_length((const unsigned char *)(in), in_len, &out_len);
+
+	out = malloc(sizeof(*out) * (out_len + 1));
+	if (out == NULL){
+		return NULL;
 	}
 
+	utf_kernel_utf8_to_utf32((const unsigned char *)(in), valid_len, out, &out_len);
+
+	out[out_len] = 0;
+
 	if (out_len_ptr != 0){
 		*out_len_ptr = out_len;
 	}
@@ -186,3 +175,40 @@ char32_t * utf8_to_utf32_s(const char * in, size_t in_len, size_t * out_len_ptr)
 	return out;
 }
 
+size_t utf8_to_utf32_into(const char * in, size_t in_len, char32_t * out, size_t out_cap){
+
+	size_t valid_len = 0;
+	size_t count = 0;
+	size_t out_len = 0;
+
+	valid_len = utf_kernel_utf8_length((const unsigned char *)(in), in_len, &count);
+
+	if (out_cap == 0){
+		return count;
+	} else if (count >= out_cap){
+		/* leave room for the null terminator */
+		valid_len = utf8_prefix(in, valid_len, out_cap - 1);
+	}
+
+	utf_kernel_utf8_to_utf32((const unsigned char *)(in), valid_len, out, &out_len);
+
+	out[out_len] = 0;
+
+	return count;
+}
+
+/** Finds where a number of characters end, in well-formed UTF-8.
+ * @returns The number of bytes that the first @p count characters take.
+ */
+
+static size_t utf8_prefix(const char * in, size_t in_len, size_t count){
+
+	size_t i = 0;
+
+	while ((count > 0) && (i < in_len)){
+		i += utf8_decode_length(in[i]);
+		count--;
+	}
+
+	return i;
+}
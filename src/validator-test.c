@@ -0,0 +1,157 @@
+#include <libutf/validator.h>
+
+#include <assert.h>
+#include <string.h>
+
+static void test_valid(void);
+
+static void test_invalid(void);
+
+static void test_split(void);
+
+static void test_incomplete(void);
+
+static utf_error_t validate(const char * src, size_t src_size, size_t * offset);
+
+int main(void){
+	test_valid();
+	test_invalid();
+	test_split();
+	test_incomplete();
+	return 0;
+}
+
+static void test_valid(void){
+
+	size_t offset = 0;
+
+	assert(validate("", 0, &offset) == UTF_ERROR_NONE);
+	assert(offset == 0);
+
+	assert(validate("hello", 5, &offset) == UTF_ERROR_NONE);
+	assert(offset == 5);
+
+	/* U+0080, U+07FF, U+0800, U+D7FF, U+E000, U+FFFF, U+10000, U+10FFFF */
+	assert(validate("\xC2\x80\xDF\xBF\xE0\xA0\x80\xED\x9F\xBF\xEE\x80\x80\xEF\xBF\xBF\xF0\x90\x80\x80\xF4\x8F\xBF\xBF", 24, &offset) == UTF_ERROR_NONE);
+	assert(offset == 24);
+}
+
+static void test_invalid(void){
+
+	size_t offset = 0;
+
+	/* stray continuation byte */
+	assert(validate("ab\x80", 3, &offset) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(offset == 2);
+
+	/* overlong forms */
+	assert(validate("a\xC0\xAF", 3, &offset) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(offset == 1);
+	assert(validate("ab\xE0\x80\xAF", 5, &offset) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(offset == 2);
+	assert(validate("\xF0\x80\x80\xAF", 4, &offset) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(offset == 0);
+
+	/* surrogate */
+	assert(validate("abc\xED\xA0\x80", 6, &offset) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(offset == 3);
+
+	/* above U+10FFFF */
+	assert(validate("\xF4\x90\x80\x80", 4, &offset) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(offset == 0);
+	assert(validate("\xC2\x80\xF5\x80\x80\x80", 6, &offset) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(offset == 2);
+
+	/* sequence cut short by another character */
+	assert(validate("\xE2\x82z", 3, &offset) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(offset == 0);
+}
+
+static void test_split(void){
+
+	/* valid text, long enough to reach the vector kernels */
+	const char text[] = "The quick brown fox \xC2\xBF" "C\xC3\xB3mo est\xC3\xA1s? "
+	                    "\xE2\x82\xAC\xE2\x82\xAC \xF0\x9F\x98\x80 jumps over the lazy dog \xED\x9F\xBF\xF4\x8F\xBF\xBF.";
+	/* the same text, with a surrogate in place of U+D7FF */
+	const char bad_text[] = "The quick brown fox \xC2\xBF" "C\xC3\xB3mo est\xC3\xA1s? "
+	                        "\xE2\x82\xAC\xE2\x82\xAC \xF0\x9F\x98\x80 jumps over the lazy dog \xED\xA0\x80\xF4\x8F\xBF\xBF.";
+	size_t text_size = sizeof(text) - 1;
+	size_t bad_offset = (size_t)(strstr(bad_text, "\xED\xA0") - bad_text);
+	size_t i;
+	size_t j;
+	utf_error_t error;
+	utf_validator_t validator;
+
+	for (i = 0; i <= text_size; i++){
+		for (j = i; j <= text_size; j++){
+
+			utf_validator_init(&validator);
+			assert(utf_validator_write(&validator, text, i) == UTF_ERROR_NONE);
+			assert(utf_validator_write(&validator, text + i, j - i) == UTF_ERROR_NONE);
+			assert(utf_validator_write(&validator, text + j, text_size - j) == UTF_ERROR_NONE);
+			assert(utf_validator_finish(&validator) == UTF_ERROR_NONE);
+			assert(utf_validator_get_offset(&validator) == text_size);
+
+			utf_validator_init(&validator);
+			error = utf_validator_write(&validator, bad_text, i);
+			if (error == UTF_ERROR_NONE){
+				error = utf_validator_write(&validator, bad_text + i, j - i);
+			}
+			if (error == UTF_ERROR_NONE){
+				error = utf_validator_write(&validator, bad_text + j, text_size - j);
+			}
+			if (error == UTF_ERROR_NONE){
+				error = utf_validator_finish(&validator);
+			}
+			assert(error == UTF_ERROR_INVALID_SEQUENCE);
+			assert(utf_validator_get_offset(&validator) == bad_offset);
+
+			/* the error sticks */
+			assert(utf_validator_write(&validator, "a", 1) == UTF_ERROR_INVALID_SEQUENCE);
+			assert(utf_validator_finish(&validator) == UTF_ERROR_INVALID_SEQUENCE);
+		}
+	}
+}
+
+static void test_incomplete(void){
+
+	size_t offset = 0;
+	utf_validator_t validator;
+
+	/* a valid prefix is only an error once the input ends */
+	utf_validator_init(&validator);
+	assert(utf_validator_write(&validator, "ab\xF0\x9F\x98", 5) == UTF_ERROR_NONE);
+	assert(utf_validator_get_offset(&validator) == 2);
+	assert(utf_validator_finish(&validator) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(utf_validator_get_offset(&validator) == 2);
+
+	/* a prefix that can't be completed is an error right away */
+	utf_validator_init(&validator);
+	assert(utf_validator_write(&validator, "ab\xE0\x9F", 4) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(utf_validator_get_offset(&validator) == 2);
+
+	utf_validator_init(&validator);
+	assert(utf_validator_write(&validator, "\xF4", 1) == UTF_ERROR_NONE);
+	assert(utf_validator_write(&validator, "\x90", 1) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(utf_validator_get_offset(&validator) == 0);
+
+	assert(validate("\xE2\x82", 2, &offset) == UTF_ERROR_INVALID_SEQUENCE);
+	assert(offset == 0);
+}
+
+static utf_error_t validate(const char * src, size_t src_size, size_t * offset){
+
+	utf_error_t error;
+	utf_validator_t validator;
+
+	utf_validator_init(&validator);
+
+	error = utf_validator_write(&validator, src, src_size);
+	if (error == UTF_ERROR_NONE){
+		error = utf_validator_finish(&validator);
+	}
+
+	*offset = utf_validator_get_offset(&validator);
+
+	return error;
+}
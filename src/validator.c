@@ -0,0 +1,163 @@
+/*
+ *    This file is part of libutf.
+ *
+ *    libutf is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    libutf is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with libutf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libutf/validator.h>
+
+#include "kernel.h"
+
+#include <string.h>
+
+static size_t sequence_length(unsigned char lead);
+
+static utf_bool_t is_incomplete(const unsigned char * src, size_t src_size);
+
+void utf_validator_init(utf_validator_t * validator){
+	validator->sequence_size = 0;
+	validator->valid_size = 0;
+	validator->invalid = 0;
+}
+
+utf_error_t utf_validator_write(utf_validator_t * validator, const void * src_ptr, size_t src_size){
+
+	const unsigned char * src = (const unsigned char *)(src_ptr);
+	size_t sequence_size;
+	size_t read_size;
+	size_t valid_size;
+
+	if (validator->invalid){
+		return UTF_ERROR_INVALID_SEQUENCE;
+	}
+
+	if (validator->sequence_size > 0){
+		/* finish the sequence that was split by the last chunk */
+		sequence_size = sequence_length(validator->sequence[0]);
+		read_size = sequence_size - validator->sequence_size;
+		if (read_size > src_size){
+			read_size = src_size;
+		}
+		memcpy(validator->sequence + validator->sequence_size, src, read_size);
+		validator->sequence_size += read_size;
+		src += read_size;
+		src_size -= read_size;
+		if (validator->sequence_size < sequence_size){
+			if (!is_incomplete(validator->sequence, validator->sequence_size)){
+				validator->invalid = 1;
+				return UTF_ERROR_INVALID_SEQUENCE;
+			}
+			return UTF_ERROR_NONE;
+		}
+		if (utf_kernel_utf8_validate(validator->sequence, sequence_size) != sequence_size){
+			validator->invalid = 1;
+			return UTF_ERROR_INVALID_SEQUENCE;
+		}
+		validator->valid_size += sequence_size;
+		validator->sequence_size = 0;
+	}
+
+	valid_size = utf_kernel_utf8_validate(src, src_size);
+	validator->valid_size += valid_size;
+	if (valid_size == src_size){
+		return UTF_ERROR_NONE;
+	}
+
+	src += valid_size;
+	src_size -= valid_size;
+	if (!is_incomplete(src, src_size)){
+		validator->invalid = 1;
+		return UTF_ERROR_INVALID_SEQUENCE;
+	}
+
+	/* the chunk ends in the middle of a sequence */
+	memcpy(validator->sequence, src, src_size);
+	validator->sequence_size = src_size;
+
+	return UTF_ERROR_NONE;
+}
+
+utf_error_t utf_validator_finish(utf_validator_t * validator){
+
+	if (validator->sequence_size > 0){
+		validator->invalid = 1;
+	}
+
+	if (validator->invalid){
+		return UTF_ERROR_INVALID_SEQUENCE;
+	}
+
+	return UTF_ERROR_NONE;
+}
+
+size_t utf_validator_get_offset(const utf_validator_t * validator){
+	return validator->valid_size;
+}
+
+static size_t sequence_length(unsigned char lead){
+	if (lead < 0xE0){
+		return 2;
+	} else if (lead < 0xF0){
+		return 3;
+	}
+	return 4;
+}
+
+/* Checks that the bytes are the start of a well-formed
+ * sequence, but that the sequence needs more bytes. */
+
+static utf_bool_t is_incomplete(const unsigned char * src, size_t src_size){
+
+	size_t i;
+	unsigned char min;
+	unsigned char max;
+
+	if ((src_size == 0) || (src[0] < 0xC2) || (src[0] > 0xF4)){
+		return 0;
+	}
+
+	if (src_size >= sequence_length(src[0])){
+		return 0;
+	}
+
+	if (src_size < 2){
+		return 1;
+	}
+
+	/* the second byte excludes overlong forms,
+	 * surrogates and values above U+10FFFF */
+	min = 0x80;
+	max = 0xBF;
+	if (src[0] == 0xE0){
+		min = 0xA0;
+	} else if (src[0] == 0xED){
+		max = 0x9F;
+	} else if (src[0] == 0xF0){
+		min = 0x90;
+	} else if (src[0] == 0xF4){
+		max = 0x8F;
+	}
+
+	if ((src[1] < min) || (src[1] > max)){
+		return 0;
+	}
+
+	for (i = 2; i < src_size; i++){
+		if ((src[i] < 0x80) || (src[i] > 0xBF)){
+			return 0;
+		}
+	}
+
+	return 1;
+}
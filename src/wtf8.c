@@ -0,0 +1,523 @@
+/*
+ *    This file is part of libutf.
+ *
+ *    libutf is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    libutf is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with libutf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libutf/utf8.h>
+
+#include "wtf8.h"
+#include "kernel.h"
+
+static int is_continuation(unsigned char c);
+
+static int is_surrogate(const unsigned char * src, size_t src_size);
+
+static char16_t surrogate_value(const unsigned char * src);
+
+static size_t decode_unit(const unsigned char * src, size_t src_size, char16_t * unit);
+
+static size_t encode_unit(char16_t unit, unsigned char * dst);
+
+static void write_unit(char16_t unit, unsigned char * dst, int big_endian);
+
+static char16_t read_unit(const unsigned char * src, int big_endian);
+
+static size_t wtf8_to_utf16(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size, int big_endian);
+
+static size_t wtf8_from_utf16(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size, int big_endian);
+
+static size_t cesu8_to_utf16(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size, int big_endian);
+
+static size_t cesu8_from_utf16(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size, int big_endian);
+
+size_t utf_wtf8_decode(const unsigned char * src, size_t src_size, char32_t * c, int complete){
+
+	size_t length = 0;
+	size_t count = 0;
+	char32_t out[4];
+
+	if (src_size == 0){
+		return 1;
+	}
+
+	if (!is_surrogate(src, src_size)){
+		length = utf8_decode_length((char)(src[0]));
+		if ((length > src_size) && (utf_wtf8_subpart(src, src_size) <= src_size)){
+			/* it can't be completed, whatever comes next */
+			return 0;
+		} else if ((length == 0) || (length > src_size)){
+			return length;
+		} else if (utf_kernel_utf8_to_utf32(src, length, out, &count) != length){
+			return 0;
+		}
+		*c = out[0];
+		return length;
+	}
+
+	*c = surrogate_value(src);
+
+	if (*c >= 0xdc00){
+		return 3;
+	}
+
+	/* a high surrogate is only valid if a low one doesn't follow */
+
+	if (src_size < 4){
+		return complete ? 3 : 6;
+	} else if (src[3] != 0xed){
+		return 3;
+	} else if (src_size < 5){
+		return complete ? 3 : 6;
+	} else if ((src[4] < 0xb0) || (src[4] > 0xbf)){
+		return 3;
+	} else if (src_size < 6){
+		return complete ? 3 : 6;
+	} else if (!is_continuation(src[5])){
+		return 3;
+	}
+
+	return 0;
+}
+
+size_t utf_wtf8_subpart(const unsigned char * src, size_t src_size){
+
+	char32_t c = 0;
+	size_t length = 0;
+
+	if (is_surrogate(src, src_size)){
+		length = utf_wtf8_decode(src, src_size, &c, 0);
+		if (length == 0){
+			/* the high surrogate of a pair that is written as two */
+			return 3;
+		} else if (length > src_size){
+			return length;
+		}
+		return 0;
+	}
+
+	if ((src_size == 0) || (src[0] != 0xed)){
+		return utf_kernel_utf8_subpart(src, src_size);
+	}
+
+	/* ED starts a surrogate if it's followed by A0 to BF,
+	 * which UTF-8 on its own doesn't allow */
+
+	if (src_size < 2){
+		return src_size + 1;
+	} else if (!is_continuation(src[1])){
+		return 1;
+	} else if (src_size < 3){
+		return src_size + 1;
+	} else if (!is_continuation(src[2])){
+		return 2;
+	}
+
+	return 0;
+}
+
+size_t utf_wtf8_to_utf32(const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count){
+
+	size_t i = 0;
+	size_t count = 0;
+	size_t block_count = 0;
+	char32_t c = 0;
+
+	/* the kernel does everything up to each surrogate */
+
+	while (i < src_size){
+		i += utf_kernel_utf8_to_utf32(src + i, src_size - i, dst + count, &block_count);
+		count += block_count;
+		if (!is_surrogate(src + i, src_size - i)
+		 || (utf_wtf8_decode(src + i, src_size - i, &c, 0) != 3)){
+			break;
+		}
+		dst[count++] = c;
+		i += 3;
+	}
+
+	*dst_count = count;
+
+	return i;
+}
+
+size_t utf_wtf8_from_utf32(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size){
+
+	size_t i = 0;
+	size_t size = 0;
+	size_t block_size = 0;
+
+	/* the kernel does everything up to each surrogate */
+
+	while (i < src_count){
+		i += utf_kernel_utf32_to_utf8(src + i, src_count - i, dst + size, &block_size);
+		size += block_size;
+		if ((i >= src_count) || (src[i] < 0xd800) || (src[i] > 0xdfff)){
+			break;
+		} else if ((src[i] < 0xdc00)
+		        && ((i + 1) < src_count)
+		        && (src[i + 1] >= 0xdc00)
+		        && (src[i + 1] <= 0xdfff)){
+			/* a pair is one four byte sequence, as it is in UTF-8 */
+			size += utf8_encode(0x10000 + ((src[i] - 0xd800) << 10) + (src[i + 1] - 0xdc00), (char *)(dst + size));
+			i += 2;
+			continue;
+		}
+		size += encode_unit((char16_t) src[i], dst + size);
+		i++;
+	}
+
+	*dst_size = size;
+
+	return i;
+}
+
+size_t utf_wtf8_to_utf16le(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+	return wtf8_to_utf16(src, src_size, dst, dst_size, 0);
+}
+
+size_t utf_wtf8_to_utf16be(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+	return wtf8_to_utf16(src, src_size, dst, dst_size, 1);
+}
+
+size_t utf_wtf8_from_utf16le(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+	return wtf8_from_utf16(src, src_size, dst, dst_size, 0);
+}
+
+size_t utf_wtf8_from_utf16be(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+	return wtf8_from_utf16(src, src_size, dst, dst_size, 1);
+}
+
+size_t utf_cesu8_decode(const unsigned char * src, size_t src_size, char32_t * c, int complete){
+
+	size_t length = 0;
+	char16_t high = 0;
+	char16_t low = 0;
+
+	length = decode_unit(src, src_size, &high);
+	if ((length != 3) || (length > src_size)){
+		*c = high;
+		return length;
+	}
+
+	*c = high;
+
+	if ((high < 0xd800) || (high > 0xdbff)){
+		return 3;
+	}
+
+	/* a high surrogate is only a character on its own if a low one doesn't follow */
+
+	if (src_size < 4){
+		return complete ? 3 : 6;
+	} else if (src[3] != 0xed){
+		return 3;
+	} else if (src_size < 5){
+		return complete ? 3 : 6;
+	} else if ((src[4] < 0xb0) || (src[4] > 0xbf)){
+		return 3;
+	} else if (src_size < 6){
+		return complete ? 3 : 6;
+	} else if (!is_continuation(src[5])){
+		return 3;
+	}
+
+	low = surrogate_value(src + 3);
+
+	*c = 0x10000 + ((((char32_t) high) - 0xd800) << 10) + (((char32_t) low) - 0xdc00);
+
+	return 6;
+}
+
+size_t utf_cesu8_subpart(const unsigned char * src, size_t src_size){
+
+	char32_t c = 0;
+	size_t length = 0;
+
+	length = utf_cesu8_decode(src, src_size, &c, 0);
+	if (length > src_size){
+		return length;
+	} else if (length > 0){
+		return 0;
+	} else if (src[0] >= 0xf0){
+		/* four byte sequences are never valid */
+		return 1;
+	}
+
+	return utf_wtf8_subpart(src, src_size);
+}
+
+size_t utf_cesu8_to_utf32(const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count){
+
+	size_t i = 0;
+	size_t count = 0;
+	size_t length = 0;
+	char32_t c = 0;
+
+	while (i < src_size){
+		if (src[i] < 0x80){
+			length = utf_kernel_ascii_length(src + i, src_size - i);
+			utf_kernel_latin1_to_utf32(src + i, length, dst + count);
+			count += length;
+			i += length;
+			continue;
+		}
+		length = utf_cesu8_decode(src + i, src_size - i, &c, 0);
+		if ((length == 0) || (length > (src_size - i))){
+			break;
+		}
+		dst[count++] = c;
+		i += length;
+	}
+
+	*dst_count = count;
+
+	return i;
+}
+
+size_t utf_cesu8_from_utf32(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size){
+
+	size_t i = 0;
+	size_t size = 0;
+	char32_t c = 0;
+
+	for (i = 0; i < src_count; i++){
+		c = src[i];
+		if (c < 0x10000){
+			size += encode_unit((char16_t) c, dst + size);
+		} else if (c < 0x110000){
+			c -= 0x10000;
+			size += encode_unit((char16_t) (0xd800 | (c >> 10)), dst + size);
+			size += encode_unit((char16_t) (0xdc00 | (c & 0x3ff)), dst + size);
+		} else {
+			break;
+		}
+	}
+
+	*dst_size = size;
+
+	return i;
+}
+
+size_t utf_cesu8_to_utf16le(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+	return cesu8_to_utf16(src, src_size, dst, dst_size, 0);
+}
+
+size_t utf_cesu8_to_utf16be(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+	return cesu8_to_utf16(src, src_size, dst, dst_size, 1);
+}
+
+size_t utf_cesu8_from_utf16le(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+	return cesu8_from_utf16(src, src_size, dst, dst_size, 0);
+}
+
+size_t utf_cesu8_from_utf16be(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size){
+	return cesu8_from_utf16(src, src_size, dst, dst_size, 1);
+}
+
+static int is_continuation(unsigned char c){
+	return (c & 0xc0) == 0x80;
+}
+
+static int is_surrogate(const unsigned char * src, size_t src_size){
+	return (src_size >= 3)
+	    && (src[0] == 0xed)
+	    && (src[1] >= 0xa0)
+	    && is_continuation(src[1])
+	    && is_continuation(src[2]);
+}
+
+static char16_t surrogate_value(const unsigned char * src){
+	return (char16_t) (0xd000 | ((src[1] & 0x3f) << 6) | (src[2] & 0x3f));
+}
+
+static size_t decode_unit(const unsigned char * src, size_t src_size, char16_t * unit){
+
+	unsigned char c = 0;
+
+	if (src_size == 0){
+		return 1;
+	}
+
+	c = src[0];
+	if (c < 0x80){
+		*unit = c;
+		return 1;
+	} else if ((c < 0xc2) || (c >= 0xf0)){
+		return 0;
+	} else if (src_size < 2){
+		return (c < 0xe0) ? 2 : 3;
+	} else if (!is_continuation(src[1])){
+		return 0;
+	} else if (c < 0xe0){
+		*unit = (char16_t) (((c & 0x1f) << 6) | (src[1] & 0x3f));
+		return 2;
+	} else if ((c == 0xe0) && (src[1] < 0xa0)){
+		/* overlong */
+		return 0;
+	} else if (src_size < 3){
+		return 3;
+	} else if (!is_continuation(src[2])){
+		return 0;
+	}
+
+	*unit = (char16_t) (((c & 0x0f) << 12) | ((src[1] & 0x3f) << 6) | (src[2] & 0x3f));
+
+	return 3;
+}
+
+static size_t encode_unit(char16_t unit, unsigned char * dst){
+
+	if (unit < 0x80){
+		dst[0] = (unsigned char) unit;
+		return 1;
+	} else if (unit < 0x800){
+		dst[0] = (unsigned char) (0xc0 | (unit >> 6));
+		dst[1] = (unsigned char) (0x80 | (unit & 0x3f));
+		return 2;
+	}
+
+	dst[0] = (unsigned char) (0xe0 | (unit >> 12));
+	dst[1] = (unsigned char) (0x80 | ((unit >> 6) & 0x3f));
+	dst[2] = (unsigned char) (0x80 | (unit & 0x3f));
+
+	return 3;
+}
+
+static void write_unit(char16_t unit, unsigned char * dst, int big_endian){
+	dst[big_endian ? 0 : 1] = (unsigned char) (unit >> 8);
+	dst[big_endian ? 1 : 0] = (unsigned char) (unit & 0xff);
+}
+
+static char16_t read_unit(const unsigned char * src, int big_endian){
+	return (char16_t) ((src[big_endian ? 0 : 1] << 8) | src[big_endian ? 1 : 0]);
+}
+
+static size_t wtf8_to_utf16(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size, int big_endian){
+
+	size_t i = 0;
+	size_t size = 0;
+	size_t block_size = 0;
+	char32_t c = 0;
+
+	while (i < src_size){
+		if (big_endian){
+			i += utf_kernel_utf8_to_utf16be(src + i, src_size - i, dst + size, &block_size);
+		} else {
+			i += utf_kernel_utf8_to_utf16le(src + i, src_size - i, dst + size, &block_size);
+		}
+		size += block_size;
+		if (!is_surrogate(src + i, src_size - i)
+		 || (utf_wtf8_decode(src + i, src_size - i, &c, 0) != 3)){
+			break;
+		}
+		write_unit((char16_t) c, dst + size, big_endian);
+		size += 2;
+		i += 3;
+	}
+
+	*dst_size = size;
+
+	return i;
+}
+
+static size_t wtf8_from_utf16(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size, int big_endian){
+
+	size_t i = 0;
+	size_t size = 0;
+	size_t block_size = 0;
+	char16_t unit = 0;
+
+	/* the kernel only stops early at a surrogate that isn't part of a pair,
+	 * or at a high surrogate that its pair may still follow */
+
+	while (i < src_size){
+		if (big_endian){
+			i += utf_kernel_utf16be_to_utf8(src + i, src_size - i, dst + size, &block_size);
+		} else {
+			i += utf_kernel_utf16le_to_utf8(src + i, src_size - i, dst + size, &block_size);
+		}
+		size += block_size;
+		if ((src_size - i) < 2){
+			break;
+		}
+		unit = read_unit(src + i, big_endian);
+		if ((unit < 0xdc00) && ((src_size - i) < 4)){
+			break;
+		}
+		size += encode_unit(unit, dst + size);
+		i += 2;
+	}
+
+	*dst_size = size;
+
+	return i;
+}
+
+static size_t cesu8_to_utf16(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size, int big_endian){
+
+	size_t i = 0;
+	size_t j = 0;
+	size_t size = 0;
+	size_t length = 0;
+	char16_t unit = 0;
+
+	/* every sequence is one code unit, so there's nothing to pair up */
+
+	while (i < src_size){
+		if (src[i] < 0x80){
+			length = utf_kernel_ascii_length(src + i, src_size - i);
+			for (j = 0; j < length; j++){
+				write_unit(src[i + j], dst + size, big_endian);
+				size += 2;
+			}
+			i += length;
+			continue;
+		}
+		length = decode_unit(src + i, src_size - i, &unit);
+		if ((length == 0) || (length > (src_size - i))){
+			break;
+		}
+		write_unit(unit, dst + size, big_endian);
+		size += 2;
+		i += length;
+	}
+
+	*dst_size = size;
+
+	return i;
+}
+
+static size_t cesu8_from_utf16(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size, int big_endian){
+
+	size_t i = 0;
+	size_t size = 0;
+	char16_t unit = 0;
+
+	/* a high surrogate at the end waits for the code unit after it,
+	 * as it does for WTF-8, so that the converter stops in the same
+	 * place however the input is split up */
+
+	for (i = 0; (i + 1) < src_size; i += 2){
+		unit = read_unit(src + i, big_endian);
+		if ((unit >= 0xd800) && (unit <= 0xdbff) && ((i + 4) > src_size)){
+			break;
+		}
+		size += encode_unit(unit, dst + size);
+	}
+
+	*dst_size = size;
+
+	return i;
+}
@@ -0,0 +1,172 @@
+/*
+ *    This file is part of libutf.
+ *
+ *    libutf is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    libutf is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with libutf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This header is private to the library, it is not installed. */
+
+#ifndef LIBUTF_WTF8_H
+#define LIBUTF_WTF8_H
+
+/* for size_t */
+#include <stdlib.h>
+
+/* for char32_t */
+#include <uchar.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* WTF-8 is UTF-8 that may also have unpaired surrogates, each one
+ * as a three byte sequence. CESU-8 writes every UTF-16 code unit as
+ * its own UTF-8 sequence, so a character from U+10000 on takes two
+ * three byte sequences, and unpaired surrogates are kept the same way.
+ * Both of them convert to and from UTF-16 without losing anything. */
+
+/** Decodes one WTF-8 sequence.
+ * A surrogate on its own is valid, but a high surrogate that is followed by a
+ * low one isn't, since the pair has to be written as one four byte sequence.
+ * @param c Set to the character.
+ * @param complete Whether the input ends at @p src_size, so that a high
+ *  surrogate at the end of it isn't waiting to see what follows it.
+ * @returns The length of the sequence, which is larger than @p src_size
+ *  if the input is too short to tell. If the sequence is invalid, zero is returned.
+ */
+
+size_t utf_wtf8_decode(const unsigned char * src, size_t src_size, char32_t * c, int complete);
+
+/** Finds the maximal subpart of an invalid WTF-8 sequence.
+ * This is the same as @ref utf_kernel_utf8_subpart, except that surrogates are
+ * valid, unless a high one is followed by a low one.
+ */
+
+size_t utf_wtf8_subpart(const unsigned char * src, size_t src_size);
+
+/** Decodes the longest prefix of well-formed WTF-8.
+ * @param dst It must fit one character for every byte in @p src.
+ * @param dst_count Set to the number of characters written to @p dst.
+ * @returns The number of bytes decoded. Decoding stops at the first invalid
+ *  or incomplete sequence, and before a high surrogate at the end of @p src.
+ */
+
+size_t utf_wtf8_to_utf32(const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count);
+
+/** Transcodes the longest prefix of well-formed WTF-8 to UTF-16LE.
+ * Each surrogate is written as one code unit. Like @ref utf_wtf8_to_utf32,
+ * it stops before a high surrogate at the end of @p src.
+ * @param dst It must fit two bytes for every byte in @p src.
+ * @param dst_size Set to the number of bytes written to @p dst.
+ * @returns The number of bytes consumed from @p src.
+ */
+
+size_t utf_wtf8_to_utf16le(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+/** Transcodes WTF-8 to UTF-16BE, the same as @ref utf_wtf8_to_utf16le. */
+
+size_t utf_wtf8_to_utf16be(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+/** Encodes characters as WTF-8, until one above U+10FFFF.
+ * Surrogates are encoded as they are, apart from a high surrogate
+ * followed by a low one, which are encoded as the character they make.
+ * @param dst It must fit four bytes for every character.
+ * @param dst_size Set to the number of bytes written to @p dst.
+ * @returns The number of characters encoded.
+ */
+
+size_t utf_wtf8_from_utf32(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size);
+
+/** Transcodes UTF-16LE to WTF-8, with unpaired surrogates as three byte sequences.
+ * A high surrogate at the end of the input is left for the next call,
+ * since the code unit after it may be its pair.
+ * @param dst It must fit three bytes for every two bytes in @p src.
+ * @param dst_size Set to the number of bytes written to @p dst.
+ * @returns The number of bytes consumed from @p src.
+ */
+
+size_t utf_wtf8_from_utf16le(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+/** Transcodes UTF-16BE to WTF-8, the same as @ref utf_wtf8_from_utf16le. */
+
+size_t utf_wtf8_from_utf16be(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+/** Decodes one CESU-8 sequence.
+ * A pair of surrogates is decoded as one character. A surrogate
+ * that isn't part of a pair is decoded on its own.
+ * @param c Set to the character.
+ * @param complete Whether the input ends at @p src_size, so that a high
+ *  surrogate at the end of it isn't waiting for its pair.
+ * @returns The length of the sequence, which is larger than @p src_size
+ *  if the input is too short to tell. If the sequence is invalid, zero is returned.
+ */
+
+size_t utf_cesu8_decode(const unsigned char * src, size_t src_size, char32_t * c, int complete);
+
+/** Finds the maximal subpart of an invalid CESU-8 sequence.
+ * @returns Zero if @p src starts with a valid sequence, and more than
+ *  @p src_size if it's too short to tell.
+ */
+
+size_t utf_cesu8_subpart(const unsigned char * src, size_t src_size);
+
+/** Decodes the longest prefix of well-formed CESU-8.
+ * @param dst It must fit one character for every byte in @p src.
+ * @param dst_count Set to the number of characters written to @p dst.
+ * @returns The number of bytes decoded. Decoding stops at the first
+ *  invalid or incomplete sequence, and before a high surrogate at the end of @p src.
+ */
+
+size_t utf_cesu8_to_utf32(const unsigned char * src, size_t src_size, char32_t * dst, size_t * dst_count);
+
+/** Encodes characters as CESU-8, until one above U+10FFFF.
+ * @param dst It must fit six bytes for every character.
+ * @param dst_size Set to the number of bytes written to @p dst.
+ * @returns The number of characters encoded.
+ */
+
+size_t utf_cesu8_from_utf32(const char32_t * src, size_t src_count, unsigned char * dst, size_t * dst_size);
+
+/** Transcodes the longest prefix of well-formed CESU-8 to UTF-16LE,
+ * one code unit for each sequence.
+ * @param dst It must fit two bytes for every byte in @p src.
+ * @param dst_size Set to the number of bytes written to @p dst.
+ * @returns The number of bytes consumed from @p src.
+ */
+
+size_t utf_cesu8_to_utf16le(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+/** Transcodes CESU-8 to UTF-16BE, the same as @ref utf_cesu8_to_utf16le. */
+
+size_t utf_cesu8_to_utf16be(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+/** Transcodes UTF-16LE to CESU-8, one sequence for each code unit.
+ * Like @ref utf_wtf8_from_utf16le, a high surrogate at the end of the
+ * input is left for the next call.
+ * @param dst It must fit three bytes for every two bytes in @p src.
+ * @param dst_size Set to the number of bytes written to @p dst.
+ * @returns The number of bytes consumed from @p src.
+ */
+
+size_t utf_cesu8_from_utf16le(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+/** Transcodes UTF-16BE to CESU-8, the same as @ref utf_cesu8_from_utf16le. */
+
+size_t utf_cesu8_from_utf16be(const unsigned char * src, size_t src_size, unsigned char * dst, size_t * dst_size);
+
+#ifdef __cplusplus
+} /* extern "C" { */
+#endif /* __cplusplus */
+
+#endif /* LIBUTF_WTF8_H */